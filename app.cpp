@@ -1,42 +1,146 @@
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <limits>
 #include <iomanip>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <cmath>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 #include "repr.h"
 #include "serialization.h"
+#include "journal.h"
+#include "csv.h"
+#include "parse.h"
+#include "server.h"
+#include "query.h"
+#include "delta.h"
+#include "memusage.h"
 
 using namespace std;
 
 namespace Lifecycle
 {
     static void Welcome();
-    static void OnBeforeQuit(Serialization::DataFile f, Inventory& inv);
+    static void OnBeforeQuit(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv);
 
+    static bool Replay(Inventory& inv, const std::vector<Journal::Txn>& txns);
+    static void Persist(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv);
+    static void Checkpoint(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv);
+
+    static bool WriteDelta(Inventory& inv,
+                           const char* baseline,
+                           const char* path,
+                           size_t& changed,
+                           uint64_t& bytes,
+                           std::string& error);
+    static int SendDelta(Inventory& inv, const char* baseline, const char* path);
+    static int ReceiveDelta(Inventory& inv, const char* path);
+
+    static bool StartRecording(Inventory& inv, const char* path);
+    static int ReplayTrace(Inventory& inv, const char* path, Serialization::DataFile f, Journal::Writer& journal);
+
+    static bool LoadDataFile(Inventory& inv, const char* path, uint32_t& loaded);
     static void InitInventory(Inventory* inv);
     static void FreeInventory(Inventory* inv);
 }; // namespace Lifecycle
 
 namespace Input
 {
+    enum class Status
+    {
+        Ok = 0,
+        Empty,  // blank line where allow_empty was given
+        Invalid // not a number, out of range for the target type, or end of input
+    };
+
     bool string(std::string& target, bool allow_empty = false);
-    int64_t integer(bool allow_empty = false);
-    InventoryItem* identitfied_item(Inventory& inv, bool show_error = true);
+    template<typename T>
+    Status number(T& target, bool allow_empty = false);
+    bool eof();
+    bool is_blank(const std::string& str);
+    const InventoryItem* identitfied_item(Inventory& inv, bool show_error = true);
 }; // namespace Input
 
 namespace Core
 {
-    static InventoryItem* FindItemById(const Inventory& inv, item_id_t id, bool active_only = true);
-    static Member* FindMemberByName(Member* head, const char* name);
-
-    static void Add(Inventory& inv, item_id_t id, item_count_t icount, const ItemMeta& meta);
-    static void Delete(InventoryItem* item);
-    static void Assign(InventoryItem* item, const char* name);
-    static void Assign(Inventory& inv, item_id_t id, const char* name);
-    static void Retrieve(InventoryItem* item, Member* entry);
+    /* One line of a batch: units handed to a member, or taken back from them */
+    struct Transfer
+    {
+        item_id_t id;
+        std::string member;
+        item_count_t units;
+        bool retrieve;
+    };
+
+    static const InventoryItem* FindItemById(const Inventory& inv, item_id_t id);
+    static InventoryItem* ForUpdate(Inventory& inv, const InventoryItem* item);
+    static MemberList& Members(Inventory& inv, InventoryItem* item);
+    static const InventoryItem* WithMembers(Inventory& inv, const InventoryItem* item);
+    static uint32_t FindMember(Inventory& inv, InventoryItem* item, const char* name, size_t len);
+    static std::pair<const uint32_t*, const uint32_t*> FindByName(Inventory& inv, const char* name, size_t len);
+
+    static void Add(Inventory& inv, item_id_t id, item_count_t icount, const ItemMeta& meta, item_count_t reorder = 0);
+    static void Edit(Inventory& inv,
+                     InventoryItem* item,
+                     const ItemMeta& meta,
+                     item_count_t icount,
+                     item_count_t reorder);
+    static void Delete(Inventory& inv, InventoryItem* item);
+    static bool Assign(Inventory& inv, InventoryItem* item, const char* name, item_count_t units = 1, uint64_t due = 0);
+    static bool Assign(Inventory& inv, item_id_t id, const char* name, item_count_t units = 1, uint64_t due = 0);
+    static bool Retrieve(Inventory& inv, InventoryItem* item, uint32_t index, item_count_t units = 1);
+    static size_t ApplyBatch(Inventory& inv, const std::vector<Transfer>& batch);
+    static void SetDue(Inventory& inv, InventoryItem* item, member_id_t member, uint64_t due);
+    static void Drop(Inventory& inv);
+    static void Undelete(Inventory& inv, InventoryItem* item);
+
+    static bool Apply(Inventory& inv, const ItemOp& op);
+    static bool Begin(Inventory& inv);
+    static void Commit(Inventory& inv);
+    static bool Rollback(Inventory& inv);
+    static bool Undo(Inventory& inv);
+    static bool Redo(Inventory& inv);
+
+    static void Reserve(Inventory& inv, uint32_t capacity);
+    static void RebuildIndexes(Inventory& inv, uint32_t loaded = 0);
+    static uint32_t Compact(Inventory& inv);
+    static void Leaderboards(Inventory& inv);
+    static bool ApplyDelta(Inventory& inv, const Delta& delta);
 } // namespace Core
 
+namespace Exchange
+{
+    struct ImportStats
+    {
+        uint64_t imported = 0;
+        uint64_t rejected = 0;
+    };
+
+    static bool ImportItems(Inventory& inv, const char* path, ImportStats& stats);
+    static bool ImportAssignments(Inventory& inv, const char* path, ImportStats& stats);
+    static bool ExportItems(const Inventory& inv, const char* path, uint64_t& rows);
+    static bool ExportAssignments(const Inventory& inv, const char* path, uint64_t& rows);
+} // namespace Exchange
+
+namespace Server
+{
+    static int Run(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv, const char* path);
+} // namespace Server
+
 namespace Frontend
 {
     enum class NextTickStatus
@@ -68,12 +172,75 @@ namespace Frontend
     InvActionResult AssignItem(Inventory& inv);
     InvActionResult RetrieveItem(Inventory& inv);
     InvActionResult ItemDetails(Inventory& inv);
+    InvActionResult ViewCategory(Inventory& inv);
+    InvActionResult CategorySummary(Inventory& inv);
+    InvActionResult ItemsBelow(Inventory& inv);
+    InvActionResult LowStockReport(Inventory& inv);
+    InvActionResult ImportData(Inventory& inv);
+    InvActionResult ExportData(Inventory& inv);
+    InvActionResult CompactStorage(Inventory& inv);
+    InvActionResult BeginTransaction(Inventory& inv);
+    InvActionResult CommitTransaction(Inventory& inv);
+    InvActionResult RollbackTransaction(Inventory& inv);
+    InvActionResult UndoChange(Inventory& inv);
+    InvActionResult RedoChange(Inventory& inv);
+    InvActionResult Snapshots(Inventory& inv);
+    InvActionResult AssignmentHistory(Inventory& inv);
+    InvActionResult BatchTransfer(Inventory& inv);
+    InvActionResult LoansDue(Inventory& inv);
+    InvActionResult Leaderboards(Inventory& inv);
+    InvActionResult RunQuery(Inventory& inv);
+    InvActionResult MemoryReport(Inventory& inv);
+
+    void ReleaseSnapshots();
 }; // namespace Frontend
 
-int main()
+int main(int argc, char** argv)
 {
     std::ios::sync_with_stdio(false);
 
+    const char* serve_path = nullptr;
+    const char* delta_base = nullptr; // --delta: what the standby has
+    const char* delta_path = nullptr; // --delta or --apply
+    const char* record_path = nullptr;
+    const char* replay_path = nullptr;
+    bool replay_persist = false;
+    if (argc > 1)
+    {
+        bool serve = strcmp(argv[1], "--serve") == 0 && argc <= 3;
+        bool send = strcmp(argv[1], "--delta") == 0 && argc == 4;
+        bool receive = strcmp(argv[1], "--apply") == 0 && argc == 3;
+        bool record = strcmp(argv[1], "--record") == 0 && argc == 3;
+        bool replay = strcmp(argv[1], "--replay") == 0
+                      && (argc == 3 || (argc == 4 && strcmp(argv[3], "--persist") == 0));
+
+        if (!serve && !send && !receive && !record && !replay)
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--serve [socket path] | --delta baseline_file delta_file | --apply delta_file"
+                      << " | --record trace_file | --replay trace_file [--persist]]" << endl;
+            return 1;
+        }
+
+        if (serve)
+            serve_path = argc > 2 ? argv[2] : Protocol::SOCKET_NAME;
+
+        if (send)
+            delta_base = argv[2];
+
+        if (send || receive)
+            delta_path = argv[argc - 1];
+
+        if (record)
+            record_path = argv[2];
+
+        if (replay)
+        {
+            replay_path = argv[2];
+            replay_persist = argc == 4;
+        }
+    }
+
     Lifecycle::Welcome();
 
     Inventory inv;
@@ -99,9 +266,37 @@ int main()
     Core::Assign(inv, 6, "OPQ");
 #endif
 
-    auto file = Serialization::OpenFile();
+    /* Without persistence a replay leaves the files in the current directory alone */
+    if (replay_path != nullptr && !replay_persist)
+    {
+        Journal::Writer none;
+        int status = Lifecycle::ReplayTrace(inv, replay_path, nullptr, none);
+
+        Lifecycle::FreeInventory(&inv);
+        return status;
+    }
+
+    Journal::Writer journal;
+    Serialization::DataFile file;
     {
+        std::vector<char> contents;
+        std::vector<Journal::Txn> txns;
+
+        /* Opened first: its lock keeps other copies of the program away from both files */
+        if (!Journal::Open(journal, Journal::FILE_NAME, sizeof(item_id_t), contents, txns))
+        {
+            if (errno == EWOULDBLOCK)
+                std::cerr << "[ERROR] The inventory is in use by another copy of this program."
+                          << " Run one with --serve and connect to it instead" << endl;
+            else
+                std::cerr << "[ERROR] Unable to use " << Journal::FILE_NAME << endl;
+
+            return 1;
+        }
+
         using namespace Serialization;
+
+        file = OpenFile();
         if (file == nullptr)
         {
             std::cerr << "[ERROR] Unable to open file" << endl;
@@ -110,7 +305,15 @@ int main()
 
         if (IsFileValid(file))
         {
-            if (!ReadFromFile(file, inv))
+            if (!IsFileCompatible(file))
+            {
+                std::cerr << "[ERROR] " << MAIN_FILE_NAME << " uses a newer format or wider item ids than this build"
+                          << " (APP_ITEM_ID_BITS=" << APP_ITEM_ID_BITS << ")" << endl;
+                return 1;
+            }
+
+            uint32_t loaded;
+            if (!ReadFromFile(file, inv, loaded))
             {
                 std::cerr << "[WARN] Invalid or corrupted file -- Skipping" << endl;
 
@@ -118,658 +321,3966 @@ int main()
                 Lifecycle::FreeInventory(&inv);
                 Lifecycle::InitInventory(&inv);
             }
+            else
+            {
+                Core::RebuildIndexes(inv, loaded);
+            }
+        }
+
+        if (!Lifecycle::Replay(inv, txns))
+        {
+            std::cerr << "[WARN] Journal does not match the data file -- Skipping the rest of it" << endl;
+            inv.log.checkpoint = true;
         }
     }
 
-    bool first_tick = true;
+    /* Not opened to apply a delta, whose retrieves and assigns are bookkeeping rather than loans */
+    if (delta_path == nullptr && !Events::Open(inv.history, Events::FILE_PREFIX))
+        std::cerr << "[WARN] Unable to open the assignment history -- Not recording it" << endl;
+
+    int status = 0;
+
+    if (delta_path != nullptr)
+    {
+        if (delta_base != nullptr)
+            status = Lifecycle::SendDelta(inv, delta_base, delta_path);
+        else
+            status = Lifecycle::ReceiveDelta(inv, delta_path);
 
-    while (!std::cin.eof())
+        /* The change is journaled like any other; the data file is rewritten only when the journal is due */
+        Lifecycle::Persist(file, journal, inv);
+    }
+    else if (serve_path != nullptr)
+    {
+        status = Server::Run(file, journal, inv, serve_path);
+    }
+    else if (replay_path != nullptr)
+    {
+        status = Lifecycle::ReplayTrace(inv, replay_path, file, journal);
+    }
+    else if (record_path != nullptr && !Lifecycle::StartRecording(inv, record_path))
+    {
+        std::cerr << "[ERROR] * Unable to record to " << record_path << " *" << endl;
+        status = 1;
+    }
+    else
     {
-        using namespace Frontend;
+        bool first_tick = true;
 
-        if (!first_tick)
+        while (!Input::eof())
         {
-            std::cout << "----------------------------";
-            std::cout << "\n\n";
-        }
+            using namespace Frontend;
 
-        first_tick = false;
+            if (!first_tick)
+            {
+                std::cout << "----------------------------";
+                std::cout << "\n\n";
+            }
+
+            first_tick = false;
+
+            auto tick = Frontend::AppTick(inv);
 
-        auto tick = Frontend::AppTick(inv);
+            if (tick.next_tick_st == Frontend::NextTickStatus::Quit)
+                break;
+
+            Lifecycle::Persist(file, journal, inv);
+        }
+    }
 
-        if (tick.next_tick_st == Frontend::NextTickStatus::Quit)
-            break;
+    if (delta_path == nullptr)
+        Lifecycle::OnBeforeQuit(file, journal, inv);
 
-        if (tick.result == InvActionResult::Ok)
-            Serialization::WriteToFile(file, inv);
+    if (!Traces::Close(inv.trace))
+    {
+        std::cerr << "[ERROR] * Unable to write " << record_path << " *" << endl;
+        status = 1;
     }
 
-    Lifecycle::OnBeforeQuit(file, inv);
     Serialization::CloseFile(file);
+    Journal::Close(journal);
+    Events::Close(inv.history);
 
+    Frontend::ReleaseSnapshots();
     Lifecycle::FreeInventory(&inv);
 
-    return 0;
+    return status;
 }
 
 namespace Lifecycle
 {
+    static constexpr uint64_t JOURNAL_CHECKPOINT_BYTES = 16 << 20;
+
     static inline void Welcome()
     {
         std::cout << "* Welcome to PUCIT Inventory Management System *\n" << endl;
     }
 
-    static void OnBeforeQuit(Serialization::DataFile f, Inventory& inv)
+    static void OnBeforeQuit(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv)
     {
-        Serialization::WriteToFile(f, inv);
-    }
+        if (inv.log.open)
+        {
+            if (Core::Rollback(inv))
+                std::cerr << "[WARN] Uncommitted transaction rolled back" << endl;
+            else
+                std::cerr << "[ERROR] Uncommitted transaction could only be partly rolled back -- Saving it as is"
+                          << endl;
+        }
 
-    void InitInventory(Inventory* inv)
-    {
-        inv->count = 0;
-        inv->capacity = 0;
-        inventory_allocate_capacity(*inv, 64);
+        Core::Commit(inv);
+        Checkpoint(f, journal, inv);
     }
 
-    void FreeInventory(Inventory* inv)
+    /* Reapplies the transactions committed after the data file was last written */
+    static bool Replay(Inventory& inv, const std::vector<Journal::Txn>& txns)
     {
-        for (int i = 0; i < inv->count; ++i)
+        inv.log.mode = OperationLog::Mode::Off;
+
+        bool ok = true;
+        for (auto& txn : txns)
         {
-            Member* head = inv->items[i].allocated_to;
-            while (head != nullptr)
+            /* Already in the data file: the checkpoint got written but the journal was not emptied */
+            if (txn.seq <= inv.log.seq)
+                continue;
+
+            if (txn.seq != inv.log.seq + 1)
             {
-                auto next = head->next;
-                DeleteMember(head);
-                head = next;
+                ok = false;
+                break;
             }
+
+            ItemOp op;
+            const char* p = txn.begin;
+
+            for (uint32_t i = 0; ok && i < txn.ops; ++i)
+                ok = OpLog::Decode(p, txn.end, op) && Core::Apply(inv, op);
+
+            if (!ok)
+                break;
+
+            ++inv.log.seq;
         }
 
-        delete[] inv->items;
+        inv.log.mode = OperationLog::Mode::Normal;
+        return ok;
     }
-}; // namespace Lifecycle
-
-namespace Input
-{
-    static constexpr streamsize max_ssz = std::numeric_limits<streamsize>::max();
 
-    bool string(std::string& target, bool allow_empty)
+    /* Journals the transaction that just finished, unless one is still open */
+    static void Persist(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv)
     {
-        if (!allow_empty)
-            std::cin >> std::ws;
+        auto& log = inv.log;
 
-        static std::string buf;
+        if (log.open)
+            return;
 
-        getline(std::cin, buf);
+        Core::Commit(inv);
 
-        if (std::cin.eof() || std::cin.fail())
+        /* Replaying a long journal would cost more than writing the file once */
+        if (log.checkpoint || journal.size + log.pending.size() > JOURNAL_CHECKPOINT_BYTES)
         {
-            return false;
+            Checkpoint(f, journal, inv);
+            return;
         }
 
-        target = buf;
+        if (log.pending_ops == 0)
+            return;
 
-        return true;
+        if (!Journal::Append(journal, log.seq + 1, log.pending_ops, log.pending))
+        {
+            std::cerr << "[ERROR] * Unable to write " << Journal::FILE_NAME << ", saving all data instead *\n";
+            Checkpoint(f, journal, inv);
+            return;
+        }
+
+        ++log.seq;
+        log.pending.clear();
+        log.pending_ops = 0;
+
+        Events::Publish(inv.history, Events::Now());
     }
 
-    int64_t integer(bool allow_empty)
+    /*
+     * Writes the whole inventory and empties the journal, whose transactions it now includes.
+     *
+     * If the file cannot be replaced, the old one and the journal still agree with each other, so the pending
+     * transaction is appended to the journal if its slots still mean what they did there. After a compaction
+     * they don't: the transaction stays pending and the checkpoint is retried by the next Persist.
+     */
+    static void Checkpoint(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv)
     {
-        static std::string target;
-        if (!Input::string(target, allow_empty))
-            return -1;
+        auto& log = inv.log;
+        auto seq = log.seq;
 
-        stringstream ss(target);
+        /* The file records the transaction it includes */
+        if (log.pending_ops > 0)
+            ++log.seq;
 
-        /* Immediately discard leading whitespaces */
-        ss >> std::ws;
+        /* Saved with the file, so that applying a delta later only hashes what changed since. Hashing every
+         * item happens once, for a file saved without it; after that only changed items are folded in */
+        Deltas::Digest(inv);
 
-        if (allow_empty && ss.eof())
-            return -2;
+        if (!Serialization::WriteToFile(f, inv))
+        {
+            std::cerr << "[ERROR] * Unable to write " << Serialization::MAIN_FILE_NAME << " *\n";
+            log.seq = seq;
 
-        int64_t val;
+            if (log.checkpoint || log.pending_ops == 0)
+                return;
 
-        ss >> val;
+            if (!Journal::Append(journal, log.seq + 1, log.pending_ops, log.pending))
+            {
+                std::cerr << "[ERROR] * Unable to write " << Journal::FILE_NAME << " either *\n";
+                return;
+            }
 
-        if (ss.fail())
-            return -1;
+            ++log.seq;
+        }
+        else
+        {
+            Journal::Reset(journal);
+        }
 
-        if (!(ss >> ws).eof())
-            return -1;
+        log.pending.clear();
+        log.pending_ops = 0;
+        log.checkpoint = false;
 
-        return val;
+        Events::Publish(inv.history, Events::Now());
     }
 
-    InventoryItem* identitfied_item(Inventory& inv, bool show_error)
+    /*
+     * Writes what changed since the baseline, a data file holding what the standby has, to path as a delta,
+     * then saves the current state over the baseline for the next one. A missing baseline counts as empty,
+     * so the first delta carries everything.
+     */
+    static bool WriteDelta(Inventory& inv,
+                           const char* baseline,
+                           const char* path,
+                           size_t& changed,
+                           uint64_t& bytes,
+                           std::string& error)
     {
-        auto id_ = Input::integer();
+        Inventory before;
+        InitInventory(&before);
 
-        if (id_ == -1)
+        uint32_t loaded;
+        if (!LoadDataFile(before, baseline, loaded))
         {
-            std::cerr << "\n[ERROR] * Invalid id *" << '\n';
-            return nullptr;
+            FreeInventory(&before);
+            error = std::string(baseline) + " is not a data file this build can read";
+            return false;
         }
 
-        auto itemptr = Core::FindItemById(inv, (item_id_t) id_);
+        Delta delta;
+        Deltas::Diff(before, inv, delta);
+        FreeInventory(&before);
 
-        if (show_error && itemptr == nullptr)
+        changed = delta.items.size();
+        bytes = Deltas::Write(path, delta);
+        if (bytes == 0)
         {
-            std::cerr << "\n[ERROR] * Item with id " << id_ << " not found *\n"
-                      << "        * Failed to load item *\n";
+            error = std::string("unable to write ") + path;
+            return false;
         }
 
-        return itemptr;
-    }
+        /* The next delta is taken against the baseline, so this one must not be applied if it stays behind */
+        auto snap = snapshot_take(inv);
+        bool saved = Serialization::WriteSnapshot(baseline, snap);
+        snapshot_release(snap);
 
-}; // namespace Input
+        if (!saved)
+        {
+            ::remove(path);
+            error = std::string("unable to update ") + baseline;
+            return false;
+        }
 
-namespace DisplayItem
-{
-    static constexpr int w1 = 6;
-    static constexpr int w2 = 16;
-    static constexpr int w3 = 18;
-    static constexpr int w4 = 18;
-    static constexpr int w5 = 18;
+        return true;
+    }
 
-    static inline void Header()
+    static int SendDelta(Inventory& inv, const char* baseline, const char* path)
     {
-        // clang-format off
-        std::cout
-            << std::setw(w1) << std::left << "ID"
-            << std::setw(w2) << std::left << "Name"
-            << std::setw(w3) << std::left << "Category"
-            << std::setw(w4) << std::left << "Units Available"
-            << std::setw(w5) << std::left << "Units Assigned"
-        << "\n";
+        size_t changed;
+        uint64_t bytes;
+        std::string error;
 
-        std::cout
-            << std::setw(w1 + w2 + w3 + w4 + w5)
-            << std::setfill('-') << "" << "\n" << std::setfill(' ');
-        // clang-format on
-    }
+        if (!WriteDelta(inv, baseline, path, changed, bytes, error))
+        {
+            std::cerr << "[ERROR] * " << error << " *" << endl;
+            return 1;
+        }
 
-    static inline void Summary(InventoryItem& item)
-    {
-        // clang-format off
-        std::cout
-            << std::setw(w1) << std::left << item.item_id
-            << std::setw(w2) << std::left << item.meta.name
-            << std::setw(w3) << std::left << item.meta.cat
-            << std::setw(w4) << std::left << item.item_count
-            << std::setw(w5) << std::left << item.assigned_count
-            << "\n";
-        // clang-format on
+        std::cout << changed << " of " << inv.count << " items changed, " << bytes << " bytes written to " << path
+                  << endl;
+        return 0;
     }
 
-    static inline uint32_t MemList(InventoryItem& item)
+    /* Applies a delta written by --delta, as one transaction */
+    static int ReceiveDelta(Inventory& inv, const char* path)
     {
-        auto mem = item.allocated_to;
-        int i = 0;
-        if (mem != nullptr)
+        Delta delta;
+        if (!Deltas::Read(path, delta))
         {
-            std::cout << "\nAssigned To: \n";
-            while (mem != nullptr)
-            {
-                // clang-format off
-                std::cout
-                    << "   > " << ++i << ". "
-                    << mem->name << " | "
-                    << mem->borrow_count << " unit(s) assigned" << "\n";
-                // clang-format on
-                mem = mem->next;
-            }
+            std::cerr << "[ERROR] * " << path << " is not a delta, or is damaged *" << endl;
+            return 1;
         }
 
-        return i;
-    }
+        if (!Core::ApplyDelta(inv, delta))
+        {
+            std::cerr << "[ERROR] * " << path << " was not taken against this inventory's current state *" << endl;
+            return 1;
+        }
 
-    uint32_t Full(InventoryItem& item)
-    {
-        Header();
-        Summary(item);
-        return MemList(item);
+        std::cout << delta.items.size() << " items updated, " << inv.count << " in all" << endl;
+        return 0;
     }
 
-    inline static void Compact(InventoryItem& item)
+    /* Loads a data file other than the inventory's own into an empty inventory. A missing file leaves it empty */
+    static bool LoadDataFile(Inventory& inv, const char* path, uint32_t& loaded)
     {
-        Summary(item);
-    }
-}; // namespace DisplayItem
+        loaded = 0;
+        std::fstream f(path, ios::binary | ios::in);
 
-namespace Frontend
-{
-    static const char* g_menu = 1 + (const char*) R"(
-Select an option:
-    [0] Quit 
-    [1] Add a New tem
-    [2] View Added Items
-    [3] Search Item By Name
-    [4] Edit an Existing Item
-    [5] Delete an Existing Item
-    [6] Assign an Existing Item to a Member
-    [7] Retrieve an Existing Item from a Member
-    [8] Show Details of a Specifc Item
-)";
+        return !f || !Serialization::IsFileValid(&f)
+               || (Serialization::IsFileCompatible(&f) && Serialization::ReadFromFile(&f, inv, loaded, path));
+    }
 
-    using menu_option_t = int64_t;
+    static constexpr const char* TRACE_BASE_SUFFIX = ".base";
 
-    static menu_option_t menu_input()
+    /* Saves the state the session starts from next to the trace, for a replay to start from, and starts it */
+    static bool StartRecording(Inventory& inv, const char* path)
     {
-        std::cout << g_menu << endl;
-
-        menu_option_t op;
-
-        while (true)
-        {
-            std::cout << "> Choose option [0-8]: ";
+        auto snap = snapshot_take(inv);
+        bool saved = Serialization::WriteSnapshot((std::string(path) + TRACE_BASE_SUFFIX).c_str(), snap);
+        snapshot_release(snap);
 
-            bool valid = false;
-            op = Input::integer();
-
-            if (std::cin.eof())
-                return 0;
+        return saved && Traces::Open<item_id_t>(inv.trace, path);
+    }
 
-            if (op >= 0 && op <= 8)
-                valid = true;
+    static void PrintLatencies(const char* name, LatencyStats& stats)
+    {
+        if (stats.ns.empty())
+            return;
 
-            if (valid)
-                break;
-            else
-                std::cerr << "[ERROR] * Invalid choice. Try again *" << endl;
-        }
+        auto us = [](double ns) { return ns / 1000; };
 
-        return op;
+        // clang-format off
+        std::cout
+            << "  " << std::setw(10) << std::left << name
+            << std::setw(10) << std::right << stats.ns.size()
+            << std::setw(12) << std::right << std::fixed << std::setprecision(2) << stats.total / 1e6
+            << std::setw(11) << std::right << us((double) stats.total / stats.ns.size())
+            << std::setw(11) << std::right << us(Traces::Percentile(stats, 0.5))
+            << std::setw(11) << std::right << us(Traces::Percentile(stats, 0.99))
+            << std::setw(11) << std::right << us(Traces::Percentile(stats, 1))
+            << "\n";
+        // clang-format on
     }
 
-    TickInfo AppTick(Inventory& inv)
+    /*
+     * Runs a recorded session against a fresh inventory holding the state it started from, as fast as it
+     * goes, and reports the throughput and the latency of each kind of operation. With a data file and a
+     * journal, which must hold no inventory yet, each action is persisted the way a session would.
+     */
+    static int ReplayTrace(Inventory& inv, const char* path, Serialization::DataFile f, Journal::Writer& journal)
     {
-        auto op = menu_input();
+        using Clock = std::chrono::steady_clock;
 
-        InvActionResult result = InvActionResult::Failed;
-
-        if (op == 0)
+        std::vector<char> bytes;
+        std::vector<TraceRecord<item_id_t>> records;
+        if (!Traces::Read(path, bytes, records))
         {
-            return { result, NextTickStatus::Quit };
+            std::cerr << "[ERROR] * " << path << " is not a trace from this build, or is damaged *" << endl;
+            return 1;
         }
 
-        // clang-format off
-        switch (op)
+        if (inv.count != 0 || inv.log.seq != 0)
         {
-            case 1:     result = Frontend::AddItem(inv);      break;
-            case 2:     result = Frontend::ViewItems(inv);    break;
-            case 3:     result = Frontend::SearchItem(inv);   break;
-            case 4:     result = Frontend::EditItem(inv);     break;
-            case 5:     result = Frontend::DeleteItem(inv);   break;
-            case 6:     result = Frontend::AssignItem(inv);   break;
-            case 7:     result = Frontend::RetrieveItem(inv); break;
-            case 8:     result = Frontend::ItemDetails(inv);  break;
+            std::cerr << "[ERROR] * Replay with --persist in a directory without an inventory;"
+                      << " it would overwrite this one *" << endl;
+            return 1;
+        }
 
-            default:
-                break;
+        auto base = std::string(path) + TRACE_BASE_SUFFIX;
+        uint32_t loaded;
+        if (!LoadDataFile(inv, base.c_str(), loaded))
+        {
+            std::cerr << "[ERROR] * " << base << " is not a data file this build can read *" << endl;
+            return 1;
         }
-        // clang-format on
 
-        std::cout << endl;
+        Core::RebuildIndexes(inv, loaded);
 
-        return { result, NextTickStatus::Continue };
-    }
+        /* Written out first, so the first action does not pay for the whole inventory */
+        if (f != nullptr)
+            Checkpoint(f, journal, inv);
 
-} // namespace Frontend
+        WorkPool pool;
+        Pool::Start(pool, APP_QUERY_THREADS);
 
-namespace Frontend
-{
-    static const char* IDN = " >> ";
+        /* Changes by OpKind, then the other kinds of record, then whole actions */
+        static constexpr size_t FIND = 16, SEARCH = 17, QUERY = 18, COMPACT = 19, ACTION = 20;
+        std::vector<LatencyStats> stats(ACTION + 1);
+        LatencyStats all;
 
-    InvActionResult AddItem(Inventory& inv)
-    {
-        item_id_t id;
-        item_count_t icount;
-        ItemMeta meta;
+        uint64_t recorded_us = 0, failed = 0, actions = 0;
+        auto action_start = Clock::now();
+        bool in_action = false;
+
+        auto finish_action = [&]() {
+            if (!in_action)
+                return;
+
+            if (f != nullptr)
+                Persist(f, journal, inv);
 
+            Traces::Add(stats[ACTION], (Clock::now() - action_start).count());
+            in_action = false;
+        };
+
+        auto start = Clock::now();
+        for (auto& rec : records)
         {
-            std::cout << IDN << "Enter Item Id: ";
-            auto id_ = Input::integer();
+            recorded_us += rec.gap_us;
 
-            if (id_ == -1)
+            if (rec.kind == TraceKind::Action)
             {
-                std::cout << "\n[ERROR] * Invalid id *" << '\n';
-                return InvActionResult::Failed;
-            }
+                finish_action();
 
-            id = id_;
+                ++actions;
+                in_action = true;
+                action_start = Clock::now();
+                continue;
+            }
+
+            auto t0 = Clock::now();
+            size_t kind;
+
+            switch (rec.kind)
+            {
+                case TraceKind::Change:
+                {
+                    kind = (size_t) rec.op.kind;
+                    failed += !Core::Apply(inv, rec.op);
+                    break;
+                }
+
+                case TraceKind::Find:
+                {
+                    kind = FIND;
+                    Core::FindItemById(inv, rec.id);
+                    break;
+                }
+
+                case TraceKind::Search:
+                {
+                    kind = SEARCH;
+                    Core::FindByName(inv, rec.text, rec.text_len);
+                    break;
+                }
+
+                case TraceKind::Query:
+                {
+                    kind = QUERY;
+
+                    static Query q;
+                    static QueryResult result;
+                    std::string error;
+                    if (Queries::Parse(inv.categories, rec.text, rec.text_len, q, error))
+                        Queries::Run(inv, q, pool, result);
+                    break;
+                }
+
+                default:
+                {
+                    kind = COMPACT;
+                    Core::Compact(inv);
+                    break;
+                }
+            }
+
+            uint64_t ns = (Clock::now() - t0).count();
+            Traces::Add(stats[kind], ns);
+            Traces::Add(all, ns);
+        }
+
+        finish_action();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::cout << records.size() << " records (" << actions << " actions, " << all.ns.size() << " operations)"
+                  << " recorded over " << std::fixed << std::setprecision(1) << recorded_us / 1e6 << " s,"
+                  << " replayed in " << std::setprecision(2) << ms << " ms"
+                  << (f != nullptr ? " with persistence" : " without persistence") << "\n"
+                  << std::setprecision(0) << all.ns.size() / (ms / 1000) << " operations/s, "
+                  << actions / (ms / 1000) << " actions/s\n\n";
+
+        // clang-format off
+        std::cout
+            << "  " << std::setw(10) << std::left << "Operation"
+            << std::setw(10) << std::right << "Count"
+            << std::setw(12) << std::right << "Total ms"
+            << std::setw(11) << std::right << "Mean us"
+            << std::setw(11) << std::right << "p50 us"
+            << std::setw(11) << std::right << "p99 us"
+            << std::setw(11) << std::right << "Max us"
+            << "\n";
+        // clang-format on
+
+        const char* change_names[] = { "", "add", "drop", "delete", "undelete", "assign", "retrieve", "edit",
+                                       "", "", "set due" };
+        for (size_t k = 1; k <= (size_t) OpKind::SetDue; ++k)
+            PrintLatencies(change_names[k], stats[k]);
+
+        PrintLatencies("find", stats[FIND]);
+        PrintLatencies("search", stats[SEARCH]);
+        PrintLatencies("query", stats[QUERY]);
+        PrintLatencies("compact", stats[COMPACT]);
+        PrintLatencies("action", stats[ACTION]);
+
+        /* One row per power of two, from the fastest operation to the slowest */
+        auto buckets = Traces::Histogram(all);
+        uint64_t most = buckets.empty() ? 0 : *std::max_element(buckets.begin(), buckets.end());
+
+        size_t first = 0;
+        while (first < buckets.size() && buckets[first] == 0)
+            ++first;
+
+        std::cout << "\nLatency of all operations:\n";
+        for (size_t b = first; b < buckets.size(); ++b)
+        {
+            double below = std::ldexp(1.0, (int) b);
+            const char* unit = below < 1e3 ? "ns" : below < 1e6 ? "us" : "ms";
+            double scaled = below < 1e3 ? below : below < 1e6 ? below / 1e3 : below / 1e6;
+
+            std::cout << "  < " << std::setw(5) << std::right << std::setprecision(scaled < 10 ? 1 : 0) << scaled
+                      << " " << unit << std::setw(10) << std::right << buckets[b] << "  "
+                      << std::string((size_t) (50.0 * buckets[b] / most + 0.5), '#') << "\n";
+        }
+
+        if (failed != 0)
+            std::cerr << "\n[WARN] " << failed << " change(s) did not apply -- " << base
+                      << " is not the state the trace was recorded from" << endl;
+
+        std::cout << endl;
+        return failed != 0;
+    }
+
+    void InitInventory(Inventory* inv)
+    {
+        inv->count = 0;
+        inv->capacity = 0;
+        inventory_allocate_capacity(*inv, 64);
+        Categories::Clear(inv->categories);
+        inv->columns = {};
+        LowStock::Clear(inv->low_stock);
+        IdIndex::Clear(inv->ids);
+        NameIndexes::Reset(inv->names);
+        Strings::Clear(inv->strings);
+        MemberLists::Clear(inv->member_names);
+        DueDates::Clear(inv->due);
+        Leaders::Reset(inv->top_items);
+        Leaders::Reset(inv->top_members);
+        Digests::Reset(inv->digest);
+        inv->member_source.reset();
+        inv->log = OperationLog {};
+    }
+
+    void FreeInventory(Inventory* inv)
+    {
+        /* Member lists go with their pages; pages still held by a snapshot stay alive until it is released */
+        inventory_free(*inv);
+        NameIndexes::Reset(inv->names);
+        Strings::Clear(inv->strings);
+        MemberLists::Clear(inv->member_names);
+        DueDates::Clear(inv->due);
+        Leaders::Reset(inv->top_items);
+        Leaders::Reset(inv->top_members);
+        inv->member_source.reset();
+    }
+}; // namespace Lifecycle
+
+namespace Input
+{
+    /*
+     * stdin is read straight into one buffer that is reused for the whole session, and lines are handed
+     * out as views into it. The buffer only grows if a single line is longer than it; no prompt allocates.
+     */
+    static constexpr size_t STDIN_BUFFER_SIZE = 1 << 16;
+
+    struct LineReader
+    {
+        std::vector<char> buf;
+        size_t begin = 0;
+        size_t end = 0;
+        bool eof = false;
+    };
+
+    static LineReader g_stdin;
+
+    /* Next line without its terminator. The view is valid until the next call */
+    static bool next_line(const char*& line, size_t& len)
+    {
+        auto& r = g_stdin;
+
+        if (r.buf.empty())
+            r.buf.resize(STDIN_BUFFER_SIZE);
+
+        while (true)
+        {
+            char* base = r.buf.data();
+            auto nl = (char*) memchr(base + r.begin, '\n', r.end - r.begin);
+
+            if (nl != nullptr || (r.eof && r.begin < r.end))
+            {
+                line = base + r.begin;
+                len = (nl ? nl : base + r.end) - line;
+                r.begin += len + (nl != nullptr);
+
+                if (len > 0 && line[len - 1] == '\r')
+                    --len;
+
+                return true;
+            }
+
+            if (r.eof)
+                return false;
+
+            if (r.begin > 0)
+            {
+                memmove(base, base + r.begin, r.end - r.begin);
+                r.end -= r.begin;
+                r.begin = 0;
+            }
+
+            if (r.end == r.buf.size())
+                r.buf.resize(r.buf.size() * 2);
+
+            /* The prompt has to be visible before blocking on the terminal */
+            std::cout.flush();
+
+            ssize_t got;
+            do
+            {
+                got = ::read(STDIN_FILENO, r.buf.data() + r.end, r.buf.size() - r.end);
+            } while (got < 0 && errno == EINTR);
+
+            if (got <= 0)
+                r.eof = true;
+            else
+                r.end += got;
+        }
+    }
+
+    /* Unless allow_empty is given, blank lines are skipped and leading whitespace is dropped */
+    static bool next_input(const char*& line, size_t& len, bool allow_empty)
+    {
+        while (next_line(line, len))
+        {
+            if (allow_empty)
+                return true;
+
+            while (len > 0 && Parse::IsSpace(*line))
+            {
+                ++line;
+                --len;
+            }
+
+            if (len > 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    bool eof()
+    {
+        return g_stdin.eof && g_stdin.begin >= g_stdin.end;
+    }
+
+    bool is_blank(const std::string& str)
+    {
+        return Parse::IsBlank(str.data(), str.size());
+    }
+
+    bool string(std::string& target, bool allow_empty)
+    {
+        const char* line;
+        size_t len;
+
+        if (!next_input(line, len, allow_empty))
+            return false;
+
+        /* Reuses target's capacity */
+        target.assign(line, len);
+
+        return true;
+    }
+
+    template<typename T>
+    Status number(T& target, bool allow_empty)
+    {
+        static_assert(std::is_unsigned<T>::value, "prompts only read unsigned quantities");
+
+        const char* line;
+        size_t len;
+
+        if (!next_input(line, len, allow_empty))
+            return Status::Invalid;
+
+        Parse::Trim(line, len);
+
+        if (len == 0)
+            return allow_empty ? Status::Empty : Status::Invalid;
+
+        uint64_t value;
+        auto res = Parse::Uint(line, line + len, std::numeric_limits<T>::max(), value);
+
+        if (res.ec != Parse::Error::None || res.ptr != line + len)
+            return Status::Invalid;
+
+        target = value;
+        return Status::Ok;
+    }
+
+    const InventoryItem* identitfied_item(Inventory& inv, bool show_error)
+    {
+        item_id_t id;
+
+        if (Input::number(id) != Status::Ok)
+        {
+            std::cerr << "\n[ERROR] * Invalid id *" << '\n';
+            return nullptr;
+        }
+
+        Traces::Find(inv.trace, id);
+        auto itemptr = Core::FindItemById(inv, id);
+
+        if (show_error && itemptr == nullptr)
+        {
+            std::cerr << "\n[ERROR] * Item with id " << id << " not found *\n"
+                      << "        * Failed to load item *\n";
+        }
+
+        return itemptr;
+    }
+
+}; // namespace Input
+
+namespace DisplayItem
+{
+    static constexpr int w1 = std::numeric_limits<item_id_t>::digits10 + 2;
+    static constexpr int w2 = 16;
+    static constexpr int w3 = 18;
+    static constexpr int w4 = 18;
+    static constexpr int w5 = 18;
+
+    static inline void Header()
+    {
+        // clang-format off
+        std::cout
+            << std::setw(w1) << std::left << "ID"
+            << std::setw(w2) << std::left << "Name"
+            << std::setw(w3) << std::left << "Category"
+            << std::setw(w4) << std::left << "Units Available"
+            << std::setw(w5) << std::left << "Units Assigned"
+        << "\n";
+
+        std::cout
+            << std::setw(w1 + w2 + w3 + w4 + w5)
+            << std::setfill('-') << "" << "\n" << std::setfill(' ');
+        // clang-format on
+    }
+
+    static inline void Summary(const InventoryItem& item)
+    {
+        // clang-format off
+        std::cout
+            << std::setw(w1) << std::left << item.item_id
+            << std::setw(w2) << std::left << item.meta.name
+            << std::setw(w3) << std::left << item.meta.cat
+            << std::setw(w4) << std::left << item.item_count
+            << std::setw(w5) << std::left << item.assigned_count
+            << "\n";
+        // clang-format on
+    }
+
+    /* "YYYY-MM-DD HH:MM" in local time */
+    static const char* DueTime(uint64_t due)
+    {
+        static char text[24];
+        time_t secs = due;
+        strftime(text, sizeof(text), "%Y-%m-%d %H:%M", localtime(&secs));
+        return text;
+    }
+
+    static inline uint32_t MemList(const Inventory& inv, const InventoryItem& item)
+    {
+        auto& list = members_of(item);
+        if (!list.empty())
+        {
+            std::cout << "\nAssigned To: \n";
+            for (uint32_t i = 0; i < list.size; ++i)
+            {
+                // clang-format off
+                std::cout
+                    << "   > " << i + 1 << ". "
+                    << inv.member_names.names[list[i].member] << " | "
+                    << list[i].units << " unit(s) assigned";
+                // clang-format on
+
+                auto due = DueDates::Get(inv.due, slot_of(inv, &item), list[i].member);
+                if (due != 0)
+                    std::cout << " | due " << DueTime(due) << (due <= (uint64_t) time(nullptr) ? " (overdue)" : "");
+
+                std::cout << "\n";
+            }
+        }
+
+        return list.size;
+    }
+
+    uint32_t Full(const Inventory& inv, const InventoryItem& item)
+    {
+        Header();
+        Summary(item);
+        return MemList(inv, item);
+    }
+
+    inline static void Compact(const InventoryItem& item)
+    {
+        Summary(item);
+    }
+}; // namespace DisplayItem
+
+namespace Frontend
+{
+    static const char* g_menu = 1 + (const char*) R"(
+Select an option:
+    [0] Quit 
+    [1] Add a New tem
+    [2] View Added Items
+    [3] Search Item By Name
+    [4] Edit an Existing Item
+    [5] Delete an Existing Item
+    [6] Assign an Existing Item to a Member
+    [7] Retrieve an Existing Item from a Member
+    [8] Show Details of a Specifc Item
+    [9] View Items of a Category
+   [10] Show Category Summary
+   [11] List Items Below a Unit Count
+   [12] Show Low Stock Alerts
+   [13] Import Items or Assignments from CSV/TSV
+   [14] Export Items or Assignments to CSV/TSV
+   [15] Purge Deleted Items and Compact Storage
+   [16] Begin a Transaction
+   [17] Commit the Transaction
+   [18] Roll Back the Transaction
+   [19] Undo Last Change
+   [20] Redo Last Undone Change
+   [21] Take, View or Save Point-in-Time Snapshots
+   [22] Show Assignment History
+   [23] Assign or Retrieve Several Items at Once
+   [24] Show Overdue and Upcoming Loans
+   [25] Show Most Assigned Items and Top Borrowers
+   [26] Run a Query
+   [27] Show Memory Usage
+)";
+
+    using menu_option_t = uint32_t;
+
+    static menu_option_t menu_input()
+    {
+        std::cout << g_menu << endl;
+
+        menu_option_t op;
+
+        while (true)
+        {
+            std::cout << "> Choose option [0-27]: ";
+
+            bool valid = Input::number(op) == Input::Status::Ok && op <= 27;
+
+            if (valid)
+                break;
+
+            if (Input::eof())
+                return 0;
+            else
+                std::cerr << "[ERROR] * Invalid choice. Try again *" << endl;
+        }
+
+        return op;
+    }
+
+    TickInfo AppTick(Inventory& inv)
+    {
+        auto op = menu_input();
+
+        InvActionResult result = InvActionResult::Failed;
+
+        if (op == 0)
+        {
+            return { result, NextTickStatus::Quit };
+        }
+
+        Traces::Action(inv.trace, (uint8_t) op);
+
+        // clang-format off
+        switch (op)
+        {
+            case 1:     result = Frontend::AddItem(inv);      break;
+            case 2:     result = Frontend::ViewItems(inv);    break;
+            case 3:     result = Frontend::SearchItem(inv);   break;
+            case 4:     result = Frontend::EditItem(inv);     break;
+            case 5:     result = Frontend::DeleteItem(inv);   break;
+            case 6:     result = Frontend::AssignItem(inv);   break;
+            case 7:     result = Frontend::RetrieveItem(inv); break;
+            case 8:     result = Frontend::ItemDetails(inv);  break;
+            case 9:     result = Frontend::ViewCategory(inv); break;
+            case 10:    result = Frontend::CategorySummary(inv); break;
+            case 11:    result = Frontend::ItemsBelow(inv);   break;
+            case 12:    result = Frontend::LowStockReport(inv); break;
+            case 13:    result = Frontend::ImportData(inv);   break;
+            case 14:    result = Frontend::ExportData(inv);   break;
+            case 15:    result = Frontend::CompactStorage(inv); break;
+            case 16:    result = Frontend::BeginTransaction(inv); break;
+            case 17:    result = Frontend::CommitTransaction(inv); break;
+            case 18:    result = Frontend::RollbackTransaction(inv); break;
+            case 19:    result = Frontend::UndoChange(inv);   break;
+            case 20:    result = Frontend::RedoChange(inv);   break;
+            case 21:    result = Frontend::Snapshots(inv);    break;
+            case 22:    result = Frontend::AssignmentHistory(inv); break;
+            case 23:    result = Frontend::BatchTransfer(inv); break;
+            case 24:    result = Frontend::LoansDue(inv);     break;
+            case 25:    result = Frontend::Leaderboards(inv); break;
+            case 26:    result = Frontend::RunQuery(inv);     break;
+            case 27:    result = Frontend::MemoryReport(inv); break;
+
+            default:
+                break;
+        }
+        // clang-format on
+
+        std::cout << endl;
+
+        return { result, NextTickStatus::Continue };
+    }
+
+} // namespace Frontend
+
+namespace Frontend
+{
+    static const char* IDN = " >> ";
+
+    static void AlertIfLow(Inventory& inv, const InventoryItem* item)
+    {
+        if (!LowStock::IsAlerting(inv.low_stock, slot_of(inv, item)))
+            return;
+
+        std::cout << "\n[ALERT] * Item \"" << item->meta.name << "\" is below its reorder level ("
+                  << item->item_count << " of " << item->reorder_level << " unit(s) left) *\n";
+    }
+
+    /* A date, "+N" for N days from now, or nothing (0) */
+    static bool due_input(uint64_t& due)
+    {
+        static std::string text;
+        std::cout << IDN << "Enter due date (YYYY-MM-DD [HH:MM[:SS]] or +days, press enter for none): ";
+
+        due = 0;
+        if (!Input::string(text, true) || Input::is_blank(text))
+            return true;
+
+        const char* p = text.data();
+        size_t len = text.size();
+        Parse::Trim(p, len);
+
+        time_t at;
+        if (*p == '+')
+        {
+            uint64_t days;
+            auto res = Parse::Uint(p + 1, p + len, 100000, days);
+            if (res.ec != Parse::Error::None || res.ptr != p + len)
+                return false;
+
+            due = (uint64_t) time(nullptr) + days * 24 * 60 * 60;
+        }
+        else if (Parse::LocalTime(p, len, at) && at > 0)
+        {
+            due = at;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    InvActionResult AddItem(Inventory& inv)
+    {
+        item_id_t id;
+        item_count_t icount;
+
+        static std::string name;
+        static std::string cat;
+
+        {
+            std::cout << IDN << "Enter Item Id: ";
+
+            if (Input::number(id) != Input::Status::Ok)
+            {
+                std::cout << "\n[ERROR] * Invalid id (expected 0 to " << std::numeric_limits<item_id_t>::max()
+                          << ") *" << '\n';
+                return InvActionResult::Failed;
+            }
+
+            if (Core::FindItemById(inv, id) != nullptr)
+            {
+                std::cerr << "\n[ERROR] * Item with id " << id << " already exists. *\n"
+                          << "        * Failed to add item *\n";
+
+                return InvActionResult::Failed;
+            }
+        }
+
+        {
+            std::cout << IDN << "Enter Item name: ";
+            if (!Input::string(name))
+                return InvActionResult::Failed;
+        }
+
+        {
+            std::cout << IDN << "Enter Item Category: ";
+            if (!Input::string(cat))
+                return InvActionResult::Failed;
+        }
+
+        {
+            std::cout << IDN << "Enter Item's available unit count: ";
+
+            if (Input::number(icount) != Input::Status::Ok)
+            {
+                std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+                return InvActionResult::Failed;
+            }
+        }
+
+        item_count_t reorder = 0;
+        {
+            std::cout << IDN << "Enter Item's reorder level (press enter for none): ";
+
+            if (Input::number(reorder, true) == Input::Status::Invalid)
+            {
+                std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+                return InvActionResult::Failed;
+            }
+        }
+
+        std::cout << "\n";
+
+        ItemMeta meta;
+        meta.name = Strings::Store(inv.strings, name);
+        meta.cat = Strings::Store(inv.strings, cat);
+
+        Core::Add(inv, id, icount, meta, reorder);
+
+        std::cout << "Item \"" << name << "\" added successfully\n";
+
+        AlertIfLow(inv, Core::FindItemById(inv, id));
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult ViewItems(Inventory& inv)
+    {
+        auto active = inv.columns.active.data();
+
+        if (Scan::CountActive(active, inv.count) == 0)
+        {
+            std::cout << "*No items added*\n";
+            return InvActionResult::Failed;
+        }
+
+        DisplayItem::Header();
+
+        for (size_t i = Scan::NextActive(active, 0, inv.count); i < inv.count;
+             i = Scan::NextActive(active, i + 1, inv.count))
+            DisplayItem::Compact(inv.items[i]);
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult SearchItem(Inventory& inv)
+    {
+        static std::string str;
+        {
+            std::cout << IDN << "Enter Item name: ";
+            if (!Input::string(str))
+                return InvActionResult::Failed;
+        }
+
+        std::cout << "\n";
+
+        Traces::Text(inv.trace, TraceKind::Search, str.data(), str.size());
+        auto found = Core::FindByName(inv, str.data(), str.size());
+        for (auto slot = found.first; slot != found.second; ++slot)
+            DisplayItem::Full(inv, *Core::WithMembers(inv, &inv.items[*slot]));
+
+        if (found.first == found.second)
+        {
+            std::cout << "*No items found*\n";
+            return InvActionResult::Failed;
+        }
+
+        return InvActionResult::Ok;
+    }
+
+// clang-format off
+#define SELECT_ITEM(inv, item) \
+    { \
+        InvActionResult res; \
+        if ((res = ViewItems(inv)) != InvActionResult::Ok) \
+            return res; \
+        std::cout << "\n"; \
+    } \
+    std::cout << IDN << "Enter Item Id: "; \
+    auto item = Input::identitfied_item(inv); \
+    if (item == nullptr) \
+        return InvActionResult::Failed;
+
+/* For actions that change the item: a writable pointer, valid until the action returns */
+#define SELECT_ITEM_FOR_UPDATE(inv, item) \
+    SELECT_ITEM(inv, item##_found) \
+    auto item = Core::ForUpdate(inv, item##_found);
+    // clang-format on
+
+    InvActionResult EditItem(Inventory& inv)
+    {
+        SELECT_ITEM_FOR_UPDATE(inv, item);
+
+        std::cout << IDN << "Enter Item's new name (press enter to keep original): ";
+        static std::string name;
+        if (!Input::string(name, true))
+            return InvActionResult::Failed;
+
+        std::cout << IDN << "Enter Item's new category (press enter to keep original): ";
+        static std::string cat;
+        if (!Input::string(cat, true))
+            return InvActionResult::Failed;
+
+        /* Left untouched by number() on an empty answer, which keeps the original */
+        item_count_t icount = item->item_count;
+        item_count_t reorder = item->reorder_level;
+
+        std::cout << IDN << "Enter Item's available unit count (press enter to keep original): ";
+        if (Input::number(icount, true) == Input::Status::Invalid)
+        {
+            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << IDN << "Enter Item's reorder level (press enter to keep original): ";
+        if (Input::number(reorder, true) == Input::Status::Invalid)
+        {
+            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "\n";
+
+        static ItemMeta meta;
+        meta = item->meta;
+
+        if (!Input::is_blank(name))
+            meta.name = Strings::Store(inv.strings, name);
+
+        if (!Input::is_blank(cat))
+            meta.cat = Strings::Store(inv.strings, cat);
+
+        Core::Edit(inv, item, meta, icount, reorder);
+
+        std::cout << "Item saved successfully\n";
+
+        AlertIfLow(inv, item);
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult DeleteItem(Inventory& inv)
+    {
+        SELECT_ITEM_FOR_UPDATE(inv, item);
+
+        std::cout << "\n";
+
+        Core::Delete(inv, item);
+
+        std::cout << "Item \"" << item->meta.name << "\" with id " << item->item_id << " deleted successfully\n";
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult AssignItem(Inventory& inv)
+    {
+        SELECT_ITEM_FOR_UPDATE(inv, item);
+
+        if (item->item_count > 0)
+        {
+            std::cout << "\n<*> Assigning item \"" << item->meta.name << "\"\n";
+        }
+        else
+        {
+            std::cerr << "\n[ERROR] * No units available for this item *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        static std::string name;
+        std::cout << IDN << "Enter assignee's name: ";
+        if (!Input::string(name))
+            return InvActionResult::Failed;
+
+        item_count_t units = 1;
+        std::cout << IDN << "Enter units to assign (press enter for 1): ";
+        if (Input::number(units, true) == Input::Status::Invalid || units == 0)
+        {
+            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        uint64_t due;
+        if (!due_input(due))
+        {
+            std::cerr << "\n[ERROR] * Invalid date (expected YYYY-MM-DD [HH:MM[:SS]] or +days) *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "\n";
+
+        if (!Core::Assign(inv, item, name.c_str(), units, due))
+        {
+            std::cerr << "[ERROR] * Only " << item->item_count << " unit(s) available *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "Item \"" << item->meta.name << "\" assigned to \"" << name << "\" successfully";
+        if (units > 1)
+            std::cout << " (" << units << " units)";
+        if (due != 0)
+            std::cout << ", due " << DisplayItem::DueTime(due);
+        std::cout << "\n";
+
+        AlertIfLow(inv, item);
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult RetrieveItem(Inventory& inv)
+    {
+        SELECT_ITEM_FOR_UPDATE(inv, item);
+
+        if (item->assigned_count == 0)
+        {
+            std::cout << "\n* No units currently assigned to any member *" << '\n';
+            return InvActionResult::Ok;
+        }
+
+        auto mem_count = DisplayItem::Full(inv, *Core::WithMembers(inv, item));
+
+        std::cout << IDN << "Select an entry: ";
+        uint32_t location;
+
+        if (Input::number(location) != Input::Status::Ok || location < 1 || location > mem_count)
+        {
+            std::cerr << "\n [ERROR] * Invalid choice *" << '\n';
+            return InvActionResult::Failed;
+        }
+        --location;
+
+        item_count_t units = 1;
+        std::cout << IDN << "Enter units to retrieve (press enter for 1): ";
+        if (Input::number(units, true) == Input::Status::Invalid || units == 0)
+        {
+            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "\n";
+
+        if (!Core::Retrieve(inv, item, location, units))
+        {
+            auto held = members_of(*item)[location].units;
+            std::cerr << "[ERROR] * The member holds only " << held << " unit(s) *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "Item \"" << item->meta.name << "\" retrieved successfully";
+        if (units > 1)
+            std::cout << " (" << units << " units)";
+        std::cout << "\n";
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult ItemDetails(Inventory& inv)
+    {
+        SELECT_ITEM(inv, item);
+
+        std::cout << "\n";
+
+        DisplayItem::Full(inv, *Core::WithMembers(inv, item));
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult ViewCategory(Inventory& inv)
+    {
+        static std::string cat;
+        {
+            std::cout << IDN << "Enter Category: ";
+            if (!Input::string(cat))
+                return InvActionResult::Failed;
+        }
+
+        std::cout << "\n";
+
+        auto id = Categories::Find(inv.categories, cat);
+
+        if (id == CAT_NONE || inv.categories.entries[id].slots.empty())
+        {
+            std::cout << "*No items found*\n";
+            return InvActionResult::Failed;
+        }
+
+        DisplayItem::Header();
+
+        for (auto slot : inv.categories.entries[id].slots)
+            DisplayItem::Compact(inv.items[slot]);
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult ItemsBelow(Inventory& inv)
+    {
+        std::cout << IDN << "Enter unit count: ";
+        item_count_t limit;
+
+        if (Input::number(limit) != Input::Status::Ok)
+        {
+            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "\n";
+
+        static std::vector<uint32_t> slots;
+        slots.resize(inv.count);
+
+        auto& cols = inv.columns;
+        auto found = Scan::SelectBelow(cols.counts.data(), cols.active.data(), inv.count, limit, slots.data());
+
+        if (found == 0)
+        {
+            std::cout << "*No items found*\n";
+            return InvActionResult::Failed;
+        }
+
+        DisplayItem::Header();
+
+        for (size_t i = 0; i < found; ++i)
+            DisplayItem::Compact(inv.items[slots[i]]);
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult LowStockReport(Inventory& inv)
+    {
+        auto& slots = inv.low_stock.slots;
+
+        if (slots.empty())
+        {
+            std::cout << "*No items below their reorder level*\n";
+            return InvActionResult::Failed;
+        }
+
+        DisplayItem::Header();
+
+        for (auto slot : slots)
+            DisplayItem::Compact(inv.items[slot]);
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult CompactStorage(Inventory& inv)
+    {
+        if (inv.log.open)
+        {
+            std::cerr << "[ERROR] * Commit or roll back the open transaction first *\n";
+            return InvActionResult::Failed;
+        }
+
+        auto before = inv.capacity;
+        auto purged = Core::Compact(inv);
+
+        std::cout << purged << " deleted item(s) purged, storage capacity " << before << " -> " << inv.capacity
+                  << " item(s)\n";
+
+        return purged > 0 ? InvActionResult::Ok : InvActionResult::Failed;
+    }
+
+    InvActionResult BeginTransaction(Inventory& inv)
+    {
+        if (!Core::Begin(inv))
+        {
+            std::cerr << "[ERROR] * A transaction is already open *\n";
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "Transaction started. Changes are kept until it is committed or rolled back\n";
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult CommitTransaction(Inventory& inv)
+    {
+        if (!inv.log.open)
+        {
+            std::cerr << "[ERROR] * No transaction is open *\n";
+            return InvActionResult::Failed;
+        }
+
+        auto ops = inv.log.pending_ops;
+        Core::Commit(inv);
+
+        std::cout << "Transaction committed (" << ops << " change(s))\n";
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult RollbackTransaction(Inventory& inv)
+    {
+        auto ops = inv.log.pending_ops;
+
+        if (!inv.log.open)
+        {
+            std::cerr << "[ERROR] * No transaction is open *\n";
+            return InvActionResult::Failed;
+        }
+
+        if (!Core::Rollback(inv))
+        {
+            std::cerr << "[ERROR] * Unable to roll back every change. The rest were committed and can be undone *\n";
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "Transaction rolled back (" << ops << " change(s) discarded)\n";
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult UndoChange(Inventory& inv)
+    {
+        if (inv.log.open)
+        {
+            std::cerr << "[ERROR] * Commit or roll back the open transaction first *\n";
+            return InvActionResult::Failed;
+        }
+
+        if (inv.log.undo_marks.empty())
+        {
+            std::cerr << "[ERROR] * Nothing to undo *\n";
+            return InvActionResult::Failed;
+        }
+
+        if (!Core::Undo(inv))
+        {
+            std::cerr << "[ERROR] * Unable to undo every change (" << inv.log.pending_ops
+                      << " reverted). The rest are kept to undo *\n";
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "Undone (" << inv.log.pending_ops << " change(s) reverted)\n";
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult RedoChange(Inventory& inv)
+    {
+        if (inv.log.open)
+        {
+            std::cerr << "[ERROR] * Commit or roll back the open transaction first *\n";
+            return InvActionResult::Failed;
+        }
+
+        if (inv.log.redo_marks.empty())
+        {
+            std::cerr << "[ERROR] * Nothing to redo *\n";
+            return InvActionResult::Failed;
+        }
+
+        if (!Core::Redo(inv))
+        {
+            std::cerr << "[ERROR] * Unable to redo every change (" << inv.log.pending_ops
+                      << " reapplied). The rest are kept to redo *\n";
+            return InvActionResult::Failed;
+        }
+
+        std::cout << "Redone (" << inv.log.pending_ops << " change(s) reapplied)\n";
+        return InvActionResult::Ok;
+    }
+
+    /* A snapshot being written to disk by a thread of its own */
+    struct SnapshotJob
+    {
+        enum State
+        {
+            Running,
+            Done,
+            Failed
+        };
+
+        std::string path;
+        std::atomic<int> state { Running };
+        std::thread thread;
+    };
+
+    static std::vector<Snapshot> g_snapshots;
+    static std::vector<std::unique_ptr<SnapshotJob>> g_snapshot_jobs;
+
+    /* Reports and joins the background saves that have finished */
+    static void reap_snapshot_jobs(bool wait)
+    {
+        for (size_t i = 0; i < g_snapshot_jobs.size();)
+        {
+            auto& job = *g_snapshot_jobs[i];
+
+            if (!wait && job.state.load() == SnapshotJob::Running)
+            {
+                ++i;
+                continue;
+            }
+
+            job.thread.join();
+
+            if (job.state.load() == SnapshotJob::Done)
+                std::cout << "Snapshot saved to \"" << job.path << "\"\n";
+            else
+                std::cerr << "[ERROR] * Unable to save snapshot to \"" << job.path << "\" *\n";
+
+            g_snapshot_jobs.erase(g_snapshot_jobs.begin() + i);
+        }
+    }
+
+    /* Lists the snapshots and asks for one. Returns its index, or -1 */
+    static int snapshot_input()
+    {
+        if (g_snapshots.empty())
+        {
+            std::cerr << "[ERROR] * No snapshots taken *\n";
+            return -1;
+        }
+
+        for (size_t i = 0; i < g_snapshots.size(); ++i)
+        {
+            auto& snap = g_snapshots[i];
+
+            char when[16];
+            strftime(when, sizeof(when), "%H:%M:%S", localtime(&snap.taken_at));
+
+            std::cout << "   [" << i + 1 << "] taken at " << when << ", " << snap.count << " slot(s), transaction #"
+                      << snap.seq << "\n";
+        }
+
+        uint32_t n;
+        std::cout << IDN << "Enter snapshot number: ";
+
+        if (Input::number(n) != Input::Status::Ok || n == 0 || n > g_snapshots.size())
+        {
+            std::cerr << "\n[ERROR] * Invalid choice *" << '\n';
+            return -1;
+        }
+
+        return n - 1;
+    }
+
+    InvActionResult Snapshots(Inventory& inv)
+    {
+        reap_snapshot_jobs(false);
+
+        std::cout << IDN << "[1] Take  [2] View  [3] Save  [4] Release: ";
+        uint32_t action;
+
+        if (Input::number(action) != Input::Status::Ok || action == 0 || action > 4)
+        {
+            std::cerr << "\n[ERROR] * Invalid choice *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        if (action == 1)
+        {
+            if (inv.log.open)
+            {
+                std::cerr << "[ERROR] * Commit or roll back the open transaction first *\n";
+                return InvActionResult::Failed;
+            }
+
+            g_snapshots.push_back(snapshot_take(inv));
+            std::cout << "Snapshot " << g_snapshots.size() << " taken (" << inv.count << " slot(s))\n";
+
+            return InvActionResult::Ok;
+        }
+
+        auto index = snapshot_input();
+        if (index < 0)
+            return InvActionResult::Failed;
+
+        auto& snap = g_snapshots[index];
+
+        if (action == 2)
+        {
+            int shown = 0;
+            for (uint32_t i = 0; i < snap.count; ++i)
+            {
+                auto& item = snap.items[i];
+                if (!item.active)
+                    continue;
+
+                if (shown++ == 0)
+                    DisplayItem::Header();
+
+                DisplayItem::Compact(item);
+            }
+
+            if (shown == 0)
+                std::cout << "*No items in this snapshot*\n";
+        }
+        else if (action == 3)
+        {
+            static std::string path;
+            std::cout << IDN << "Enter file path: ";
+            if (!Input::string(path))
+                return InvActionResult::Failed;
+
+            std::unique_ptr<SnapshotJob> job(new SnapshotJob);
+            job->path = path;
+
+            /* The thread gets its own reference, so releasing the snapshot meanwhile is fine */
+            auto shared = snapshot_share(snap);
+            auto p = job.get();
+
+            job->thread = std::thread([p, shared]() mutable {
+                bool ok = Serialization::WriteSnapshot(p->path.c_str(), shared);
+                snapshot_release(shared);
+                p->state.store(ok ? SnapshotJob::Done : SnapshotJob::Failed);
+            });
+
+            g_snapshot_jobs.push_back(std::move(job));
+            std::cout << "\nSaving snapshot " << index + 1 << " to \"" << path << "\" in the background\n";
+        }
+        else
+        {
+            snapshot_release(snap);
+            g_snapshots.erase(g_snapshots.begin() + index);
+            std::cout << "Snapshot " << index + 1 << " released\n";
+        }
+
+        return InvActionResult::Ok;
+    }
+
+    void ReleaseSnapshots()
+    {
+        reap_snapshot_jobs(true);
+
+        for (auto& snap : g_snapshots)
+            snapshot_release(snap);
+
+        g_snapshots.clear();
+    }
+
+    static void history_header()
+    {
+        // clang-format off
+        std::cout
+            << std::setw(22) << std::left << "Time"
+            << std::setw(12) << std::left << "Event"
+            << std::setw(DisplayItem::w1) << std::left << "ID"
+            << std::setw(8) << std::left << "Units"
+            << "Member"
+            << "\n";
+
+        std::cout
+            << std::setw(22 + 12 + DisplayItem::w1 + 8 + 16)
+            << std::setfill('-') << "" << "\n" << std::setfill(' ');
+        // clang-format on
+    }
+
+    static void history_row(const Event& e)
+    {
+        time_t secs = e.time / 1000000;
+        char when[24];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+
+        // clang-format off
+        std::cout
+            << std::setw(22) << std::left << when
+            << std::setw(12) << std::left << (e.kind == EventKind::Assign ? "Assigned" : "Retrieved")
+            << std::setw(DisplayItem::w1) << std::left << e.item
+            << std::setw(8) << std::left << e.count;
+        // clang-format on
+
+        std::cout.write(e.name, e.name_len);
+        std::cout << "\n";
+    }
+
+    static bool time_input(const char* prompt, time_t& out, bool allow_empty)
+    {
+        static std::string text;
+        std::cout << IDN << prompt;
+
+        if (!Input::string(text, allow_empty))
+            return false;
+
+        if (allow_empty && Input::is_blank(text))
+        {
+            out = time(nullptr);
+            return true;
+        }
+
+        if (!Parse::LocalTime(text.data(), text.size(), out))
+        {
+            std::cerr << "\n[ERROR] * Invalid time (expected YYYY-MM-DD or YYYY-MM-DD HH:MM[:SS]) *" << '\n';
+            return false;
+        }
+
+        /* The history starts at the epoch */
+        if (out < 0)
+            out = 0;
+
+        return true;
+    }
+
+    InvActionResult AssignmentHistory(Inventory& inv)
+    {
+        if (!Events::IsOpen(inv.history))
+        {
+            std::cerr << "[ERROR] * The assignment history is not available *\n";
+            return InvActionResult::Failed;
+        }
+
+        std::cout << IDN << "[1] Of an Item  [2] Between Two Times: ";
+        uint32_t kind;
+
+        if (Input::number(kind) != Input::Status::Ok || (kind != 1 && kind != 2))
+        {
+            std::cerr << "\n[ERROR] * Invalid choice *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::vector<Event> events;
+
+        if (kind == 1)
+        {
+            /* Deleted items keep their history, so any id goes */
+            item_id_t id;
+            std::cout << IDN << "Enter Item Id: ";
+
+            if (Input::number(id) != Input::Status::Ok)
+            {
+                std::cerr << "\n[ERROR] * Invalid id *" << '\n';
+                return InvActionResult::Failed;
+            }
+
+            Events::ForEachOfItem(inv.history, id, [&](const Event& e) { events.push_back(e); });
+            std::reverse(events.begin(), events.end());
+        }
+        else
+        {
+            time_t from, to;
+            if (!time_input("Enter start time (YYYY-MM-DD [HH:MM[:SS]]): ", from, false)
+                || !time_input("Enter end time (press enter for now): ", to, true))
+                return InvActionResult::Failed;
+
+            Events::ForEachBetween(inv.history,
+                                   (uint64_t) from * 1000000,
+                                   (uint64_t) to * 1000000 + 999999,
+                                   [&](const Event& e) { events.push_back(e); });
+        }
+
+        std::cout << "\n";
+
+        if (events.empty())
+        {
+            std::cout << "*No assignments recorded*\n";
+            return InvActionResult::Failed;
+        }
+
+        history_header();
+        for (auto& e : events)
+            history_row(e);
+
+        return InvActionResult::Ok;
+    }
+
+    /* "id units member": units with a leading '-' are retrieved, otherwise assigned */
+    static bool parse_transfer(const std::string& line, Core::Transfer& t)
+    {
+        const char* p = line.data();
+        const char* end = p + line.size();
+        uint64_t value;
+
+        auto skip_space = [&]() {
+            while (p != end && Parse::IsSpace(*p))
+                ++p;
+        };
+
+        skip_space();
+        auto res = Parse::Uint(p, end, std::numeric_limits<item_id_t>::max(), value);
+        if (res.ec != Parse::Error::None)
+            return false;
+
+        t.id = value;
+        p = res.ptr;
+        skip_space();
+
+        t.retrieve = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+'))
+            ++p;
+
+        res = Parse::Uint(p, end, std::numeric_limits<item_count_t>::max(), value);
+        if (res.ec != Parse::Error::None || value == 0 || res.ptr == end || !Parse::IsSpace(*res.ptr))
+            return false;
+
+        t.units = value;
+        p = res.ptr;
+        skip_space();
+
+        size_t len = end - p;
+        Parse::Trim(p, len);
+        t.member.assign(p, len);
+
+        return !t.member.empty();
+    }
+
+    InvActionResult BatchTransfer(Inventory& inv)
+    {
+        std::cout << IDN << "Enter one transfer per line as: item id, units, member name (e.g. 12 5 Ali)\n"
+                  << IDN << "Units with a leading '-' are retrieved from the member. Finish with an empty line\n";
+
+        static std::vector<Core::Transfer> batch;
+        static std::string line;
+        batch.clear();
+
+        while (true)
+        {
+            std::cout << IDN << "Transfer " << batch.size() + 1 << ": ";
+            if (!Input::string(line, true) || Input::is_blank(line))
+                break;
+
+            Core::Transfer t;
+            if (!parse_transfer(line, t))
+            {
+                std::cerr << "[ERROR] * Invalid transfer. Try again *" << '\n';
+                continue;
+            }
+
+            batch.push_back(std::move(t));
+        }
+
+        std::cout << "\n";
+
+        if (batch.empty())
+        {
+            std::cout << "*No transfers entered*\n";
+            return InvActionResult::Failed;
+        }
+
+        auto done = Core::ApplyBatch(inv, batch);
+        if (done != batch.size())
+        {
+            auto& t = batch[done];
+            std::cerr << "[ERROR] * Transfer " << done + 1 << ": ";
+
+            if (Core::FindItemById(inv, t.id) == nullptr)
+                std::cerr << "no item with id " << t.id;
+            else if (t.retrieve)
+                std::cerr << "\"" << t.member << "\" does not hold " << t.units << " unit(s) of item " << t.id;
+            else
+                std::cerr << "item " << t.id << " does not have " << t.units << " unit(s) available";
+
+            std::cerr << ". Nothing was changed *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << batch.size() << " transfer(s) applied\n";
+
+        static std::vector<item_id_t> assigned;
+        assigned.clear();
+
+        for (auto& t : batch)
+            if (!t.retrieve)
+                assigned.push_back(t.id);
+
+        std::sort(assigned.begin(), assigned.end());
+        assigned.erase(std::unique(assigned.begin(), assigned.end()), assigned.end());
+
+        for (auto id : assigned)
+            AlertIfLow(inv, Core::FindItemById(inv, id));
+
+        return InvActionResult::Ok;
+    }
+
+    static void loans_header()
+    {
+        // clang-format off
+        std::cout
+            << std::setw(18) << std::left << "Due"
+            << std::setw(DisplayItem::w1) << std::left << "ID"
+            << std::setw(DisplayItem::w2) << std::left << "Name"
+            << std::setw(8) << std::left << "Units"
+            << "Member"
+            << "\n";
+
+        std::cout
+            << std::setw(18 + DisplayItem::w1 + DisplayItem::w2 + 8 + 16)
+            << std::setfill('-') << "" << "\n" << std::setfill(' ');
+        // clang-format on
+    }
+
+    static void loan_row(Inventory& inv, const DueEntry& e)
+    {
+        auto item = Core::WithMembers(inv, &inv.items[e.slot]);
+        auto& list = members_of(*item);
+        auto index = MemberLists::IndexOf(list, e.member);
+
+        // clang-format off
+        std::cout
+            << std::setw(18) << std::left << DisplayItem::DueTime(e.due)
+            << std::setw(DisplayItem::w1) << std::left << item->item_id
+            << std::setw(DisplayItem::w2) << std::left << item->meta.name
+            << std::setw(8) << std::left << (index == MEMBER_NONE ? 0 : list[index].units)
+            << inv.member_names.names[e.member]
+            << "\n";
+        // clang-format on
+    }
+
+    InvActionResult LoansDue(Inventory& inv)
+    {
+        static constexpr size_t UPCOMING = 10;
+        uint64_t now = time(nullptr);
+
+        /* Oldest first. Loans of deleted items stay on record but are not listed */
+        static std::vector<DueEntry> overdue;
+        overdue.clear();
+
+        DueDates::ForEachDueBy(inv.due, now, [&](const DueEntry& e) {
+            if (inv.items[e.slot].active)
+                overdue.push_back(e);
+        });
+
+        std::sort(overdue.begin(), overdue.end(), [](const DueEntry& a, const DueEntry& b) { return a.due < b.due; });
+
+        std::cout << "\nOverdue:\n";
+        if (overdue.empty())
+        {
+            std::cout << "*No overdue loans*\n";
+        }
+        else
+        {
+            loans_header();
+            for (auto& e : overdue)
+                loan_row(inv, e);
+        }
+
+        static std::vector<DueEntry> upcoming;
+        upcoming.clear();
+
+        DueDates::ForEachDueAfter(inv.due, now, UPCOMING, [&](const DueEntry& e) {
+            if (!inv.items[e.slot].active)
+                return false;
+
+            upcoming.push_back(e);
+            return true;
+        });
+
+        std::cout << "\nDue next:\n";
+        if (upcoming.empty())
+        {
+            std::cout << "*No upcoming loans*\n";
+        }
+        else
+        {
+            loans_header();
+            for (auto& e : upcoming)
+                loan_row(inv, e);
+        }
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult Leaderboards(Inventory& inv)
+    {
+        uint32_t k = 10;
+        std::cout << IDN << "Enter how many to show (press enter for 10): ";
+        if (Input::number(k, true) == Input::Status::Invalid || k == 0)
+        {
+            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        Core::Leaderboards(inv);
+
+        std::cout << "\nMost assigned items:\n";
+        if (inv.top_items.order.empty())
+        {
+            std::cout << "*No units assigned*\n";
+        }
+        else
+        {
+            // clang-format off
+            std::cout
+                << std::setw(6) << std::left << "Rank"
+                << std::setw(DisplayItem::w1) << std::left << "ID"
+                << std::setw(DisplayItem::w2) << std::left << "Name"
+                << "Units Assigned"
+                << "\n";
+
+            std::cout
+                << std::setw(6 + DisplayItem::w1 + DisplayItem::w2 + 14)
+                << std::setfill('-') << "" << "\n" << std::setfill(' ');
+            // clang-format on
+
+            uint32_t rank = 0;
+            Leaders::ForEachTop(inv.top_items, k, [&](uint32_t slot, uint64_t units) {
+                auto& item = inv.items[slot];
+
+                // clang-format off
+                std::cout
+                    << std::setw(6) << std::left << ++rank
+                    << std::setw(DisplayItem::w1) << std::left << item.item_id
+                    << std::setw(DisplayItem::w2) << std::left << item.meta.name
+                    << units
+                    << "\n";
+                // clang-format on
+            });
+        }
+
+        std::cout << "\nMembers holding the most units:\n";
+        if (inv.top_members.order.empty())
+        {
+            std::cout << "*No units assigned*\n";
+        }
+        else
+        {
+            // clang-format off
+            std::cout
+                << std::setw(6) << std::left << "Rank"
+                << std::setw(DisplayItem::w2) << std::left << "Member"
+                << "Units Held"
+                << "\n";
+
+            std::cout
+                << std::setw(6 + DisplayItem::w2 + 10)
+                << std::setfill('-') << "" << "\n" << std::setfill(' ');
+            // clang-format on
+
+            uint32_t rank = 0;
+            Leaders::ForEachTop(inv.top_members, k, [&](uint32_t member, uint64_t units) {
+                // clang-format off
+                std::cout
+                    << std::setw(6) << std::left << ++rank
+                    << std::setw(DisplayItem::w2) << std::left << inv.member_names.names[member]
+                    << units
+                    << "\n";
+                // clang-format on
+            });
+        }
+
+        return InvActionResult::Ok;
+    }
+
+    /* Started on the first query and kept for the rest of the session */
+    static WorkPool g_query_pool;
+
+    static const char* column_label(const Query::Column& col)
+    {
+        static const char* fields[] = { "ID", "Name", "Category", "Units", "Assigned", "Total", "Reorder" };
+        static const char* aggs[] = { "", "Count", "Sum", "Min", "Max" };
+        static std::string label;
+
+        if (col.agg == Query::Agg::None)
+            return fields[(int) col.field];
+
+        if (col.agg == Query::Agg::Count)
+            return aggs[(int) col.agg];
+
+        label = std::string(aggs[(int) col.agg]) + "(" + fields[(int) col.field] + ")";
+        return label.c_str();
+    }
+
+    static int column_width(const Query::Column& col)
+    {
+        if (col.agg != Query::Agg::None)
+            return 18;
+
+        switch (col.field)
+        {
+            case Query::Field::Id:   return DisplayItem::w1;
+            case Query::Field::Name: return DisplayItem::w2;
+            case Query::Field::Cat:  return DisplayItem::w3;
+            default:                 return 12;
+        }
+    }
+
+    InvActionResult RunQuery(Inventory& inv)
+    {
+        static std::string text;
+        std::cout << IDN << "Enter query (e.g. select sum(assigned), count where units < 10 group by cat): ";
+
+        if (!Input::string(text))
+        {
+            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        static Query q;
+        std::string error;
+        if (!Queries::Parse(inv.categories, text.data(), text.size(), q, error))
+        {
+            std::cerr << "\n[ERROR] * " << error << " *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        Traces::Text(inv.trace, TraceKind::Query, text.data(), text.size());
+
+        if (!Pool::Started(g_query_pool))
+            Pool::Start(g_query_pool, APP_QUERY_THREADS);
+
+        static QueryResult result;
+        auto start = std::chrono::steady_clock::now();
+        Queries::Run(inv, q, g_query_pool, result);
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "\n";
+
+        int width = 0;
+        if (q.by_cat)
+        {
+            std::cout << std::setw(DisplayItem::w3) << std::left << "Category";
+            width += DisplayItem::w3;
+        }
+
+        for (auto& col : q.columns)
+        {
+            std::cout << std::setw(column_width(col)) << std::left << column_label(col);
+            width += column_width(col);
+        }
+
+        std::cout << "\n" << std::setw(width) << std::setfill('-') << "" << "\n" << std::setfill(' ');
+
+        for (auto& group : result.groups)
+        {
+            if (q.by_cat)
+                std::cout << std::setw(DisplayItem::w3) << std::left << inv.categories.entries[group.cat].name;
+
+            for (size_t c = 0; c < q.columns.size(); ++c)
+                std::cout << std::setw(column_width(q.columns[c])) << std::left << group.values[c];
+
+            std::cout << "\n";
+        }
+
+        for (auto slot : result.slots)
+        {
+            auto& item = inv.items[slot];
+
+            for (auto& col : q.columns)
+            {
+                std::cout << std::setw(column_width(col)) << std::left;
+
+                if (col.field == Query::Field::Name)
+                    std::cout << item.meta.name;
+                else if (col.field == Query::Field::Cat)
+                    std::cout << item.meta.cat;
+                else
+                    std::cout << Queries::number(inv, item, col.field);
+            }
+
+            std::cout << "\n";
+        }
+
+        auto rows = q.aggregate ? result.groups.size() : result.slots.size();
+        auto precision = std::cout.precision(2);
+        std::cout << "\n(" << rows << " row(s), " << std::fixed << ms << " ms on " << g_query_pool.size
+                  << " thread(s))\n";
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout.precision(precision);
+
+        return InvActionResult::Ok;
+    }
+
+    static std::string byte_size(uint64_t bytes)
+    {
+        static const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+
+        double v = bytes;
+        int u = 0;
+        while (v >= 1024 && u < 4)
+        {
+            v /= 1024;
+            ++u;
+        }
+
+        char text[32];
+        snprintf(text, sizeof(text), "%.*f %s", u == 0 ? 0 : 1, v, units[u]);
+        return text;
+    }
+
+    InvActionResult MemoryReport(Inventory& inv)
+    {
+        auto usage = MemoryUsages::Measure(inv);
+
+        static constexpr int w_name = 22, w_bytes = 16;
+
+        // clang-format off
+        std::cout
+            << std::setw(w_name) << std::left << "Structure"
+            << std::setw(w_bytes) << std::left << "In Use"
+            << std::setw(w_bytes) << std::left << "Allocated"
+            << "Spare\n";
+
+        std::cout
+            << std::setw(w_name + 3 * w_bytes)
+            << std::setfill('-') << "" << "\n" << std::setfill(' ');
+        // clang-format on
+
+        uint64_t used = 0, allocated = 0;
+        for (auto& line : usage.lines)
+        {
+            used += line.used;
+            allocated += line.allocated;
+
+            // clang-format off
+            std::cout
+                << std::setw(w_name) << std::left << line.name
+                << std::setw(w_bytes) << std::left << byte_size(line.used)
+                << std::setw(w_bytes) << std::left << byte_size(line.allocated)
+                << byte_size(line.allocated - line.used)
+                << "\n";
+            // clang-format on
+        }
+
+        // clang-format off
+        std::cout
+            << std::setw(w_name + 3 * w_bytes)
+            << std::setfill('-') << "" << "\n" << std::setfill(' ')
+            << std::setw(w_name) << std::left << "Total"
+            << std::setw(w_bytes) << std::left << byte_size(used)
+            << std::setw(w_bytes) << std::left << byte_size(allocated)
+            << byte_size(allocated - used)
+            << "\n\n";
+        // clang-format on
+
+        auto flags = std::cout.flags();
+        auto precision = std::cout.precision();
+        std::cout << std::fixed << std::setprecision(1);
+
+        std::cout << usage.items << " item(s): " << sizeof(InventoryItem) << " bytes per record";
+        if (usage.items > 0)
+            std::cout << ", " << (double) usage.item_bytes / usage.items << " with the pages they take, "
+                      << (double) allocated / usage.items << " counting everything";
+        std::cout << "\n";
+
+        std::cout << usage.members << " member assignment(s) in memory, " << byte_size(usage.member_bytes)
+                  << " for lists outside the item records";
+        if (usage.members > 0)
+            std::cout << " (" << (double) usage.member_bytes / usage.members << " bytes per assignment)";
+        std::cout << "; " << usage.stored_lists << " list(s) not read from the data file yet\n";
+
+        std::cout << "Strings: " << byte_size(usage.string_bytes) << " referenced by items out of "
+                  << byte_size(inv.strings.used) << " stored\n";
+
+        if (usage.rss > 0)
+            std::cout << "Process resident size: " << byte_size(usage.rss) << "\n";
+
+        std::cout.flags(flags);
+        std::cout.precision(precision);
+
+        return InvActionResult::Ok;
+    }
+
+    /* 1 = items, 2 = assignments, 0 = invalid input */
+    static int data_kind_input()
+    {
+        std::cout << IDN << "[1] Items  [2] Assignments: ";
+        uint32_t kind;
+
+        if (Input::number(kind) != Input::Status::Ok || (kind != 1 && kind != 2))
+        {
+            std::cerr << "\n[ERROR] * Invalid choice *" << '\n';
+            return 0;
+        }
+
+        return kind;
+    }
+
+    InvActionResult ImportData(Inventory& inv)
+    {
+        auto kind = data_kind_input();
+        if (kind == 0)
+            return InvActionResult::Failed;
+
+        static std::string path;
+        std::cout << IDN << "Enter file path (.csv or .tsv): ";
+        if (!Input::string(path))
+            return InvActionResult::Failed;
+
+        std::cout << "\n";
+
+        Exchange::ImportStats stats;
+        bool ok = kind == 1 ? Exchange::ImportItems(inv, path.c_str(), stats)
+                            : Exchange::ImportAssignments(inv, path.c_str(), stats);
+
+        if (!ok)
+        {
+            std::cerr << "[ERROR] * Unable to import \"" << path << "\" *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << stats.imported << " row(s) imported, " << stats.rejected << " row(s) rejected\n";
+
+        return stats.imported > 0 ? InvActionResult::Ok : InvActionResult::Failed;
+    }
+
+    InvActionResult ExportData(Inventory& inv)
+    {
+        auto kind = data_kind_input();
+        if (kind == 0)
+            return InvActionResult::Failed;
+
+        static std::string path;
+        std::cout << IDN << "Enter file path (.csv or .tsv): ";
+        if (!Input::string(path))
+            return InvActionResult::Failed;
+
+        std::cout << "\n";
+
+        uint64_t rows = 0;
+        bool ok = kind == 1 ? Exchange::ExportItems(inv, path.c_str(), rows)
+                            : Exchange::ExportAssignments(inv, path.c_str(), rows);
+
+        if (!ok)
+        {
+            std::cerr << "[ERROR] * Unable to write \"" << path << "\" *" << '\n';
+            return InvActionResult::Failed;
+        }
+
+        std::cout << rows << " row(s) exported to \"" << path << "\"\n";
+
+        return InvActionResult::Ok;
+    }
+
+    InvActionResult CategorySummary(Inventory& inv)
+    {
+        using namespace DisplayItem;
+
+        int count = 0;
+        for (auto& entry : inv.categories.entries)
+        {
+            if (entry.slots.empty())
+                continue;
+
+            if (count++ == 0)
+            {
+                // clang-format off
+                std::cout
+                    << std::setw(w3) << std::left << "Category"
+                    << std::setw(w2) << std::left << "Items"
+                    << std::setw(w4) << std::left << "Units Available"
+                    << std::setw(w5) << std::left << "Units Assigned"
+                << "\n";
+
+                std::cout
+                    << std::setw(w3 + w2 + w4 + w5)
+                    << std::setfill('-') << "" << "\n" << std::setfill(' ');
+                // clang-format on
+            }
+
+            // clang-format off
+            std::cout
+                << std::setw(w3) << std::left << entry.name
+                << std::setw(w2) << std::left << entry.slots.size()
+                << std::setw(w4) << std::left << entry.item_count
+                << std::setw(w5) << std::left << entry.assigned_count
+                << "\n";
+            // clang-format on
+        }
+
+        if (count == 0)
+        {
+            std::cout << "*No items added*\n";
+            return InvActionResult::Failed;
+        }
+
+        return InvActionResult::Ok;
+    }
+}; // namespace Frontend
+
+namespace Core
+{
+
+    const InventoryItem* FindItemById(const Inventory& inv, item_id_t id)
+    {
+        auto slot = IdIndex::Find(inv.ids, id);
+        return slot == IDINDEX_NONE ? nullptr : &inv.items[slot];
+    }
+
+    /* Writable version of an item found by a lookup. Its page is copied first if a snapshot still shares it,
+     * so the pointer passed in must not be used for reading afterwards */
+    InventoryItem* ForUpdate(Inventory& inv, const InventoryItem* item)
+    {
+        return item == nullptr ? nullptr : &inventory_mutable(inv, slot_of(inv, item));
+    }
+
+    /* The item's member list, decoded from the data file the first time it is asked for */
+    MemberList& Members(Inventory& inv, InventoryItem* item)
+    {
+        auto stored = stored_members_of(*item);
+        if (stored != MemberSources::NONE)
+        {
+            auto names = inv.member_names.names.size();
+            if (!Serialization::DecodeMembers(*inv.member_source, stored, names, members_mutable(*item)))
+                std::cerr << "[WARN] * Members of item " << item->item_id << " could not be read *\n";
+
+            set_stored_members(*item, MemberSources::NONE);
+        }
+
+        return members_mutable(*item);
+    }
+
+    /* For read-only code that walks the list, e.g. to display it */
+    const InventoryItem* WithMembers(Inventory& inv, const InventoryItem* item)
+    {
+        if (item == nullptr || stored_members_of(*item) == MemberSources::NONE)
+            return item;
+
+        auto writable = ForUpdate(inv, item);
+        Members(inv, writable);
+        return writable;
+    }
+
+    /* Position of the named member in the item's list, or MEMBER_NONE */
+    uint32_t FindMember(Inventory& inv, InventoryItem* item, const char* name, size_t len)
+    {
+        auto member = MemberLists::Find(inv.member_names, name, len);
+        return member == MEMBER_NONE ? MEMBER_NONE : MemberLists::IndexOf(members_of(*WithMembers(inv, item)), member);
+    }
+
+    /* Slots of the active items with this name, in slot order. The first call sorts every name, unless the
+     * data file carried the order */
+    std::pair<const uint32_t*, const uint32_t*> FindByName(Inventory& inv, const char* name, size_t len)
+    {
+        if (!inv.names.ready)
+        {
+            std::vector<uint32_t> slots;
+            auto active = inv.columns.active.data();
+            for (size_t i = Scan::NextActive(active, 0, inv.count); i < inv.count;
+                 i = Scan::NextActive(active, i + 1, inv.count))
+                slots.push_back(i);
+
+            NameIndexes::Build(inv.names, std::move(slots), ItemNameOf { &inv });
+        }
+
+        return NameIndexes::Equal(inv.names, name, len, ItemNameOf { &inv });
+    }
+
+    static inline void RefreshAlert(Inventory& inv, uint32_t slot)
+    {
+        LowStock::Update(inv.low_stock, slot, is_below_reorder_level(inv.items[slot]));
+    }
+
+    static inline void RefreshRank(Inventory& inv, uint32_t slot)
+    {
+        auto& item = inv.items[slot];
+        Leaders::Set(inv.top_items, slot, item.active ? item.assigned_count : 0);
+    }
+
+    /* Counts (or, with sign -1, stops counting) the units the item's members hold towards their totals */
+    static void RankMembers(Inventory& inv, InventoryItem* item, int sign)
+    {
+        if (!inv.top_members.ready)
+            return;
+
+        auto& list = members_of(*WithMembers(inv, item));
+        for (uint32_t i = 0; i < list.size; ++i)
+            Leaders::Adjust(inv.top_members, list[i].member, sign * (int64_t) list[i].units);
+    }
+
+    static ItemOp op_on(OpKind kind, uint32_t slot, const char* name = nullptr, size_t name_len = 0)
+    {
+        ItemOp op;
+        op.kind = kind;
+        op.slot = slot;
+        op.name = name;
+        op.name_len = name_len;
+
+        return op;
+    }
+
+    static ItemOp op_with_meta(OpKind kind,
+                               uint32_t slot,
+                               item_id_t id,
+                               const ItemMeta& meta,
+                               item_count_t icount,
+                               item_count_t reorder)
+    {
+        auto op = op_on(kind, slot, meta.name.data(), meta.name.size());
+        op.id = id;
+        op.count = icount;
+        op.reorder = reorder;
+        op.cat = meta.cat.data();
+        op.cat_len = meta.cat.size();
+
+        return op;
+    }
+
+    /* Every mutator reports itself here: the forward op goes to the transaction being built, the inverse to
+     * undo (or to redo, while undoing) */
+    static void Record(Inventory& inv, const ItemOp& forward, const ItemOp& inverse)
+    {
+        using Mode = OperationLog::Mode;
+        auto& log = inv.log;
+
+        /* Rollbacks too, so a replay goes through the same states */
+        Traces::Change(inv.trace, forward);
+
+        if (log.mode == Mode::Off)
+            return;
+
+        OpLog::Encode(log.pending, forward);
+        ++log.pending_ops;
+
+        /* Assignments also go to the history, once their transaction is durable */
+        if (forward.kind == OpKind::Assign || forward.kind == OpKind::Retrieve)
+            Events::Stage(inv.history,
+                          inv.items[forward.slot].item_id,
+                          forward.kind == OpKind::Assign ? EventKind::Assign : EventKind::Retrieve,
+                          forward.count,
+                          forward.name,
+                          forward.name_len);
+
+        if (log.mode == Mode::Undoing)
+        {
+            OpLog::Encode(log.redo, inverse);
+            return;
+        }
+
+        /* A new change makes whatever was undone unreachable */
+        if (log.mode == Mode::Normal && !log.redo.empty())
+        {
+            log.redo.clear();
+            log.redo_marks.clear();
+        }
+
+        OpLog::Encode(log.undo, inverse);
+    }
+
+    static void Add(Inventory& inv, item_id_t id, item_count_t icount, const ItemMeta& meta, item_count_t reorder)
+    {
+        Deltas::Touch(inv, inv.count);
+        InventoryItem& slot = inventory_emplace(inv);
+
+        slot.item_id = id;
+
+        slot.meta = meta;
+
+        slot.item_count = icount;
+        slot.reorder_level = reorder;
+
+        inv.columns.counts.push_back(icount);
+        inv.columns.active.push_back(1);
+
+        IdIndex::Insert(inv.ids, id, slot_of(inv, &slot));
+        NameIndexes::Insert(inv.names, slot_of(inv, &slot));
+
+        auto cat = Categories::Intern(inv.categories, meta.cat.data(), meta.cat.size());
+        Categories::Link(inv.categories, slot_of(inv, &slot), cat, slot.item_count, slot.assigned_count);
+
+        RefreshAlert(inv, slot_of(inv, &slot));
+
+        Record(inv, op_with_meta(OpKind::Add, 0, id, meta, icount, reorder), op_on(OpKind::Drop, 0));
+    }
+
+    /* Removes the last item altogether. Only ever used to reverse an Add */
+    static void Drop(Inventory& inv)
+    {
+        uint32_t slot = inv.count - 1;
+        auto& item = inv.items[slot];
+
+        Deltas::Touch(inv, slot);
+        Record(inv,
+               op_on(OpKind::Drop, 0),
+               op_with_meta(OpKind::Add, 0, item.item_id, item.meta, item.item_count, item.reorder_level));
+
+        if (item.active)
+        {
+            Categories::Unlink(inv.categories, slot, item.item_count, item.assigned_count);
+            IdIndex::Erase(inv.ids, item.item_id);
+            NameIndexes::Erase(inv.names, slot, ItemNameOf { &inv });
+        }
+
+        LowStock::Update(inv.low_stock, slot, false);
+        Leaders::Set(inv.top_items, slot, 0);
+
+        inv.columns.counts.pop_back();
+        inv.columns.active.pop_back();
+
+        inventory_truncate(inv, slot);
+    }
+
+    static void Edit(Inventory& inv,
+                     InventoryItem* item,
+                     const ItemMeta& meta,
+                     item_count_t icount,
+                     item_count_t reorder)
+    {
+        auto slot = slot_of(inv, item);
+
+        Deltas::Touch(inv, slot);
+        Record(inv,
+               op_with_meta(OpKind::Edit, slot, item->item_id, meta, icount, reorder),
+               op_with_meta(OpKind::Edit, slot, item->item_id, item->meta, item->item_count, item->reorder_level));
+
+        if (meta.cat != item->meta.cat)
+        {
+            Categories::Unlink(inv.categories, slot, item->item_count, item->assigned_count);
+
+            auto cat = Categories::Intern(inv.categories, meta.cat.data(), meta.cat.size());
+            Categories::Link(inv.categories, slot, cat, icount, item->assigned_count);
+        }
+        else
+        {
+            Categories::Adjust(inv.categories, slot, (int64_t) icount - item->item_count, 0);
+        }
+
+        bool renamed = item->active && meta.name != item->meta.name;
+        if (renamed)
+            NameIndexes::Erase(inv.names, slot, ItemNameOf { &inv });
+
+        item->meta = meta;
+        item->item_count = icount;
+        item->reorder_level = reorder;
+
+        if (renamed)
+            NameIndexes::Insert(inv.names, slot);
+
+        inv.columns.counts[slot] = icount;
+        RefreshAlert(inv, slot);
+    }
+
+    static inline void Delete(Inventory& inv, InventoryItem* item)
+    {
+        auto slot = slot_of(inv, item);
+        Deltas::Touch(inv, slot);
+
+        Categories::Unlink(inv.categories, slot, item->item_count, item->assigned_count);
+        item->active = false;
+
+        inv.columns.active[slot] = 0;
+        RefreshAlert(inv, slot);
+
+        /* Units held of a deleted item stay with their members, but no longer rank */
+        RefreshRank(inv, slot);
+        RankMembers(inv, item, -1);
+
+        IdIndex::Erase(inv.ids, item->item_id);
+        NameIndexes::Erase(inv.names, slot, ItemNameOf { &inv });
+
+        Record(inv, op_on(OpKind::Delete, slot), op_on(OpKind::Undelete, slot));
+    }
+
+    static void Undelete(Inventory& inv, InventoryItem* item)
+    {
+        auto slot = slot_of(inv, item);
+        Deltas::Touch(inv, slot);
+
+        item->active = true;
+        inv.columns.active[slot] = 1;
+
+        IdIndex::Insert(inv.ids, item->item_id, slot);
+        NameIndexes::Insert(inv.names, slot);
+
+        auto cat = Categories::Intern(inv.categories, item->meta.cat.data(), item->meta.cat.size());
+        Categories::Link(inv.categories, slot, cat, item->item_count, item->assigned_count);
+
+        RefreshAlert(inv, slot);
+        RefreshRank(inv, slot);
+        RankMembers(inv, item, +1);
+
+        Record(inv, op_on(OpKind::Undelete, slot), op_on(OpKind::Delete, slot));
+    }
+
+    static ItemOp op_units(OpKind kind, uint32_t slot, const std::string& member, item_count_t units)
+    {
+        auto op = op_on(kind, slot, member.data(), member.size());
+        op.count = units;
+
+        return op;
+    }
+
+    /* Moves `units` of the item's available units to the member, due back at `due` if it isn't 0. Changes
+     * nothing and returns false if there are not that many units, or units is 0 */
+    static bool Assign(Inventory& inv, InventoryItem* item, const char* name, item_count_t units, uint64_t due)
+    {
+        if (units == 0 || units > item->item_count)
+            return false;
+
+        Deltas::Touch(inv, slot_of(inv, item));
+
+        auto& list = Members(inv, item);
+        auto member = MemberLists::Intern(inv.member_names, name, strlen(name));
+        auto index = MemberLists::IndexOf(list, member);
 
-            if (Core::FindItemById(inv, id) != nullptr)
+        if (index == MEMBER_NONE)
+            MemberLists::Append(list, member, units);
+        else
+            list[index].units += units;
+
+        item->assigned_count += units;
+        item->item_count -= units;
+
+        auto slot = slot_of(inv, item);
+
+        Categories::Adjust(inv.categories, slot, -(int64_t) units, +(int64_t) units);
+        inv.columns.counts[slot] = item->item_count;
+        RefreshAlert(inv, slot);
+        RefreshRank(inv, slot);
+
+        if (item->active)
+            Leaders::Adjust(inv.top_members, member, +(int64_t) units);
+
+        auto& member_name = inv.member_names.names[member];
+        Record(inv,
+               op_units(OpKind::Assign, slot, member_name, units),
+               op_units(OpKind::Retrieve, slot, member_name, units));
+
+        if (due != 0)
+            SetDue(inv, item, member, due);
+
+        return true;
+    }
+
+    static inline bool Assign(Inventory& inv, item_id_t id, const char* name, item_count_t units, uint64_t due)
+    {
+        auto item = ForUpdate(inv, FindItemById(inv, id));
+        return item != nullptr && Assign(inv, item, name, units, due);
+    }
+
+    /* Takes `units` back from the member at index, a position in the item's (decoded) member list. Changes
+     * nothing and returns false if the member holds fewer, or units is 0 */
+    static bool Retrieve(Inventory& inv, InventoryItem* item, uint32_t index, item_count_t units)
+    {
+        auto slot = slot_of(inv, item);
+        auto& list = members_mutable(*item);
+
+        if (units == 0 || units > list[index].units)
+            return false;
+
+        Deltas::Touch(inv, slot);
+
+        /* A loan that is returned in full is no longer due */
+        if (units == list[index].units)
+            SetDue(inv, item, list[index].member, 0);
+
+        auto& member_name = inv.member_names.names[list[index].member];
+        Record(inv,
+               op_units(OpKind::Retrieve, slot, member_name, units),
+               op_units(OpKind::Assign, slot, member_name, units));
+
+        if (item->active)
+            Leaders::Adjust(inv.top_members, list[index].member, -(int64_t) units);
+
+        if ((list[index].units -= units) == 0)
+            MemberLists::SwapRemove(list, index);
+
+        item->item_count += units;
+        item->assigned_count -= units;
+
+        Categories::Adjust(inv.categories, slot, +(int64_t) units, -(int64_t) units);
+        inv.columns.counts[slot] = item->item_count;
+        RefreshAlert(inv, slot);
+        RefreshRank(inv, slot);
+
+        return true;
+    }
+
+    /* Sets (or, with 0, clears) when the member is to bring the units they hold of the item back */
+    static void SetDue(Inventory& inv, InventoryItem* item, member_id_t member, uint64_t due)
+    {
+        auto slot = slot_of(inv, item);
+        auto previous = DueDates::Get(inv.due, slot, member);
+        if (previous == due)
+            return;
+
+        Deltas::Touch(inv, slot);
+
+        auto& member_name = inv.member_names.names[member];
+        auto op = op_on(OpKind::SetDue, slot, member_name.data(), member_name.size());
+        auto inverse = op;
+        op.time = due;
+        inverse.time = previous;
+
+        Record(inv, op, inverse);
+        DueDates::Set(inv.due, slot, member, due);
+    }
+
+    /*
+     * Applies a list of transfers as one change: all of them, or none if any line can't be applied. Lines are
+     * checked in order against what the lines before them leave behind, so units assigned by one line can be
+     * retrieved by a later one. Returns batch.size(), or the position of the first line that failed.
+     */
+    static size_t ApplyBatch(Inventory& inv, const std::vector<Transfer>& batch)
+    {
+        std::unordered_map<uint32_t, uint64_t> available; // by slot
+        std::unordered_map<std::string, uint64_t> held;   // by slot and member name
+        std::string key;
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            auto& t = batch[i];
+
+            auto item = WithMembers(inv, FindItemById(inv, t.id));
+            if (item == nullptr || t.units == 0 || t.member.empty())
+                return i;
+
+            auto slot = slot_of(inv, item);
+            key.assign((const char*) &slot, sizeof(slot));
+            key += t.member;
+
+            auto avail = available.emplace(slot, item->item_count).first;
+            auto h = held.find(key);
+
+            if (h == held.end())
             {
-                std::cerr << "\n[ERROR] * Item with id " << id << " already exists. *\n"
-                          << "        * Failed to add item *\n";
+                auto member = MemberLists::Find(inv.member_names, t.member.data(), t.member.size());
+                auto& list = members_of(*item);
+                auto index = member == MEMBER_NONE ? MEMBER_NONE : MemberLists::IndexOf(list, member);
+
+                h = held.emplace(key, index == MEMBER_NONE ? 0 : list[index].units).first;
+            }
+
+            auto& from = t.retrieve ? h->second : avail->second;
+            auto& to = t.retrieve ? avail->second : h->second;
+
+            if (t.units > from)
+                return i;
+
+            from -= t.units;
+            to += t.units;
+        }
+
+        for (auto& t : batch)
+        {
+            auto item = ForUpdate(inv, FindItemById(inv, t.id));
+
+            if (t.retrieve)
+                Retrieve(inv, item, FindMember(inv, item, t.member.data(), t.member.size()), t.units);
+            else
+                Assign(inv, item, t.member.c_str(), t.units);
+        }
+
+        return batch.size();
+    }
+
+    /* Replays one logged operation through the regular mutators. Returns false if it doesn't fit the
+     * current state, which only happens with a damaged journal */
+    static bool Apply(Inventory& inv, const ItemOp& op)
+    {
+        static std::string name;
+        name.assign(op.name, op.name_len);
+
+        if (op.kind == OpKind::Add)
+        {
+            if (FindItemById(inv, op.id) != nullptr)
+                return false;
+
+            ItemMeta meta;
+            meta.name = Strings::Store(inv.strings, op.name, op.name_len);
+            meta.cat = Strings::Store(inv.strings, op.cat, op.cat_len);
+
+            Add(inv, op.id, op.count, meta, op.reorder);
+            return true;
+        }
+
+        if (op.kind == OpKind::Drop)
+        {
+            if (inv.count == 0)
+                return false;
+
+            Drop(inv);
+            return true;
+        }
+
+        if (op.slot >= inv.count)
+            return false;
+
+        auto item = ForUpdate(inv, &inv.items[op.slot]);
+
+        switch (op.kind)
+        {
+            case OpKind::Delete:
+            {
+                if (!item->active)
+                    return false;
+
+                Delete(inv, item);
+                return true;
+            }
+
+            case OpKind::Undelete:
+            {
+                if (item->active || FindItemById(inv, item->item_id) != nullptr)
+                    return false;
+
+                Undelete(inv, item);
+                return true;
+            }
+
+            case OpKind::Assign:
+            {
+                return item->active && Assign(inv, item, name.c_str(), op.count);
+            }
+
+            case OpKind::Retrieve:
+            {
+                auto index = FindMember(inv, item, name.data(), name.size());
+                return index != MEMBER_NONE && Retrieve(inv, item, index, op.count);
+            }
+
+            case OpKind::SetDue:
+            {
+                /* Only loans that are out can be due */
+                auto index = FindMember(inv, item, name.data(), name.size());
+                if (index == MEMBER_NONE)
+                    return op.time == 0;
+
+                SetDue(inv, item, members_of(*item)[index].member, op.time);
+                return true;
+            }
+
+            case OpKind::Edit:
+            {
+                if (!item->active)
+                    return false;
+
+                ItemMeta meta;
+                meta.name = Strings::Store(inv.strings, op.name, op.name_len);
+                meta.cat = Strings::Store(inv.strings, op.cat, op.cat_len);
+
+                Edit(inv, item, meta, op.count, op.reorder);
+                return true;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    /*
+     * Applies the records in buf[from, end) last to first. Returns where it stopped: `from` if every record
+     * applied, else the end of the one that did not, so buf[from, returned) is what is left unapplied.
+     */
+    static size_t ApplyBackwards(Inventory& inv, const std::vector<char>& buf, size_t from)
+    {
+        for (size_t end = buf.size(); end > from;)
+        {
+            size_t start = OpLog::Previous(buf, end);
+
+            ItemOp op;
+            const char* p = buf.data() + start;
+            if (!OpLog::Decode(p, buf.data() + end, op) || !Apply(inv, op))
+                return end;
+
+            end = start;
+        }
+
+        return from;
+    }
+
+    static bool Begin(Inventory& inv)
+    {
+        if (inv.log.open)
+            return false;
+
+        inv.log.open = true;
+        inv.log.txn_start = inv.log.undo.size();
+
+        return true;
+    }
+
+    /* Closes the transaction in progress, explicit or not, into one undo step */
+    static void Commit(Inventory& inv)
+    {
+        auto& log = inv.log;
+
+        if (log.undo.size() > log.txn_start)
+            log.undo_marks.push_back(log.txn_start);
+
+        log.txn_start = log.undo.size();
+        log.open = false;
+    }
+
+    /*
+     * Reverts the open transaction. If a change cannot be reverted, the ones before it stay in place as an
+     * undo step of their own and the whole inventory is saved at the next commit, since the journal cannot
+     * describe a partial rollback. Returns false then, or when no transaction is open.
+     */
+    static bool Rollback(Inventory& inv)
+    {
+        auto& log = inv.log;
+        if (!log.open)
+            return false;
+
+        log.mode = OperationLog::Mode::Off;
+        size_t stop = ApplyBackwards(inv, log.undo, log.txn_start);
+        log.mode = OperationLog::Mode::Normal;
+
+        Events::Discard(inv.history);
+
+        if (stop != log.txn_start)
+        {
+            log.undo.resize(stop);
+            log.checkpoint = true;
+            Commit(inv);
+            return false;
+        }
+
+        log.undo.resize(log.txn_start);
+        log.pending.clear();
+        log.pending_ops = 0;
+        log.open = false;
+
+        return true;
+    }
+
+    static bool Undo(Inventory& inv)
+    {
+        auto& log = inv.log;
+        if (log.open || log.undo_marks.empty())
+            return false;
+
+        size_t start = log.undo_marks.back();
+        log.undo_marks.pop_back();
+        log.redo_marks.push_back(log.redo.size());
+
+        log.mode = OperationLog::Mode::Undoing;
+        size_t stop = ApplyBackwards(inv, log.undo, start);
+        log.mode = OperationLog::Mode::Normal;
+
+        log.undo.resize(stop);
+        log.txn_start = stop;
+
+        if (stop == start)
+            return true;
+
+        /* What was not reverted stays one step to undo; what was can be redone */
+        log.undo_marks.push_back(start);
+        if (log.redo.size() == log.redo_marks.back())
+            log.redo_marks.pop_back();
+
+        log.checkpoint = true;
+        return false;
+    }
+
+    static bool Redo(Inventory& inv)
+    {
+        auto& log = inv.log;
+        if (log.open || log.redo_marks.empty())
+            return false;
+
+        size_t start = log.redo_marks.back();
+        log.redo_marks.pop_back();
+        log.undo_marks.push_back(log.undo.size());
+
+        log.mode = OperationLog::Mode::Redoing;
+        size_t stop = ApplyBackwards(inv, log.redo, start);
+        log.mode = OperationLog::Mode::Normal;
+
+        log.redo.resize(stop);
+        log.txn_start = log.undo.size();
+
+        if (stop == start)
+            return true;
+
+        /* What was not reapplied stays one step to redo; what was can be undone */
+        log.redo_marks.push_back(start);
+        if (log.undo.size() == log.undo_marks.back())
+            log.undo_marks.pop_back();
+
+        log.checkpoint = true;
+        return false;
+    }
+
+    /* Makes room for `capacity` items in inv.items and in every per-slot structure at once */
+    static void Reserve(Inventory& inv, uint32_t capacity)
+    {
+        inventory_allocate_capacity(inv, capacity);
+
+        inv.columns.counts.reserve(capacity);
+        inv.columns.active.reserve(capacity);
+
+        IdIndex::Reserve(inv.ids, capacity);
+    }
+
+    /* Rebuilds the derived lookup structures from inv.items, after a load or a compaction. `loaded` has the
+     * Serialization::LoadedIndex bits of those the data file carried, which are left as they are */
+    static void RebuildIndexes(Inventory& inv, uint32_t loaded)
+    {
+        bool ids = !(loaded & Serialization::LOADED_IDS);
+        bool cats = !(loaded & Serialization::LOADED_CATEGORIES);
+
+        if (cats)
+            Categories::Clear(inv.categories);
+        if (ids)
+            IdIndex::Clear(inv.ids, inv.count);
+
+        LowStock::Clear(inv.low_stock);
+
+        /* Sorted again when next searched */
+        if (!(loaded & Serialization::LOADED_NAMES))
+            NameIndexes::Reset(inv.names);
+
+        /* Keyed by slot, so built again when next asked for. Member totals don't depend on slots */
+        Leaders::Reset(inv.top_items);
+
+        auto& cols = inv.columns;
+        cols.counts.resize(inv.count);
+        cols.active.resize(inv.count);
+
+        for (uint32_t i = 0; i < inv.count; ++i)
+        {
+            auto& item = inv.items[i];
+
+            cols.counts[i] = item.item_count;
+            cols.active[i] = item.active;
+
+            RefreshAlert(inv, i);
+
+            if (!item.active)
+                continue;
+
+            if (ids)
+                IdIndex::Insert(inv.ids, item.item_id, i);
+
+            if (cats)
+            {
+                auto cat = Categories::Intern(inv.categories, item.meta.cat.data(), item.meta.cat.size());
+                Categories::Link(inv.categories, i, cat, item.item_count, item.assigned_count);
+            }
+        }
+    }
+
+    /* Drops deleted items for good and hands the unused storage back. Slots change, so every index is rebuilt.
+     * Returns the number of items purged */
+    static uint32_t Compact(Inventory& inv)
+    {
+        Traces::Compact(inv.trace);
+
+        uint32_t kept = 0;
+        std::vector<uint32_t> new_slot(inv.count, DueDates::SLOT_GONE);
+
+        for (uint32_t i = 0; i < inv.count; ++i)
+        {
+            if (!inv.items[i].active)
+            {
+                /* Deleted items can still hold members from before the delete */
+                if (!members_of(inv.items[i]).empty())
+                    free_members(inventory_mutable(inv, i));
+
+                continue;
+            }
+
+            if (kept != i)
+            {
+                auto& from = inventory_mutable(inv, i);
+                move_item(inventory_mutable(inv, kept), from);
+            }
+
+            new_slot[i] = kept++;
+        }
+
+        uint32_t purged = inv.count - kept;
+
+        inventory_truncate(inv, kept);
+        inventory_shrink_to_fit(inv);
+
+        /* Purged and edited items left their long strings behind; only the live ones move to a fresh arena */
+        StringArena strings;
+        for (uint32_t i = 0; i < inv.count; ++i)
+        {
+            if (!inv.items[i].meta.name.in_arena() && !inv.items[i].meta.cat.in_arena())
+                continue;
+
+            auto& meta = inventory_mutable(inv, i).meta;
+
+            if (meta.name.in_arena())
+                meta.name = Strings::Store(strings, meta.name.data(), meta.name.size());
+
+            if (meta.cat.in_arena())
+                meta.cat = Strings::Store(strings, meta.cat.data(), meta.cat.size());
+        }
+
+        std::swap(inv.strings, strings);
+
+        RebuildIndexes(inv);
+        DueDates::Remap(inv.due, new_slot);
+        Digests::Reset(inv.digest);
+
+        inv.columns.counts.shrink_to_fit();
+        inv.columns.active.shrink_to_fit();
+
+        /* Slots moved, so logged operations no longer point at the right items */
+        OpLog::Clear(inv.log);
+        inv.log.checkpoint = true;
+
+        return purged;
+    }
+
+    /* Readies both leaderboards. The first call totals every item and every member list, O(items + loans);
+     * from then on each change keeps them current */
+    static void Leaderboards(Inventory& inv)
+    {
+        if (!inv.top_items.ready)
+        {
+            std::vector<uint64_t> assigned(inv.count, 0);
+            for (uint32_t i = 0; i < inv.count; ++i)
+            {
+                if (inv.items[i].active)
+                    assigned[i] = inv.items[i].assigned_count;
+            }
+
+            Leaders::Build(inv.top_items, std::move(assigned));
+        }
+
+        if (inv.top_members.ready)
+            return;
+
+        auto names = inv.member_names.names.size();
+        std::vector<uint64_t> held(names, 0);
+        auto add = [&](member_id_t member, uint32_t units) { held[member] += units; };
+
+        /* Lists not read yet are totalled straight from the file, without keeping them */
+        for (uint32_t i = 0; i < inv.count; ++i)
+        {
+            auto& item = inv.items[i];
+            if (!item.active)
+                continue;
+
+            auto stored = stored_members_of(item);
+            if (stored != MemberSources::NONE)
+            {
+                Serialization::ForEachStoredMember(*inv.member_source, stored, names, add);
+                continue;
+            }
+
+            auto& list = members_of(item);
+            for (uint32_t m = 0; m < list.size; ++m)
+                add(list[m].member, list[m].units);
+        }
+
+        Leaders::Build(inv.top_members, std::move(held));
+    }
+
+    /* Hands every unit of the item back, last member first so none is moved */
+    static void RetrieveAll(Inventory& inv, InventoryItem* item)
+    {
+        auto& list = members_of(*WithMembers(inv, item));
+        while (list.size > 0)
+            Retrieve(inv, item, list.size - 1, list[list.size - 1].units);
+    }
+
+    /*
+     * Brings the inventory to the state a delta was taken of, through the usual mutators in one transaction,
+     * so it is journaled (and undone) like any other change and costs in proportion to the items it touches.
+     * Changes nothing and returns false unless the inventory is in the state the delta was taken against, and
+     * ends in the one it was taken of, as told by their digests. Those cost a hash of each item changed since
+     * the digest was last read (all of them, the first time in a process without a saved digest).
+     *
+     * Items are only edited and assigned to while active, as replaying the journal requires, so every changed
+     * item is deleted first, which also frees its id, filled in, and undeleted last if it should be active.
+     */
+    static bool ApplyDelta(Inventory& inv, const Delta& delta)
+    {
+        if (delta.old_count != inv.count || inv.log.open || Deltas::Digest(inv) != delta.old_digest)
+            return false;
+
+        for (auto& d : delta.items)
+        {
+            if (d.slot < delta.keep && Deltas::ItemHash(inv, d.slot) != d.old_hash)
+                return false;
+
+            uint64_t held = 0;
+            for (auto& m : d.members)
+                held += m.units;
+
+            if (held != d.assigned || (uint64_t) d.units + d.assigned > std::numeric_limits<item_count_t>::max())
+                return false;
+        }
+
+        Begin(inv);
+
+        /* Slots from keep on hold other items now, so they are dropped and added again */
+        while (inv.count > delta.keep)
+        {
+            RetrieveAll(inv, ForUpdate(inv, &inv.items[inv.count - 1]));
+            Drop(inv);
+        }
+
+        for (auto& d : delta.items)
+        {
+            if (d.slot < delta.keep && inv.items[d.slot].active)
+                Delete(inv, ForUpdate(inv, &inv.items[d.slot]));
+        }
+
+        bool ok = true;
+        for (size_t i = 0; ok && i < delta.items.size(); ++i)
+        {
+            auto& d = delta.items[i];
+
+            /* Taken by an item the delta leaves alone */
+            if (FindItemById(inv, d.id) != nullptr)
+            {
+                ok = false;
+                break;
+            }
+
+            ItemMeta meta;
+            meta.name = Strings::Store(inv.strings, d.name);
+            meta.cat = Strings::Store(inv.strings, d.cat);
+
+            /* Every unit starts out available and is then assigned as the delta lists them */
+            item_count_t total = d.units + d.assigned;
 
-                return InvActionResult::Failed;
+            InventoryItem* item;
+            if (d.slot < delta.keep)
+            {
+                item = ForUpdate(inv, &inv.items[d.slot]);
+                Undelete(inv, item);
+                RetrieveAll(inv, item);
+                Edit(inv, item, meta, total, d.reorder);
+            }
+            else
+            {
+                Add(inv, d.id, total, meta, d.reorder);
+                item = ForUpdate(inv, &inv.items[d.slot]);
             }
+
+            for (auto& m : d.members)
+                ok = ok && Assign(inv, item, m.name.c_str(), m.units, m.due);
+
+            Delete(inv, item);
         }
 
+        for (size_t i = 0; ok && i < delta.items.size(); ++i)
         {
-            std::cout << IDN << "Enter Item name: ";
-            if (!Input::string(meta.name))
-                return InvActionResult::Failed;
+            auto& d = delta.items[i];
+            if (d.active)
+                Undelete(inv, ForUpdate(inv, &inv.items[d.slot]));
         }
 
+        if (!ok || Deltas::Digest(inv) != delta.new_digest)
         {
-            std::cout << IDN << "Enter Item Category: ";
-            if (!Input::string(meta.cat))
-                return InvActionResult::Failed;
+            Rollback(inv);
+            return false;
         }
 
+        Commit(inv);
+        return true;
+    }
+} // namespace Core
+
+namespace Exchange
+{
+    /*
+     * Items:        id, name, category, units, reorder_level (optional). `units` is the total a member could
+     *               be assigned, i.e. available + assigned. An `assigned` column is written on export for
+     *               reference and ignored on import; assignments carry that information instead.
+     * Assignments:  item_id, member, units. Importing one moves units from available to assigned.
+     *
+     * The first row names the columns, so they can come in any order.
+     */
+
+    static constexpr int MAX_REPORTED_ERRORS = 5;
+
+    static void reject(ImportStats& stats, uint64_t line, const char* reason)
+    {
+        if (stats.rejected++ < MAX_REPORTED_ERRORS)
+            std::cerr << "[WARN] line " << line << ": " << reason << '\n';
+    }
+
+    /* Maps each wanted column name to its position in the header row, -1 if absent */
+    static bool map_columns(const Csv::Field* header,
+                            size_t n,
+                            const char* const* names,
+                            int* columns,
+                            int count,
+                            int required)
+    {
+        for (int c = 0; c < count; ++c)
         {
-            std::cout << IDN << "Enter Item's available unit count: ";
-            auto ic = Input::integer();
+            columns[c] = -1;
+            for (size_t i = 0; i < n; ++i)
+                if (strcmp(header[i].ptr, names[c]) == 0)
+                    columns[c] = i;
 
-            if (ic == -1)
+            if (c < required && columns[c] == -1)
             {
-                std::cerr << "\n[ERROR] * Invalid input *" << '\n';
-                return InvActionResult::Failed;
+                std::cerr << "[ERROR] * Missing column \"" << names[c] << "\" *" << '\n';
+                return false;
             }
-
-            icount = ic;
         }
 
-        std::cout << "\n";
-
-        Core::Add(inv, id, icount, meta);
-
-        std::cout << "Item \"" << meta.name << "\" added successfully\n";
-
-        return InvActionResult::Ok;
+        return true;
     }
 
-    InvActionResult ViewItems(Inventory& inv)
+    static bool ImportItems(Inventory& inv, const char* path, ImportStats& stats)
     {
-        if (inv.count == 0)
+        enum Column
         {
-            std::cout << "*No items added*\n";
-            return InvActionResult::Failed;
-        }
+            Id = 0,
+            Name,
+            Category,
+            Units,
+            Reorder,
+            COLUMN_COUNT
+        };
+
+        static const char* const names[COLUMN_COUNT] = { "id", "name", "category", "units", "reorder_level" };
+
+        std::ifstream in(path, ios::binary);
+        if (!in)
+            return false;
 
-        DisplayItem::Header();
+        /* One pass to count rows, so storage and indexes are sized once up front */
+        auto rows = Csv::CountLines(in);
+        in.clear();
+        in.seekg(0, ios::beg);
+
+        Csv::Reader r;
+        Csv::InitReader(r, in, Csv::DelimiterFor(path));
+
+        Csv::Field fields[Csv::MAX_FIELDS];
+        int col[COLUMN_COUNT];
+
+        size_t n = Csv::NextRecord(r, fields);
+        if (n == 0 || !map_columns(fields, n, names, col, COLUMN_COUNT, Reorder))
+            return false;
+
+        size_t needed = 0;
+        for (int c : col)
+            needed = std::max<size_t>(needed, c + 1);
+
+        if (rows > 1)
+            Core::Reserve(inv, inv.count + rows - 1);
+
+        ItemMeta meta;
 
-        for (int i = 0; i < inv.count; ++i)
+        while ((n = Csv::NextRecord(r, fields)) != 0)
         {
-            auto& item = inv.items[i];
+            uint64_t id, units, reorder = 0;
 
-            if (!item.active)
+            if (n < needed)
+            {
+                reject(stats, r.line, "missing fields");
                 continue;
+            }
+
+            if (!Csv::ToUint(fields[col[Id]], std::numeric_limits<item_id_t>::max(), id)
+                || !Csv::ToUint(fields[col[Units]], std::numeric_limits<item_count_t>::max(), units)
+                || (col[Reorder] != -1 && fields[col[Reorder]].len > 0
+                    && !Csv::ToUint(fields[col[Reorder]], std::numeric_limits<item_count_t>::max(), reorder)))
+            {
+                reject(stats, r.line, "invalid number");
+                continue;
+            }
+
+            if (Core::FindItemById(inv, id) != nullptr)
+            {
+                reject(stats, r.line, "an item with this id already exists");
+                continue;
+            }
 
-            DisplayItem::Compact(item);
+            meta.name = Strings::Store(inv.strings, fields[col[Name]].ptr, fields[col[Name]].len);
+            meta.cat = Strings::Store(inv.strings, fields[col[Category]].ptr, fields[col[Category]].len);
+
+            Core::Add(inv, id, units, meta, reorder);
+            ++stats.imported;
         }
 
-        return InvActionResult::Ok;
+        return true;
     }
 
-    InvActionResult SearchItem(Inventory& inv)
+    static bool ImportAssignments(Inventory& inv, const char* path, ImportStats& stats)
     {
-        string str;
+        enum Column
         {
-            std::cout << IDN << "Enter Item name: ";
-            if (!Input::string(str))
-                return InvActionResult::Failed;
-        }
+            ItemId = 0,
+            MemberName,
+            Units,
+            COLUMN_COUNT
+        };
 
-        std::cout << "\n";
+        static const char* const names[COLUMN_COUNT] = { "item_id", "member", "units" };
 
-        int count = 0;
-        for (int i = 0; i < inv.count; ++i)
+        std::ifstream in(path, ios::binary);
+        if (!in)
+            return false;
+
+        Csv::Reader r;
+        Csv::InitReader(r, in, Csv::DelimiterFor(path));
+
+        Csv::Field fields[Csv::MAX_FIELDS];
+        int col[COLUMN_COUNT];
+
+        size_t n = Csv::NextRecord(r, fields);
+        if (n == 0 || !map_columns(fields, n, names, col, COLUMN_COUNT, COLUMN_COUNT))
+            return false;
+
+        size_t needed = 0;
+        for (int c : col)
+            needed = std::max<size_t>(needed, c + 1);
+
+        while ((n = Csv::NextRecord(r, fields)) != 0)
         {
-            auto& item = inv.items[i];
-            if (item.active && item.meta.name == str)
+            uint64_t id, units;
+
+            if (n < needed)
+            {
+                reject(stats, r.line, "missing fields");
+                continue;
+            }
+
+            if (!Csv::ToUint(fields[col[ItemId]], std::numeric_limits<item_id_t>::max(), id)
+                || !Csv::ToUint(fields[col[Units]], std::numeric_limits<item_count_t>::max(), units))
+            {
+                reject(stats, r.line, "invalid number");
+                continue;
+            }
+
+            auto& member = fields[col[MemberName]];
+            if (member.len == 0)
+            {
+                reject(stats, r.line, "empty member name");
+                continue;
+            }
+
+            auto item = Core::ForUpdate(inv, Core::FindItemById(inv, id));
+            if (item == nullptr)
+            {
+                reject(stats, r.line, "no item with this id");
+                continue;
+            }
+
+            if (units > item->item_count)
             {
-                ++count;
-                DisplayItem::Full(inv.items[i]);
+                reject(stats, r.line, "not enough units available");
+                continue;
             }
+
+            if (units > 0)
+                Core::Assign(inv, item, member.ptr, units);
+
+            ++stats.imported;
         }
 
-        if (count == 0)
+        return true;
+    }
+
+    static bool ExportItems(const Inventory& inv, const char* path, uint64_t& rows)
+    {
+        std::ofstream out(path, ios::binary | ios::trunc);
+        if (!out)
+            return false;
+
+        Csv::Writer w;
+        Csv::InitWriter(w, out, Csv::DelimiterFor(path));
+
+        for (auto name : { "id", "name", "category", "units", "assigned", "reorder_level" })
+            Csv::WriteField(w, name, strlen(name));
+        Csv::EndRecord(w);
+
+        auto active = inv.columns.active.data();
+        for (size_t i = Scan::NextActive(active, 0, inv.count); i < inv.count;
+             i = Scan::NextActive(active, i + 1, inv.count))
         {
-            std::cout << "*No items found*\n";
-            return InvActionResult::Failed;
+            auto& item = inv.items[i];
+
+            Csv::WriteField(w, (uint64_t) item.item_id);
+            Csv::WriteField(w, item.meta.name.data(), item.meta.name.size());
+            Csv::WriteField(w, item.meta.cat.data(), item.meta.cat.size());
+            Csv::WriteField(w, (uint64_t) item.item_count + item.assigned_count);
+            Csv::WriteField(w, (uint64_t) item.assigned_count);
+            Csv::WriteField(w, (uint64_t) item.reorder_level);
+            Csv::EndRecord(w);
+
+            ++rows;
         }
 
-        return InvActionResult::Ok;
+        Csv::Flush(w);
+        return (bool) out;
     }
 
-// clang-format off
-#define SELECT_ITEM(inv, item) \
-    { \
-        InvActionResult res; \
-        if ((res = ViewItems(inv)) != InvActionResult::Ok) \
-            return res; \
-        std::cout << "\n"; \
-    } \
-    std::cout << IDN << "Enter Item Id: "; \
-    auto item = Input::identitfied_item(inv); \
-    if (item == nullptr) \
-        return InvActionResult::Failed;
-    // clang-format on
-
-    InvActionResult EditItem(Inventory& inv)
+    static bool ExportAssignments(const Inventory& inv, const char* path, uint64_t& rows)
     {
-        SELECT_ITEM(inv, item);
+        std::ofstream out(path, ios::binary | ios::trunc);
+        if (!out)
+            return false;
 
-        std::cout << IDN << "Enter Item's new name (press enter to keep original): ";
-        static std::string name;
-        if (!Input::string(name, true))
-            return InvActionResult::Failed;
+        Csv::Writer w;
+        Csv::InitWriter(w, out, Csv::DelimiterFor(path));
 
-        std::cout << IDN << "Enter Item's new category (press enter to keep original): ";
-        static std::string cat;
-        if (!Input::string(cat, true))
-            return InvActionResult::Failed;
+        for (auto name : { "item_id", "member", "units" })
+            Csv::WriteField(w, name, strlen(name));
+        Csv::EndRecord(w);
 
-        std::cout << IDN << "Enter Item's available unit count (press enter to keep original): ";
-        auto ic = Input::integer(true);
-        if (ic == -1)
+        auto active = inv.columns.active.data();
+        for (size_t i = Scan::NextActive(active, 0, inv.count); i < inv.count;
+             i = Scan::NextActive(active, i + 1, inv.count))
         {
-            std::cerr << "\n[ERROR] * Invalid input *" << '\n';
-            return InvActionResult::Failed;
-        }
+            auto& item = inv.items[i];
 
-        std::cout << "\n";
+            auto& names = inv.member_names.names;
 
-        if (ic != -2)
-            item->item_count = ic;
+            auto row = [&](member_id_t member, uint32_t units) {
+                Csv::WriteField(w, (uint64_t) item.item_id);
+                Csv::WriteField(w, names[member]);
+                Csv::WriteField(w, (uint64_t) units);
+                Csv::EndRecord(w);
 
-        if (!(stringstream(name) >> std::ws).eof())
-            item->meta.name = name;
+                ++rows;
+            };
 
-        if (!(stringstream(cat) >> std::ws).eof())
-            item->meta.cat = cat;
+            /* Lists still in the data file are read from it without being kept */
+            auto stored = stored_members_of(item);
+            if (stored != MemberSources::NONE)
+                Serialization::ForEachStoredMember(*inv.member_source, stored, names.size(), row);
 
-        std::cout << "Item saved successfully\n";
+            auto& list = members_of(item);
+            for (uint32_t m = 0; m < list.size; ++m)
+                row(list[m].member, list[m].units);
+        }
 
-        return InvActionResult::Ok;
+        Csv::Flush(w);
+        return (bool) out;
     }
+} // namespace Exchange
 
-    InvActionResult DeleteItem(Inventory& inv)
-    {
-        SELECT_ITEM(inv, item);
-
-        std::cout << "\n";
+namespace Server
+{
+    static constexpr int EVENTS_PER_WAIT = 256;
 
-        Core::Delete(item);
+    /* id, name, category, available, assigned, reorder: what FIND and LIST report for an item */
+    static void write_item(std::vector<char>& out, const char* tag, const InventoryItem& item)
+    {
+        Protocol::Append(out, tag);
+        Protocol::AppendField(out, (uint64_t) item.item_id);
+        Protocol::AppendField(out, item.meta.name.data(), item.meta.name.size());
+        Protocol::AppendField(out, item.meta.cat.data(), item.meta.cat.size());
+        Protocol::AppendField(out, (uint64_t) item.item_count);
+        Protocol::AppendField(out, (uint64_t) item.assigned_count);
+        Protocol::AppendField(out, (uint64_t) item.reorder_level);
+        out.push_back('\n');
+    }
 
-        std::cout << "Item \"" << item->meta.name << "\" with id " << item->item_id << " deleted successfully\n";
-        return InvActionResult::Ok;
+    static void write_available(std::vector<char>& out, const InventoryItem& item)
+    {
+        Protocol::Append(out, "OK");
+        Protocol::AppendField(out, (uint64_t) item.item_count);
+        out.push_back('\n');
     }
 
-    InvActionResult AssignItem(Inventory& inv)
+    /* Runs one request line through Core and appends its response to out */
+    static void Handle(Inventory& inv, char* line, size_t len, std::vector<char>& out)
     {
-        SELECT_ITEM(inv, item);
+        using Protocol::IsCommand;
+        using Protocol::ToUint;
 
-        if (item->item_count > 0)
+        Protocol::Field f[Protocol::MAX_FIELDS];
+        auto n = Protocol::Split(line, len, f);
+
+        uint64_t id;
+        const auto id_max = std::numeric_limits<item_id_t>::max();
+        const auto count_max = std::numeric_limits<item_count_t>::max();
+
+        if (IsCommand(f[0], "PING"))
         {
-            std::cout << "\n<*> Assigning item \"" << item->meta.name << "\"\n";
+            Protocol::Append(out, "OK\n");
         }
-        else
+        else if (IsCommand(f[0], "FIND"))
         {
-            std::cerr << "\n[ERROR] * No units available for this item *" << '\n';
-            return InvActionResult::Failed;
-        }
-
-        static std::string name;
-        std::cout << IDN << "Enter assignee's name: ";
-        if (!Input::string(name))
-            return InvActionResult::Failed;
+            if (n != 2 || !ToUint(f[1], id_max, id))
+                return Protocol::Error(out, "usage: FIND id");
 
-        std::cout << "\n";
+            auto item = Core::FindItemById(inv, id);
+            if (item == nullptr)
+                return Protocol::Error(out, "no item with this id");
 
-        Core::Assign(item, name.c_str());
+            write_item(out, "OK", *item);
+        }
+        else if (IsCommand(f[0], "ADD"))
+        {
+            uint64_t units, reorder = 0;
 
-        std::cout << "Item \"" << item->meta.name << "\" assigned to \"" << name << "\" successfully\n";
+            if ((n != 5 && n != 6) || !ToUint(f[1], id_max, id) || !ToUint(f[4], count_max, units)
+                || (n == 6 && !ToUint(f[5], count_max, reorder)))
+                return Protocol::Error(out, "usage: ADD id name category units [reorder]");
 
-        return InvActionResult::Ok;
-    }
+            if (Core::FindItemById(inv, id) != nullptr)
+                return Protocol::Error(out, "an item with this id already exists");
 
-    InvActionResult RetrieveItem(Inventory& inv)
-    {
-        SELECT_ITEM(inv, item);
+            ItemMeta meta;
+            meta.name = Strings::Store(inv.strings, f[2].ptr, f[2].len);
+            meta.cat = Strings::Store(inv.strings, f[3].ptr, f[3].len);
 
-        if (item->assigned_count == 0)
-        {
-            std::cout << "\n* No units currently assigned to any member *" << '\n';
-            return InvActionResult::Ok;
+            Core::Add(inv, id, units, meta, reorder);
+            Protocol::Append(out, "OK\n");
         }
+        else if (IsCommand(f[0], "ASSIGN") || IsCommand(f[0], "RETRIEVE"))
+        {
+            bool assign = IsCommand(f[0], "ASSIGN");
+            uint64_t units = 1;
 
-        auto mem_count = DisplayItem::Full(*item);
+            if ((n != 3 && n != 4) || !ToUint(f[1], id_max, id) || f[2].len == 0
+                || (n == 4 && (!ToUint(f[3], count_max, units) || units == 0)))
+            {
+                return Protocol::Error(out, assign ? "usage: ASSIGN id member [units]"
+                                                   : "usage: RETRIEVE id member [units]");
+            }
 
-        std::cout << IDN << "Select an entry: ";
-        auto location = Input::integer();
+            auto item = Core::ForUpdate(inv, Core::FindItemById(inv, id));
+            if (item == nullptr)
+                return Protocol::Error(out, "no item with this id");
+
+            if (assign)
+            {
+                if (!Core::Assign(inv, item, f[2].ptr, units))
+                    return Protocol::Error(out, "not enough units available for this item");
+            }
+            else
+            {
+                auto index = Core::FindMember(inv, item, f[2].ptr, f[2].len);
+                if (index == MEMBER_NONE)
+                    return Protocol::Error(out, "nothing assigned to this member");
+
+                if (!Core::Retrieve(inv, item, index, units))
+                    return Protocol::Error(out, "the member holds fewer units");
+            }
 
-        if (location < 1 || location > mem_count)
+            write_available(out, *item);
+        }
+        else if (IsCommand(f[0], "DELTA"))
         {
-            std::cerr << "\n [ERROR] * Invalid choice *" << '\n';
-            return InvActionResult::Failed;
+            if (n != 3 || f[1].len == 0 || f[2].len == 0)
+                return Protocol::Error(out, "usage: DELTA baseline_file delta_file");
+
+            size_t changed;
+            uint64_t bytes;
+            std::string error;
+            if (!Lifecycle::WriteDelta(inv, f[1].ptr, f[2].ptr, changed, bytes, error))
+                return Protocol::Error(out, error.c_str());
+
+            Protocol::Append(out, "OK");
+            Protocol::AppendField(out, (uint64_t) changed);
+            Protocol::AppendField(out, bytes);
+            out.push_back('\n');
         }
-        --location;
-
-        std::cout << "\n";
+        else if (IsCommand(f[0], "LIST"))
+        {
+            uint64_t listed = 0;
 
-        auto entry = item->allocated_to;
-        for (int i = 0; i < location; ++i)
-            entry = entry->next;
+            auto active = inv.columns.active.data();
+            for (size_t i = Scan::NextActive(active, 0, inv.count); i < inv.count;
+                 i = Scan::NextActive(active, i + 1, inv.count))
+            {
+                write_item(out, "ITEM", inv.items[i]);
+                ++listed;
+            }
 
-        /* TODO: check for unreachable case of entry->borrow_count == 0 */
-        Core::Retrieve(item, entry);
+            Protocol::Append(out, "OK");
+            Protocol::AppendField(out, listed);
+            out.push_back('\n');
+        }
+        else
+        {
+            Protocol::Error(out, "unknown command");
+        }
+    }
 
-        std::cout << "Item \"" << item->meta.name << "\" retrieved successfully\n";
+    /* Handles the complete lines a client has sent, unless it is not reading its responses */
+    static void serve(Inventory& inv, Net::Connection& c)
+    {
+        char* line;
+        size_t len;
 
-        return InvActionResult::Ok;
+        while (!c.failed && Net::Pending(c) < Net::MAX_PENDING_OUTPUT && Net::NextLine(c, line, len))
+            if (!Parse::IsBlank(line, len))
+                Handle(inv, line, len, c.out);
     }
 
-    InvActionResult ItemDetails(Inventory& inv)
+    /* Read while there is room for responses, write while there are some. 0 once the client is done */
+    static uint32_t interest(const Net::Connection& c)
     {
-        SELECT_ITEM(inv, item);
+        uint32_t events = 0;
 
-        std::cout << "\n";
+        if (Net::Pending(c) > 0)
+            events |= EPOLLOUT;
 
-        DisplayItem::Full(*item);
+        if (!c.eof && Net::Pending(c) < Net::MAX_PENDING_OUTPUT)
+            events |= EPOLLIN;
 
-        return InvActionResult::Ok;
+        return c.failed ? 0 : events;
     }
-}; // namespace Frontend
 
-namespace Core
-{
-
-    InventoryItem* FindItemById(const Inventory& inv, item_id_t id, bool active_only)
+    static void accept_clients(int ep, int listener, std::vector<std::unique_ptr<Net::Connection>>& clients)
     {
-        for (int i = 0; i < inv.count; ++i)
+        int fd;
+        while ((fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
         {
-            auto& item = inv.items[i];
-            if (item.item_id == id && (!active_only || item.active))
-                return &item;
+            if ((size_t) fd >= clients.size())
+                clients.resize(fd + 1);
+
+            clients[fd].reset(new Net::Connection);
+            clients[fd]->fd = fd;
+            clients[fd]->events = EPOLLIN;
+
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            ::epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
         }
+    }
 
-        return nullptr;
+    static void close_client(int ep, std::unique_ptr<Net::Connection>& c)
+    {
+        ::epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, nullptr);
+        ::close(c->fd);
+        c.reset();
     }
 
-    Member* FindMemberByName(Member* head, const char* name)
+    /*
+     * Serves the inventory on a Unix socket until SIGINT or SIGTERM. One thread owns the inventory and runs
+     * every request through Core, so clients never see each other's changes half done.
+     *
+     * Each pass of the loop handles whatever all ready clients sent, makes the resulting changes durable
+     * with a single journal record, and only then writes the responses back, one write per client.
+     */
+    static int Run(Serialization::DataFile f, Journal::Writer& journal, Inventory& inv, const char* path)
     {
-        while (head != nullptr)
+        int listener = Net::Listen(path);
+        if (listener < 0)
         {
-            if (head->name == name)
-                return head;
-
-            head = head->next;
+            std::cerr << "[ERROR] Unable to listen on " << path << ": " << strerror(errno) << endl;
+            return 1;
         }
 
-        return nullptr;
-    }
+        /* Stop requests arrive as events, so a shutdown never lands in the middle of a request */
+        sigset_t stop_signals, old_mask;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        sigprocmask(SIG_BLOCK, &stop_signals, &old_mask);
 
-    static void Add(Inventory& inv, item_id_t id, item_count_t icount, const ItemMeta& meta)
-    {
-        if (inv.count == inv.capacity)
-            inventory_allocate_capacity(inv, grow(inv.capacity));
+        int sigfd = ::signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        int ep = ::epoll_create1(EPOLL_CLOEXEC);
 
-        InventoryItem& slot = inv.items[inv.count++];
+        for (int fd : { listener, sigfd })
+        {
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            ::epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+        }
 
-        slot.item_id = id;
+        std::cout << "Serving on " << path << " (Ctrl+C to stop)" << endl;
 
-        slot.meta = meta;
+        std::vector<std::unique_ptr<Net::Connection>> clients; // by fd
+        std::vector<int> touched;
+        epoll_event events[EVENTS_PER_WAIT];
 
-        slot.item_count = icount;
-        slot.allocated_to = nullptr;
-    }
+        bool stop = false;
+        while (!stop)
+        {
+            int n = ::epoll_wait(ep, events, EVENTS_PER_WAIT, -1);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
 
-    static inline void Delete(InventoryItem* item)
-    {
-        item->active = false;
-    }
+                std::cerr << "[ERROR] epoll_wait: " << strerror(errno) << endl;
+                break;
+            }
 
-    static void Assign(InventoryItem* item, const char* name)
-    {
-        auto entry = FindMemberByName(item->allocated_to, name);
+            touched.clear();
 
-        if (entry == nullptr)
-        {
-            entry = CreateMember(name);
+            for (int i = 0; i < n; ++i)
+            {
+                int fd = events[i].data.fd;
 
-            auto tail = item->allocated_to;
+                if (fd == sigfd)
+                {
+                    /* Consumed, or it would still be pending when the mask is restored */
+                    signalfd_siginfo info;
+                    stop = ::read(sigfd, &info, sizeof(info)) == sizeof(info);
+                    continue;
+                }
 
-            if (tail != nullptr)
-                tail->prev = entry;
+                if (fd == listener)
+                {
+                    accept_clients(ep, listener, clients);
+                    continue;
+                }
 
-            item->allocated_to = entry;
+                auto& c = *clients[fd];
 
-            entry->next = tail;
-            entry->prev = nullptr;
-        }
+                /* Only responses from earlier passes are pending here, and those are already durable */
+                if (events[i].events & EPOLLOUT)
+                    Net::Flush(c);
 
-        ++entry->borrow_count;
-        ++item->assigned_count;
-        --item->item_count;
-    }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    Net::Receive(c);
 
-    static inline void Assign(Inventory& inv, item_id_t id, const char* name)
-    {
-        auto item = FindItemById(inv, id);
-        if (item != nullptr)
-            Assign(item, name);
-    }
+                serve(inv, c);
+                touched.push_back(fd);
+            }
 
-    static void Retrieve(InventoryItem* item, Member* entry)
-    {
-        if (--entry->borrow_count == 0)
-        {
-            auto first = entry->prev;
-            auto second = entry->next;
+            Lifecycle::Persist(f, journal, inv);
 
-            Member** head = first == nullptr ? &item->allocated_to : &first->next;
+            for (int fd : touched)
+            {
+                auto& c = *clients[fd];
+                Net::Flush(c);
+
+                auto want = interest(c);
+                if (want == 0)
+                {
+                    close_client(ep, clients[fd]);
+                    continue;
+                }
+
+                if (want != c.events)
+                {
+                    epoll_event ev = {};
+                    ev.events = want;
+                    ev.data.fd = fd;
+                    ::epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+                    c.events = want;
+                }
+            }
+        }
 
-            *head = second;
+        for (auto& c : clients)
+            if (c != nullptr)
+                close_client(ep, c);
 
-            if (second != nullptr)
-                second->prev = first;
+        ::close(ep);
+        ::close(sigfd);
+        ::close(listener);
+        ::unlink(path);
 
-            DeleteMember(entry);
-        }
+        sigprocmask(SIG_SETMASK, &old_mask, nullptr);
 
-        ++item->item_count;
-        --item->assigned_count;
+        std::cout << "Server stopped" << endl;
+        return 0;
     }
-} // namespace Core
+} // namespace Server
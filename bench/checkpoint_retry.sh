@@ -0,0 +1,144 @@
+#!/usr/bin/env bash
+#
+# Regression check for a data file rewrite that fails (the temporary file cannot be created):
+#
+#     bench/checkpoint_retry.sh [work dir]
+#
+# 1. A purge forces a rewrite that fails, then an assign follows and the process is killed. The restart
+#    must come back to the state before the purge, without applying the assign to the wrong item and
+#    without a journal mismatch.
+# 2. The same, but the temporary file is unblocked before the assign: that commit retries the rewrite,
+#    so the purge and the assign both survive the kill.
+# 3. An assign whose size-triggered rewrite fails at quit is journaled instead, and survives.
+#
+# The work dir defaults to a fresh temporary one; CXX and CXXFLAGS pick the compiler and flags.
+
+set -eu
+
+repo="$(cd "$(dirname "$0")/.." && pwd)"
+work="${1:-$(mktemp -d)}"
+
+CXX="${CXX:-g++}"
+CXXFLAGS="${CXXFLAGS:--std=c++11 -O2}"
+
+mkdir -p "$work"
+cd "$work"
+rm -rf run
+mkdir run
+
+echo "building into $work"
+# shellcheck disable=SC2086
+"$CXX" $CXXFLAGS -pthread "$repo/app.cpp" -o app
+
+cd run
+
+temp=inventory_data.rvms.bin.tmp
+
+fail()
+{
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# A directory where the temporary file goes makes every rewrite of the data file fail
+block()
+{
+    mkdir "$temp"
+}
+
+unblock()
+{
+    rmdir "$temp"
+}
+
+# Feeds menu input (one answer per line) and quits
+session()
+{
+    printf '%s\n' "$@" 0 | ../app > session.out 2>&1
+}
+
+# Starts a session on a pipe kept open by fd 3, so it can be fed in steps and killed before it quits
+start()
+{
+    rm -f input
+    mkfifo input
+    ../app < input > session.out 2>&1 &
+    pid=$!
+    exec 3> input
+}
+
+feed()
+{
+    printf '%s\n' "$@" >&3
+    sleep 0.5
+}
+
+crash()
+{
+    kill -9 "$pid"
+    wait "$pid" 2> /dev/null || true
+    exec 3>&-
+}
+
+# Item 1 deleted but not purged, so a purge moves items 2 and 3 down one slot
+fresh()
+{
+    rm -rf inventory_data.rvms.*
+    session \
+        1 1 A C 5 "" \
+        1 2 B C 5 "" \
+        1 3 D C 5 "" \
+        5 1
+}
+
+# Details of an item after a restart; fails on a journal that no longer matches the data file
+details()
+{
+    printf '%s\n' 8 "$1" 0 | ../app 2>&1 | tee details.out | grep -q "does not match" && fail "$label: journal mismatch"
+    cat details.out
+}
+
+expect_assignee()
+{
+    details "$1" | grep -q "bob" || fail "$label: item $1 lost its assignee"
+}
+
+expect_none()
+{
+    ! details "$1" | grep -q "bob" || fail "$label: item $1 has an assignee it was never given"
+}
+
+label="failed rewrite after a purge"
+fresh
+block
+start
+feed 15
+feed 6 3 bob 1 ""
+crash
+unblock
+expect_none 2
+expect_none 3
+echo "ok: $label"
+
+label="rewrite retried after a purge"
+fresh
+block
+start
+feed 15
+unblock
+feed 6 3 bob 1 ""
+crash
+expect_none 2
+expect_assignee 3
+echo "ok: $label"
+
+label="failed rewrite at quit"
+fresh
+block
+session 6 3 bob 1 ""
+unblock
+expect_none 2
+expect_assignee 3
+echo "ok: $label"
+
+echo "all checks passed"
@@ -0,0 +1,134 @@
+#!/usr/bin/env bash
+#
+# End-to-end check of --delta/--apply with a primary and a standby in two directories of their own:
+#
+#     bench/delta_twodir.sh [work dir]
+#
+# Builds the app, fills primary/ through the menu, ships an initial delta (empty baseline) and then an
+# incremental one to standby/, and after each compares what both sides list and show for every item.
+# Finally checks that a delta already applied, taken against an older state, or applied to a standby that
+# was changed on its own, is refused. The work dir defaults to a fresh temporary one; CXX and CXXFLAGS pick
+# the compiler and flags.
+
+set -eu
+
+repo="$(cd "$(dirname "$0")/.." && pwd)"
+work="${1:-$(mktemp -d)}"
+
+CXX="${CXX:-g++}"
+CXXFLAGS="${CXXFLAGS:--std=c++11 -O2}"
+
+mkdir -p "$work"
+cd "$work"
+rm -rf primary standby baseline.bin ./*.delta ./*.out
+mkdir primary standby
+
+echo "building into $work"
+# shellcheck disable=SC2086
+"$CXX" $CXXFLAGS -pthread "$repo/app.cpp" -o app
+
+fail()
+{
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# Feeds menu input (one answer per line, quitting at the end) to the app in a directory
+session()
+{
+    (cd "$1" && printf '%s\n' "${@:2}" 0 | ../app > /dev/null)
+}
+
+# What one side shows: the item list, then the details (assignees and due dates included) of every id given
+view()
+{
+    local dir="$1"
+    shift
+
+    local input=(2)
+    for id in "$@"; do
+        input+=(8 "$id")
+    done
+
+    (cd "$dir" && printf '%s\n' "${input[@]}" 0 | ../app 2>&1)
+}
+
+compare()
+{
+    view primary "$@" > primary.out
+    view standby "$@" > standby.out
+
+    diff -u primary.out standby.out || fail "standby differs from primary after $label"
+    echo "ok: $label"
+}
+
+ship()
+{
+    (cd primary && ../app --delta ../baseline.bin "../$1") || fail "--delta $1"
+    (cd standby && ../app --apply "../$1") || fail "--apply $1"
+}
+
+ids=(1 2 3 4 5 6)
+
+#
+# Initial delta: the baseline does not exist yet, so it carries the whole inventory
+#
+
+#       add:    id name     category units reorder
+session primary \
+        1 1 Hammer   Tools    10    2 \
+        1 2 Wrench   Tools    4     "" \
+        1 3 Tape     Supplies 25    5 \
+        1 4 Gloves   Supplies 8     "" \
+        1 6 Ladder   Tools    2     "" \
+        6 1 alice    3 "" \
+        6 3 bob      5 2030-01-15 \
+        6 3 alice    1 ""
+
+label="initial delta"
+ship initial.delta
+compare "${ids[@]}"
+
+#
+# Incremental delta: edits, a retrieve, a delete, a due date and a new item. Ladder (6) is left alone
+# and should not be shipped again
+#
+
+#       edit:   id new name  category units reorder
+session primary \
+        4 2 "Torque Wrench" "" 6 3 \
+        7 3 1 2 \
+        5 4 \
+        6 1 carol 2 +14 \
+        1 5 Drill    Tools    3     1
+
+label="incremental delta"
+ship incremental.delta
+compare "${ids[@]}"
+
+#
+# Replays are refused and leave the standby as it is
+#
+
+label="reapplying the incremental delta"
+if (cd standby && ../app --apply ../incremental.delta > /dev/null 2>&1); then
+    fail "$label was accepted"
+fi
+compare "${ids[@]}"
+
+label="applying the initial delta over a newer state"
+if (cd standby && ../app --apply ../initial.delta > /dev/null 2>&1); then
+    fail "$label was accepted"
+fi
+compare "${ids[@]}"
+
+label="a delta over a standby changed elsewhere"
+session standby 4 6 "" "" 9 ""
+session primary 4 1 "" "" 7 ""
+(cd primary && ../app --delta ../baseline.bin ../diverged.delta > /dev/null) || fail "--delta diverged.delta"
+if (cd standby && ../app --apply ../diverged.delta > /dev/null 2>&1); then
+    fail "$label was accepted"
+fi
+echo "ok: $label"
+
+echo "all checks passed"
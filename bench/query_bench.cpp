@@ -0,0 +1,204 @@
+/*
+ * Scaling benchmark for the query engine in query.h: runs a few queries over a generated inventory on work
+ * pools of 1, 2, 4, ... threads and reports the time of each against one thread, after checking every
+ * result against a plain loop.
+ *
+ *     g++ -std=c++11 -O2 -pthread bench/query_bench.cpp -o query_bench.xout
+ *     ./query_bench.xout [item_count] [max_threads]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../repr.h"
+#include "../query.h"
+
+using namespace std;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int CATEGORIES = 64;
+
+    void build(Inventory& inv, size_t n)
+    {
+        std::mt19937 rng(42);
+        inventory_allocate_capacity(inv, n);
+
+        for (int c = 0; c < CATEGORIES; ++c)
+            Categories::Intern(inv.categories, "C" + std::to_string(c));
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto& item = inventory_emplace(inv);
+            item.item_id = (item_id_t) i;
+            item.item_count = rng() % 200;
+            item.assigned_count = rng() % 20;
+            item.active = (rng() % 10) != 0;
+
+            auto name = "Item " + std::to_string(i);
+            auto cat = (cat_id_t) (rng() % CATEGORIES);
+            item.meta.name = Strings::Store(inv.strings, name.data(), name.size());
+            item.meta.cat = Strings::Store(inv.strings, inv.categories.entries[cat].name);
+
+            if (item.active)
+                Categories::Link(inv.categories, (uint32_t) i, cat, item.item_count, item.assigned_count);
+        }
+    }
+
+    /* The first query, the way it would be written without the engine */
+    void reference(const Inventory& inv, QueryResult& out)
+    {
+        std::vector<uint64_t> sums(CATEGORIES), counts(CATEGORIES);
+
+        for (uint32_t i = 0; i < inv.count; ++i)
+        {
+            auto& item = inv.items[i];
+            if (!item.active || item.item_count >= 10)
+                continue;
+
+            auto cat = Categories::CategoryOf(inv.categories, i);
+            sums[cat] += item.assigned_count;
+            ++counts[cat];
+        }
+
+        out.groups.clear();
+        for (int c = 0; c < CATEGORIES; ++c)
+        {
+            if (counts[c] != 0)
+                out.groups.push_back({ (cat_id_t) c, counts[c], { sums[c], counts[c] } });
+        }
+    }
+
+    bool same(const QueryResult& a, const QueryResult& b)
+    {
+        if (a.slots != b.slots || a.groups.size() != b.groups.size())
+            return false;
+
+        for (size_t g = 0; g < a.groups.size(); ++g)
+        {
+            auto& x = a.groups[g];
+            auto& y = b.groups[g];
+            if (x.cat != y.cat || x.rows != y.rows || x.values != y.values)
+                return false;
+        }
+
+        return true;
+    }
+
+    template<typename F>
+    double best_ms(int reps, F&& fn)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (int r = 0; r < reps; ++r)
+        {
+            auto start = Clock::now();
+            fn();
+            best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+
+        return best;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4000000;
+    unsigned max_threads = argc > 2 ? strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+    if (n > std::numeric_limits<item_id_t>::max())
+        n = std::numeric_limits<item_id_t>::max();
+    if (max_threads == 0)
+        max_threads = 1;
+
+    Inventory inv;
+    build(inv, n);
+
+    const char* texts[] = {
+        "select sum(assigned), count where units < 10 group by cat",
+        "select count, max(total), min(units) where cat = C7 and assigned > 5",
+        "select id where name ~ 4242",
+    };
+
+    std::vector<Query> queries(3);
+    for (int i = 0; i < 3; ++i)
+    {
+        std::string error;
+        if (!Queries::Parse(inv.categories, texts[i], strlen(texts[i]), queries[i], error))
+        {
+            std::cerr << "[ERROR] * " << texts[i] << ": " << error << " *\n";
+            return 1;
+        }
+    }
+
+    std::cout << "items: " << n << ", cores: " << std::thread::hardware_concurrency()
+              << ", morsel: " << Queries::MORSEL_PAGES * ITEMS_PER_PAGE << " items\n";
+
+    /* Single-threaded results to check every run against; the first also against the plain loop */
+    std::vector<QueryResult> expected(3);
+    {
+        WorkPool one;
+        Pool::Start(one, 1);
+        for (int i = 0; i < 3; ++i)
+            Queries::Run(inv, queries[i], one, expected[i]);
+    }
+
+    QueryResult loop;
+    double loop_ms = best_ms(5, [&] { reference(inv, loop); });
+    if (!same(loop, expected[0]))
+    {
+        std::cerr << "[ERROR] * query results disagree with the reference loop *\n";
+        return 1;
+    }
+
+    std::vector<unsigned> sizes;
+    for (unsigned t = 1; t < max_threads; t *= 2)
+        sizes.push_back(t);
+    sizes.push_back(max_threads);
+
+    std::cout << "\nplain loop (query 1): " << std::fixed << std::setprecision(2) << loop_ms << " ms\n";
+
+    for (int i = 0; i < 3; ++i)
+    {
+        std::cout << "\nquery " << i + 1 << ": " << texts[i] << "\n";
+
+        double base = 0;
+        for (auto threads : sizes)
+        {
+            WorkPool pool;
+            Pool::Start(pool, threads);
+
+            QueryResult result;
+            double ms = best_ms(5, [&] { Queries::Run(inv, queries[i], pool, result); });
+
+            if (!same(result, expected[i]))
+            {
+                std::cerr << "[ERROR] * " << threads << " threads disagree with one *\n";
+                return 1;
+            }
+
+            if (threads == 1)
+                base = ms;
+
+            // clang-format off
+            std::cout
+                << std::setw(4) << std::right << threads << " thread(s)"
+                << std::setw(12) << std::right << std::setprecision(2) << ms << " ms"
+                << std::setw(10) << std::right << std::setprecision(1) << (n / ms / 1000) << " M items/s"
+                << std::setw(9) << std::right << std::setprecision(2) << (base / ms) << "x"
+                << "\n";
+            // clang-format on
+        }
+    }
+
+    inventory_free(inv);
+    return 0;
+}
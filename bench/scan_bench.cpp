@@ -0,0 +1,164 @@
+/*
+ * Microbenchmark for the scan kernels in scan.h against the plain loop over inv.items that
+ * Core::FindItemById and the ViewItems/SearchItem filters used before the columns existed.
+ *
+ *     g++ -std=c++11 -O2 bench/scan_bench.cpp -o scan_bench.xout && ./scan_bench.xout [item_count]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "../repr.h"
+#include "../scan.h"
+
+using namespace std;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    volatile size_t g_sink;
+
+    template<typename F>
+    double time_ns_per_call(int reps, F&& fn)
+    {
+        auto start = Clock::now();
+        for (int r = 0; r < reps; ++r)
+            g_sink = fn(r);
+        auto end = Clock::now();
+
+        return std::chrono::duration<double, std::nano>(end - start).count() / reps;
+    }
+
+    void report(const char* what, const char* impl, double ns, double baseline_ns, size_t n)
+    {
+        // clang-format off
+        std::cout
+            << std::setw(16) << std::left << what
+            << std::setw(10) << std::left << impl
+            << std::setw(14) << std::right << std::fixed << std::setprecision(1) << ns << " ns"
+            << std::setw(10) << std::right << std::setprecision(2) << (ns / n) << " ns/item"
+            << std::setw(9) << std::right << std::setprecision(1) << (baseline_ns / ns) << "x"
+            << "\n";
+        // clang-format on
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 60000;
+    if (n > std::numeric_limits<item_id_t>::max())
+        n = std::numeric_limits<item_id_t>::max();
+
+    std::mt19937 rng(42);
+
+    /* AoS inventory as Core kept it, plus the columns the kernels read */
+    std::vector<InventoryItem> items(n);
+    ScanColumns<item_count_t> cols;
+    std::vector<item_id_t> ids;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto& item = items[i];
+        item.item_id = (item_id_t) i;
+        item.item_count = rng() % 200;
+        item.active = (rng() % 10) != 0;
+
+        ids.push_back(item.item_id);
+        cols.counts.push_back(item.item_count);
+        cols.active.push_back(item.active);
+    }
+
+    const int reps = 2000;
+    const item_count_t threshold = 10;
+
+    /* Keys spread over the whole range so the average search walks half the array */
+    std::vector<item_id_t> keys(reps);
+    for (auto& k : keys)
+        k = (item_id_t) (rng() % n);
+
+    std::vector<uint32_t> out(n);
+
+    auto loop_find = [&](int r) -> size_t {
+        for (size_t i = 0; i < n; ++i)
+            if (items[i].item_id == keys[r] && items[i].active)
+                return i;
+        return n;
+    };
+
+    auto loop_below = [&](int) -> size_t {
+        size_t k = 0;
+        for (size_t i = 0; i < n; ++i)
+            if (items[i].active && items[i].item_count < threshold)
+                out[k++] = i;
+        return k;
+    };
+
+    auto loop_active = [&](int) -> size_t {
+        size_t c = 0;
+        for (size_t i = 0; i < n; ++i)
+            c += items[i].active;
+        return c;
+    };
+
+    std::cout << "items: " << n << ", detected isa: " << Scan::IsaName(Scan::DetectIsa()) << "\n\n";
+
+    double base_find = time_ns_per_call(reps, loop_find);
+    double base_below = time_ns_per_call(reps / 10, loop_below);
+    double base_active = time_ns_per_call(reps, loop_active);
+
+    report("find id", "loop", base_find, base_find, n / 2);
+    report("count < 10", "loop", base_below, base_below, n);
+    report("active count", "loop", base_active, base_active, n);
+
+    auto expected_below = loop_below(0);
+    std::vector<uint32_t> expected(out.begin(), out.begin() + expected_below);
+
+    for (auto isa : { Scan::Isa::Scalar, Scan::Isa::SSE2, Scan::Isa::AVX2 })
+    {
+        if ((int) isa > (int) Scan::DetectIsa())
+            continue;
+
+        auto k = Scan::KernelsFor(isa);
+        auto name = Scan::IsaName(isa);
+
+        auto find = [&](int r) -> size_t {
+            auto key = keys[r];
+            size_t i = 0;
+            while ((i += Scan::Find(k, ids.data() + i, n - i, key)) < n && !cols.active[i])
+                ++i;
+            return i;
+        };
+
+        auto below = [&](int) -> size_t {
+            return k.select_below_u32(cols.counts.data(), cols.active.data(), n, threshold, out.data());
+        };
+
+        auto active = [&](int) -> size_t { return k.count_active(cols.active.data(), n); };
+
+        /* Cross-check against the loop before timing anything */
+        bool ok = below(0) == expected_below && std::equal(expected.begin(), expected.end(), out.begin())
+                  && active(0) == loop_active(0);
+        for (int r = 0; ok && r < reps; ++r)
+            ok = find(r) == loop_find(r);
+
+        if (!ok)
+        {
+            std::cerr << "[ERROR] * " << name << " kernels disagree with the reference loop *\n";
+            return 1;
+        }
+
+        std::cout << "\n";
+        report("find id", name, time_ns_per_call(reps, find), base_find, n / 2);
+        report("count < 10", name, time_ns_per_call(reps / 10, below), base_below, n);
+        report("active count", name, time_ns_per_call(reps, active), base_active, n);
+    }
+
+    return 0;
+}
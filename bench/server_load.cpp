@@ -0,0 +1,254 @@
+/*
+ * Load generator for the server mode (app --serve). Adds a set of items, then runs a number of clients that
+ * each send FIND/ASSIGN/RETRIEVE requests in pipelined windows and time every response.
+ *
+ *     g++ -std=c++11 -O2 -pthread bench/server_load.cpp -o server_load.xout
+ *     ./server_load.xout [socket] [clients] [requests per client] [pipeline depth] [items]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../server.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /* Blocking line reader over a socket */
+    struct LineReader
+    {
+        int fd;
+        std::vector<char> buf;
+        size_t begin = 0;
+        size_t end = 0;
+
+        explicit LineReader(int fd) : fd(fd), buf(64 << 10) {}
+
+        /* Skips one response line. Returns whether it started with OK; false on a closed socket too */
+        bool next(bool& ok)
+        {
+            while (true)
+            {
+                auto nl = (const char*) memchr(buf.data() + begin, '\n', end - begin);
+                if (nl != nullptr)
+                {
+                    ok = end - begin >= 2 && memcmp(buf.data() + begin, "OK", 2) == 0;
+                    begin = nl - buf.data() + 1;
+                    return true;
+                }
+
+                if (begin > 0)
+                {
+                    memmove(buf.data(), buf.data() + begin, end - begin);
+                    end -= begin;
+                    begin = 0;
+                }
+
+                if (end == buf.size())
+                    buf.resize(buf.size() * 2);
+
+                auto got = ::read(fd, buf.data() + end, buf.size() - end);
+                if (got <= 0)
+                    return false;
+
+                end += got;
+            }
+        }
+    };
+
+    bool send_all(int fd, const std::string& s)
+    {
+        size_t sent = 0;
+        while (sent < s.size())
+        {
+            auto w = ::send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+            if (w <= 0)
+                return false;
+
+            sent += w;
+        }
+
+        return true;
+    }
+
+    struct ClientResult
+    {
+        std::vector<double> latencies_us;
+        uint64_t errors = 0;
+        bool broken = false;
+    };
+
+    void run_client(const char* path, int index, size_t requests, size_t depth, size_t items, ClientResult& res)
+    {
+        int fd = Net::Connect(path);
+        if (fd < 0)
+        {
+            res.broken = true;
+            return;
+        }
+
+        LineReader reader(fd);
+        std::mt19937 rng(index + 1);
+        std::string member = "load client " + std::to_string(index);
+        std::string batch;
+
+        res.latencies_us.reserve(requests);
+
+        for (size_t done = 0; done < requests && !res.broken;)
+        {
+            size_t window = std::min(depth, requests - done);
+
+            batch.clear();
+            for (size_t i = 0; i < window; ++i)
+            {
+                auto id = std::to_string(1 + rng() % items);
+                auto dice = rng() % 100;
+
+                if (dice < 90)
+                    batch += "FIND\t" + id + "\n";
+                else if (dice < 95)
+                    batch += "ASSIGN\t" + id + "\t" + member + "\n";
+                else
+                    batch += "RETRIEVE\t" + id + "\t" + member + "\n";
+            }
+
+            auto sent_at = Clock::now();
+            if (!send_all(fd, batch))
+            {
+                res.broken = true;
+                break;
+            }
+
+            for (size_t i = 0; i < window; ++i)
+            {
+                bool ok;
+                if (!reader.next(ok))
+                {
+                    res.broken = true;
+                    break;
+                }
+
+                res.errors += !ok;
+                res.latencies_us.push_back(
+                    std::chrono::duration<double, std::micro>(Clock::now() - sent_at).count());
+            }
+
+            done += window;
+        }
+
+        ::close(fd);
+    }
+
+    /* Adds items 1..items, pipelined. Items that already exist are fine */
+    bool populate(const char* path, size_t items)
+    {
+        int fd = Net::Connect(path);
+        if (fd < 0)
+            return false;
+
+        LineReader reader(fd);
+        const size_t chunk = 1024;
+
+        for (size_t first = 1; first <= items; first += chunk)
+        {
+            size_t last = std::min(items, first + chunk - 1);
+
+            std::string batch;
+            for (size_t id = first; id <= last; ++id)
+                batch += "ADD\t" + std::to_string(id) + "\tload item " + std::to_string(id) + "\tload\t1000000\n";
+
+            if (!send_all(fd, batch))
+                return false;
+
+            for (size_t id = first; id <= last; ++id)
+            {
+                bool ok;
+                if (!reader.next(ok))
+                    return false;
+            }
+        }
+
+        ::close(fd);
+        return true;
+    }
+
+    double percentile(const std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+
+        return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : Protocol::SOCKET_NAME;
+    size_t clients = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4;
+    size_t requests = argc > 3 ? strtoul(argv[3], nullptr, 10) : 100000;
+    size_t depth = argc > 4 ? strtoul(argv[4], nullptr, 10) : 16;
+    size_t items = argc > 5 ? strtoul(argv[5], nullptr, 10) : 1000;
+
+    if (clients == 0 || depth == 0 || items == 0)
+    {
+        std::cerr << "clients, pipeline depth and items must be positive\n";
+        return 1;
+    }
+
+    if (!populate(path, items))
+    {
+        std::cerr << "Unable to reach a server on " << path << "\n";
+        return 1;
+    }
+
+    std::vector<ClientResult> results(clients);
+    std::vector<std::thread> threads;
+
+    auto start = Clock::now();
+
+    for (size_t i = 0; i < clients; ++i)
+        threads.emplace_back(run_client, path, (int) i, requests, depth, items, std::ref(results[i]));
+
+    for (auto& t : threads)
+        t.join();
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> all;
+    uint64_t errors = 0;
+    size_t broken = 0;
+
+    for (auto& r : results)
+    {
+        all.insert(all.end(), r.latencies_us.begin(), r.latencies_us.end());
+        errors += r.errors;
+        broken += r.broken;
+    }
+
+    std::sort(all.begin(), all.end());
+
+    // clang-format off
+    std::cout
+        << "clients: " << clients << ", pipeline depth: " << depth << ", items: " << items << "\n"
+        << "requests: " << all.size() << " in " << std::fixed << std::setprecision(2) << seconds << " s, "
+        << std::setprecision(0) << all.size() / seconds << " req/s, " << errors << " ERR response(s)\n"
+        << "latency (us): p50 " << std::setprecision(1) << percentile(all, 0.50)
+        << "  p90 " << percentile(all, 0.90)
+        << "  p99 " << percentile(all, 0.99)
+        << "  max " << (all.empty() ? 0 : all.back()) << "\n";
+    // clang-format on
+
+    if (broken > 0)
+        std::cerr << broken << " client(s) lost their connection\n";
+
+    return broken > 0 ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#ifndef __APP_CATINDEX_H_
+#define __APP_CATINDEX_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+typedef uint32_t cat_id_t;
+
+static constexpr cat_id_t CAT_NONE = (cat_id_t) -1;
+
+/* Running totals and members (as slots in inv.items) of a single category */
+struct CategoryEntry
+{
+    std::string name;
+
+    uint64_t item_count = 0;
+    uint64_t assigned_count = 0;
+
+    std::vector<uint32_t> slots;
+};
+
+/* Where an item currently sits inside the index, addressed by its slot in inv.items */
+struct CategoryLink
+{
+    cat_id_t cat = CAT_NONE;
+    uint32_t pos = 0;
+};
+
+struct CategoryIndex
+{
+    std::unordered_map<std::string, cat_id_t> lookup;
+    std::vector<CategoryEntry> entries;
+    std::vector<CategoryLink> links;
+};
+
+namespace Categories
+{
+    inline cat_id_t Find(const CategoryIndex& index, const std::string& name)
+    {
+        auto it = index.lookup.find(name);
+        return it == index.lookup.end() ? CAT_NONE : it->second;
+    }
+
+    inline cat_id_t Intern(CategoryIndex& index, const std::string& name)
+    {
+        auto it = index.lookup.find(name);
+        if (it != index.lookup.end())
+            return it->second;
+
+        cat_id_t id = index.entries.size();
+
+        index.entries.emplace_back();
+        index.entries.back().name = name;
+        index.lookup.emplace(name, id);
+
+        return id;
+    }
+
+    inline cat_id_t Intern(CategoryIndex& index, const char* name, size_t len)
+    {
+        /* Reused, so looking up an existing long name doesn't allocate */
+        static std::string key;
+        key.assign(name, len);
+
+        return Intern(index, key);
+    }
+
+    inline cat_id_t CategoryOf(const CategoryIndex& index, uint32_t slot)
+    {
+        return slot < index.links.size() ? index.links[slot].cat : CAT_NONE;
+    }
+
+    inline void Link(CategoryIndex& index, uint32_t slot, cat_id_t cat, uint32_t icount, uint32_t acount)
+    {
+        if (slot >= index.links.size())
+            index.links.resize(slot + 1);
+
+        auto& entry = index.entries[cat];
+        auto& link = index.links[slot];
+
+        link.cat = cat;
+        link.pos = entry.slots.size();
+
+        entry.slots.push_back(slot);
+        entry.item_count += icount;
+        entry.assigned_count += acount;
+    }
+
+    /* O(1): the last slot of the category takes the place of the removed one */
+    inline void Unlink(CategoryIndex& index, uint32_t slot, uint32_t icount, uint32_t acount)
+    {
+        if (slot >= index.links.size() || index.links[slot].cat == CAT_NONE)
+            return;
+
+        auto& link = index.links[slot];
+        auto& entry = index.entries[link.cat];
+
+        uint32_t moved = entry.slots.back();
+        entry.slots[link.pos] = moved;
+        index.links[moved].pos = link.pos;
+        entry.slots.pop_back();
+
+        entry.item_count -= icount;
+        entry.assigned_count -= acount;
+
+        link.cat = CAT_NONE;
+        link.pos = 0;
+    }
+
+    inline void Adjust(CategoryIndex& index, uint32_t slot, int64_t d_count, int64_t d_assigned)
+    {
+        auto cat = CategoryOf(index, slot);
+        if (cat == CAT_NONE)
+            return;
+
+        auto& entry = index.entries[cat];
+        entry.item_count += d_count;
+        entry.assigned_count += d_assigned;
+    }
+
+    inline void Clear(CategoryIndex& index)
+    {
+        index.lookup.clear();
+        index.entries.clear();
+        index.links.clear();
+    }
+} // namespace Categories
+
+#endif
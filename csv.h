@@ -0,0 +1,386 @@
+#pragma once
+
+#ifndef __APP_CSV_H_
+#define __APP_CSV_H_
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "parse.h"
+
+/*
+ * Streaming CSV/TSV reading and writing.
+ *
+ * The reader pulls the input through one large buffer and splits each record in place: fields are pointers
+ * into that buffer, NUL-terminated where the delimiter used to be, and quoted fields are unescaped without
+ * leaving the buffer. Nothing is allocated per record or per field. A record's fields stay valid until the
+ * next call to NextRecord().
+ *
+ * The writer formats straight into its own buffer and flushes it in large blocks.
+ */
+namespace Csv
+{
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+    static constexpr size_t MAX_FIELDS = 16;
+
+    struct Field
+    {
+        const char* ptr;
+        size_t len;
+    };
+
+    struct Reader
+    {
+        std::istream* in;
+        char delim;
+
+        std::vector<char> buf;
+        size_t begin = 0; // start of the unparsed data
+        size_t end = 0;   // end of the data read so far
+        bool eof = false;
+
+        uint64_t line = 0; // number of the last record returned, 1-based
+    };
+
+    struct Writer
+    {
+        std::ostream* out;
+        char delim;
+
+        std::vector<char> buf;
+        size_t used = 0;
+        bool first_field = true;
+    };
+
+    /* Tab for .tsv files, comma for anything else */
+    inline char DelimiterFor(const char* path)
+    {
+        auto len = strlen(path);
+        return len >= 4 && strcmp(path + len - 4, ".tsv") == 0 ? '\t' : ',';
+    }
+
+    /* ------------------------------------------------------------------------ */
+    /* -------------------------------- READING ------------------------------- */
+    /* ------------------------------------------------------------------------ */
+
+    inline void InitReader(Reader& r, std::istream& in, char delim)
+    {
+        r.in = &in;
+        r.delim = delim;
+        r.buf.resize(BUFFER_SIZE);
+        r.begin = r.end = 0;
+        r.eof = false;
+        r.line = 0;
+    }
+
+    /* Moves the unparsed tail to the front and reads more after it. Grows the buffer only when a single
+     * record does not fit. Returns false when nothing more could be read */
+    inline bool Refill(Reader& r)
+    {
+        if (r.eof)
+            return false;
+
+        if (r.begin > 0)
+        {
+            memmove(r.buf.data(), r.buf.data() + r.begin, r.end - r.begin);
+            r.end -= r.begin;
+            r.begin = 0;
+        }
+
+        if (r.end == r.buf.size())
+            r.buf.resize(r.buf.size() * 2);
+
+        r.in->read(r.buf.data() + r.end, r.buf.size() - r.end);
+        auto got = r.in->gcount();
+
+        r.end += got;
+        if (got == 0 || !*r.in)
+            r.eof = true;
+
+        return got > 0;
+    }
+
+    /* Finds the newline that ends the record starting at r.begin, honouring quotes. Returns its offset,
+     * or r.end if the buffer holds no complete record */
+    inline size_t FindRecordEnd(const Reader& r)
+    {
+        const char* base = r.buf.data();
+        size_t p = r.begin;
+        bool quoted = false;
+
+        while (p < r.end)
+        {
+            if (!quoted)
+            {
+                auto nl = (const char*) memchr(base + p, '\n', r.end - p);
+                size_t stop = nl ? nl - base : r.end;
+
+                auto q = (const char*) memchr(base + p, '"', stop - p);
+                if (q == nullptr)
+                    return stop;
+
+                quoted = true;
+                p = q - base + 1;
+            }
+            else
+            {
+                auto q = (const char*) memchr(base + p, '"', r.end - p);
+                if (q == nullptr)
+                    return r.end;
+
+                /* A doubled quote inside a quoted field toggles twice, which leaves us quoted */
+                quoted = false;
+                p = q - base + 1;
+            }
+        }
+
+        return r.end;
+    }
+
+    /* Splits buf[from, to) into fields, unescaping quoted fields in place */
+    inline size_t SplitRecord(Reader& r, size_t from, size_t to, Field* fields, size_t max_fields)
+    {
+        char* base = r.buf.data();
+        size_t n = 0;
+        size_t p = from;
+
+        while (true)
+        {
+            char* start = base + p;
+            size_t len;
+
+            if (p < to && base[p] == '"')
+            {
+                size_t w = p;
+                ++p;
+                while (p < to)
+                {
+                    if (base[p] == '"')
+                    {
+                        if (p + 1 < to && base[p + 1] == '"')
+                        {
+                            base[w++] = '"';
+                            p += 2;
+                            continue;
+                        }
+
+                        ++p;
+                        break;
+                    }
+
+                    base[w++] = base[p++];
+                }
+
+                /* Anything between the closing quote and the delimiter is dropped */
+                auto d = (char*) memchr(base + p, r.delim, to - p);
+                p = d ? d - base : to;
+                len = w - (start - base);
+            }
+            else
+            {
+                auto d = (char*) memchr(base + p, r.delim, to - p);
+                p = d ? d - base : to;
+                len = (base + p) - start;
+            }
+
+            bool last = p >= to;
+
+            start[len] = '\0';
+            if (n < max_fields)
+                fields[n++] = { start, len };
+
+            if (last)
+                break;
+
+            ++p; // skip delimiter
+        }
+
+        return n;
+    }
+
+    /*
+     * Reads the next non-empty record into fields (at most max_fields are kept). Returns the number of fields,
+     * or 0 at the end of input.
+     */
+    inline size_t NextRecord(Reader& r, Field* fields, size_t max_fields = MAX_FIELDS)
+    {
+        while (true)
+        {
+            size_t rec_end = FindRecordEnd(r);
+
+            /* No newline yet: read more unless this is the unterminated last record */
+            if (rec_end == r.end && !r.eof)
+            {
+                Refill(r);
+                continue;
+            }
+
+            if (r.begin >= r.end)
+                return 0;
+
+            size_t from = r.begin;
+            size_t to = rec_end;
+
+            r.begin = rec_end < r.end ? rec_end + 1 : r.end;
+            ++r.line;
+
+            if (to > from && r.buf[to - 1] == '\r')
+                --to;
+
+            if (to == from)
+                continue;
+
+            /* The byte at `to` (newline, CR, or spare capacity) becomes the last field's terminator */
+            if (to == r.buf.size())
+                r.buf.push_back('\0');
+
+            return SplitRecord(r, from, to, fields, max_fields);
+        }
+    }
+
+    /* Counts the records in a stream without keeping them, so bulk loads can reserve storage once */
+    inline uint64_t CountLines(std::istream& in)
+    {
+        std::vector<char> buf(BUFFER_SIZE);
+        uint64_t lines = 0;
+        char last = '\n';
+
+        while (in)
+        {
+            in.read(buf.data(), buf.size());
+            auto got = in.gcount();
+            if (got <= 0)
+                break;
+
+            const char* p = buf.data();
+            const char* e = p + got;
+            while ((p = (const char*) memchr(p, '\n', e - p)) != nullptr)
+            {
+                ++lines;
+                ++p;
+            }
+
+            last = buf[got - 1];
+        }
+
+        return lines + (last != '\n');
+    }
+
+    /* Unsigned decimal, rejecting anything that is empty, not entirely digits, or larger than max */
+    inline bool ToUint(const Field& f, uint64_t max, uint64_t& out)
+    {
+        auto res = Parse::Uint(f.ptr, f.ptr + f.len, max, out);
+        return res.ec == Parse::Error::None && res.ptr == f.ptr + f.len;
+    }
+
+    /* ------------------------------------------------------------------------ */
+    /* -------------------------------- WRITING ------------------------------- */
+    /* ------------------------------------------------------------------------ */
+
+    inline void InitWriter(Writer& w, std::ostream& out, char delim)
+    {
+        w.out = &out;
+        w.delim = delim;
+        w.buf.resize(BUFFER_SIZE);
+        w.used = 0;
+        w.first_field = true;
+    }
+
+    inline void Flush(Writer& w)
+    {
+        w.out->write(w.buf.data(), w.used);
+        w.used = 0;
+    }
+
+    /* Makes room for n more bytes */
+    inline char* Reserve(Writer& w, size_t n)
+    {
+        if (w.used + n > w.buf.size())
+        {
+            Flush(w);
+            if (n > w.buf.size())
+                w.buf.resize(n);
+        }
+
+        return w.buf.data() + w.used;
+    }
+
+    inline void BeginField(Writer& w)
+    {
+        if (!w.first_field)
+        {
+            *Reserve(w, 1) = w.delim;
+            ++w.used;
+        }
+
+        w.first_field = false;
+    }
+
+    inline void WriteField(Writer& w, const char* s, size_t len)
+    {
+        BeginField(w);
+
+        bool needs_quotes = false;
+        for (size_t i = 0; i < len && !needs_quotes; ++i)
+            needs_quotes = s[i] == w.delim || s[i] == '"' || s[i] == '\n' || s[i] == '\r';
+
+        if (!needs_quotes)
+        {
+            memcpy(Reserve(w, len), s, len);
+            w.used += len;
+            return;
+        }
+
+        /* Worst case every character is a quote and gets doubled */
+        char* o = Reserve(w, 2 * len + 2);
+        char* start = o;
+
+        *o++ = '"';
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (s[i] == '"')
+                *o++ = '"';
+            *o++ = s[i];
+        }
+        *o++ = '"';
+
+        w.used += o - start;
+    }
+
+    inline void WriteField(Writer& w, const std::string& s)
+    {
+        WriteField(w, s.data(), s.size());
+    }
+
+    inline void WriteField(Writer& w, uint64_t v)
+    {
+        BeginField(w);
+
+        char digits[20];
+        int n = 0;
+        do
+        {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v != 0);
+
+        char* o = Reserve(w, n);
+        for (int i = 0; i < n; ++i)
+            o[i] = digits[n - 1 - i];
+
+        w.used += n;
+    }
+
+    inline void EndRecord(Writer& w)
+    {
+        *Reserve(w, 1) = '\n';
+        ++w.used;
+        w.first_field = true;
+    }
+} // namespace Csv
+
+#endif
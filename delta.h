@@ -0,0 +1,312 @@
+#pragma once
+
+#ifndef __APP_DELTA_H_
+#define __APP_DELTA_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "serialization.h"
+
+/*
+ * What changed between two states of an inventory, for keeping a standby copy in step without shipping the
+ * whole data file. Items are compared slot by slot through a hash of their contents: id, name, category,
+ * counts, reorder level, whether deleted, and each member with their units and due date, in list order. The
+ * delta holds the new contents of every item whose hash differs, together with the old hash, and the digests
+ * (see digest.h) of the whole inventory before and after, so the copy it is applied to can check that it starts
+ * from the state the delta was taken against and ends in the one it was taken of.
+ *
+ * Slots keep their items until a purge renumbers them. From the first slot whose item id differs (`keep`),
+ * every item is sent again and the copy drops and re-adds them.
+ */
+struct DeltaItem
+{
+    struct Member
+    {
+        std::string name;
+        uint32_t units = 0;
+        uint64_t due = 0;
+    };
+
+    uint32_t slot = 0;
+    uint64_t old_hash = 0; // of the item at slot before, for slots under keep
+
+    item_id_t id = 0;
+    std::string name;
+    std::string cat;
+    item_count_t units = 0; // available
+    item_count_t assigned = 0;
+    item_count_t reorder = 0;
+    bool active = true;
+    std::vector<Member> members;
+};
+
+struct Delta
+{
+    uint32_t old_count = 0;
+    uint32_t keep = 0; // slots below it hold the same items before and after
+    uint32_t new_count = 0;
+    uint64_t old_digest = 0;
+    uint64_t new_digest = 0;
+    std::vector<DeltaItem> items; // by slot
+};
+
+namespace Deltas
+{
+    /*
+     * File layout: MAGIC, VERSION (2), the byte width of item ids (1) and a checksum (8) of the rest, which
+     * is the three counts (4 each), the old and new digests (8 each) and the number of items (4), then per
+     * item its slot (4), old hash (8), id, name and category (4-byte length and characters), units, assigned
+     * units and reorder level, whether active (1), and its members: their count (4), then per member the name,
+     * units (4) and due time (8).
+     */
+    static constexpr uint32_t MAGIC = 0x41544C44; // "DLTA"
+    static constexpr uint16_t VERSION = 2;
+    static constexpr size_t HEADER_BYTES = 15;
+
+    inline uint64_t mix(uint64_t h, uint64_t v)
+    {
+        h = (h ^ v) * 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 29);
+    }
+
+    inline uint64_t mix(uint64_t h, const char* s, size_t len)
+    {
+        return mix(mix(h, len), MemberLists::NameHash(s, len));
+    }
+
+    /* Calls fn(member_id_t member, uint32_t units) for each member of the item in list order, reading a
+     * stored list straight from the data file rather than decoding it into the item */
+    template<typename F>
+    inline void ForEachMember(const Inventory& inv, const InventoryItem& item, F fn)
+    {
+        auto stored = stored_members_of(item);
+        if (stored != MemberSources::NONE)
+        {
+            auto names = inv.member_names.names.size();
+            Serialization::ForEachStoredMember(*inv.member_source, stored, names, fn);
+            return;
+        }
+
+        auto& list = members_of(item);
+        for (uint32_t i = 0; i < list.size; ++i)
+            fn(list[i].member, list[i].units);
+    }
+
+    /* Hash of everything a delta carries for the item at slot; never 0 */
+    inline uint64_t ItemHash(const Inventory& inv, uint32_t slot)
+    {
+        auto& item = inv.items[slot];
+
+        uint64_t h = mix(0, (uint64_t) item.item_id);
+        h = mix(h, item.meta.name.data(), item.meta.name.size());
+        h = mix(h, item.meta.cat.data(), item.meta.cat.size());
+        h = mix(h, item.item_count);
+        h = mix(h, item.assigned_count);
+        h = mix(h, item.reorder_level);
+        h = mix(h, item.active);
+
+        ForEachMember(inv, item, [&](member_id_t member, uint32_t units) {
+            auto& name = inv.member_names.names[member];
+            h = mix(h, name.data(), name.size());
+            h = mix(h, units);
+            h = mix(h, DueDates::Get(inv.due, slot, member));
+        });
+
+        return h != 0 ? h : 1;
+    }
+
+    /* Keeps inv.digest current: call before changing the item at slot, or adding one there */
+    inline void Touch(Inventory& inv, uint32_t slot)
+    {
+        Digests::Touch(inv.digest, slot, inv.count, [&](uint32_t s) { return ItemHash(inv, s); });
+    }
+
+    /* The digest of the whole inventory; hashes only the items changed since it was last asked for */
+    inline uint64_t Digest(Inventory& inv)
+    {
+        return Digests::Value(inv.digest, inv.count, [&](uint32_t s) { return ItemHash(inv, s); });
+    }
+
+    inline void Describe(const Inventory& inv, uint32_t slot, DeltaItem& out)
+    {
+        auto& item = inv.items[slot];
+
+        out.slot = slot;
+        out.id = item.item_id;
+        out.name.assign(item.meta.name.data(), item.meta.name.size());
+        out.cat.assign(item.meta.cat.data(), item.meta.cat.size());
+        out.units = item.item_count;
+        out.assigned = item.assigned_count;
+        out.reorder = item.reorder_level;
+        out.active = item.active;
+
+        ForEachMember(inv, item, [&](member_id_t member, uint32_t units) {
+            out.members.emplace_back();
+            out.members.back().name = inv.member_names.names[member];
+            out.members.back().units = units;
+            out.members.back().due = DueDates::Get(inv.due, slot, member);
+        });
+    }
+
+    /* The delta that turns `before` into `after` */
+    inline void Diff(Inventory& before, Inventory& after, Delta& out)
+    {
+        out.old_count = before.count;
+        out.new_count = after.count;
+        out.old_digest = Digest(before);
+        out.new_digest = Digest(after);
+        out.items.clear();
+
+        uint32_t keep = std::min(before.count, after.count);
+        for (uint32_t i = 0; i < keep; ++i)
+        {
+            if (before.items[i].item_id != after.items[i].item_id)
+            {
+                keep = i;
+                break;
+            }
+        }
+        out.keep = keep;
+
+        for (uint32_t i = 0; i < after.count; ++i)
+        {
+            uint64_t old_hash = 0;
+            if (i < keep)
+            {
+                old_hash = ItemHash(before, i);
+                if (old_hash == ItemHash(after, i))
+                    continue;
+            }
+
+            out.items.emplace_back();
+            Describe(after, i, out.items.back());
+            out.items.back().old_hash = old_hash;
+        }
+    }
+
+    inline void put_string(Serialization::IndexPayload& out, const std::string& s)
+    {
+        out.put((uint32_t) s.size());
+        out.put(s.data(), s.size());
+    }
+
+    inline bool get_string(Serialization::IndexReader& in, std::string& s)
+    {
+        uint32_t len;
+        if (!in.get(len) || len > in.left())
+            return false;
+
+        s.resize(len);
+        return in.get(&s[0], len);
+    }
+
+    /* Returns the size of the file written, or 0 if it could not be */
+    inline uint64_t Write(const char* path, const Delta& delta)
+    {
+        Serialization::IndexPayload body;
+        body.put(delta.old_count);
+        body.put(delta.keep);
+        body.put(delta.new_count);
+        body.put(delta.old_digest);
+        body.put(delta.new_digest);
+        body.put((uint32_t) delta.items.size());
+
+        for (auto& d : delta.items)
+        {
+            body.put(d.slot);
+            body.put(d.old_hash);
+            body.put(d.id);
+            put_string(body, d.name);
+            put_string(body, d.cat);
+            body.put(d.units);
+            body.put(d.assigned);
+            body.put(d.reorder);
+            body.put((uint8_t) d.active);
+
+            body.put((uint32_t) d.members.size());
+            for (auto& m : d.members)
+            {
+                put_string(body, m.name);
+                body.put(m.units);
+                body.put(m.due);
+            }
+        }
+
+        std::fstream f(path, std::ios::binary | std::ios::out | std::ios::trunc);
+        Serialization::write_bytes(f, MAGIC);
+        Serialization::write_bytes(f, VERSION);
+        Serialization::write_bytes(f, (uint8_t) sizeof(item_id_t));
+        Serialization::write_bytes(f, Serialization::Checksum(body.bytes.data(), body.bytes.size()));
+        Serialization::write_bytes(f, body.bytes.data(), body.bytes.size());
+
+        f.flush();
+        return f ? HEADER_BYTES + body.bytes.size() : 0;
+    }
+
+    /* Fails on anything but an intact delta, from a build with the same item id width, whose slots make sense */
+    inline bool Read(const char* path, Delta& delta)
+    {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        if (!f)
+            return false;
+
+        std::vector<char> bytes((size_t) f.tellg());
+        f.seekg(0);
+        if (!f.read(bytes.data(), bytes.size()) || bytes.size() < HEADER_BYTES)
+            return false;
+
+        auto p = bytes.data();
+        if (Schema::get<uint32_t>(p) != MAGIC || Schema::get<uint16_t>(p + 4) != VERSION
+            || (uint8_t) p[6] != sizeof(item_id_t))
+            return false;
+
+        if (Schema::get<uint64_t>(p + 7) != Serialization::Checksum(p + HEADER_BYTES, bytes.size() - HEADER_BYTES))
+            return false;
+
+        Serialization::IndexReader in { p + HEADER_BYTES, p + bytes.size() };
+
+        uint32_t items;
+        if (!in.get(delta.old_count) || !in.get(delta.keep) || !in.get(delta.new_count) || !in.get(delta.old_digest)
+            || !in.get(delta.new_digest) || !in.get(items))
+            return false;
+
+        if (delta.keep > std::min(delta.old_count, delta.new_count) || items > delta.new_count)
+            return false;
+
+        delta.items.assign(items, DeltaItem {});
+        for (uint32_t i = 0; i < items; ++i)
+        {
+            auto& d = delta.items[i];
+
+            uint8_t active;
+            uint32_t members;
+            if (!in.get(d.slot) || !in.get(d.old_hash) || !in.get(d.id) || !get_string(in, d.name)
+                || !get_string(in, d.cat) || !in.get(d.units) || !in.get(d.assigned) || !in.get(d.reorder)
+                || !in.get(active) || !in.get(members) || members > in.left())
+                return false;
+
+            d.active = active != 0;
+
+            d.members.resize(members);
+            for (auto& m : d.members)
+                if (!get_string(in, m.name) || !in.get(m.units) || !in.get(m.due))
+                    return false;
+
+            /* In slot order, and every slot from keep on */
+            if ((i > 0 && d.slot <= delta.items[i - 1].slot) || d.slot >= delta.new_count)
+                return false;
+        }
+
+        uint32_t resent = 0;
+        for (auto& d : delta.items)
+            resent += d.slot >= delta.keep;
+
+        return in.left() == 0 && resent == delta.new_count - delta.keep;
+    }
+} // namespace Deltas
+
+#endif
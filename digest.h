@@ -0,0 +1,103 @@
+#pragma once
+
+#ifndef __APP_DIGEST_H_
+#define __APP_DIGEST_H_
+
+#include <vector>
+#include <cstdint>
+
+/*
+ * Digest of a whole inventory: the sum of one term per slot, each mixing the slot with the hash of its item
+ * (Deltas::ItemHash). A delta carries the digests of the states it goes from and to, so the copy it is applied
+ * to can tell whether it is in the first state, and ends in the second, without hashing every item.
+ *
+ * It is kept up to date as items change. Before its first change, a slot's term is taken out of the sum and
+ * the slot is listed in `touched`; the terms of touched slots are added back the next time the digest is read,
+ * so a burst of changes to one item costs one hash. Until the digest is first read, or again after a compaction
+ * renumbers slots, nothing is tracked and the next read hashes every item. Every checkpoint reads it, and the
+ * data file saves it for the journal position it was written at.
+ */
+struct StateDigest
+{
+    bool valid = false;
+    uint64_t sum = 0;
+    std::vector<uint32_t> touched;
+    std::vector<uint8_t> is_touched; // by slot
+};
+
+namespace Digests
+{
+    inline uint64_t Term(uint32_t slot, uint64_t item_hash)
+    {
+        uint64_t h = (item_hash ^ ((uint64_t) slot << 32 | slot)) * 0xff51afd7ed558ccdull;
+        return h ^ (h >> 33);
+    }
+
+    /* Call before changing the item at slot, or adding one there (slot == count). hash(slot) hashes an item */
+    template<typename H>
+    inline void Touch(StateDigest& d, uint32_t slot, uint32_t count, H hash)
+    {
+        if (!d.valid)
+            return;
+
+        if (slot >= d.is_touched.size())
+            d.is_touched.resize(slot + 1, 0);
+
+        if (d.is_touched[slot])
+            return;
+
+        if (slot < count)
+            d.sum -= Term(slot, hash(slot));
+
+        d.is_touched[slot] = 1;
+        d.touched.push_back(slot);
+    }
+
+    /* The digest of the first `count` slots as they are now */
+    template<typename H>
+    inline uint64_t Value(StateDigest& d, uint32_t count, H hash)
+    {
+        if (!d.valid)
+        {
+            d.sum = 0;
+            for (uint32_t i = 0; i < count; ++i)
+                d.sum += Term(i, hash(i));
+
+            d.valid = true;
+        }
+
+        /* Slots past the end were dropped; their terms are already out */
+        for (auto slot : d.touched)
+        {
+            d.is_touched[slot] = 0;
+            if (slot < count)
+                d.sum += Term(slot, hash(slot));
+        }
+
+        d.touched.clear();
+        return d.sum;
+    }
+
+    /* Taken from a data file, for the state it was saved in */
+    inline void Assign(StateDigest& d, uint64_t sum)
+    {
+        d.valid = true;
+        d.sum = sum;
+        d.touched.clear();
+        d.is_touched.clear();
+    }
+
+    /* Slots were renumbered */
+    inline void Reset(StateDigest& d)
+    {
+        d = StateDigest {};
+    }
+
+    /* Whether `sum` is the digest as it stands, without resolving touched slots */
+    inline bool Settled(const StateDigest& d)
+    {
+        return d.valid && d.touched.empty();
+    }
+} // namespace Digests
+
+#endif
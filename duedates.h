@@ -0,0 +1,297 @@
+#pragma once
+
+#ifndef __APP_DUEDATES_H_
+#define __APP_DUEDATES_H_
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "memberlist.h"
+
+/*
+ * Due dates of loans: when the units a member holds of an item are expected back, in seconds since the
+ * epoch. Only loans that have one are tracked, in a binary min-heap ordered by due time, so the earliest due
+ * date is always at the root; pos maps a loan (item slot, member) to its place in the heap for O(log n)
+ * updates and removal.
+ *
+ * Every loan due by some time t sits in the part of the heap hanging from the root whose entries are all due
+ * by t, so listing them visits only that part and its border: O(results), however many loans are open.
+ */
+struct DueEntry
+{
+    uint64_t due;
+    uint32_t slot;
+    member_id_t member;
+};
+
+/*
+ * The heap's array, in fixed chunks held by shared_ptr. A snapshot keeps the chunks by reference along with
+ * the size; like an item page, a chunk is copied the first time the index writes to it while a snapshot
+ * shares it, so taking one costs a reference per chunk and nothing more until the heap changes.
+ */
+struct DueHeap
+{
+    static constexpr uint32_t CHUNK = 1024;
+
+    std::vector<std::shared_ptr<DueEntry>> chunks;
+    uint32_t count = 0;
+
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const DueEntry& operator[](uint32_t i) const { return chunks[i / CHUNK].get()[i % CHUNK]; }
+    const DueEntry& back() const { return (*this)[count - 1]; }
+
+    /* The entry, to change it; writes go through here so shared chunks get copied first */
+    DueEntry& write(uint32_t i)
+    {
+        auto& chunk = chunks[i / CHUNK];
+
+        if (chunk.use_count() != 1)
+        {
+            std::shared_ptr<DueEntry> copy(new DueEntry[CHUNK], std::default_delete<DueEntry[]>());
+            uint32_t used = count - i / CHUNK * CHUNK;
+            std::copy(chunk.get(), chunk.get() + (used < CHUNK ? used : CHUNK), copy.get());
+            chunk = std::move(copy);
+        }
+        else
+        {
+            /* A snapshot released on another thread must be done reading the chunk we now write */
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+
+        return chunk.get()[i % CHUNK];
+    }
+
+    /* Chunks stay allocated as the heap shrinks, so they are not reallocated back and forth at a border */
+    void push_back(const DueEntry& e)
+    {
+        if (count == chunks.size() * CHUNK)
+            chunks.emplace_back(new DueEntry[CHUNK], std::default_delete<DueEntry[]>());
+
+        ++count;
+        write(count - 1) = e;
+    }
+
+    void pop_back() { --count; }
+
+    void clear()
+    {
+        chunks.clear();
+        count = 0;
+    }
+};
+
+struct DueIndex
+{
+    DueHeap heap;
+    std::unordered_map<uint64_t, uint32_t> pos; // by DueDates::key()
+};
+
+namespace DueDates
+{
+    inline uint64_t key(uint32_t slot, member_id_t member)
+    {
+        return (uint64_t) slot << 32 | member;
+    }
+
+    inline void place(DueIndex& index, uint32_t i, const DueEntry& e)
+    {
+        index.heap.write(i) = e;
+        index.pos[key(e.slot, e.member)] = i;
+    }
+
+    inline void sift_up(DueIndex& index, uint32_t i)
+    {
+        auto e = index.heap[i];
+
+        while (i > 0 && index.heap[(i - 1) / 2].due > e.due)
+        {
+            place(index, i, index.heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+
+        place(index, i, e);
+    }
+
+    inline void sift_down(DueIndex& index, uint32_t i)
+    {
+        auto e = index.heap[i];
+        uint32_t n = index.heap.size();
+
+        while (true)
+        {
+            uint32_t child = 2 * i + 1;
+            if (child >= n)
+                break;
+
+            if (child + 1 < n && index.heap[child + 1].due < index.heap[child].due)
+                ++child;
+
+            if (index.heap[child].due >= e.due)
+                break;
+
+            place(index, i, index.heap[child]);
+            i = child;
+        }
+
+        place(index, i, e);
+    }
+
+    /* 0 if the loan has no due date */
+    inline uint64_t Get(const DueIndex& index, uint32_t slot, member_id_t member)
+    {
+        auto it = index.pos.find(key(slot, member));
+        return it == index.pos.end() ? 0 : index.heap[it->second].due;
+    }
+
+    /* Sets or moves the loan's due date; 0 removes it */
+    inline void Set(DueIndex& index, uint32_t slot, member_id_t member, uint64_t due)
+    {
+        auto it = index.pos.find(key(slot, member));
+
+        if (it == index.pos.end())
+        {
+            if (due == 0)
+                return;
+
+            index.heap.push_back({ due, slot, member });
+            sift_up(index, index.heap.size() - 1);
+            return;
+        }
+
+        uint32_t i = it->second;
+
+        if (due == 0)
+        {
+            index.pos.erase(it);
+
+            auto last = index.heap.back();
+            index.heap.pop_back();
+
+            if (i == index.heap.size())
+                return;
+
+            place(index, i, last);
+            sift_up(index, i);
+            sift_down(index, index.pos[key(last.slot, last.member)]);
+            return;
+        }
+
+        auto previous = index.heap[i].due;
+        index.heap.write(i).due = due;
+
+        if (due < previous)
+            sift_up(index, i);
+        else
+            sift_down(index, i);
+    }
+
+    /* Calls fn(const DueEntry&) for every loan due at or before `by`, in no particular order */
+    template<typename F>
+    inline void ForEachDueBy(const DueIndex& index, uint64_t by, F fn)
+    {
+        static std::vector<uint32_t> stack;
+        stack.clear();
+
+        if (!index.heap.empty())
+            stack.push_back(0);
+
+        while (!stack.empty())
+        {
+            uint32_t i = stack.back();
+            stack.pop_back();
+
+            if (index.heap[i].due > by)
+                continue;
+
+            fn(index.heap[i]);
+
+            for (uint32_t child = 2 * i + 1; child <= 2 * i + 2 && child < index.heap.size(); ++child)
+                stack.push_back(child);
+        }
+    }
+
+    /* Calls fn(const DueEntry&) for loans due after `after`, soonest first, until it has returned true for
+     * `limit` of them; fn returns false to skip a loan without using up the limit. The loans due before
+     * `after`, and skipped ones, are walked past, so this costs O(v log v) for the v loans visited */
+    template<typename F>
+    inline void ForEachDueAfter(const DueIndex& index, uint64_t after, size_t limit, F fn)
+    {
+        auto later = [&](uint32_t a, uint32_t b) { return index.heap[a].due > index.heap[b].due; };
+
+        static std::vector<uint32_t> frontier;
+        frontier.clear();
+
+        if (!index.heap.empty())
+            frontier.push_back(0);
+
+        while (!frontier.empty() && limit > 0)
+        {
+            std::pop_heap(frontier.begin(), frontier.end(), later);
+            uint32_t i = frontier.back();
+            frontier.pop_back();
+
+            if (index.heap[i].due > after && fn(index.heap[i]))
+                --limit;
+
+            for (uint32_t child = 2 * i + 1; child <= 2 * i + 2 && child < index.heap.size(); ++child)
+            {
+                frontier.push_back(child);
+                std::push_heap(frontier.begin(), frontier.end(), later);
+            }
+        }
+    }
+
+    /* Builds the index from loans in any order, in O(n) */
+    inline void Assign(DueIndex& index, std::vector<DueEntry> entries)
+    {
+        std::make_heap(entries.begin(), entries.end(), [](const DueEntry& a, const DueEntry& b) {
+            return a.due > b.due;
+        });
+
+        index.heap.clear();
+        index.pos.clear();
+        index.pos.reserve(entries.size());
+
+        for (uint32_t i = 0; i < entries.size(); ++i)
+        {
+            index.heap.push_back(entries[i]);
+            index.pos[key(entries[i].slot, entries[i].member)] = i;
+        }
+    }
+
+    /* Items moved to new slots (SLOT_GONE for purged ones); their loans follow them */
+    static constexpr uint32_t SLOT_GONE = (uint32_t) -1;
+
+    inline void Remap(DueIndex& index, const std::vector<uint32_t>& new_slot)
+    {
+        std::vector<DueEntry> kept;
+        kept.reserve(index.heap.size());
+
+        for (uint32_t i = 0; i < index.heap.size(); ++i)
+        {
+            auto e = index.heap[i];
+
+            if (e.slot >= new_slot.size() || new_slot[e.slot] == SLOT_GONE)
+                continue;
+
+            e.slot = new_slot[e.slot];
+            kept.push_back(e);
+        }
+
+        Assign(index, std::move(kept));
+    }
+
+    inline void Clear(DueIndex& index)
+    {
+        index.heap.clear();
+        index.pos.clear();
+    }
+} // namespace DueDates
+
+#endif
@@ -0,0 +1,364 @@
+#pragma once
+
+#ifndef __APP_EVENTLOG_H_
+#define __APP_EVENTLOG_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Assignment history: an append-only log of assign/retrieve events, kept in fixed-size segment files
+ * (inventory_data.rvms.events.000000, .000001, ...) that are memory-mapped, so adding an event is a copy
+ * into the mapping.
+ *
+ * Event times are microseconds since the epoch and never decrease, so the log is sorted by time. A sparse
+ * index (one entry every INDEX_STRIDE bytes) narrows a time range down to a few KiB before scanning, and
+ * every event links back to the previous event of the same item, so an item's history is a walk down its
+ * own chain.
+ *
+ * Core stages events as it makes changes; they are published once their transaction is durable and dropped
+ * if it is rolled back. Opening the log scans it once to rebuild the index and the chain heads.
+ */
+
+enum class EventKind : uint8_t
+{
+    Assign = 1,
+    Retrieve,
+};
+
+/* On-disk record, followed by the member's name padded to 8 bytes */
+struct EventRecord
+{
+    uint64_t time;     // 0 marks the unused end of a segment
+    uint64_t item;
+    uint64_t prev;     // position of the same item's previous event, or Events::NONE
+    uint32_t count;    // units
+    uint16_t name_len;
+    EventKind kind;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(EventRecord) == 32, "EventRecord layout is part of the file format");
+
+/* Decoded event. name points into the mapping and stays valid until the log is closed */
+struct Event
+{
+    uint64_t time;
+    uint64_t item;
+    EventKind kind;
+    uint32_t count;
+    const char* name;
+    uint16_t name_len;
+};
+
+struct EventSegment
+{
+    int fd;
+    char* base;
+};
+
+struct EventIndexEntry
+{
+    uint64_t time;
+    uint64_t pos;
+};
+
+/* Positions are global: segment number * SEGMENT_SIZE + offset in the segment */
+struct EventLog
+{
+    std::string prefix;
+    std::vector<EventSegment> segments;
+
+    uint64_t end = 0; // where the next event goes
+    uint64_t last_time = 0;
+    uint64_t count = 0;
+
+    std::vector<EventIndexEntry> index;
+    std::unordered_map<uint64_t, uint64_t> last_of_item;
+
+    std::vector<char> staged; // records of the transaction in progress, without time and prev
+};
+
+namespace Events
+{
+    static constexpr const char* FILE_PREFIX = "inventory_data.rvms.events";
+
+    static constexpr uint8_t MAGIC_BYTES[8] = { 'R', 'V', 'M', 'S', 'E', 'V', 'N', 'T' };
+    static constexpr uint64_t SEGMENT_SIZE = 8 << 20;
+    static constexpr uint64_t HEADER_SIZE = 16; // magic, then the segment number
+    static constexpr uint64_t INDEX_STRIDE = 4 << 10;
+    static constexpr uint64_t NONE = (uint64_t) -1;
+
+    inline uint64_t Now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    inline bool IsOpen(const EventLog& log)
+    {
+        return !log.segments.empty();
+    }
+
+    inline uint64_t record_size(uint16_t name_len)
+    {
+        return (sizeof(EventRecord) + name_len + 7) & ~(uint64_t) 7;
+    }
+
+    inline char* at(const EventLog& log, uint64_t pos)
+    {
+        return log.segments[pos / SEGMENT_SIZE].base + pos % SEGMENT_SIZE;
+    }
+
+    inline EventRecord record_at(const EventLog& log, uint64_t pos)
+    {
+        EventRecord rec;
+        memcpy(&rec, at(log, pos), sizeof(rec));
+        return rec;
+    }
+
+    inline Event event_at(const EventLog& log, uint64_t pos)
+    {
+        auto rec = record_at(log, pos);
+        return { rec.time, rec.item, rec.kind, rec.count, at(log, pos) + sizeof(EventRecord), rec.name_len };
+    }
+
+    /* The record after the one at pos, skipping the unused tail of its segment */
+    inline uint64_t next_position(const EventLog& log, uint64_t pos)
+    {
+        pos += record_size(record_at(log, pos).name_len);
+
+        uint64_t offset = pos % SEGMENT_SIZE;
+        if (pos >= log.end)
+            return pos;
+
+        if (offset == 0)
+            return pos + HEADER_SIZE;
+
+        if (offset + sizeof(EventRecord) > SEGMENT_SIZE || record_at(log, pos).time == 0)
+            return (pos / SEGMENT_SIZE + 1) * SEGMENT_SIZE + HEADER_SIZE;
+
+        return pos;
+    }
+
+    inline std::string segment_path(const std::string& prefix, size_t n)
+    {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), ".%06zu", n);
+        return prefix + suffix;
+    }
+
+    /* Maps segment n, creating it (or finishing its creation) as needed */
+    inline bool map_segment(EventLog& log, size_t n, bool create)
+    {
+        auto path = segment_path(log.prefix, n);
+
+        int fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || ((uint64_t) st.st_size < SEGMENT_SIZE && ::ftruncate(fd, SEGMENT_SIZE) != 0))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        auto base = (char*) ::mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        uint32_t number = n;
+        char header[HEADER_SIZE] = {};
+        memcpy(header, MAGIC_BYTES, sizeof(MAGIC_BYTES));
+        memcpy(header + sizeof(MAGIC_BYTES), &number, sizeof(number));
+
+        /* A segment whose header never made it to disk is as good as new */
+        if (std::all_of(base, base + HEADER_SIZE, [](char c) { return c == 0; }))
+            memcpy(base, header, HEADER_SIZE);
+
+        if (memcmp(base, header, HEADER_SIZE) != 0)
+        {
+            ::munmap(base, SEGMENT_SIZE);
+            ::close(fd);
+            return false;
+        }
+
+        log.segments.push_back({ fd, base });
+        log.end = n * SEGMENT_SIZE + HEADER_SIZE;
+        return true;
+    }
+
+    /* Bookkeeping for an event that now sits at pos */
+    inline void link(EventLog& log, uint64_t pos, const EventRecord& rec)
+    {
+        bool first_in_segment = pos % SEGMENT_SIZE == HEADER_SIZE;
+
+        if (log.index.empty() || first_in_segment || pos - log.index.back().pos >= INDEX_STRIDE)
+            log.index.push_back({ rec.time, pos });
+
+        log.last_of_item[rec.item] = pos;
+        log.last_time = rec.time;
+        log.end = pos + record_size(rec.name_len);
+        ++log.count;
+    }
+
+    /* Picks up the events of the segment mapped last. Stops at the first one that is unused or torn */
+    inline void scan_segment(EventLog& log)
+    {
+        uint64_t start = (log.segments.size() - 1) * SEGMENT_SIZE;
+
+        for (uint64_t offset = HEADER_SIZE; offset + sizeof(EventRecord) <= SEGMENT_SIZE;)
+        {
+            auto rec = record_at(log, start + offset);
+            auto size = record_size(rec.name_len);
+
+            if (rec.time == 0 || rec.time < log.last_time || offset + size > SEGMENT_SIZE)
+                break;
+
+            link(log, start + offset, rec);
+            offset += size;
+        }
+    }
+
+    inline void Close(EventLog& log)
+    {
+        for (auto& seg : log.segments)
+        {
+            ::munmap(seg.base, SEGMENT_SIZE);
+            ::close(seg.fd);
+        }
+
+        log = EventLog {};
+    }
+
+    inline bool Open(EventLog& log, const char* prefix)
+    {
+        Close(log);
+        log.prefix = prefix;
+
+        for (size_t n = 0;; ++n)
+        {
+            if (!map_segment(log, n, n == 0))
+            {
+                if (n > 0 && errno == ENOENT)
+                    return true;
+
+                Close(log);
+                return false;
+            }
+
+            scan_segment(log);
+        }
+    }
+
+    /* Queues an event of the transaction in progress */
+    inline void Stage(EventLog& log, uint64_t item, EventKind kind, uint32_t count, const char* name, size_t len)
+    {
+        if (!IsOpen(log))
+            return;
+
+        EventRecord rec = {};
+        rec.item = item;
+        rec.count = count;
+        rec.name_len = len > UINT16_MAX ? UINT16_MAX : len;
+        rec.kind = kind;
+
+        auto off = log.staged.size();
+        log.staged.resize(off + record_size(rec.name_len));
+
+        memcpy(log.staged.data() + off, &rec, sizeof(rec));
+        memcpy(log.staged.data() + off + sizeof(rec), name, rec.name_len);
+    }
+
+    inline void Discard(EventLog& log)
+    {
+        log.staged.clear();
+    }
+
+    /* Appends the staged events, timestamped from `now` on */
+    inline void Publish(EventLog& log, uint64_t now)
+    {
+        for (size_t off = 0; off < log.staged.size();)
+        {
+            EventRecord rec;
+            memcpy(&rec, log.staged.data() + off, sizeof(rec));
+            auto size = record_size(rec.name_len);
+
+            uint64_t offset = log.end - (log.segments.size() - 1) * SEGMENT_SIZE;
+            if (offset + size > SEGMENT_SIZE && !map_segment(log, log.segments.size(), true))
+                break; // out of disk space or file descriptors: the rest of the history is lost
+
+            auto it = log.last_of_item.find(rec.item);
+            rec.prev = it == log.last_of_item.end() ? NONE : it->second;
+            rec.time = std::max(now, log.last_time + 1);
+
+            /* The time goes in last: it is what marks the slot as used */
+            char* dst = at(log, log.end);
+            memcpy(dst + sizeof(uint64_t), (char*) &rec + sizeof(uint64_t), sizeof(rec) - sizeof(uint64_t));
+            memcpy(dst + sizeof(rec), log.staged.data() + off + sizeof(rec), rec.name_len);
+            memcpy(dst, &rec.time, sizeof(uint64_t));
+
+            link(log, log.end, rec);
+            off += size;
+        }
+
+        log.staged.clear();
+    }
+
+    /* Calls fn(const Event&) for the item's events, newest first */
+    template<typename F>
+    inline void ForEachOfItem(const EventLog& log, uint64_t item, F fn)
+    {
+        auto it = log.last_of_item.find(item);
+        if (it == log.last_of_item.end())
+            return;
+
+        for (uint64_t pos = it->second; pos != NONE; pos = record_at(log, pos).prev)
+            fn(event_at(log, pos));
+    }
+
+    /* Calls fn(const Event&) for the events in [from, to], oldest first */
+    template<typename F>
+    inline void ForEachBetween(const EventLog& log, uint64_t from, uint64_t to, F fn)
+    {
+        /* Last index entry before `from`: everything earlier is before the range too */
+        auto it = std::lower_bound(log.index.begin(), log.index.end(), from,
+                                   [](const EventIndexEntry& e, uint64_t t) { return e.time < t; });
+
+        if (log.index.empty())
+            return;
+
+        if (it != log.index.begin())
+            --it;
+
+        for (uint64_t pos = it->pos; pos < log.end; pos = next_position(log, pos))
+        {
+            auto e = event_at(log, pos);
+
+            if (e.time > to)
+                break;
+
+            if (e.time >= from)
+                fn(e);
+        }
+    }
+} // namespace Events
+
+#endif
@@ -0,0 +1,174 @@
+#pragma once
+
+#ifndef __APP_IDINDEX_H_
+#define __APP_IDINDEX_H_
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+static constexpr uint32_t IDINDEX_NONE = (uint32_t) -1;
+
+/*
+ * Open addressing (linear probing) map from the id of an active item to its slot in inv.items.
+ *
+ * Keys and slots live in separate arrays so a probe only walks keys: one cache line holds 16 keys at 32 bits
+ * or 8 at 64 bits, and slots[] is touched once, on the hit. The all-ones key marks an empty bucket; an item
+ * that really uses that id is kept on the side in max_key_slot.
+ */
+template<typename Key>
+struct IdHashIndex
+{
+    static constexpr Key EMPTY = std::numeric_limits<Key>::max();
+
+    std::vector<Key> keys;
+    std::vector<uint32_t> slots;
+
+    uint32_t size = 0;
+    uint32_t max_key_slot = IDINDEX_NONE;
+};
+
+template<typename Key>
+constexpr Key IdHashIndex<Key>::EMPTY;
+
+namespace IdIndex
+{
+    /* Fibonacci hashing spreads sequential ids, which is what most inventories use */
+    template<typename Key>
+    inline size_t Bucket(Key key, size_t mask)
+    {
+        return (size_t) (((uint64_t) key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    }
+
+    template<typename Key>
+    inline uint32_t Find(const IdHashIndex<Key>& index, Key key)
+    {
+        if (key == IdHashIndex<Key>::EMPTY)
+            return index.max_key_slot;
+
+        if (index.keys.empty())
+            return IDINDEX_NONE;
+
+        size_t mask = index.keys.size() - 1;
+        for (size_t b = Bucket(key, mask);; b = (b + 1) & mask)
+        {
+            if (index.keys[b] == key)
+                return index.slots[b];
+
+            if (index.keys[b] == IdHashIndex<Key>::EMPTY)
+                return IDINDEX_NONE;
+        }
+    }
+
+    template<typename Key>
+    inline void Rehash(IdHashIndex<Key>& index, size_t buckets);
+
+    template<typename Key>
+    inline void Insert(IdHashIndex<Key>& index, Key key, uint32_t slot)
+    {
+        if (key == IdHashIndex<Key>::EMPTY)
+        {
+            index.max_key_slot = slot;
+            return;
+        }
+
+        /* Stay at or under 50% load so probe runs remain short */
+        if ((index.size + 1) * 2 > index.keys.size())
+            Rehash(index, index.keys.empty() ? 64 : index.keys.size() * 2);
+
+        size_t mask = index.keys.size() - 1;
+        size_t b = Bucket(key, mask);
+        while (index.keys[b] != IdHashIndex<Key>::EMPTY && index.keys[b] != key)
+            b = (b + 1) & mask;
+
+        if (index.keys[b] == IdHashIndex<Key>::EMPTY)
+            ++index.size;
+
+        index.keys[b] = key;
+        index.slots[b] = slot;
+    }
+
+    /* Backward-shift deletion, so no tombstones pile up on long probe runs */
+    template<typename Key>
+    inline void Erase(IdHashIndex<Key>& index, Key key)
+    {
+        if (key == IdHashIndex<Key>::EMPTY)
+        {
+            index.max_key_slot = IDINDEX_NONE;
+            return;
+        }
+
+        if (index.keys.empty())
+            return;
+
+        size_t mask = index.keys.size() - 1;
+        size_t hole = Bucket(key, mask);
+        while (index.keys[hole] != key)
+        {
+            if (index.keys[hole] == IdHashIndex<Key>::EMPTY)
+                return;
+
+            hole = (hole + 1) & mask;
+        }
+
+        for (size_t b = (hole + 1) & mask; index.keys[b] != IdHashIndex<Key>::EMPTY; b = (b + 1) & mask)
+        {
+            size_t home = Bucket(index.keys[b], mask);
+
+            /* Move b into the hole unless its home lies cyclically in (hole, b] */
+            bool stays = hole <= b ? (hole < home && home <= b) : (hole < home || home <= b);
+            if (stays)
+                continue;
+
+            index.keys[hole] = index.keys[b];
+            index.slots[hole] = index.slots[b];
+            hole = b;
+        }
+
+        index.keys[hole] = IdHashIndex<Key>::EMPTY;
+        --index.size;
+    }
+
+    template<typename Key>
+    inline void Rehash(IdHashIndex<Key>& index, size_t buckets)
+    {
+        std::vector<Key> old_keys(buckets, IdHashIndex<Key>::EMPTY);
+        std::vector<uint32_t> old_slots(buckets, IDINDEX_NONE);
+
+        old_keys.swap(index.keys);
+        old_slots.swap(index.slots);
+        index.size = 0;
+
+        for (size_t b = 0; b < old_keys.size(); ++b)
+            if (old_keys[b] != IdHashIndex<Key>::EMPTY)
+                Insert(index, old_keys[b], old_slots[b]);
+    }
+
+    /* Grows the table so `expected` keys fit without rehashing along the way */
+    template<typename Key>
+    inline void Reserve(IdHashIndex<Key>& index, size_t expected)
+    {
+        size_t buckets = index.keys.empty() ? 64 : index.keys.size();
+        while (buckets < expected * 2)
+            buckets *= 2;
+
+        if (buckets != index.keys.size())
+            Rehash(index, buckets);
+    }
+
+    /* Sizes the table for `expected` keys up front, e.g. before a rebuild after a load */
+    template<typename Key>
+    inline void Clear(IdHashIndex<Key>& index, size_t expected = 0)
+    {
+        size_t buckets = 0;
+        if (expected > 0)
+            for (buckets = 64; buckets < expected * 2; buckets *= 2) {}
+
+        index.keys.assign(buckets, IdHashIndex<Key>::EMPTY);
+        index.slots.assign(buckets, IDINDEX_NONE);
+        index.size = 0;
+        index.max_key_slot = IDINDEX_NONE;
+    }
+} // namespace IdIndex
+
+#endif
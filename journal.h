@@ -0,0 +1,215 @@
+#pragma once
+
+#ifndef __APP_JOURNAL_H_
+#define __APP_JOURNAL_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+/*
+ * Append-only log of committed transactions, kept next to the data file. Each record carries the forward
+ * operations of one transaction (see oplog.h) and is synced before the commit is reported, so a commit
+ * costs one small write instead of rewriting the data file.
+ *
+ * The data file is the checkpoint: it stores the sequence number of the last transaction it includes, and
+ * on startup only newer journal records are replayed. After a checkpoint the journal is emptied.
+ *
+ * Record: seq (8) | op count (4) | payload length (4) | checksum (4) | payload. A record that is cut short
+ * or fails its checksum ends the journal; it was never acknowledged, and it is truncated away.
+ */
+namespace Journal
+{
+    static constexpr const char* FILE_NAME = "inventory_data.rvms.journal";
+
+    static constexpr uint8_t MAGIC_BYTES[8] = { 'R', 'V', 'M', 'S', 'J', 'R', 'N', 'L' };
+    static constexpr size_t HEADER_SIZE = sizeof(MAGIC_BYTES) + 1; // magic, then the id width in bytes
+    static constexpr size_t RECORD_HEADER_SIZE = 20;
+
+    struct Writer
+    {
+        int fd = -1;
+        uint64_t size = 0;
+        uint8_t id_bytes = 0;
+    };
+
+    /* A transaction found on disk. Its payload points into the buffer given to Open() */
+    struct Txn
+    {
+        uint64_t seq;
+        uint32_t ops;
+        const char* begin;
+        const char* end;
+    };
+
+    /* FNV-1a */
+    inline uint32_t Checksum(const char* p, size_t n, uint32_t h = 2166136261u)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            h ^= (uint8_t) p[i];
+            h *= 16777619u;
+        }
+
+        return h;
+    }
+
+    inline bool write_all(int fd, const char* p, size_t n)
+    {
+        while (n > 0)
+        {
+            auto w = ::write(fd, p, n);
+            if (w < 0)
+                return false;
+
+            p += w;
+            n -= w;
+        }
+
+        return true;
+    }
+
+    inline bool WriteHeader(Writer& w)
+    {
+        char header[HEADER_SIZE];
+        memcpy(header, MAGIC_BYTES, sizeof(MAGIC_BYTES));
+        header[sizeof(MAGIC_BYTES)] = w.id_bytes;
+
+        if (::ftruncate(w.fd, 0) != 0 || ::lseek(w.fd, 0, SEEK_SET) != 0)
+            return false;
+
+        if (!write_all(w.fd, header, sizeof(header)) || ::fsync(w.fd) != 0)
+            return false;
+
+        w.size = sizeof(header);
+        return true;
+    }
+
+    /*
+     * Opens (or creates) the journal and reads every intact transaction in it into `contents`/`txns`.
+     * Returns false if the file exists but belongs to something else, or holds records written by a build
+     * with other id widths.
+     *
+     * The journal is locked for as long as it stays open. If another process holds it, this fails with
+     * errno set to EWOULDBLOCK.
+     */
+    inline bool Open(Writer& w,
+                     const char* path,
+                     uint8_t id_bytes,
+                     std::vector<char>& contents,
+                     std::vector<Txn>& txns)
+    {
+        w.fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        w.id_bytes = id_bytes;
+        if (w.fd < 0 || ::flock(w.fd, LOCK_EX | LOCK_NB) != 0)
+            return false;
+
+        contents.clear();
+        txns.clear();
+
+        char chunk[1 << 16];
+        ssize_t got;
+        while ((got = ::read(w.fd, chunk, sizeof(chunk))) > 0)
+            contents.insert(contents.end(), chunk, chunk + got);
+
+        /* Empty, or torn while being created */
+        if (contents.size() < HEADER_SIZE)
+            return WriteHeader(w);
+
+        if (memcmp(contents.data(), MAGIC_BYTES, sizeof(MAGIC_BYTES)) != 0)
+            return false;
+
+        if ((uint8_t) contents[sizeof(MAGIC_BYTES)] != id_bytes)
+        {
+            /* Nothing to replay, so the journal can simply restart at this build's width */
+            if (contents.size() == HEADER_SIZE)
+                return WriteHeader(w);
+
+            return false;
+        }
+
+        const char* p = contents.data() + HEADER_SIZE;
+        const char* end = contents.data() + contents.size();
+
+        while ((size_t) (end - p) >= RECORD_HEADER_SIZE)
+        {
+            Txn txn;
+            uint32_t len, sum;
+
+            memcpy(&txn.seq, p, 8);
+            memcpy(&txn.ops, p + 8, 4);
+            memcpy(&len, p + 12, 4);
+            memcpy(&sum, p + 16, 4);
+
+            if ((size_t) (end - p) - RECORD_HEADER_SIZE < len)
+                break;
+
+            txn.begin = p + RECORD_HEADER_SIZE;
+            txn.end = txn.begin + len;
+
+            if (Checksum(txn.begin, len, Checksum(p, 16)) != sum)
+                break;
+
+            txns.push_back(txn);
+            p = txn.end;
+        }
+
+        w.size = p - contents.data();
+
+        /* Drop a torn tail so the next append starts on a record boundary */
+        if (w.size != contents.size() && ::ftruncate(w.fd, w.size) != 0)
+            return false;
+
+        return ::lseek(w.fd, w.size, SEEK_SET) == (off_t) w.size;
+    }
+
+    /* Appends one transaction and waits until it is on disk */
+    inline bool Append(Writer& w, uint64_t seq, uint32_t ops, const std::vector<char>& payload)
+    {
+        static std::vector<char> record;
+        record.resize(RECORD_HEADER_SIZE + payload.size());
+
+        uint32_t len = payload.size();
+
+        char* p = record.data();
+        memcpy(p, &seq, 8);
+        memcpy(p + 8, &ops, 4);
+        memcpy(p + 12, &len, 4);
+        memcpy(p + RECORD_HEADER_SIZE, payload.data(), len);
+
+        uint32_t sum = Checksum(p + RECORD_HEADER_SIZE, len, Checksum(p, 16));
+        memcpy(p + 16, &sum, 4);
+
+        if (!write_all(w.fd, record.data(), record.size()) || ::fdatasync(w.fd) != 0)
+        {
+            /* Don't leave half a record in front of the next one */
+            if (::ftruncate(w.fd, w.size) == 0)
+                ::lseek(w.fd, w.size, SEEK_SET);
+
+            return false;
+        }
+
+        w.size += record.size();
+        return true;
+    }
+
+    /* Empties the journal once a checkpoint made its records redundant */
+    inline bool Reset(Writer& w)
+    {
+        return WriteHeader(w);
+    }
+
+    inline void Close(Writer& w)
+    {
+        if (w.fd >= 0)
+            ::close(w.fd);
+
+        w.fd = -1;
+    }
+} // namespace Journal
+
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+
+#ifndef __APP_LEADERS_H_
+#define __APP_LEADERS_H_
+
+#include <vector>
+#include <set>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+/*
+ * Scores per key (an item slot, a member id) kept in order as they change, so the K highest are read off the
+ * front of `order` instead of scanning and sorting every key. A change costs O(log n); keys scoring 0 are left
+ * out. Ties go to the lower key.
+ *
+ * A board starts out not ready and ignores changes until Leaders::Build fills it, the first time it is asked
+ * for, so a session that never looks at it pays nothing.
+ */
+struct Leaderboard
+{
+    typedef std::pair<uint64_t, uint32_t> Entry; // score, key
+
+    struct Higher
+    {
+        bool operator()(const Entry& a, const Entry& b) const
+        {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    };
+
+    std::set<Entry, Higher> order;
+    std::vector<uint64_t> score; // by key
+    bool ready = false;
+};
+
+namespace Leaders
+{
+    inline uint64_t Get(const Leaderboard& board, uint32_t key)
+    {
+        return key < board.score.size() ? board.score[key] : 0;
+    }
+
+    inline void Set(Leaderboard& board, uint32_t key, uint64_t score)
+    {
+        if (!board.ready)
+            return;
+
+        if (key >= board.score.size())
+            board.score.resize(key + 1, 0);
+
+        auto& current = board.score[key];
+        if (current == score)
+            return;
+
+        if (current != 0)
+            board.order.erase({ current, key });
+
+        if (score != 0)
+            board.order.insert({ score, key });
+
+        current = score;
+    }
+
+    inline void Adjust(Leaderboard& board, uint32_t key, int64_t delta)
+    {
+        Set(board, key, Get(board, key) + delta);
+    }
+
+    /* Calls fn(uint32_t key, uint64_t score) for at most k keys, highest score first */
+    template<typename F>
+    inline void ForEachTop(const Leaderboard& board, size_t k, F fn)
+    {
+        for (auto it = board.order.begin(); it != board.order.end() && k > 0; ++it, --k)
+            fn(it->second, it->first);
+    }
+
+    /* Fills the board from every key's score at once, in O(n log n) for the sort and O(n) for the rest */
+    inline void Build(Leaderboard& board, std::vector<uint64_t> scores)
+    {
+        std::vector<Leaderboard::Entry> entries;
+        for (uint32_t key = 0; key < scores.size(); ++key)
+        {
+            if (scores[key] != 0)
+                entries.push_back({ scores[key], key });
+        }
+
+        std::sort(entries.begin(), entries.end(), Leaderboard::Higher());
+
+        board.order = std::set<Leaderboard::Entry, Leaderboard::Higher>(entries.begin(), entries.end());
+        board.score = std::move(scores);
+        board.ready = true;
+    }
+
+    /* Back to not ready, e.g. when the keys change meaning */
+    inline void Reset(Leaderboard& board)
+    {
+        board.order.clear();
+        board.score.clear();
+        board.score.shrink_to_fit();
+        board.ready = false;
+    }
+} // namespace Leaders
+
+#endif
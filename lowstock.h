@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef __APP_LOWSTOCK_H_
+#define __APP_LOWSTOCK_H_
+
+#include <vector>
+#include <cstdint>
+
+static constexpr uint32_t LOWSTOCK_NONE = (uint32_t) -1;
+
+/*
+ * Set of items whose available units have dropped below their reorder level. Slots (into inv.items) are
+ * kept densely packed so the report walks only alerting items; pos maps a slot back to its place in the
+ * list for O(1) removal.
+ */
+struct LowStockIndex
+{
+    std::vector<uint32_t> slots;
+    std::vector<uint32_t> pos;
+};
+
+namespace LowStock
+{
+    inline bool IsAlerting(const LowStockIndex& index, uint32_t slot)
+    {
+        return slot < index.pos.size() && index.pos[slot] != LOWSTOCK_NONE;
+    }
+
+    /* Returns true if the item just started alerting */
+    inline bool Update(LowStockIndex& index, uint32_t slot, bool below)
+    {
+        if (slot >= index.pos.size())
+            index.pos.resize(slot + 1, LOWSTOCK_NONE);
+
+        auto& p = index.pos[slot];
+
+        if (below && p == LOWSTOCK_NONE)
+        {
+            p = index.slots.size();
+            index.slots.push_back(slot);
+            return true;
+        }
+
+        if (!below && p != LOWSTOCK_NONE)
+        {
+            uint32_t moved = index.slots.back();
+            index.slots[p] = moved;
+            index.pos[moved] = p;
+            index.slots.pop_back();
+
+            p = LOWSTOCK_NONE;
+        }
+
+        return false;
+    }
+
+    inline void Clear(LowStockIndex& index)
+    {
+        index.slots.clear();
+        index.pos.clear();
+    }
+} // namespace LowStock
+
+#endif
@@ -0,0 +1,252 @@
+#pragma once
+
+#ifndef __APP_MEMBERLIST_H_
+#define __APP_MEMBERLIST_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+typedef uint32_t member_id_t;
+
+static constexpr uint32_t MEMBER_NONE = (uint32_t) -1;
+
+/*
+ * The names of a directory, in fixed chunks that are only ever appended to: a name never moves once added,
+ * so a snapshot keeps the chunks it saw by reference along with how many names there were, and the live
+ * directory goes on filling the last chunk past that count.
+ */
+struct MemberNames
+{
+    static constexpr uint32_t CHUNK = 256;
+
+    std::vector<std::shared_ptr<std::string>> chunks;
+    uint32_t count = 0;
+
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const std::string& operator[](uint32_t i) const { return chunks[i / CHUNK].get()[i % CHUNK]; }
+
+    template<typename... Args>
+    std::string& emplace_back(Args&&... args)
+    {
+        if (count == chunks.size() * CHUNK)
+            chunks.emplace_back(new std::string[CHUNK], std::default_delete<std::string[]>());
+
+        auto& name = chunks.back().get()[count++ % CHUNK];
+        name.assign(std::forward<Args>(args)...);
+        return name;
+    }
+
+    void reserve(uint32_t n) { chunks.reserve((n + CHUNK - 1) / CHUNK); }
+
+    /* Drops the chunks rather than emptying them, as snapshots may still hold them */
+    void clear()
+    {
+        chunks.clear();
+        count = 0;
+    }
+};
+
+/*
+ * Every member name ever assigned to, interned once. Ids never change, so lists and data files can keep them.
+ *
+ * table finds an id by name: open addressing with linear probing over MemberLists::NameHash, at most half
+ * full, MEMBER_NONE in empty buckets. The hash is fixed rather than std::hash, so the table can be saved with
+ * the data file and loaded as is.
+ */
+struct MemberDirectory
+{
+    MemberNames names;
+    std::vector<member_id_t> table;
+};
+
+/* One assignee of an item */
+struct MemberSlot
+{
+    member_id_t member;
+    uint32_t units;
+};
+
+static_assert(sizeof(MemberSlot) == 8, "MemberSlot is stored as is in data files");
+
+/*
+ * The assignees of one item, in one contiguous array. Up to INLINE_CAPACITY of them fit in the list itself;
+ * more move to the heap. Order is not kept: removing a member moves the last one into its place.
+ *
+ * Like the member chains it replaces, a list is a plain value owned by whoever holds the item; copy it with
+ * MemberLists::Copy and release it with MemberLists::Free.
+ */
+struct MemberList
+{
+    static constexpr uint32_t INLINE_CAPACITY = 2;
+
+    uint32_t size;
+    uint32_t capacity;
+
+    union
+    {
+        MemberSlot small[INLINE_CAPACITY];
+        MemberSlot* heap;
+    };
+
+    MemberList() : size(0), capacity(INLINE_CAPACITY) {}
+
+    bool empty() const { return size == 0; }
+
+    MemberSlot* data() { return capacity > INLINE_CAPACITY ? heap : small; }
+    const MemberSlot* data() const { return capacity > INLINE_CAPACITY ? heap : small; }
+
+    MemberSlot& operator[](uint32_t i) { return data()[i]; }
+    const MemberSlot& operator[](uint32_t i) const { return data()[i]; }
+};
+
+namespace MemberLists
+{
+    /* 64-bit FNV-1a */
+    inline uint64_t NameHash(const char* name, size_t len)
+    {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < len; ++i)
+            h = (h ^ (unsigned char) name[i]) * 0x100000001b3ull;
+
+        return h;
+    }
+
+    inline member_id_t Find(const MemberDirectory& dir, const char* name, size_t len)
+    {
+        if (dir.table.empty())
+            return MEMBER_NONE;
+
+        size_t mask = dir.table.size() - 1;
+        for (size_t b = NameHash(name, len) & mask;; b = (b + 1) & mask)
+        {
+            auto id = dir.table[b];
+            if (id == MEMBER_NONE)
+                return MEMBER_NONE;
+
+            auto& candidate = dir.names[id];
+            if (candidate.size() == len && memcmp(candidate.data(), name, len) == 0)
+                return id;
+        }
+    }
+
+    inline void place(MemberDirectory& dir, member_id_t id)
+    {
+        size_t mask = dir.table.size() - 1;
+        size_t b = NameHash(dir.names[id].data(), dir.names[id].size()) & mask;
+
+        while (dir.table[b] != MEMBER_NONE)
+            b = (b + 1) & mask;
+
+        dir.table[b] = id;
+    }
+
+    /* Fills the table from names, e.g. once they are loaded. Returns false if a name repeats */
+    inline bool Index(MemberDirectory& dir)
+    {
+        size_t buckets = 64;
+        while (buckets < dir.names.size() * 2)
+            buckets *= 2;
+
+        dir.table.assign(buckets, MEMBER_NONE);
+
+        for (member_id_t id = 0; id < dir.names.size(); ++id)
+        {
+            if (Find(dir, dir.names[id].data(), dir.names[id].size()) != MEMBER_NONE)
+                return false;
+
+            place(dir, id);
+        }
+
+        return true;
+    }
+
+    inline member_id_t Intern(MemberDirectory& dir, const char* name, size_t len)
+    {
+        auto id = Find(dir, name, len);
+        if (id != MEMBER_NONE)
+            return id;
+
+        id = dir.names.size();
+        dir.names.emplace_back(name, len);
+
+        if (dir.names.size() * 2 > dir.table.size())
+            Index(dir);
+        else
+            place(dir, id);
+
+        return id;
+    }
+
+    inline void Clear(MemberDirectory& dir)
+    {
+        dir.names.clear();
+        dir.table.clear();
+    }
+
+    /* Position of the member in the list, or MEMBER_NONE */
+    inline uint32_t IndexOf(const MemberList& list, member_id_t member)
+    {
+        auto slots = list.data();
+        for (uint32_t i = 0; i < list.size; ++i)
+            if (slots[i].member == member)
+                return i;
+
+        return MEMBER_NONE;
+    }
+
+    inline void Reserve(MemberList& list, uint32_t capacity)
+    {
+        if (capacity <= list.capacity)
+            return;
+
+        auto grown = new MemberSlot[capacity];
+        memcpy(grown, list.data(), list.size * sizeof(MemberSlot));
+
+        if (list.capacity > MemberList::INLINE_CAPACITY)
+            delete[] list.heap;
+
+        list.heap = grown;
+        list.capacity = capacity;
+    }
+
+    inline void Append(MemberList& list, member_id_t member, uint32_t units)
+    {
+        if (list.size == list.capacity)
+            Reserve(list, list.capacity * 2);
+
+        list[list.size++] = { member, units };
+    }
+
+    /* O(1): the last slot takes the place of the removed one */
+    inline void SwapRemove(MemberList& list, uint32_t i)
+    {
+        list[i] = list[list.size - 1];
+        --list.size;
+    }
+
+    inline void Free(MemberList& list)
+    {
+        if (list.capacity > MemberList::INLINE_CAPACITY)
+            delete[] list.heap;
+
+        list = MemberList();
+    }
+
+    inline MemberList Copy(const MemberList& list)
+    {
+        MemberList copy;
+        Reserve(copy, list.size);
+
+        memcpy(copy.data(), list.data(), list.size * sizeof(MemberSlot));
+        copy.size = list.size;
+
+        return copy;
+    }
+} // namespace MemberLists
+
+#endif
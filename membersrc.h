@@ -0,0 +1,126 @@
+#pragma once
+
+#ifndef __APP_MEMBERSRC_H_
+#define __APP_MEMBERSRC_H_
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Member lists are decoded from the data file the first time something needs them (see Core::Members);
+ * until then an item only records where its list is stored. MemberSource is that file, opened a second
+ * time: memory-mapped, so lists nobody looks at are never even paged in, or as a stream of its own.
+ *
+ * APP_LAZY_MEMBERS picks the backend: 1 maps the file, 2 reads it through an ifstream, 0 maps it but decodes
+ * every list while loading, like before.
+ *
+ * A source holds on to the file as it was loaded. Checkpoints write a new file and rename it into place
+ * (see Serialization::WriteToFile), so the old contents stay readable for as long as some item still refers
+ * to them.
+ */
+#ifndef APP_LAZY_MEMBERS
+    #define APP_LAZY_MEMBERS 1
+#endif
+
+struct MemberSource
+{
+    uint64_t size = 0;
+
+    /* mmap backend */
+    const char* base = nullptr;
+
+    /* ifstream backend. Snapshots are saved on a thread of their own, so reads take the lock */
+    std::ifstream stream;
+    std::mutex lock;
+    uint64_t at = 0; // stream position; reading on from it needs no seek, which would drop the buffer
+
+    MemberSource() = default;
+    MemberSource(const MemberSource&) = delete;
+    MemberSource& operator=(const MemberSource&) = delete;
+
+    ~MemberSource()
+    {
+        if (base != nullptr)
+            ::munmap((void*) base, size);
+    }
+};
+
+namespace MemberSources
+{
+    /* Stored position of an item whose list is already in memory */
+    static constexpr uint64_t NONE = (uint64_t) -1;
+
+    inline std::shared_ptr<MemberSource> Open(const char* path)
+    {
+        std::shared_ptr<MemberSource> src(new MemberSource);
+
+#if APP_LAZY_MEMBERS != 2
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return nullptr;
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+
+        src->size = st.st_size;
+
+        /* The mapping keeps the file alive on its own */
+        void* base = src->size > 0 ? ::mmap(nullptr, src->size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        ::close(fd);
+
+        if (base == MAP_FAILED)
+            return nullptr;
+
+        src->base = (const char*) base;
+#else
+        src->stream.open(path, std::ios::binary);
+        src->stream.seekg(0, std::ios::end);
+        src->size = src->stream.tellg();
+        src->at = src->size;
+
+        if (!src->stream)
+            return nullptr;
+#endif
+
+        return src;
+    }
+
+    /* Copies the n bytes at pos. Fails on anything past the end of the file */
+    inline bool Read(MemberSource& src, uint64_t pos, void* dst, size_t n)
+    {
+        if (pos > src.size || src.size - pos < n)
+            return false;
+
+#if APP_LAZY_MEMBERS != 2
+        memcpy(dst, src.base + pos, n);
+        return true;
+#else
+        std::lock_guard<std::mutex> hold(src.lock);
+
+        if (src.at != pos)
+        {
+            src.stream.clear();
+            src.stream.seekg(pos);
+        }
+
+        src.stream.read((char*) dst, n);
+        src.at = src.stream.fail() ? MemberSources::NONE : pos + n;
+
+        return !src.stream.fail();
+#endif
+    }
+} // namespace MemberSources
+
+#endif
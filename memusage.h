@@ -0,0 +1,301 @@
+#pragma once
+
+#ifndef __APP_MEMUSAGE_H_
+#define __APP_MEMUSAGE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "repr.h"
+
+/*
+ * Where the memory of an inventory goes, structure by structure. Each line counts the bytes in use by what
+ * the structure holds and the bytes allocated for it, which adds spare capacity (vectors grown ahead, the
+ * unused end of arena blocks and pages). Sizes of standard containers are worked out from their layout in
+ * libstdc++: hash tables as one node per element plus the bucket array, sets as red-black tree nodes, and
+ * strings as their heap buffer once they outgrow the 15 characters kept in the object.
+ *
+ * Pages and arena blocks shared with snapshots are counted as the live inventory's.
+ */
+struct MemoryLine
+{
+    const char* name;
+    uint64_t used = 0;
+    uint64_t allocated = 0;
+};
+
+struct MemoryUsage
+{
+    std::vector<MemoryLine> lines;
+
+    uint32_t items = 0;
+    uint64_t item_bytes = 0;    // allocated for item records, pages included
+    uint64_t members = 0;       // assignments in memory
+    uint64_t member_bytes = 0;  // allocated for member lists outside item records
+    uint64_t stored_lists = 0;  // member lists still only in the data file
+    uint64_t string_bytes = 0;  // distinct arena strings items refer to, as stored
+    uint64_t rss = 0;           // resident size of the process, 0 if unknown
+};
+
+namespace MemoryUsages
+{
+    static constexpr size_t SSO_CAPACITY = 15;
+
+    template<typename T>
+    inline void add(MemoryLine& line, const std::vector<T>& v)
+    {
+        line.used += v.size() * sizeof(T);
+        line.allocated += v.capacity() * sizeof(T);
+    }
+
+    inline uint64_t heap_bytes(const std::string& s)
+    {
+        return s.capacity() > SSO_CAPACITY ? s.capacity() + 1 : 0;
+    }
+
+    inline void add(MemoryLine& line, const std::vector<std::string>& v)
+    {
+        line.used += v.size() * sizeof(std::string);
+        line.allocated += v.capacity() * sizeof(std::string);
+
+        for (auto& s : v)
+        {
+            line.used += s.size() > SSO_CAPACITY ? s.size() + 1 : 0;
+            line.allocated += heap_bytes(s);
+        }
+    }
+
+    inline void add(MemoryLine& line, const MemberNames& names)
+    {
+        line.used += (uint64_t) names.size() * sizeof(std::string);
+        line.allocated += names.chunks.size() * MemberNames::CHUNK * sizeof(std::string)
+                        + names.chunks.capacity() * sizeof(std::shared_ptr<std::string>);
+
+        for (uint32_t i = 0; i < names.size(); ++i)
+        {
+            line.used += names[i].size() > SSO_CAPACITY ? names[i].size() + 1 : 0;
+            line.allocated += heap_bytes(names[i]);
+        }
+    }
+
+    inline void add(MemoryLine& line, const DueHeap& heap)
+    {
+        line.used += (uint64_t) heap.size() * sizeof(DueEntry);
+        line.allocated += heap.chunks.size() * DueHeap::CHUNK * sizeof(DueEntry)
+                        + heap.chunks.capacity() * sizeof(std::shared_ptr<DueEntry>);
+    }
+
+    /* Nodes hold the next pointer and the element, and the key's hash too unless hashing it is cheap */
+    template<typename K, typename V>
+    inline void add(MemoryLine& line, const std::unordered_map<K, V>& m)
+    {
+        size_t hash = std::is_integral<K>::value ? 0 : sizeof(size_t);
+        size_t node = sizeof(void*) + sizeof(std::pair<const K, V>) + hash;
+        line.used += m.size() * node;
+        line.allocated += m.size() * node + m.bucket_count() * sizeof(void*);
+    }
+
+    inline MemoryLine& line(MemoryUsage& usage, const char* name)
+    {
+        usage.lines.emplace_back();
+        usage.lines.back().name = name;
+        return usage.lines.back();
+    }
+
+    inline void Items(const Inventory& inv, MemoryUsage& usage)
+    {
+#if APP_COMPACT_ITEMS
+        static constexpr size_t page_bytes = PAGE_BYTES;
+#else
+        static constexpr size_t page_bytes = sizeof(ItemPage);
+#endif
+
+        auto& pages = inv.items.pages;
+
+        auto& items = line(usage, "Item records");
+        items.used = (uint64_t) inv.count * sizeof(InventoryItem);
+        items.allocated = pages.size() * page_bytes + pages.capacity() * sizeof(ItemPage*);
+        usage.item_bytes = items.allocated;
+
+        auto& lists = line(usage, "Member lists");
+        for (size_t p = 0; p < pages.size(); ++p)
+        {
+            auto page = pages[p];
+
+#if APP_COMPACT_ITEMS
+            auto& table = page->lists;
+            lists.used += (table.size - table.unused.size()) * sizeof(MemberEntry);
+            lists.allocated += table.chunks.size() * MemberTable::CHUNK * sizeof(MemberEntry)
+                             + table.chunks.capacity() * sizeof(void*) + table.unused.capacity() * sizeof(uint32_t);
+#endif
+
+            for (uint32_t i = 0; i < page->count; ++i)
+            {
+                auto& item = page->items()[i];
+                auto& list = members_of(item);
+
+                usage.members += list.size;
+                usage.stored_lists += stored_members_of(item) != MemberSources::NONE;
+
+                if (list.capacity > MemberList::INLINE_CAPACITY)
+                {
+                    lists.used += list.size * sizeof(MemberSlot);
+                    lists.allocated += list.capacity * sizeof(MemberSlot);
+                }
+            }
+        }
+
+        usage.member_bytes = lists.allocated;
+    }
+
+    inline void StringData(const Inventory& inv, MemoryUsage& usage)
+    {
+#if APP_COMPACT_ITEMS
+        static constexpr size_t OVERHEAD = sizeof(uint32_t) + 1; // length and terminator
+#else
+        static constexpr size_t OVERHEAD = 1;
+#endif
+
+        /* Equal strings may be stored once, so each is counted by where it lives */
+        std::vector<std::pair<const char*, uint32_t>> strings;
+        for (uint32_t i = 0; i < inv.count; ++i)
+        {
+            auto& meta = inv.items[i].meta;
+
+            if (meta.name.in_arena())
+                strings.emplace_back(meta.name.data(), meta.name.size());
+
+            if (meta.cat.in_arena())
+                strings.emplace_back(meta.cat.data(), meta.cat.size());
+        }
+
+        std::sort(strings.begin(), strings.end());
+        strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+
+        for (auto& s : strings)
+            usage.string_bytes += s.second + OVERHEAD;
+
+        auto& arena = line(usage, "String arena");
+        arena.used = inv.strings.used;
+        arena.allocated = inv.strings.reserved + inv.strings.blocks.capacity() * sizeof(std::shared_ptr<char>);
+
+#if APP_COMPACT_ITEMS
+        add(line(usage, "String pool"), inv.strings.pool);
+#endif
+
+        auto& names = line(usage, "Member directory");
+        add(names, inv.member_names.names);
+        add(names, inv.member_names.table);
+    }
+
+    inline void Indexes(const Inventory& inv, MemoryUsage& usage)
+    {
+        auto& cats = line(usage, "Category index");
+        add(cats, inv.categories.lookup);
+        add(cats, inv.categories.entries);
+        add(cats, inv.categories.links);
+
+        for (auto& entry : inv.categories.entries)
+        {
+            add(cats, entry.slots);
+            cats.used += entry.name.size() > SSO_CAPACITY ? entry.name.size() + 1 : 0;
+            cats.allocated += heap_bytes(entry.name);
+        }
+
+        for (auto& kv : inv.categories.lookup)
+        {
+            cats.used += kv.first.size() > SSO_CAPACITY ? kv.first.size() + 1 : 0;
+            cats.allocated += heap_bytes(kv.first);
+        }
+
+        auto& columns = line(usage, "Scan columns");
+        add(columns, inv.columns.counts);
+        add(columns, inv.columns.active);
+
+        auto& low = line(usage, "Low stock index");
+        add(low, inv.low_stock.slots);
+        add(low, inv.low_stock.pos);
+
+        auto& ids = line(usage, "Id index");
+        add(ids, inv.ids.keys);
+        add(ids, inv.ids.slots);
+
+        auto& names = line(usage, "Name index");
+        add(names, inv.names.sorted);
+        add(names, inv.names.added);
+
+        auto& due = line(usage, "Due dates");
+        add(due, inv.due.heap);
+        add(due, inv.due.pos);
+
+        /* Tree nodes carry a colour and three links besides the entry */
+        auto& leaders = line(usage, "Leaderboards");
+        for (auto board : { &inv.top_items, &inv.top_members })
+        {
+            size_t node = sizeof(Leaderboard::Entry) + 4 * sizeof(void*);
+            leaders.used += board->order.size() * node;
+            leaders.allocated += board->order.size() * node;
+            add(leaders, board->score);
+        }
+
+        auto& digest = line(usage, "State digest");
+        add(digest, inv.digest.touched);
+        add(digest, inv.digest.is_touched);
+    }
+
+    inline void Logs(const Inventory& inv, MemoryUsage& usage)
+    {
+        auto& ops = line(usage, "Undo and redo log");
+        add(ops, inv.log.undo);
+        add(ops, inv.log.undo_marks);
+        add(ops, inv.log.redo);
+        add(ops, inv.log.redo_marks);
+        add(ops, inv.log.pending);
+
+        /* The events themselves are in mapped files */
+        auto& history = line(usage, "History index");
+        add(history, inv.history.segments);
+        add(history, inv.history.index);
+        add(history, inv.history.last_of_item);
+        add(history, inv.history.staged);
+
+        add(line(usage, "Trace buffer"), inv.trace.buf);
+    }
+
+    /* Resident set size from /proc, or 0 where there is none */
+    inline uint64_t ResidentBytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+
+        uint64_t size, resident;
+        if (!(statm >> size >> resident))
+            return 0;
+
+        return resident * (uint64_t) sysconf(_SC_PAGESIZE);
+    }
+
+    inline MemoryUsage Measure(const Inventory& inv)
+    {
+        MemoryUsage usage;
+        usage.items = inv.count;
+        usage.rss = ResidentBytes(); // before measuring takes memory of its own
+        usage.lines.reserve(16);     // lines are filled in through references
+
+        Items(inv, usage);
+        StringData(inv, usage);
+        Indexes(inv, usage);
+        Logs(inv, usage);
+
+        return usage;
+    }
+} // namespace MemoryUsages
+
+#endif
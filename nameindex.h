@@ -0,0 +1,148 @@
+#pragma once
+
+#ifndef __APP_NAMEINDEX_H_
+#define __APP_NAMEINDEX_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "strarena.h"
+
+/*
+ * Slots of the active items sorted by name (then slot), so looking a name up is a binary search. Items
+ * added since the last lookup wait unsorted in `added` and are merged in by whatever next needs the order,
+ * so a run of adds such as an import costs one sort rather than a shifted array per item.
+ *
+ * Like the leaderboards it starts out not ready and ignores changes until it is built, the first time it is
+ * needed, unless the data file carried it. Functions that compare names take name_of(slot), which returns
+ * the item's name as an ArenaString.
+ */
+struct NameIndex
+{
+    std::vector<uint32_t> sorted;
+    std::vector<uint32_t> added;
+    bool ready = false;
+};
+
+namespace NameIndexes
+{
+    inline int compare(const char* a, size_t a_len, const char* b, size_t b_len)
+    {
+        int c = memcmp(a, b, std::min(a_len, b_len));
+        return c != 0 ? c : (a_len < b_len ? -1 : a_len > b_len);
+    }
+
+    template<typename NameOf>
+    struct Less
+    {
+        NameOf name_of;
+
+        bool operator()(uint32_t a, uint32_t b) const
+        {
+            auto& x = name_of(a);
+            auto& y = name_of(b);
+
+            int c = compare(x.data(), x.size(), y.data(), y.size());
+            return c != 0 ? c < 0 : a < b;
+        }
+    };
+
+    template<typename NameOf>
+    inline Less<NameOf> less(NameOf name_of)
+    {
+        return Less<NameOf> { name_of };
+    }
+
+    /* Merges the added slots into the sorted ones */
+    template<typename NameOf>
+    inline void Settle(NameIndex& index, NameOf name_of)
+    {
+        if (index.added.empty())
+            return;
+
+        auto mid = index.sorted.size();
+
+        std::sort(index.added.begin(), index.added.end(), less(name_of));
+        index.sorted.insert(index.sorted.end(), index.added.begin(), index.added.end());
+        std::inplace_merge(index.sorted.begin(), index.sorted.begin() + mid, index.sorted.end(), less(name_of));
+
+        index.added.clear();
+    }
+
+    inline void Insert(NameIndex& index, uint32_t slot)
+    {
+        if (index.ready)
+            index.added.push_back(slot);
+    }
+
+    /* The item must still have the name it was indexed under */
+    template<typename NameOf>
+    inline void Erase(NameIndex& index, uint32_t slot, NameOf name_of)
+    {
+        if (!index.ready)
+            return;
+
+        Settle(index, name_of);
+
+        auto it = std::lower_bound(index.sorted.begin(), index.sorted.end(), slot, less(name_of));
+        if (it != index.sorted.end() && *it == slot)
+            index.sorted.erase(it);
+    }
+
+    /* The slots of the items with this name, in slot order. Needs a ready index */
+    template<typename NameOf>
+    inline std::pair<const uint32_t*, const uint32_t*> Equal(NameIndex& index,
+                                                            const char* name,
+                                                            size_t len,
+                                                            NameOf name_of)
+    {
+        Settle(index, name_of);
+
+        auto below = [&](uint32_t slot, int) {
+            auto& s = name_of(slot);
+            return compare(s.data(), s.size(), name, len) < 0;
+        };
+        auto above = [&](int, uint32_t slot) {
+            auto& s = name_of(slot);
+            return compare(name, len, s.data(), s.size()) < 0;
+        };
+
+        auto first = std::lower_bound(index.sorted.begin(), index.sorted.end(), 0, below);
+        auto last = std::upper_bound(first, index.sorted.end(), 0, above);
+
+        auto base = index.sorted.data();
+        return { base + (first - index.sorted.begin()), base + (last - index.sorted.begin()) };
+    }
+
+    /* Sorts the given slots into a ready index */
+    template<typename NameOf>
+    inline void Build(NameIndex& index, std::vector<uint32_t> slots, NameOf name_of)
+    {
+        std::sort(slots.begin(), slots.end(), less(name_of));
+
+        index.sorted = std::move(slots);
+        index.added.clear();
+        index.ready = true;
+    }
+
+    /* Takes slots already in order, e.g. from a data file */
+    inline void Adopt(NameIndex& index, std::vector<uint32_t> sorted)
+    {
+        index.sorted = std::move(sorted);
+        index.added.clear();
+        index.ready = true;
+    }
+
+    inline void Reset(NameIndex& index)
+    {
+        index.sorted.clear();
+        index.sorted.shrink_to_fit();
+        index.added.clear();
+        index.ready = false;
+    }
+} // namespace NameIndexes
+
+#endif
@@ -0,0 +1,264 @@
+#pragma once
+
+#ifndef __APP_OPLOG_H_
+#define __APP_OPLOG_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Every change Core makes is one of these operations, and each has an exact inverse:
+ *
+ *   Add      <->  Drop       (append an item / remove the last one)
+ *   Delete   <->  Undelete
+ *   Assign   <->  Retrieve   (`count` units, to / from a member by name)
+ *   Edit     <->  Edit       (with the previous name, category, unit count and reorder level)
+ *   SetDue   <->  SetDue     (a member's due date for an item, with the previous one; 0 = none)
+ *
+ * Items are addressed by slot, which stays valid because undo and redo run strictly in reverse order.
+ */
+enum class OpKind : uint8_t
+{
+    Add = 1,
+    Drop,
+    Delete,
+    Undelete,
+    Assign,
+    Retrieve,
+    Edit,
+    AssignUnits, // only ever encoded: Assign/Retrieve of more than one unit, see OpLog::Encode
+    RetrieveUnits,
+    SetDue,
+};
+
+/* A decoded operation. Strings point into the buffer it was decoded from */
+template<typename IdT>
+struct Op
+{
+    OpKind kind;
+
+    uint32_t slot = 0;
+    IdT id = 0;
+    uint32_t count = 0; // unit count for Add/Edit, units moved for Assign/Retrieve
+    uint32_t reorder = 0;
+    uint64_t time = 0; // due date for SetDue
+
+    const char* name = nullptr; // item name, or member name for Assign/Retrieve/SetDue
+    uint32_t name_len = 0;
+    const char* cat = nullptr;
+    uint32_t cat_len = 0;
+};
+
+/*
+ * Operations are stored encoded back to back in byte buffers: the kind, only the fields that kind uses,
+ * then the record's total length so a buffer can be walked backwards as a stack. Undoing an Add costs
+ * five bytes, an Assign about as many as the member's name.
+ *
+ * undo/redo hold inverse records, grouped into transactions by the offsets in *_marks. pending holds the
+ * forward records of the transaction in progress; that is what gets persisted when it commits.
+ */
+struct OperationLog
+{
+    enum class Mode : uint8_t
+    {
+        Normal,  // a new change: inverses go to undo, and redo is forgotten
+        Undoing, // inverses go to redo
+        Redoing, // inverses go to undo
+        Off,     // rolling back or replaying: nothing is recorded
+    };
+
+    std::vector<char> undo;
+    std::vector<size_t> undo_marks;
+
+    std::vector<char> redo;
+    std::vector<size_t> redo_marks;
+
+    std::vector<char> pending;
+    uint32_t pending_ops = 0;
+
+    Mode mode = Mode::Normal;
+    bool open = false;       // inside an explicit Begin ... Commit
+    size_t txn_start = 0;    // offset in undo where the current transaction starts
+    uint64_t seq = 0;        // number of the last transaction made durable
+    bool checkpoint = false; // something happened that only a full save can persist
+};
+
+namespace OpLog
+{
+    template<typename T>
+    inline void put(std::vector<char>& buf, const T& x)
+    {
+        auto at = buf.size();
+        buf.resize(at + sizeof(T));
+        memcpy(buf.data() + at, &x, sizeof(T));
+    }
+
+    inline void put_string(std::vector<char>& buf, const char* p, uint32_t len)
+    {
+        put(buf, len);
+        buf.insert(buf.end(), p, p + len);
+    }
+
+    template<typename T>
+    inline bool get(const char*& p, const char* end, T& x)
+    {
+        if ((size_t) (end - p) < sizeof(T))
+            return false;
+
+        memcpy(&x, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    inline bool get_string(const char*& p, const char* end, const char*& s, uint32_t& len)
+    {
+        if (!get(p, end, len) || (size_t) (end - p) < len)
+            return false;
+
+        s = p;
+        p += len;
+        return true;
+    }
+
+    /*
+     * A single-unit Assign or Retrieve is stored as it always was, without a count, so journals written
+     * before counts existed still replay. Anything more goes under the *Units kinds, which add one.
+     */
+    template<typename IdT>
+    inline void Encode(std::vector<char>& buf, const Op<IdT>& op)
+    {
+        auto start = buf.size();
+        auto kind = op.kind;
+
+        if (op.count > 1 && kind == OpKind::Assign)
+            kind = OpKind::AssignUnits;
+        else if (op.count > 1 && kind == OpKind::Retrieve)
+            kind = OpKind::RetrieveUnits;
+
+        put(buf, kind);
+
+        switch (kind)
+        {
+            case OpKind::Add:
+                put(buf, op.id);
+                put(buf, op.count);
+                put(buf, op.reorder);
+                put_string(buf, op.name, op.name_len);
+                put_string(buf, op.cat, op.cat_len);
+                break;
+
+            case OpKind::Drop:
+                break;
+
+            case OpKind::Delete:
+            case OpKind::Undelete:
+                put(buf, op.slot);
+                break;
+
+            case OpKind::Assign:
+            case OpKind::Retrieve:
+                put(buf, op.slot);
+                put_string(buf, op.name, op.name_len);
+                break;
+
+            case OpKind::AssignUnits:
+            case OpKind::RetrieveUnits:
+                put(buf, op.slot);
+                put(buf, op.count);
+                put_string(buf, op.name, op.name_len);
+                break;
+
+            case OpKind::SetDue:
+                put(buf, op.slot);
+                put(buf, op.time);
+                put_string(buf, op.name, op.name_len);
+                break;
+
+            case OpKind::Edit:
+                put(buf, op.slot);
+                put(buf, op.count);
+                put(buf, op.reorder);
+                put_string(buf, op.name, op.name_len);
+                put_string(buf, op.cat, op.cat_len);
+                break;
+        }
+
+        put(buf, (uint32_t) (buf.size() - start + sizeof(uint32_t)));
+    }
+
+    /* Decodes the record starting at p. Returns false if it is truncated or not a known kind */
+    template<typename IdT>
+    inline bool Decode(const char*& p, const char* end, Op<IdT>& op)
+    {
+        op = Op<IdT> {};
+
+        if (!get(p, end, op.kind))
+            return false;
+
+        bool ok = true;
+
+        switch (op.kind)
+        {
+            case OpKind::Add:
+                ok = get(p, end, op.id) && get(p, end, op.count) && get(p, end, op.reorder)
+                     && get_string(p, end, op.name, op.name_len) && get_string(p, end, op.cat, op.cat_len);
+                break;
+
+            case OpKind::Drop:
+                break;
+
+            case OpKind::Delete:
+            case OpKind::Undelete:
+                ok = get(p, end, op.slot);
+                break;
+
+            case OpKind::Assign:
+            case OpKind::Retrieve:
+                op.count = 1;
+                ok = get(p, end, op.slot) && get_string(p, end, op.name, op.name_len);
+                break;
+
+            case OpKind::AssignUnits:
+            case OpKind::RetrieveUnits:
+                op.kind = op.kind == OpKind::AssignUnits ? OpKind::Assign : OpKind::Retrieve;
+                ok = get(p, end, op.slot) && get(p, end, op.count) && get_string(p, end, op.name, op.name_len);
+                break;
+
+            case OpKind::SetDue:
+                ok = get(p, end, op.slot) && get(p, end, op.time) && get_string(p, end, op.name, op.name_len);
+                break;
+
+            case OpKind::Edit:
+                ok = get(p, end, op.slot) && get(p, end, op.count) && get(p, end, op.reorder)
+                     && get_string(p, end, op.name, op.name_len) && get_string(p, end, op.cat, op.cat_len);
+                break;
+
+            default:
+                return false;
+        }
+
+        uint32_t len;
+        return ok && get(p, end, len);
+    }
+
+    /* Start of the record that ends at `end` */
+    inline size_t Previous(const std::vector<char>& buf, size_t end)
+    {
+        uint32_t len;
+        memcpy(&len, buf.data() + end - sizeof(len), sizeof(len));
+        return end - len;
+    }
+
+    /* Forgets history, e.g. after a change that cannot be undone */
+    inline void Clear(OperationLog& log)
+    {
+        log.undo.clear();
+        log.undo_marks.clear();
+        log.redo.clear();
+        log.redo_marks.clear();
+        log.txn_start = 0;
+    }
+} // namespace OpLog
+
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+
+#ifndef __APP_PARSE_H_
+#define __APP_PARSE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+/* Allocation-free text helpers shared by the interactive prompts and the CSV reader */
+namespace Parse
+{
+    enum class Error
+    {
+        None = 0,
+        Invalid,  // no digits at the start of the input
+        Overflow, // the digits describe a value larger than the allowed maximum
+    };
+
+    struct Result
+    {
+        const char* ptr; // one past the last character consumed
+        Error ec;
+    };
+
+    /*
+     * Unsigned decimal at the start of [first, last), in the spirit of std::from_chars: no sign, no leading
+     * whitespace, stops at the first non-digit. The range check happens before every multiply-add, so nothing
+     * above `max` is ever produced, let alone wrapped.
+     */
+    inline Result Uint(const char* first, const char* last, uint64_t max, uint64_t& out)
+    {
+        const char* p = first;
+        uint64_t v = 0;
+
+        for (; p != last; ++p)
+        {
+            unsigned d = (unsigned char) *p - '0';
+            if (d > 9)
+                break;
+
+            if (d > max || v > (max - d) / 10)
+            {
+                /* Swallow the rest of the digits so ptr still marks the end of the number */
+                while (p != last && (unsigned) ((unsigned char) *p - '0') <= 9)
+                    ++p;
+
+                return { p, Error::Overflow };
+            }
+
+            v = v * 10 + d;
+        }
+
+        if (p == first)
+            return { first, Error::Invalid };
+
+        out = v;
+        return { p, Error::None };
+    }
+
+    inline bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+    }
+
+    /* Narrows [p, p + len) to exclude leading and trailing whitespace */
+    inline void Trim(const char*& p, size_t& len)
+    {
+        while (len > 0 && IsSpace(*p))
+        {
+            ++p;
+            --len;
+        }
+
+        while (len > 0 && IsSpace(p[len - 1]))
+            --len;
+    }
+
+    inline bool IsBlank(const char* p, size_t len)
+    {
+        Trim(p, len);
+        return len == 0;
+    }
+
+    /* Local date and time as "YYYY-MM-DD", "YYYY-MM-DD HH:MM" or "YYYY-MM-DD HH:MM:SS" */
+    inline bool LocalTime(const char* p, size_t len, time_t& out)
+    {
+        Trim(p, len);
+
+        const char* end = p + len;
+        const char seps[] = { '-', '-', ' ', ':', ':' };
+        const uint64_t max[] = { 9999, 12, 31, 23, 59, 60 };
+        uint64_t parts[6] = { 0, 1, 1, 0, 0, 0 };
+
+        int n = 0;
+        while (true)
+        {
+            auto res = Uint(p, end, max[n], parts[n]);
+            if (res.ec != Error::None)
+                return false;
+
+            p = res.ptr;
+            ++n;
+
+            if (p == end || n == 6 || *p != seps[n - 1])
+                break;
+
+            ++p;
+        }
+
+        /* Date alone, or date with at least hours and minutes */
+        if (p != end || (n != 3 && n != 5 && n != 6) || parts[1] == 0 || parts[2] == 0)
+            return false;
+
+        tm t = {};
+        t.tm_year = parts[0] - 1900;
+        t.tm_mon = parts[1] - 1;
+        t.tm_mday = parts[2];
+        t.tm_hour = parts[3];
+        t.tm_min = parts[4];
+        t.tm_sec = parts[5];
+        t.tm_isdst = -1;
+
+        out = mktime(&t);
+        return out != (time_t) -1;
+    }
+} // namespace Parse
+
+#endif
@@ -0,0 +1,196 @@
+#pragma once
+
+#ifndef __APP_POOL_H_
+#define __APP_POOL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of threads that run one job at a time over a range of morsels (small, independent pieces of
+ * work, numbered from 0). The morsels are dealt out evenly to the workers up front; a worker takes its own
+ * from the front, and once they run out it steals the back half of whatever another worker has left, so
+ * uneven morsels or a descheduled thread don't hold the job up.
+ *
+ * The thread calling Pool::Run is worker 0 and works along; the pool adds size - 1 threads of its own.
+ */
+struct WorkPool
+{
+    /* Morsels [next, end) of one worker's share not taken yet */
+    struct Queue
+    {
+        std::mutex lock;
+        uint32_t next = 0;
+        uint32_t end = 0;
+    };
+
+    unsigned size = 1;
+    std::unique_ptr<Queue[]> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex lock;
+    std::condition_variable wake; // a job was posted, or the pool stops
+    std::condition_variable idle; // the last helper finished its part of the job
+
+    std::function<void(unsigned worker, uint32_t morsel)> job;
+    uint64_t round = 0; // jobs posted so far
+    unsigned busy = 0;  // helpers still on the current job
+    bool stopping = false;
+
+    WorkPool() = default;
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+    ~WorkPool();
+};
+
+namespace Pool
+{
+    inline bool take(WorkPool::Queue& q, uint32_t& morsel)
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.next == q.end)
+            return false;
+
+        morsel = q.next++;
+        return true;
+    }
+
+    /* Moves the back half of another worker's share into worker w's (empty) queue */
+    inline bool steal(WorkPool& pool, unsigned w)
+    {
+        for (unsigned i = 1; i < pool.size; ++i)
+        {
+            auto& victim = pool.queues[(w + i) % pool.size];
+            uint32_t from, to;
+            {
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (victim.next == victim.end)
+                    continue;
+
+                to = victim.end;
+                from = to - (to - victim.next + 1) / 2;
+                victim.end = from;
+            }
+
+            auto& own = pool.queues[w];
+            std::lock_guard<std::mutex> guard(own.lock);
+            own.next = from;
+            own.end = to;
+            return true;
+        }
+
+        return false;
+    }
+
+    inline void work(WorkPool& pool, unsigned w)
+    {
+        uint32_t morsel;
+        do
+        {
+            while (take(pool.queues[w], morsel))
+                pool.job(w, morsel);
+        } while (steal(pool, w));
+    }
+
+    inline void helper(WorkPool* pool, unsigned w)
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> guard(pool->lock);
+
+        while (true)
+        {
+            pool->wake.wait(guard, [&] { return pool->stopping || pool->round != seen; });
+            if (pool->stopping)
+                return;
+
+            seen = pool->round;
+
+            guard.unlock();
+            work(*pool, w);
+            guard.lock();
+
+            if (--pool->busy == 0)
+                pool->idle.notify_one();
+        }
+    }
+
+    /* Starts the pool with `size` workers in all, counting the caller of Run; 0 means one per core */
+    inline void Start(WorkPool& pool, unsigned size = 0)
+    {
+        if (size == 0)
+            size = std::thread::hardware_concurrency();
+        if (size == 0)
+            size = 1;
+
+        pool.size = size;
+        pool.queues.reset(new WorkPool::Queue[size]);
+        pool.stopping = false;
+
+        for (unsigned w = 1; w < size; ++w)
+            pool.threads.emplace_back(helper, &pool, w);
+    }
+
+    inline void Stop(WorkPool& pool)
+    {
+        {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            pool.stopping = true;
+        }
+        pool.wake.notify_all();
+
+        for (auto& t : pool.threads)
+            t.join();
+
+        pool.threads.clear();
+    }
+
+    inline bool Started(const WorkPool& pool)
+    {
+        return pool.queues != nullptr;
+    }
+
+    /* Calls fn(unsigned worker, uint32_t morsel) once for each morsel in [0, morsels), on any worker, and
+     * returns when all calls have returned. Calls with the same worker never overlap */
+    template<typename F>
+    inline void Run(WorkPool& pool, uint32_t morsels, F fn)
+    {
+        if (pool.size == 1)
+        {
+            for (uint32_t m = 0; m < morsels; ++m)
+                fn(0, m);
+            return;
+        }
+
+        for (unsigned w = 0; w < pool.size; ++w)
+        {
+            pool.queues[w].next = (uint64_t) morsels * w / pool.size;
+            pool.queues[w].end = (uint64_t) morsels * (w + 1) / pool.size;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            pool.job = fn;
+            pool.busy = pool.size - 1;
+            ++pool.round;
+        }
+        pool.wake.notify_all();
+
+        work(pool, 0);
+
+        std::unique_lock<std::mutex> guard(pool.lock);
+        pool.idle.wait(guard, [&] { return pool.busy == 0; });
+        pool.job = nullptr;
+    }
+} // namespace Pool
+
+inline WorkPool::~WorkPool()
+{
+    Pool::Stop(*this);
+}
+
+#endif
@@ -0,0 +1,633 @@
+#pragma once
+
+#ifndef __APP_QUERY_H_
+#define __APP_QUERY_H_
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "repr.h"
+#include "pool.h"
+#include "parse.h"
+
+/* Worker threads for queries, counting the caller; 0 means one per core */
+#ifndef APP_QUERY_THREADS
+    #define APP_QUERY_THREADS 0
+#endif
+
+/*
+ * Ad-hoc filter and aggregate queries over inv.items, such as
+ *
+ *     select sum(assigned), count where cat = Tools and units < 10 group by cat
+ *
+ * Without aggregates a query lists the fields of the matching items instead. See Queries::Parse for the full
+ * syntax.
+ */
+struct Query
+{
+    enum class Field
+    {
+        Id,
+        Name,
+        Cat,
+        Units, // available
+        Assigned,
+        Total, // available + assigned
+        Reorder
+    };
+
+    enum class Cmp
+    {
+        Eq,
+        Ne,
+        Lt,
+        Le,
+        Gt,
+        Ge,
+        Contains // names only
+    };
+
+    enum class Agg
+    {
+        None, // the field itself, for row queries
+        Count,
+        Sum,
+        Min,
+        Max
+    };
+
+    struct Predicate
+    {
+        Field field;
+        Cmp cmp;
+        uint64_t number = 0;
+        std::string text; // names
+        cat_id_t cat = CAT_NONE;
+    };
+
+    struct Column
+    {
+        Agg agg;
+        Field field;
+    };
+
+    std::vector<Column> columns;
+    std::vector<Predicate> where; // all must hold
+    bool by_cat = false;
+    bool aggregate = false;
+    uint64_t limit = 0; // rows (or groups) returned, 0 = all
+};
+
+struct QueryResult
+{
+    /* Aggregate queries: one group per category (just one without group by) that had matching items */
+    struct Group
+    {
+        cat_id_t cat;
+        uint64_t rows;
+        std::vector<uint64_t> values; // one per column
+    };
+
+    std::vector<Group> groups;
+    std::vector<uint32_t> slots; // row queries: the matching items, in slot order
+};
+
+/*
+ * A query runs in morsels of MORSEL_PAGES item pages on a WorkPool. Each worker folds the items it sees
+ * into partial aggregates of its own, which are merged once every morsel is done; row queries gather the
+ * matching slots per morsel and join them in morsel order. Workers only read the inventory, so nothing may
+ * change it while a query runs.
+ */
+namespace Queries
+{
+    static constexpr uint32_t MORSEL_PAGES = 16;
+
+    inline uint64_t number(const Inventory& inv, const InventoryItem& item, Query::Field field)
+    {
+        using Field = Query::Field;
+
+        switch (field)
+        {
+            case Field::Id:       return item.item_id;
+            case Field::Cat:      return Categories::CategoryOf(inv.categories, slot_of(inv, &item));
+            case Field::Units:    return item.item_count;
+            case Field::Assigned: return item.assigned_count;
+            case Field::Total:    return (uint64_t) item.item_count + item.assigned_count;
+            case Field::Reorder:  return item.reorder_level;
+            case Field::Name:     break;
+        }
+
+        return 0;
+    }
+
+    inline bool holds(const Inventory& inv, const InventoryItem& item, const Query::Predicate& p)
+    {
+        using Cmp = Query::Cmp;
+
+        if (p.field == Query::Field::Name)
+        {
+            auto& name = item.meta.name;
+
+            if (p.cmp == Cmp::Contains)
+                return std::search(name.data(), name.data() + name.size(), p.text.begin(), p.text.end())
+                       != name.data() + name.size();
+
+            bool equal = Strings::Equal(name, p.text.data(), p.text.size());
+            return p.cmp == Cmp::Eq ? equal : !equal;
+        }
+
+        uint64_t v = p.field == Query::Field::Cat ? Categories::CategoryOf(inv.categories, slot_of(inv, &item))
+                                                  : number(inv, item, p.field);
+        uint64_t rhs = p.field == Query::Field::Cat ? p.cat : p.number;
+
+        switch (p.cmp)
+        {
+            case Cmp::Eq:       return v == rhs;
+            case Cmp::Ne:       return v != rhs;
+            case Cmp::Lt:       return v < rhs;
+            case Cmp::Le:       return v <= rhs;
+            case Cmp::Gt:       return v > rhs;
+            case Cmp::Ge:       return v >= rhs;
+            case Cmp::Contains: break;
+        }
+
+        return false;
+    }
+
+    /* Partials of one group: the row count, then one value per column */
+    inline void fold(const Inventory& inv, const InventoryItem& item, const Query& q, uint64_t* acc)
+    {
+        using Agg = Query::Agg;
+
+        ++acc[0];
+        for (size_t c = 0; c < q.columns.size(); ++c)
+        {
+            auto& col = q.columns[c];
+            auto& a = acc[1 + c];
+
+            if (col.agg == Agg::Count)
+                continue;
+
+            uint64_t v = number(inv, item, col.field);
+
+            if (col.agg == Agg::Sum)
+                a += v;
+            else if (col.agg == Agg::Min)
+                a = std::min(a, v);
+            else if (col.agg == Agg::Max)
+                a = std::max(a, v);
+        }
+    }
+
+    inline void init_partials(std::vector<uint64_t>& acc, size_t groups, const Query& q)
+    {
+        size_t stride = 1 + q.columns.size();
+        acc.assign(groups * stride, 0);
+
+        for (size_t g = 0; g < groups; ++g)
+            for (size_t c = 0; c < q.columns.size(); ++c)
+                if (q.columns[c].agg == Query::Agg::Min)
+                    acc[g * stride + 1 + c] = std::numeric_limits<uint64_t>::max();
+    }
+
+    inline void Run(const Inventory& inv, const Query& q, WorkPool& pool, QueryResult& out)
+    {
+        out.groups.clear();
+        out.slots.clear();
+
+        uint32_t pages = (inv.count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
+        uint32_t morsels = (pages + MORSEL_PAGES - 1) / MORSEL_PAGES;
+
+        size_t groups = q.by_cat ? inv.categories.entries.size() : 1;
+        size_t stride = 1 + q.columns.size();
+
+        std::vector<std::vector<uint64_t>> partials(pool.size); // by worker
+        std::vector<std::vector<uint32_t>> hits(q.aggregate ? 0 : morsels);
+
+        Pool::Run(pool, morsels, [&](unsigned worker, uint32_t morsel) {
+            auto& acc = partials[worker];
+            if (q.aggregate && acc.empty())
+                init_partials(acc, groups, q);
+
+            uint32_t last_page = std::min(pages, (morsel + 1) * MORSEL_PAGES);
+            for (uint32_t p = morsel * MORSEL_PAGES; p < last_page; ++p)
+            {
+                auto page = inv.items.pages[p];
+                uint32_t n = std::min(ITEMS_PER_PAGE, inv.count - p * ITEMS_PER_PAGE);
+
+                for (uint32_t i = 0; i < n; ++i)
+                {
+                    auto& item = page->items()[i];
+                    if (!item.active)
+                        continue;
+
+                    bool match = true;
+                    for (auto& pred : q.where)
+                    {
+                        if (!holds(inv, item, pred))
+                        {
+                            match = false;
+                            break;
+                        }
+                    }
+
+                    if (!match)
+                        continue;
+
+                    if (!q.aggregate)
+                    {
+                        hits[morsel].push_back(p * ITEMS_PER_PAGE + i);
+                        continue;
+                    }
+
+                    size_t g = q.by_cat ? Categories::CategoryOf(inv.categories, p * ITEMS_PER_PAGE + i) : 0;
+                    if (g < groups)
+                        fold(inv, item, q, &acc[g * stride]);
+                }
+            }
+        });
+
+        if (!q.aggregate)
+        {
+            for (auto& h : hits)
+            {
+                if (q.limit != 0 && out.slots.size() + h.size() >= q.limit)
+                {
+                    out.slots.insert(out.slots.end(), h.begin(), h.begin() + (q.limit - out.slots.size()));
+                    break;
+                }
+
+                out.slots.insert(out.slots.end(), h.begin(), h.end());
+            }
+
+            return;
+        }
+
+        /* Merge the workers' partials */
+        std::vector<uint64_t> total;
+        init_partials(total, groups, q);
+
+        for (auto& acc : partials)
+        {
+            if (acc.empty())
+                continue;
+
+            for (size_t g = 0; g < groups; ++g)
+            {
+                auto into = &total[g * stride];
+                auto from = &acc[g * stride];
+
+                into[0] += from[0];
+                for (size_t c = 0; c < q.columns.size(); ++c)
+                {
+                    auto agg = q.columns[c].agg;
+
+                    if (agg == Query::Agg::Min)
+                        into[1 + c] = std::min(into[1 + c], from[1 + c]);
+                    else if (agg == Query::Agg::Max)
+                        into[1 + c] = std::max(into[1 + c], from[1 + c]);
+                    else
+                        into[1 + c] += from[1 + c];
+                }
+            }
+        }
+
+        for (size_t g = 0; g < groups; ++g)
+        {
+            auto acc = &total[g * stride];
+
+            /* Without group by, a query that matched nothing still has its one (zero) row */
+            if (acc[0] == 0 && q.by_cat)
+                continue;
+
+            QueryResult::Group group;
+            group.cat = q.by_cat ? g : CAT_NONE;
+            group.rows = acc[0];
+
+            for (size_t c = 0; c < q.columns.size(); ++c)
+            {
+                auto agg = q.columns[c].agg;
+                uint64_t v = agg == Query::Agg::Count ? acc[0] : acc[1 + c];
+
+                /* Min and max of nothing */
+                if (acc[0] == 0 && agg == Query::Agg::Min)
+                    v = 0;
+
+                group.values.push_back(v);
+            }
+
+            out.groups.push_back(std::move(group));
+
+            if (q.limit != 0 && out.groups.size() == q.limit)
+                break;
+        }
+    }
+
+    /* ------------------------------------------------------------------------ */
+    /* -------------------------------- PARSER -------------------------------- */
+    /* ------------------------------------------------------------------------ */
+
+    struct Token
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    /* Words, numbers and operators, plus ',' '(' and ')' on their own */
+    inline void tokenize(const char* text, size_t len, std::vector<Token>& tokens)
+    {
+        auto is_op = [](char c) { return c == '<' || c == '>' || c == '=' || c == '!' || c == '~'; };
+        auto is_punct = [](char c) { return c == ',' || c == '(' || c == ')'; };
+
+        size_t i = 0;
+        while (i < len)
+        {
+            if (Parse::IsSpace(text[i]))
+            {
+                ++i;
+                continue;
+            }
+
+            size_t begin = i;
+            if (is_punct(text[i]))
+                ++i;
+            else if (is_op(text[i]))
+                while (i < len && is_op(text[i]))
+                    ++i;
+            else
+                while (i < len && !Parse::IsSpace(text[i]) && !is_op(text[i]) && !is_punct(text[i]))
+                    ++i;
+
+            tokens.push_back({ begin, i });
+        }
+    }
+
+    struct Parser
+    {
+        const char* text;
+        std::vector<Token> tokens;
+        size_t at = 0;
+        std::string error;
+
+        bool done() const { return at == tokens.size(); }
+
+        std::string token(size_t i) const { return std::string(text + tokens[i].begin, text + tokens[i].end); }
+
+        std::string word(size_t i) const
+        {
+            auto w = token(i);
+            for (auto& c : w)
+                c = tolower((unsigned char) c);
+            return w;
+        }
+
+        bool peek(const char* w) const { return !done() && word(at) == w; }
+
+        bool accept(const char* w)
+        {
+            if (!peek(w))
+                return false;
+
+            ++at;
+            return true;
+        }
+
+        bool fail(const std::string& message)
+        {
+            if (error.empty())
+                error = message;
+            return false;
+        }
+
+        bool expect(const char* w)
+        {
+            return accept(w) || fail(std::string("expected \"") + w + "\"" + where());
+        }
+
+        std::string where() const
+        {
+            return done() ? " at the end" : " before \"" + token(at) + "\"";
+        }
+    };
+
+    inline bool field_named(const std::string& w, Query::Field& field)
+    {
+        using Field = Query::Field;
+
+        static const struct
+        {
+            const char* name;
+            Field field;
+        } names[] = {
+            { "id", Field::Id },          { "name", Field::Name },         { "cat", Field::Cat },
+            { "category", Field::Cat },   { "units", Field::Units },       { "available", Field::Units },
+            { "assigned", Field::Assigned }, { "total", Field::Total },     { "reorder", Field::Reorder },
+        };
+
+        for (auto& n : names)
+        {
+            if (w == n.name)
+            {
+                field = n.field;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    inline bool parse_field(Parser& ps, Query::Field& field)
+    {
+        if (ps.done() || !field_named(ps.word(ps.at), field))
+            return ps.fail("expected a field (id, name, cat, units, assigned, total, reorder)" + ps.where());
+
+        ++ps.at;
+        return true;
+    }
+
+    inline bool parse_column(Parser& ps, Query::Column& col)
+    {
+        using Agg = Query::Agg;
+
+        col.field = Query::Field::Id;
+
+        if (ps.accept("count"))
+        {
+            col.agg = Agg::Count;
+
+            /* count, count() and count(*) are the same */
+            if (ps.accept("("))
+            {
+                ps.accept("*");
+                return ps.expect(")");
+            }
+
+            return true;
+        }
+
+        col.agg = ps.accept("sum") ? Agg::Sum : ps.accept("min") ? Agg::Min : ps.accept("max") ? Agg::Max : Agg::None;
+
+        if (col.agg == Agg::None)
+            return parse_field(ps, col.field);
+
+        if (!ps.expect("(") || !parse_field(ps, col.field) || !ps.expect(")"))
+            return false;
+
+        if (col.field == Query::Field::Name || col.field == Query::Field::Cat)
+            return ps.fail("names and categories can only be counted");
+
+        return true;
+    }
+
+    inline bool is_keyword(const std::string& w)
+    {
+        return w == "and" || w == "group" || w == "limit";
+    }
+
+    inline bool parse_predicate(Parser& ps, const CategoryIndex& cats, Query::Predicate& p)
+    {
+        using Cmp = Query::Cmp;
+        using Field = Query::Field;
+
+        if (!parse_field(ps, p.field))
+            return false;
+
+        static const struct
+        {
+            const char* op;
+            Cmp cmp;
+        } ops[] = {
+            { "=", Cmp::Eq }, { "==", Cmp::Eq }, { "!=", Cmp::Ne }, { "<>", Cmp::Ne }, { "<", Cmp::Lt },
+            { "<=", Cmp::Le }, { ">", Cmp::Gt }, { ">=", Cmp::Ge }, { "~", Cmp::Contains },
+        };
+
+        bool found = false;
+        for (auto& o : ops)
+        {
+            if (ps.accept(o.op))
+            {
+                p.cmp = o.cmp;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+            return ps.fail("expected a comparison (=, !=, <, <=, >, >=, ~)" + ps.where());
+
+        if (ps.done())
+            return ps.fail("expected a value at the end");
+
+        bool text = p.field == Field::Name || p.field == Field::Cat;
+
+        if (p.cmp == Cmp::Contains && p.field != Field::Name)
+            return ps.fail("~ (contains) only applies to names");
+
+        if (text && p.cmp != Cmp::Eq && p.cmp != Cmp::Ne && p.cmp != Cmp::Contains)
+            return ps.fail("names and categories can only be compared with =, != or ~");
+
+        if (!text)
+        {
+            auto& t = ps.tokens[ps.at++];
+            auto res = Parse::Uint(ps.text + t.begin, ps.text + t.end, std::numeric_limits<uint64_t>::max(), p.number);
+            if (res.ec != Parse::Error::None || res.ptr != ps.text + t.end)
+                return ps.fail("expected a number, not \"" + ps.token(ps.at - 1) + "\"");
+
+            return true;
+        }
+
+        /* Text runs up to the next keyword, spaces and all */
+        size_t begin = ps.tokens[ps.at].begin;
+        size_t end = begin;
+
+        while (!ps.done() && !is_keyword(ps.word(ps.at)))
+            end = ps.tokens[ps.at++].end;
+
+        p.text.assign(ps.text + begin, ps.text + end);
+
+        if (p.field == Field::Cat)
+            p.cat = Categories::Find(cats, p.text);
+
+        return true;
+    }
+
+    /*
+     * Reads a query:
+     *
+     *     select COLUMN, ... [where FIELD OP VALUE and ...] [group by cat] [limit N]
+     *
+     * A column is a field, count, or sum, min or max of a numeric field. Fields are id, name, cat, units
+     * (available), assigned, total and reorder; OP is one of = != < <= > >= and ~ (name contains). Keywords
+     * may be in any case. Returns false and describes the problem in error if the text is not a query.
+     */
+    inline bool Parse(const CategoryIndex& cats, const char* text, size_t len, Query& q, std::string& error)
+    {
+        q = Query();
+
+        Parser ps;
+        ps.text = text;
+        tokenize(text, len, ps.tokens);
+
+        bool ok = ps.expect("select");
+
+        do
+        {
+            Query::Column col;
+            ok = ok && parse_column(ps, col);
+            q.columns.push_back(col);
+        } while (ok && ps.accept(","));
+
+        if (ok && ps.accept("where"))
+        {
+            do
+            {
+                Query::Predicate p;
+                ok = parse_predicate(ps, cats, p);
+                q.where.push_back(std::move(p));
+            } while (ok && ps.accept("and"));
+        }
+
+        if (ok && ps.accept("group"))
+        {
+            ok = ps.expect("by") && (ps.accept("cat") || ps.accept("category"));
+            ok = ok || ps.fail("only group by cat is supported");
+            q.by_cat = ok;
+        }
+
+        if (ok && ps.accept("limit"))
+        {
+            auto& t = ps.tokens[std::min(ps.at, ps.tokens.size() - 1)];
+            auto res = Parse::Uint(text + t.begin, text + t.end, std::numeric_limits<uint32_t>::max(), q.limit);
+            ok = !ps.done() && res.ec == Parse::Error::None && res.ptr == text + t.end && q.limit > 0;
+            ok = ok || ps.fail("expected a row count after limit");
+            ++ps.at;
+        }
+
+        if (ok && !ps.done())
+            ok = ps.fail("unexpected \"" + ps.token(ps.at) + "\"");
+
+        if (ok)
+        {
+            size_t aggregates = 0;
+            for (auto& col : q.columns)
+                aggregates += col.agg != Query::Agg::None;
+
+            q.aggregate = aggregates > 0;
+
+            if (q.aggregate && aggregates != q.columns.size())
+                ok = ps.fail("fields can't be listed next to count, sum, min or max");
+            else if (q.by_cat && !q.aggregate)
+                ok = ps.fail("group by needs count, sum, min or max");
+        }
+
+        error = ps.error;
+        return ok;
+    }
+} // namespace Queries
+
+#endif
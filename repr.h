@@ -5,88 +5,655 @@
 
 #include <string>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ctime>
 
-struct Member
+#include "strarena.h"
+#include "catindex.h"
+#include "scan.h"
+#include "lowstock.h"
+#include "idindex.h"
+#include "oplog.h"
+#include "eventlog.h"
+#include "membersrc.h"
+#include "memberlist.h"
+#include "duedates.h"
+#include "leaders.h"
+#include "nameindex.h"
+#include "trace.h"
+#include "digest.h"
+
+/* Width of item ids in bits (16, 32 or 64). Data files record the width they were written with */
+#ifndef APP_ITEM_ID_BITS
+    #define APP_ITEM_ID_BITS 32
+#endif
+
+template<int Bits>
+struct item_id_width;
+
+template<>
+struct item_id_width<16>
+{
+    typedef uint16_t type;
+};
+
+template<>
+struct item_id_width<32>
 {
-    std::string name;
-    int borrow_count = 0;
+    typedef uint32_t type;
+};
 
-    Member* prev = nullptr;
-    Member* next = nullptr;
+template<>
+struct item_id_width<64>
+{
+    typedef uint64_t type;
 };
 
-typedef uint16_t item_id_t;
+typedef item_id_width<APP_ITEM_ID_BITS>::type item_id_t;
 typedef uint32_t item_count_t;
+typedef Op<item_id_t> ItemOp;
 
+/* Short names and categories are kept inline; longer ones live in inv.strings */
 struct ItemMeta
 {
-    std::string name;
-    std::string cat;
+    ArenaString name;
+    ArenaString cat;
+};
+
+#if APP_COMPACT_ITEMS
+
+/*
+ * 28 bytes with 32-bit ids. The slot follows from where the item sits in its page (see slot_of), and the
+ * member list moves to a table of the page that only items with members take an entry of; read and write
+ * them with members_of() and the functions next to it.
+ */
+struct InventoryItem
+{
+    item_id_t item_id = 0;
+    ItemMeta meta {};
+    item_count_t item_count = 0;
+    item_count_t assigned_count = 0;
+    item_count_t reorder_level = 0; // 0 = no alerting
+    uint32_t list : 24;             // 1 + index of the item's entry in page->lists, 0 for none
+    bool active = true;
+
+    InventoryItem() : list(0) {}
+};
+
+static_assert(sizeof(InventoryItem) <= 32, "Compact items are meant to take at most 32 bytes");
+
+/* Member list of an item in a compact page, or where it is stored in inv.member_source until decoded */
+struct MemberEntry
+{
+    MemberList list;
+    uint64_t stored = MemberSources::NONE;
+};
+
+/* Entries are allocated in chunks so they never move while an item's list is in use */
+struct MemberTable
+{
+    static constexpr uint32_t CHUNK = 16;
+
+    std::vector<std::unique_ptr<MemberEntry[]>> chunks;
+    std::vector<uint32_t> unused; // entries given back, to hand out first
+    uint32_t size = 0;            // entries handed out at some point
 
-    ItemMeta& operator= (const ItemMeta& other) = default;
-    ItemMeta& operator= (ItemMeta&& other) = default;
+    MemberEntry& operator[](uint32_t i) { return chunks[i / CHUNK][i % CHUNK]; }
+    const MemberEntry& operator[](uint32_t i) const { return chunks[i / CHUNK][i % CHUNK]; }
 };
 
+#else
+
 struct InventoryItem
 {
     item_id_t item_id = 0;
+    uint32_t slot = 0; // position in inv.items, maintained by the storage functions below
     ItemMeta meta {};
     item_count_t item_count = 0;
     item_count_t assigned_count = 0;
+    item_count_t reorder_level = 0; // 0 = no alerting
     bool active = true;
 
-    Member* allocated_to = nullptr;
+    MemberList members;
+    uint64_t stored_members = MemberSources::NONE; // position of the list in inv.member_source, until decoded
+};
+
+#endif
+
+/*
+ * Fixed block of item slots. A page is shared by the live inventory and by every snapshot taken while it was
+ * current; refs counts those holders, and whoever drops the last reference frees it. A page owns the member
+ * lists of its items, so a copy of a page copies the lists too.
+ *
+ * Slots [0, count) hold constructed items, the rest is uninitialized memory.
+ */
+struct ItemPageHeader
+{
+    std::atomic<uint32_t> refs { 1 };
+    uint32_t count = 0;
+
+#if APP_COMPACT_ITEMS
+    uint32_t first = 0; // slot of items()[0]
+    MemberTable lists;
+#endif
+};
+
+#if APP_COMPACT_ITEMS
+
+/*
+ * Compact pages are PAGE_BYTES long and start at a multiple of it, so an item finds its page, and from it
+ * its slot and member list, by masking its own address. They hold as many items as fit after the header.
+ */
+#ifndef APP_PAGE_BYTES
+    #define APP_PAGE_BYTES 8192
+#endif
+
+static constexpr size_t PAGE_BYTES = APP_PAGE_BYTES;
+static_assert((PAGE_BYTES & (PAGE_BYTES - 1)) == 0, "APP_PAGE_BYTES must be a power of two");
 
-    InventoryItem& operator= (const InventoryItem& other) = default;
-    InventoryItem& operator= (InventoryItem&& other) = default;
+static constexpr uint32_t ITEMS_PER_PAGE = (PAGE_BYTES - sizeof(ItemPageHeader)) / sizeof(InventoryItem);
+static_assert(ITEMS_PER_PAGE < (1u << 24), "InventoryItem::list must be able to index every item of a page");
+
+/*
+ * Where compact pages come from: slabs of SLAB_PAGES pages, so the alignment costs a fraction of a page per
+ * slab rather than per page. Freed pages wait in `unused` for the next ones; slabs are kept for the life of
+ * the process. Pages are freed by whoever drops the last reference, snapshot threads included, hence the lock.
+ */
+struct PagePool
+{
+    static constexpr size_t SLAB_PAGES = 64;
+
+    std::vector<void*> unused;
+    std::mutex lock;
 };
 
+namespace PagePools
+{
+    inline PagePool& Get()
+    {
+        static PagePool* pool = new PagePool;
+        return *pool;
+    }
+
+    inline void* Allocate()
+    {
+        auto& pool = Get();
+        std::lock_guard<std::mutex> hold(pool.lock);
+
+        if (pool.unused.empty())
+        {
+            void* slab;
+            if (posix_memalign(&slab, PAGE_BYTES, PagePool::SLAB_PAGES * PAGE_BYTES) != 0)
+                throw std::bad_alloc();
+
+            /* Handed out from the start of the slab */
+            for (size_t i = PagePool::SLAB_PAGES; i-- > 0;)
+                pool.unused.push_back((char*) slab + i * PAGE_BYTES);
+        }
+
+        void* page = pool.unused.back();
+        pool.unused.pop_back();
+        return page;
+    }
+
+    inline void Release(void* page)
+    {
+        auto& pool = Get();
+        std::lock_guard<std::mutex> hold(pool.lock);
+        pool.unused.push_back(page);
+    }
+} // namespace PagePools
+
+#else
+
+/* Items per storage page. Smaller pages make copy-on-write cheaper, larger ones make the page table shorter */
+#ifndef APP_ITEMS_PER_PAGE
+    #define APP_ITEMS_PER_PAGE 256
+#endif
+
+static constexpr uint32_t ITEMS_PER_PAGE = APP_ITEMS_PER_PAGE;
+static_assert((ITEMS_PER_PAGE & (ITEMS_PER_PAGE - 1)) == 0, "APP_ITEMS_PER_PAGE must be a power of two");
+
+#endif
+
+struct ItemPage : ItemPageHeader
+{
+    typename std::aligned_storage<sizeof(InventoryItem), alignof(InventoryItem)>::type raw[ITEMS_PER_PAGE];
+
+#if APP_COMPACT_ITEMS
+    static void* operator new(size_t) { return PagePools::Allocate(); }
+    static void operator delete(void* p) { PagePools::Release(p); }
+#endif
+
+    InventoryItem* items() { return reinterpret_cast<InventoryItem*>(raw); }
+    const InventoryItem* items() const { return reinterpret_cast<const InventoryItem*>(raw); }
+};
+
+#if APP_COMPACT_ITEMS
+static_assert(sizeof(ItemPage) <= PAGE_BYTES, "A compact page must fit its block");
+#endif
+
+/* Page table: slot s lives in pages[s / ITEMS_PER_PAGE]. Read-only; writes go through inventory_mutable() */
+struct ItemPages
+{
+    std::vector<ItemPage*> pages;
+
+    const InventoryItem& operator[](uint32_t slot) const
+    {
+        return pages[slot / ITEMS_PER_PAGE]->items()[slot % ITEMS_PER_PAGE];
+    }
+};
+
+/*
+ * Items are only ever created with inventory_emplace() and destroyed by inventory_truncate(); capacity is
+ * the number of slots in allocated pages.
+ */
 struct Inventory
 {
-    InventoryItem* items;
+    ItemPages items;
     uint32_t count = 0;
-    uint32_t capacity;
+    uint32_t capacity = 0;
+
+    CategoryIndex categories;
+    ScanColumns<item_count_t> columns;
+    LowStockIndex low_stock;
+    IdHashIndex<item_id_t> ids;
+    NameIndex names; // active items by name
+
+    StringArena strings;
+    MemberDirectory member_names;
+    std::shared_ptr<MemberSource> member_source; // the data file, for member lists not decoded yet
+    DueIndex due;
+
+    Leaderboard top_items;   // units assigned, by slot
+    Leaderboard top_members; // units held of items that are not deleted, by member id
+
+    StateDigest digest; // of every item, for checking deltas against (see delta.h)
+
+    OperationLog log;
+    EventLog history;
+    TraceLog trace; // only while recording a session
+};
+
+/* name_of(slot) for the functions of NameIndexes */
+struct ItemNameOf
+{
+    const Inventory* inv;
+
+    const ArenaString& operator()(uint32_t slot) const
+    {
+        return inv->items[slot].meta.name;
+    }
 };
 
-inline constexpr uint32_t grow(uint32_t old)
+inline bool is_below_reorder_level(const InventoryItem& item)
 {
-    return old < 8 ? 8 : 2 * old;
+    return item.active && item.item_count < item.reorder_level;
 }
 
-inline Member* CreateMember(const char* name)
+#if APP_COMPACT_ITEMS
+
+inline ItemPage* page_of(const InventoryItem* item)
 {
-    Member* m = new Member;
+    return reinterpret_cast<ItemPage*>(reinterpret_cast<uintptr_t>(item) & ~(uintptr_t) (PAGE_BYTES - 1));
+}
 
-    m->name = name;
-    m->borrow_count = 0;
-    m->next = nullptr;
-    m->prev = nullptr;
+inline uint32_t slot_of(const Inventory&, const InventoryItem* item)
+{
+    auto page = page_of(item);
+    return page->first + (uint32_t) (item - page->items());
+}
 
-    return m;
+/* The item's entry in its page, created if it has none. Only for items of pages the inventory may write */
+inline MemberEntry& member_entry(InventoryItem& item)
+{
+    auto& table = page_of(&item)->lists;
+
+    if (item.list == 0)
+    {
+        uint32_t i;
+        if (!table.unused.empty())
+        {
+            i = table.unused.back();
+            table.unused.pop_back();
+        }
+        else
+        {
+            i = table.size++;
+            if (i % MemberTable::CHUNK == 0)
+                table.chunks.emplace_back(new MemberEntry[MemberTable::CHUNK]);
+        }
+
+        item.list = i + 1;
+    }
+
+    return table[item.list - 1];
 }
 
-inline void DeleteMember(Member* m)
+/* Gives the item's entry back to its page without freeing the list in it */
+inline void member_entry_drop(InventoryItem& item)
 {
-    delete m;
+    if (item.list == 0)
+        return;
+
+    auto& table = page_of(&item)->lists;
+    table[item.list - 1] = MemberEntry();
+    table.unused.push_back(item.list - 1);
+    item.list = 0;
+}
+
+#else
+
+inline uint32_t slot_of(const Inventory&, const InventoryItem* item)
+{
+    return item->slot;
 }
 
+#endif
 
-void inventory_allocate_capacity(Inventory& inv, uint32_t capacity)
+/* The item's member list, empty while it is still stored (see Core::Members) */
+inline const MemberList& members_of(const InventoryItem& item)
 {
-    if (capacity > inv.capacity)
+#if APP_COMPACT_ITEMS
+    static const MemberList none;
+    return item.list == 0 ? none : page_of(&item)->lists[item.list - 1].list;
+#else
+    return item.members;
+#endif
+}
+
+/* The same list for writing to; the item must be in a page the inventory may write */
+inline MemberList& members_mutable(InventoryItem& item)
+{
+#if APP_COMPACT_ITEMS
+    return member_entry(item).list;
+#else
+    return item.members;
+#endif
+}
+
+/* Position of the item's list in inv.member_source, or MemberSources::NONE once it is in memory */
+inline uint64_t stored_members_of(const InventoryItem& item)
+{
+#if APP_COMPACT_ITEMS
+    return item.list == 0 ? MemberSources::NONE : page_of(&item)->lists[item.list - 1].stored;
+#else
+    return item.stored_members;
+#endif
+}
+
+inline void set_stored_members(InventoryItem& item, uint64_t pos)
+{
+#if APP_COMPACT_ITEMS
+    if (item.list != 0 || pos != MemberSources::NONE)
+        member_entry(item).stored = pos;
+#else
+    item.stored_members = pos;
+#endif
+}
+
+/* Frees the item's member list */
+inline void free_members(InventoryItem& item)
+{
+#if APP_COMPACT_ITEMS
+    if (item.list == 0)
+        return;
+
+    MemberLists::Free(members_mutable(item));
+    member_entry_drop(item);
+#else
+    MemberLists::Free(item.members);
+#endif
+}
+
+/* Moves everything of `from`, member list included, into the item at another slot, whose own list must be
+ * freed already. Both must be in pages the inventory may write */
+inline void move_item(InventoryItem& to, InventoryItem& from)
+{
+#if APP_COMPACT_ITEMS
+    MemberEntry entry;
+    if (from.list != 0)
     {
-        auto old_list = inv.items;
+        entry = page_of(&from)->lists[from.list - 1];
+        member_entry_drop(from);
+    }
 
-        auto new_list = inv.items = new InventoryItem[capacity];
-        inv.capacity = capacity;
+    member_entry_drop(to);
+    to = from;
 
-        if (inv.count > 0)
-        {
-            for (int i = 0; i < inv.count; ++i)
-                new_list[i] = std::move(old_list[i]);
+    if (!entry.list.empty() || entry.stored != MemberSources::NONE)
+        member_entry(to) = entry;
+#else
+    uint32_t slot = to.slot;
+    to = from;
+    to.slot = slot;
+    from.members = MemberList(); // the list moved with the item
+#endif
+}
 
-            delete[] old_list;
-        }
+inline void page_acquire(ItemPage* page)
+{
+    page->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Drops one reference; the last one frees the page along with its items' member lists */
+inline void page_release(ItemPage* page)
+{
+    if (page->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+#if APP_COMPACT_ITEMS
+    for (uint32_t i = 0; i < page->lists.size; ++i)
+        MemberLists::Free(page->lists[i].list);
+#endif
+
+    for (uint32_t i = 0; i < page->count; ++i)
+    {
+#if !APP_COMPACT_ITEMS
+        MemberLists::Free(page->items()[i].members);
+#endif
+        page->items()[i].~InventoryItem();
+    }
+
+    delete page;
+}
+
+/* Private copy of a shared page for the live inventory to write to */
+inline ItemPage* page_clone(const ItemPage* page)
+{
+    auto copy = new ItemPage;
+
+    for (uint32_t i = 0; i < page->count; ++i)
+        new (copy->items() + i) InventoryItem(page->items()[i]);
+
+#if APP_COMPACT_ITEMS
+    copy->first = page->first;
+
+    auto& lists = copy->lists;
+    lists.size = page->lists.size;
+    lists.unused = page->lists.unused;
+
+    for (size_t c = 0; c < page->lists.chunks.size(); ++c)
+        lists.chunks.emplace_back(new MemberEntry[MemberTable::CHUNK]);
+
+    for (uint32_t i = 0; i < lists.size; ++i)
+    {
+        lists[i].list = MemberLists::Copy(page->lists[i].list);
+        lists[i].stored = page->lists[i].stored;
+    }
+#else
+    for (uint32_t i = 0; i < page->count; ++i)
+        copy->items()[i].members = MemberLists::Copy(copy->items()[i].members);
+#endif
+
+    copy->count = page->count;
+    return copy;
+}
+
+/* The page at index p, copied first if a snapshot still references it */
+inline ItemPage* inventory_page_mutable(Inventory& inv, uint32_t p)
+{
+    auto& page = inv.items.pages[p];
+
+    /* Acquire pairs with the release in page_release(), so a snapshot reader is done with the page */
+    if (page->refs.load(std::memory_order_acquire) != 1)
+    {
+        auto copy = page_clone(page);
+        page_release(page);
+        page = copy;
+    }
+
+    return page;
+}
+
+inline InventoryItem& inventory_mutable(Inventory& inv, uint32_t slot)
+{
+    return inventory_page_mutable(inv, slot / ITEMS_PER_PAGE)->items()[slot % ITEMS_PER_PAGE];
+}
+
+/* Allocates pages until `capacity` slots exist; never shrinks */
+inline void inventory_allocate_capacity(Inventory& inv, uint32_t capacity)
+{
+    auto& pages = inv.items.pages;
+    pages.reserve((capacity + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE);
+
+    while (inv.capacity < capacity)
+    {
+        pages.push_back(new ItemPage);
+#if APP_COMPACT_ITEMS
+        pages.back()->first = inv.capacity;
+#endif
+        inv.capacity += ITEMS_PER_PAGE;
+    }
+}
+
+/* Constructs a default item in the next free slot */
+inline InventoryItem& inventory_emplace(Inventory& inv)
+{
+    if (inv.count == inv.capacity)
+        inventory_allocate_capacity(inv, inv.capacity + ITEMS_PER_PAGE);
+
+    uint32_t slot = inv.count++;
+    auto page = inventory_page_mutable(inv, slot / ITEMS_PER_PAGE);
+
+    auto item = new (page->items() + slot % ITEMS_PER_PAGE) InventoryItem();
+#if !APP_COMPACT_ITEMS
+    item->slot = slot;
+#endif
+    ++page->count;
+
+    return *item;
+}
+
+/* Destroys the items in [count, inv.count), member lists included */
+inline void inventory_truncate(Inventory& inv, uint32_t count)
+{
+    while (inv.count > count)
+    {
+        uint32_t slot = --inv.count;
+        auto page = inventory_page_mutable(inv, slot / ITEMS_PER_PAGE);
+        auto& item = page->items()[slot % ITEMS_PER_PAGE];
+
+        free_members(item);
+        item.~InventoryItem();
+        --page->count;
     }
 }
+
+/* Releases the pages past the last item, e.g. after compaction */
+inline void inventory_shrink_to_fit(Inventory& inv)
+{
+    auto& pages = inv.items.pages;
+    size_t needed = (inv.count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
+
+    while (pages.size() > needed)
+    {
+        page_release(pages.back());
+        pages.pop_back();
+    }
+
+    pages.shrink_to_fit();
+    inv.capacity = pages.size() * ITEMS_PER_PAGE;
+}
+
+/*
+ * Point-in-time, read-only view of the items. Taking one only adds a reference to each page and to each
+ * string arena block; from then on the live inventory copies a page the first time it writes to it, so
+ * memory grows with what changes rather than with the inventory. A snapshot can be read and saved from any
+ * thread. Release it with snapshot_release().
+ */
+struct Snapshot
+{
+    ItemPages items;
+    uint32_t count = 0;
+    uint64_t seq = 0; // last journal transaction it includes
+    time_t taken_at = 0;
+
+    std::vector<std::shared_ptr<char>> strings;
+    MemberNames member_names; // the chunks as they were; names added later lie past its count
+    std::shared_ptr<MemberSource> member_source;
+    DueHeap due; // shares the live heap's chunks
+};
+
+inline Snapshot snapshot_take(const Inventory& inv)
+{
+    Snapshot snap;
+    snap.count = inv.count;
+    snap.seq = inv.log.seq;
+    snap.taken_at = time(nullptr);
+    snap.strings = inv.strings.blocks;
+    snap.member_names = inv.member_names.names;
+    snap.member_source = inv.member_source;
+    snap.due = inv.due.heap;
+
+    size_t used = (inv.count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
+    snap.items.pages.assign(inv.items.pages.begin(), inv.items.pages.begin() + used);
+
+    for (auto page : snap.items.pages)
+        page_acquire(page);
+
+    return snap;
+}
+
+/* Another reference to the same state, e.g. for a thread that outlives the caller's copy */
+inline Snapshot snapshot_share(const Snapshot& snap)
+{
+    Snapshot copy = snap;
+
+    for (auto page : copy.items.pages)
+        page_acquire(page);
+
+    return copy;
+}
+
+inline void snapshot_release(Snapshot& snap)
+{
+    for (auto page : snap.items.pages)
+        page_release(page);
+
+    snap.items.pages.clear();
+    snap.strings.clear();
+    snap.member_names.clear();
+    snap.member_source.reset();
+    snap.due.clear();
+    snap.count = 0;
+}
+
+inline void inventory_free(Inventory& inv)
+{
+    for (auto page : inv.items.pages)
+        page_release(page);
+
+    inv.items.pages.clear();
+    inv.count = 0;
+    inv.capacity = 0;
+}
+
 #endif
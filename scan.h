@@ -0,0 +1,513 @@
+#pragma once
+
+#ifndef __APP_SCAN_H_
+#define __APP_SCAN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    #define APP_SCAN_X86 1
+    #include <immintrin.h>
+#else
+    #define APP_SCAN_X86 0
+#endif
+
+/*
+ * Contiguous copies of the fields that flat scans look at. Items live in pages next to their names, categories
+ * and member references, so consecutive counts are never adjacent there; Core mirrors counts and the active
+ * flag here, packed so the kernels below can load a full vector of them at once and stream through whole cache
+ * lines of nothing else. Slot i of every column belongs to inv.items[i].
+ *
+ * Ids are not mirrored: Core looks them up in IdIndex. The find kernels stay for bench/scan_bench.cpp, which
+ * measures them against that index's predecessor, the loop over inv.items.
+ */
+template<typename CountT>
+struct ScanColumns
+{
+    std::vector<CountT> counts;
+    std::vector<uint8_t> active; // 0 or 1
+};
+
+namespace Scan
+{
+    enum class Isa
+    {
+        Scalar = 0,
+        SSE2,
+        AVX2
+    };
+
+    /* Every kernel scans [0, n) and returns n (or a count of 0) when nothing matches */
+    struct Kernels
+    {
+        Isa isa;
+
+        // First index with a[i] == key
+        size_t (*find_u16)(const uint16_t* a, size_t n, uint16_t key);
+        size_t (*find_u32)(const uint32_t* a, size_t n, uint32_t key);
+        size_t (*find_u64)(const uint64_t* a, size_t n, uint64_t key);
+
+        // First index with a[i] != 0
+        size_t (*find_nonzero_u8)(const uint8_t* a, size_t n);
+
+        // Writes every index with active[i] && v[i] < threshold to out, returns how many were written
+        size_t (*select_below_u32)(const uint32_t* v,
+                                   const uint8_t* active,
+                                   size_t n,
+                                   uint32_t threshold,
+                                   uint32_t* out);
+
+        // Number of set flags in a 0/1 byte mask
+        size_t (*count_active)(const uint8_t* active, size_t n);
+    };
+
+    /* ------------------------------------------------------------------------ */
+    /* -------------------------------- SCALAR -------------------------------- */
+    /* ------------------------------------------------------------------------ */
+
+    namespace Scalar
+    {
+        template<typename T>
+        inline size_t find(const T* a, size_t n, T key)
+        {
+            for (size_t i = 0; i < n; ++i)
+                if (a[i] == key)
+                    return i;
+
+            return n;
+        }
+
+        inline size_t find_u16(const uint16_t* a, size_t n, uint16_t key) { return find(a, n, key); }
+        inline size_t find_u32(const uint32_t* a, size_t n, uint32_t key) { return find(a, n, key); }
+        inline size_t find_u64(const uint64_t* a, size_t n, uint64_t key) { return find(a, n, key); }
+
+        inline size_t find_nonzero_u8(const uint8_t* a, size_t n)
+        {
+            for (size_t i = 0; i < n; ++i)
+                if (a[i] != 0)
+                    return i;
+
+            return n;
+        }
+
+        inline size_t select_below_u32(const uint32_t* v,
+                                       const uint8_t* active,
+                                       size_t n,
+                                       uint32_t threshold,
+                                       uint32_t* out)
+        {
+            size_t k = 0;
+            for (size_t i = 0; i < n; ++i)
+                if (active[i] && v[i] < threshold)
+                    out[k++] = i;
+
+            return k;
+        }
+
+        inline size_t count_active(const uint8_t* active, size_t n)
+        {
+            size_t c = 0;
+            for (size_t i = 0; i < n; ++i)
+                c += active[i];
+
+            return c;
+        }
+    } // namespace Scalar
+
+#if APP_SCAN_X86
+
+    /* Drains a lane bitmask into out as absolute indices */
+    inline size_t emit_bits(uint32_t mask, size_t base, uint32_t* out)
+    {
+        size_t k = 0;
+        while (mask != 0)
+        {
+            out[k++] = base + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+        return k;
+    }
+
+    /* ------------------------------------------------------------------------ */
+    /* --------------------------------- SSE2 --------------------------------- */
+    /* ------------------------------------------------------------------------ */
+
+    namespace SSE2
+    {
+        /* Narrows four 4-lane 32-bit compare results to one 16-bit movemask */
+        inline uint32_t mask16_epi32(__m128i c0, __m128i c1, __m128i c2, __m128i c3)
+        {
+            auto p01 = _mm_packs_epi32(c0, c1);
+            auto p23 = _mm_packs_epi32(c2, c3);
+            return _mm_movemask_epi8(_mm_packs_epi16(p01, p23));
+        }
+
+        inline __m128i load(const void* p)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        }
+
+        inline size_t find_u16(const uint16_t* a, size_t n, uint16_t key)
+        {
+            const auto k = _mm_set1_epi16((short) key);
+
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                auto c0 = _mm_cmpeq_epi16(load(a + i), k);
+                auto c1 = _mm_cmpeq_epi16(load(a + i + 8), k);
+                uint32_t m = _mm_movemask_epi8(_mm_packs_epi16(c0, c1));
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+
+            return i + Scalar::find_u16(a + i, n - i, key);
+        }
+
+        inline size_t find_u32(const uint32_t* a, size_t n, uint32_t key)
+        {
+            const auto k = _mm_set1_epi32((int) key);
+
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                uint32_t m = mask16_epi32(
+                  _mm_cmpeq_epi32(load(a + i), k),
+                  _mm_cmpeq_epi32(load(a + i + 4), k),
+                  _mm_cmpeq_epi32(load(a + i + 8), k),
+                  _mm_cmpeq_epi32(load(a + i + 12), k));
+
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+
+            return i + Scalar::find_u32(a + i, n - i, key);
+        }
+
+        inline size_t find_u64(const uint64_t* a, size_t n, uint64_t key)
+        {
+            const auto k = _mm_set1_epi64x((long long) key);
+
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                /* No 64-bit compare before SSE4.1: a lane matches when both of its 32-bit halves do. Each
+                 * 64-bit lane then owns two adjacent bits of the narrowed mask */
+                __m128i c[4];
+                for (int j = 0; j < 4; ++j)
+                {
+                    c[j] = _mm_cmpeq_epi32(load(a + i + 2 * j), k);
+                    c[j] = _mm_and_si128(c[j], _mm_shuffle_epi32(c[j], 0xB1));
+                }
+
+                uint32_t m = mask16_epi32(c[0], c[1], c[2], c[3]);
+                if (m != 0)
+                    return i + __builtin_ctz(m) / 2;
+            }
+
+            return i + Scalar::find_u64(a + i, n - i, key);
+        }
+
+        inline size_t find_nonzero_u8(const uint8_t* a, size_t n)
+        {
+            const auto zero = _mm_setzero_si128();
+
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                uint32_t m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(load(a + i), zero)) & 0xFFFF;
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+
+            return i + Scalar::find_nonzero_u8(a + i, n - i);
+        }
+
+        inline size_t select_below_u32(const uint32_t* v,
+                                       const uint8_t* active,
+                                       size_t n,
+                                       uint32_t threshold,
+                                       uint32_t* out)
+        {
+            /* SSE2 only has signed compares; flipping the sign bit maps unsigned order onto signed order */
+            const auto bias = _mm_set1_epi32((int) 0x80000000u);
+            const auto t = _mm_xor_si128(_mm_set1_epi32((int) threshold), bias);
+            const auto zero = _mm_setzero_si128();
+
+            size_t k = 0;
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                uint32_t below = mask16_epi32(
+                  _mm_cmplt_epi32(_mm_xor_si128(load(v + i), bias), t),
+                  _mm_cmplt_epi32(_mm_xor_si128(load(v + i + 4), bias), t),
+                  _mm_cmplt_epi32(_mm_xor_si128(load(v + i + 8), bias), t),
+                  _mm_cmplt_epi32(_mm_xor_si128(load(v + i + 12), bias), t));
+
+                uint32_t live = ~_mm_movemask_epi8(_mm_cmpeq_epi8(load(active + i), zero)) & 0xFFFF;
+
+                k += emit_bits(below & live, i, out + k);
+            }
+
+            for (; i < n; ++i)
+                if (active[i] && v[i] < threshold)
+                    out[k++] = i;
+
+            return k;
+        }
+
+        inline size_t count_active(const uint8_t* active, size_t n)
+        {
+            const auto zero = _mm_setzero_si128();
+            auto acc = _mm_setzero_si128();
+
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+                acc = _mm_add_epi64(acc, _mm_sad_epu8(load(active + i), zero));
+
+            uint64_t lanes[2];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+
+            return lanes[0] + lanes[1] + Scalar::count_active(active + i, n - i);
+        }
+    } // namespace SSE2
+
+    /* ------------------------------------------------------------------------ */
+    /* --------------------------------- AVX2 --------------------------------- */
+    /* ------------------------------------------------------------------------ */
+
+    /* Compiled for AVX2 regardless of -march; only ever called after the cpuid check in DetectIsa() */
+    #define APP_TARGET_AVX2 __attribute__((target("avx2")))
+
+    namespace AVX2
+    {
+        APP_TARGET_AVX2 inline __m256i load(const void* p)
+        {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        }
+
+        /* Narrows four 8-lane 32-bit compare results to one 32-bit movemask. The packs work per 128-bit
+         * half, so the dwords come out as c0[0:4] c1[0:4] c2[0:4] c3[0:4] c0[4:8] ... and need reordering */
+        APP_TARGET_AVX2 inline uint32_t mask32_epi32(__m256i c0, __m256i c1, __m256i c2, __m256i c3)
+        {
+            auto packed = _mm256_packs_epi16(_mm256_packs_epi32(c0, c1), _mm256_packs_epi32(c2, c3));
+            packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+            return _mm256_movemask_epi8(packed);
+        }
+
+        APP_TARGET_AVX2 inline size_t find_u16(const uint16_t* a, size_t n, uint16_t key)
+        {
+            const auto k = _mm256_set1_epi16((short) key);
+
+            size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                auto c0 = _mm256_cmpeq_epi16(load(a + i), k);
+                auto c1 = _mm256_cmpeq_epi16(load(a + i + 16), k);
+                auto packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(c0, c1), 0xD8);
+                uint32_t m = _mm256_movemask_epi8(packed);
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+
+            return i + SSE2::find_u16(a + i, n - i, key);
+        }
+
+        APP_TARGET_AVX2 inline size_t find_u32(const uint32_t* a, size_t n, uint32_t key)
+        {
+            const auto k = _mm256_set1_epi32((int) key);
+
+            size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                uint32_t m = mask32_epi32(
+                  _mm256_cmpeq_epi32(load(a + i), k),
+                  _mm256_cmpeq_epi32(load(a + i + 8), k),
+                  _mm256_cmpeq_epi32(load(a + i + 16), k),
+                  _mm256_cmpeq_epi32(load(a + i + 24), k));
+
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+
+            return i + SSE2::find_u32(a + i, n - i, key);
+        }
+
+        APP_TARGET_AVX2 inline size_t find_u64(const uint64_t* a, size_t n, uint64_t key)
+        {
+            const auto k = _mm256_set1_epi64x((long long) key);
+
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                uint32_t m = 0;
+                for (int j = 0; j < 4; ++j)
+                {
+                    auto c = _mm256_cmpeq_epi64(load(a + i + 4 * j), k);
+                    m |= _mm256_movemask_pd(_mm256_castsi256_pd(c)) << (4 * j);
+                }
+
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+
+            return i + SSE2::find_u64(a + i, n - i, key);
+        }
+
+        APP_TARGET_AVX2 inline size_t find_nonzero_u8(const uint8_t* a, size_t n)
+        {
+            const auto zero = _mm256_setzero_si256();
+
+            size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                uint32_t m = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(load(a + i), zero));
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+
+            return i + SSE2::find_nonzero_u8(a + i, n - i);
+        }
+
+        APP_TARGET_AVX2 inline size_t select_below_u32(const uint32_t* v,
+                                                       const uint8_t* active,
+                                                       size_t n,
+                                                       uint32_t threshold,
+                                                       uint32_t* out)
+        {
+            const auto bias = _mm256_set1_epi32((int) 0x80000000u);
+            const auto t = _mm256_xor_si256(_mm256_set1_epi32((int) threshold), bias);
+            const auto zero = _mm256_setzero_si256();
+
+            size_t k = 0;
+            size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                uint32_t below = mask32_epi32(
+                  _mm256_cmpgt_epi32(t, _mm256_xor_si256(load(v + i), bias)),
+                  _mm256_cmpgt_epi32(t, _mm256_xor_si256(load(v + i + 8), bias)),
+                  _mm256_cmpgt_epi32(t, _mm256_xor_si256(load(v + i + 16), bias)),
+                  _mm256_cmpgt_epi32(t, _mm256_xor_si256(load(v + i + 24), bias)));
+
+                uint32_t live = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(load(active + i), zero));
+
+                k += emit_bits(below & live, i, out + k);
+            }
+
+            return k + SSE2::select_below_u32(v + i, active + i, n - i, threshold, out + k);
+        }
+
+        APP_TARGET_AVX2 inline size_t count_active(const uint8_t* active, size_t n)
+        {
+            const auto zero = _mm256_setzero_si256();
+            auto acc = _mm256_setzero_si256();
+
+            size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+                acc = _mm256_add_epi64(acc, _mm256_sad_epu8(load(active + i), zero));
+
+            uint64_t lanes[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SSE2::count_active(active + i, n - i);
+        }
+    } // namespace AVX2
+
+    #undef APP_TARGET_AVX2
+
+#endif /* APP_SCAN_X86 */
+
+    /* ------------------------------------------------------------------------ */
+    /* ------------------------------- DISPATCH ------------------------------- */
+    /* ------------------------------------------------------------------------ */
+
+    inline Isa DetectIsa()
+    {
+#if APP_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return Isa::AVX2;
+
+        return Isa::SSE2;
+#else
+        return Isa::Scalar;
+#endif
+    }
+
+    /* Kernel table for a given instruction set. Asking for one the build can't target yields the scalar table */
+    inline Kernels KernelsFor(Isa isa)
+    {
+#define SCAN_KERNEL_TABLE(ns) \
+    { Isa::ns, ns::find_u16, ns::find_u32, ns::find_u64, ns::find_nonzero_u8, ns::select_below_u32, ns::count_active }
+
+#if APP_SCAN_X86
+        if (isa == Isa::AVX2)
+            return SCAN_KERNEL_TABLE(AVX2);
+
+        if (isa == Isa::SSE2)
+            return SCAN_KERNEL_TABLE(SSE2);
+#endif
+
+        return SCAN_KERNEL_TABLE(Scalar);
+
+#undef SCAN_KERNEL_TABLE
+    }
+
+    /* Resolved once on first use */
+    inline const Kernels& Best()
+    {
+        static const Kernels k = KernelsFor(DetectIsa());
+        return k;
+    }
+
+    inline const char* IsaName(Isa isa)
+    {
+        switch (isa)
+        {
+            case Isa::AVX2: return "avx2";
+            case Isa::SSE2: return "sse2";
+            default: return "scalar";
+        }
+    }
+
+    /* Typed front doors, so callers don't have to care about the width of item_id_t */
+    inline size_t Find(const Kernels& k, const uint16_t* a, size_t n, uint16_t key)
+    {
+        return k.find_u16(a, n, key);
+    }
+
+    inline size_t Find(const Kernels& k, const uint32_t* a, size_t n, uint32_t key)
+    {
+        return k.find_u32(a, n, key);
+    }
+
+    inline size_t Find(const Kernels& k, const uint64_t* a, size_t n, uint64_t key)
+    {
+        return k.find_u64(a, n, key);
+    }
+
+    template<typename T>
+    inline size_t Find(const T* a, size_t n, T key)
+    {
+        return Find(Best(), a, n, key);
+    }
+
+    inline size_t NextActive(const uint8_t* active, size_t from, size_t n)
+    {
+        return from + Best().find_nonzero_u8(active + from, n - from);
+    }
+
+    inline size_t SelectBelow(const uint32_t* v, const uint8_t* active, size_t n, uint32_t threshold, uint32_t* out)
+    {
+        return Best().select_below_u32(v, active, n, threshold, out);
+    }
+
+    inline size_t CountActive(const uint8_t* active, size_t n)
+    {
+        return Best().count_active(active, n);
+    }
+} // namespace Scan
+
+#endif
@@ -0,0 +1,291 @@
+#pragma once
+
+#ifndef __APP_SCHEMA_H_
+#define __APP_SCHEMA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Compile-time descriptions of on-disk records. A record lists the fields of a struct in file order, and its
+ * Encode() and Decode() are generated from that list, so reader and writer cannot drift apart and adding a
+ * field is one line.
+ *
+ * Fields that sit back to back both in the struct and in the file are merged into a single memcpy. Data files
+ * are little-endian: on a little-endian host the copies are all there is; elsewhere every field is swapped
+ * on its own, once the bytes are in place.
+ *
+ * A field kind provides offset, size, max_size, fixed and swap(). Fixed fields are copied as raw bytes; other
+ * kinds also provide encode() and decode() for an encoding of their own (see Serialization::TextField).
+ */
+namespace Schema
+{
+    static constexpr bool HOST_LITTLE_ENDIAN = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+    /* Converts a number between host and file order, either way. Anything but numbers is left alone */
+    template<typename T>
+    inline T little_endian(T v)
+    {
+        if (HOST_LITTLE_ENDIAN || sizeof(T) == 1 || !(std::is_arithmetic<T>::value || std::is_enum<T>::value))
+            return v;
+
+        char bytes[sizeof(T)];
+        memcpy(bytes, &v, sizeof(T));
+        std::reverse(bytes, bytes + sizeof(T));
+        memcpy(&v, bytes, sizeof(T));
+        return v;
+    }
+
+    template<typename T>
+    inline void put(char*& out, T v)
+    {
+        v = little_endian(v);
+        memcpy(out, &v, sizeof(T));
+        out += sizeof(T);
+    }
+
+    template<typename T>
+    inline T get(const char* p)
+    {
+        T v;
+        memcpy(&v, p, sizeof(T));
+        return little_endian(v);
+    }
+
+    /* A number (or enum, or bool) stored as its bytes */
+    template<typename T, size_t Offset>
+    struct Plain
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "Plain fields must be numbers");
+
+        static constexpr size_t offset = Offset;
+        static constexpr size_t size = sizeof(T);
+        static constexpr size_t max_size = sizeof(T);
+        static constexpr bool fixed = true;
+
+        static void swap(char* s)
+        {
+            T v;
+            memcpy(&v, s + Offset, sizeof(T));
+            v = little_endian(v);
+            memcpy(s + Offset, &v, sizeof(T));
+        }
+    };
+
+#define SCHEMA_PLAIN(Struct, member) \
+    Schema::Plain<decltype(std::declval<Struct&>().member), offsetof(Struct, member)>
+
+    /* Context for records without fields of their own encoding */
+    struct NoContext
+    {
+    };
+
+    constexpr size_t sum()
+    {
+        return 0;
+    }
+
+    template<typename... Rest>
+    constexpr size_t sum(size_t first, Rest... rest)
+    {
+        return first + sum(rest...);
+    }
+
+    /* Whether the fields, in order, cover the bytes from At on without gaps */
+    template<size_t At, typename... Fields>
+    struct Contiguous : std::true_type
+    {
+    };
+
+    template<size_t At, typename F, typename... Rest>
+    struct Contiguous<At, F, Rest...>
+        : std::integral_constant<bool, F::fixed && F::offset == At && Contiguous<At + F::size, Rest...>::value>
+    {
+    };
+
+    /*
+     * Code generation. Ops<Begin, Size, Fields...> has a run of Size struct bytes from Begin pending; each
+     * field either extends the run or ends it, and a run is copied when it ends.
+     */
+    template<size_t Begin, size_t Size, typename... Fields>
+    struct Ops;
+
+    template<size_t Begin, size_t Size, bool Fixed, bool Joins, typename... Fields>
+    struct Step;
+
+    template<size_t Begin, size_t Size>
+    struct Ops<Begin, Size>
+    {
+        template<typename Ctx>
+        static void encode(const char* s, char*& out, Ctx&)
+        {
+            memcpy(out, s + Begin, Size);
+            out += Size;
+        }
+
+        template<typename In, typename Ctx>
+        static bool decode(char* s, In& in, Ctx&)
+        {
+            if (Size == 0)
+                return true;
+
+            auto p = in.take(Size);
+            if (p == nullptr)
+                return false;
+
+            memcpy(s + Begin, p, Size);
+            return true;
+        }
+    };
+
+    template<size_t Begin, size_t Size, typename F, typename... Rest>
+    struct Ops<Begin, Size, F, Rest...>
+        : Step<Begin, Size, F::fixed, F::fixed && Size != 0 && F::offset == Begin + Size, F, Rest...>
+    {
+    };
+
+    /* Fixed field right after the run: the run grows */
+    template<size_t Begin, size_t Size, typename F, typename... Rest>
+    struct Step<Begin, Size, true, true, F, Rest...> : Ops<Begin, Size + F::size, Rest...>
+    {
+    };
+
+    /* Fixed field elsewhere: the run is copied and a new one starts */
+    template<size_t Begin, size_t Size, typename F, typename... Rest>
+    struct Step<Begin, Size, true, false, F, Rest...>
+    {
+        template<typename Ctx>
+        static void encode(const char* s, char*& out, Ctx& ctx)
+        {
+            Ops<Begin, Size>::encode(s, out, ctx);
+            Ops<F::offset, F::size, Rest...>::encode(s, out, ctx);
+        }
+
+        template<typename In, typename Ctx>
+        static bool decode(char* s, In& in, Ctx& ctx)
+        {
+            return Ops<Begin, Size>::decode(s, in, ctx) && Ops<F::offset, F::size, Rest...>::decode(s, in, ctx);
+        }
+    };
+
+    /* Field with an encoding of its own */
+    template<size_t Begin, size_t Size, typename F, typename... Rest>
+    struct Step<Begin, Size, false, false, F, Rest...>
+    {
+        template<typename Ctx>
+        static void encode(const char* s, char*& out, Ctx& ctx)
+        {
+            Ops<Begin, Size>::encode(s, out, ctx);
+            F::encode(s + F::offset, out, ctx);
+            Ops<0, 0, Rest...>::encode(s, out, ctx);
+        }
+
+        template<typename In, typename Ctx>
+        static bool decode(char* s, In& in, Ctx& ctx)
+        {
+            return Ops<Begin, Size>::decode(s, in, ctx) && F::decode(s + F::offset, in, ctx)
+                   && Ops<0, 0, Rest...>::decode(s, in, ctx);
+        }
+    };
+
+    template<typename... Fields>
+    struct SwapAll
+    {
+        static void run(char*) {}
+    };
+
+    template<typename F, typename... Rest>
+    struct SwapAll<F, Rest...>
+    {
+        static void run(char* s)
+        {
+            F::swap(s);
+            SwapAll<Rest...>::run(s);
+        }
+    };
+
+    template<typename Struct, typename... Fields>
+    struct Record
+    {
+        static_assert(std::is_standard_layout<Struct>::value, "Field offsets need a standard-layout struct");
+        static_assert(std::is_trivially_copyable<Struct>::value, "Records are encoded from raw struct bytes");
+
+        typedef Struct type;
+        typedef Ops<0, 0, Fields...> Generated; // in place and in host order, see Embedded
+
+        static constexpr size_t max_size = sum(Fields::max_size...);
+
+        /* Stored exactly as the struct is laid out in memory, so an array of them is one copy on this host */
+        static constexpr bool packed = Contiguous<0, Fields...>::value && sum(Fields::size...) == sizeof(Struct);
+        static constexpr bool raw = packed && HOST_LITTLE_ENDIAN;
+
+        /* Writes at most max_size bytes at out. Returns the end of what was written */
+        template<typename Ctx>
+        static char* Encode(const Struct& s, char* out, Ctx& ctx)
+        {
+            auto bytes = reinterpret_cast<const char*>(&s);
+
+            typename std::aligned_storage<sizeof(Struct), alignof(Struct)>::type swapped;
+            if (!HOST_LITTLE_ENDIAN)
+            {
+                memcpy(&swapped, &s, sizeof(Struct));
+                SwapAll<Fields...>::run(reinterpret_cast<char*>(&swapped));
+                bytes = reinterpret_cast<const char*>(&swapped);
+            }
+
+            Generated::encode(bytes, out, ctx);
+            return out;
+        }
+
+        /* in.take(n) hands out the next n bytes, or null at the end of the input */
+        template<typename In, typename Ctx>
+        static bool Decode(Struct& s, In& in, Ctx& ctx)
+        {
+            auto bytes = reinterpret_cast<char*>(&s);
+            if (!Generated::decode(bytes, in, ctx))
+                return false;
+
+            SwapAll<Fields...>::run(bytes);
+            return true;
+        }
+
+        /* For a struct copied from a file in bulk (see raw) */
+        static void ToHostOrder(Struct& s)
+        {
+            SwapAll<Fields...>::run(reinterpret_cast<char*>(&s));
+        }
+    };
+
+    /* A struct member described by a record of its own */
+    template<size_t Offset, typename Rec>
+    struct Embedded
+    {
+        static constexpr size_t offset = Offset;
+        static constexpr size_t size = Rec::packed ? Rec::max_size : 0;
+        static constexpr size_t max_size = Rec::max_size;
+        static constexpr bool fixed = Rec::packed;
+
+        static void swap(char* s)
+        {
+            Rec::ToHostOrder(*reinterpret_cast<typename Rec::type*>(s + Offset));
+        }
+
+        template<typename Ctx>
+        static void encode(const char* field, char*& out, Ctx& ctx)
+        {
+            Rec::Generated::encode(field, out, ctx);
+        }
+
+        template<typename In, typename Ctx>
+        static bool decode(char* field, In& in, Ctx& ctx)
+        {
+            return Rec::Generated::decode(field, in, ctx);
+        }
+    };
+} // namespace Schema
+
+#endif
@@ -7,9 +7,15 @@
 #include <iostream>
 #include <cstdint>
 #include <cstring>
-#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "repr.h"
+#include "schema.h"
 
 namespace Serialization
 {
@@ -22,6 +28,105 @@ namespace Serialization
         0x59, 0x53, 0x54, 0x45, 0x4D, 0x52, 0x56, 0x4D, //
     }; // hexdump of "INVMGMTSYSTEMRVM"
 
+    /*
+     * Version 1 files have the item count right after the magic bytes and 16-bit item ids. Since version 2
+     * the magic is followed by VERSION_MARK | version and the byte width of the stored ids. No version 1 file
+     * can have a count with the mark's high bits set, which is how the two are told apart.
+     *
+     * Version 3 moves item names and categories longer than ArenaString::INLINE_CAPACITY into one blob right
+     * after the header, loaded with a single read; items refer to them by offset. Shorter strings, and every
+     * string in older versions, are stored next to the item.
+     *
+     * Version 4 moves the member block to the end, after the sections, and follows it with a table of where
+     * each item's members start and the block's size. Loading reads only the table; chains are decoded when
+     * first used (see membersrc.h).
+     *
+     * Version 5 stores every member name once, in the MemberNames section, and each item's members as one
+     * block of MemberSlots that refer to the names by index. Older files name each member in place; their
+     * lists are decoded while loading.
+     *
+     * Files are always written in the current version, so older ones are upgraded on the next save.
+     */
+    static constexpr uint32_t VERSION_MARK = 0xFFFF0000;
+    static constexpr uint16_t FORMAT_VERSION = 5;
+
+    struct FileHeader
+    {
+        uint16_t version = 1;
+        uint8_t id_bytes = 2;
+        item_count_t count = 0;
+    };
+
+    /*
+     * Optional sections following the member block (preceding it since version 4). Files written before
+     * sections existed simply end after the members, and readers skip tags they don't know, so new sections
+     * can be added without breaking either direction.
+     */
+    static constexpr uint32_t SECTIONS_MAGIC = 0x54434553; // "SECT"
+
+    enum class SectionTag : uint32_t
+    {
+        End = 0,
+        ReorderLevels = 1,
+        JournalSeq = 2,  // last journal transaction included in this file
+        MemberNames = 3, // count, then each name as a 4-byte length and the characters
+        DueDates = 4,    // count, then per loan: item position (4), member id (4), due time in seconds (8)
+
+        /* Lookup structures, each behind an IndexStamp */
+        IdTable = 5,     // key width (4), buckets (4), size (4), max_key_slot (4), keys, then slots (4 each)
+        Categories = 6,  // count, per category its name and totals (8 + 8), then per item its cat and pos (4 + 4)
+        NameOrder = 7,   // count, then the slots of the active items sorted by name (4 each)
+        MemberTable = 8, // buckets, then the member id in each (4 each)
+        StateDigest = 9, // the inventory's digest (8), see digest.h
+    };
+
+    /*
+     * The index sections save the derived structures a load would otherwise rebuild from the items. Each
+     * starts with a stamp of the index layout version and of the item count and journal seq of the file it
+     * describes, and a checksum of the rest of the section. A section whose stamp doesn't match the file, or
+     * whose checksum or contents don't add up, is ignored and that index rebuilt, just as for a file without
+     * the section. Bump INDEX_VERSION whenever an index's layout or hash function changes.
+     */
+    static constexpr uint32_t INDEX_VERSION = 1;
+
+    struct IndexStamp
+    {
+        uint32_t version = INDEX_VERSION;
+        uint32_t count = 0;
+        uint64_t seq = 0;
+        uint64_t checksum = 0;
+    };
+
+    static constexpr uint64_t INDEX_STAMP_BYTES = 24;
+
+    /* Indexes ReadFromFile took from the file, so Core::RebuildIndexes can skip them */
+    enum LoadedIndex : uint32_t
+    {
+        LOADED_IDS = 1,
+        LOADED_CATEGORIES = 2,
+        LOADED_NAMES = 4,
+    };
+
+    /* Checksum of an index section: eight bytes at a time, with one multiply each */
+    inline uint64_t Checksum(const char* p, size_t len)
+    {
+        uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+        size_t i = 0;
+
+        for (; i + 8 <= len; i += 8)
+        {
+            h = (h ^ Schema::get<uint64_t>(p + i)) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+
+        uint64_t tail = 0;
+        for (size_t k = 0; i + k < len; ++k)
+            tail |= (uint64_t) (unsigned char) p[i + k] << (8 * k);
+
+        h = (h ^ tail) * 0xc4ceb9fe1a85ec53ull;
+        return h ^ (h >> 29);
+    }
+
     using DataFile = fstream*;
 
     inline DataFile OpenFile()
@@ -60,10 +165,12 @@ namespace Serialization
     template<typename T, typename S = void>
     using enable_if_copyable = typename std::enable_if<std::is_trivially_copyable<T>::value, S>::type;
 
+    /* Numbers are stored little-endian (see schema.h); on a little-endian host every helper is a plain copy */
     template<typename T>
     inline enable_if_copyable<T> write_bytes(fstream& fout, const T& x)
     {
-        fout.write(TO_BYTES_I(&(x)), sizeof(T));
+        auto v = Schema::little_endian(x);
+        fout.write(TO_BYTES_I(&(v)), sizeof(T));
     }
 
     // Address of an array is not guaranteed to be its start. Thus another overload is required that deals with arrays
@@ -77,7 +184,14 @@ namespace Serialization
     template<typename T>
     inline enable_if_copyable<T> write_bytes(fstream& fout, const T* x, size_t count)
     {
-        fout.write(TO_BYTES_I(x), sizeof(T) * count);
+        if (Schema::HOST_LITTLE_ENDIAN || sizeof(T) == 1)
+        {
+            fout.write(TO_BYTES_I(x), sizeof(T) * count);
+            return;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            write_bytes(fout, x[i]);
     }
 
     inline void write_bytes(fstream& fout, const std::string& x)
@@ -91,6 +205,7 @@ namespace Serialization
     inline enable_if_copyable<T, bool> read_bytes(fstream& fin, T& x)
     {
         fin.read(TO_BYTES_M(&(x)), sizeof(T));
+        x = Schema::little_endian(x);
         return !fin.fail();
     }
 
@@ -105,6 +220,11 @@ namespace Serialization
     inline enable_if_copyable<T, bool> read_bytes(fstream& fin, T* x, size_t count)
     {
         fin.read(TO_BYTES_M(x), sizeof(T) * count);
+
+        if (!Schema::HOST_LITTLE_ENDIAN && sizeof(T) > 1)
+            for (size_t i = 0; i < count; ++i)
+                x[i] = Schema::little_endian(x[i]);
+
         return !fin.fail();
     }
 
@@ -115,9 +235,8 @@ namespace Serialization
         res &= read_bytes(fin, len);
         if (res)
         {
-            static char buf[4096];
-            res &= read_bytes(fin, buf, len);
-            x.assign(buf, len);
+            x.resize(len);
+            res &= read_bytes(fin, &x[0], len);
         }
         return res;
     }
@@ -125,75 +244,642 @@ namespace Serialization
 #undef TO_BYTES_I
 #undef TO_BYTES_M
 
+    /* --------------------------------------------------------------- */
+    /* --------------------------- SCHEMA ---------------------------- */
+    /* --------------------------------------------------------------- */
+
+    /* Long strings of a version 3+ file, loaded into the inventory's arena */
+    struct StringBlob
+    {
+        const char* base = nullptr;
+        uint64_t size = 0;
+    };
+
+    /* What string fields need besides the item: the offset of the next long string when writing, the blob
+     * they live in when reading */
+    struct TextContext
+    {
+        uint64_t blob_offset = 0;
+        StringBlob blob;
+        StringArena* arena = nullptr; // what the strings read are kept in
+    };
+
+    /* ArenaString stored as its length, then either the characters or the string's offset into the blob */
+    template<size_t Offset>
+    struct TextField
+    {
+        static constexpr size_t offset = Offset;
+        static constexpr size_t size = 0;
+        static constexpr size_t max_size = sizeof(uint32_t)
+                                         + (ArenaString::INLINE_CAPACITY > 8 ? ArenaString::INLINE_CAPACITY : 8);
+        static constexpr bool fixed = false;
+
+        static void swap(char*) {}
+
+        static void encode(const char* field, char*& out, TextContext& ctx)
+        {
+            auto& s = *reinterpret_cast<const ArenaString*>(field);
+            Schema::put<uint32_t>(out, s.size());
+
+            if (s.is_inline())
+            {
+                memcpy(out, s.data(), s.size());
+                out += s.size();
+            }
+            else
+            {
+                Schema::put<uint64_t>(out, ctx.blob_offset);
+                ctx.blob_offset += s.size() + 1;
+            }
+        }
+
+        template<typename In>
+        static bool decode(char* field, In& in, TextContext& ctx)
+        {
+            auto& s = *reinterpret_cast<ArenaString*>(field);
+
+            auto p = in.take(sizeof(uint32_t));
+            if (p == nullptr)
+                return false;
+
+            auto len = Schema::get<uint32_t>(p);
+            if (len <= ArenaString::INLINE_CAPACITY)
+            {
+                if ((p = in.take(len)) == nullptr)
+                    return false;
+
+                s = Strings::Load(*ctx.arena, p, len);
+                return true;
+            }
+
+            if ((p = in.take(sizeof(uint64_t))) == nullptr)
+                return false;
+
+            /* The string and its terminator must lie inside the blob */
+            auto& blob = ctx.blob;
+            auto offset = Schema::get<uint64_t>(p);
+            if (offset >= blob.size || blob.size - offset <= len || blob.base[offset + len] != '\0')
+                return false;
+
+            s = Strings::Load(*ctx.arena, blob.base + offset, len);
+            return true;
+        }
+    };
+
+    typedef Schema::Record<ItemMeta, TextField<offsetof(ItemMeta, name)>, TextField<offsetof(ItemMeta, cat)>>
+        MetaRecord;
+
+    /* Item record since version 3. The reorder level has a section of its own, members a block of their own */
+    typedef Schema::Record<InventoryItem,
+                           SCHEMA_PLAIN(InventoryItem, item_id),
+                           Schema::Embedded<offsetof(InventoryItem, meta), MetaRecord>,
+                           SCHEMA_PLAIN(InventoryItem, item_count),
+                           SCHEMA_PLAIN(InventoryItem, assigned_count),
+                           SCHEMA_PLAIN(InventoryItem, active)>
+        ItemRecord;
+
+    typedef Schema::Record<MemberSlot, SCHEMA_PLAIN(MemberSlot, member), SCHEMA_PLAIN(MemberSlot, units)>
+        MemberRecord;
+
+    static_assert(MemberRecord::packed, "Member lists are read and written as whole blocks of MemberSlots");
+
+    /* Large reads of the stream, handed out a record at a time. finish() leaves the stream right after the
+     * last byte taken */
+    struct ChunkReader
+    {
+        static constexpr size_t CHUNK = 256 << 10;
+
+        fstream& f;
+        uint64_t start; // stream position of buf[0]
+        std::vector<char> buf;
+        size_t pos = 0;
+        size_t end = 0;
+
+        explicit ChunkReader(fstream& f) : f(f), start(f.tellg()), buf(CHUNK) {}
+
+        const char* take(size_t n)
+        {
+            if (end - pos < n)
+            {
+                memmove(buf.data(), buf.data() + pos, end - pos);
+                start += pos;
+                end -= pos;
+                pos = 0;
+
+                f.read(buf.data() + end, buf.size() - end);
+                end += f.gcount();
+
+                if (end < n)
+                    return nullptr;
+            }
+
+            auto p = buf.data() + pos;
+            pos += n;
+            return p;
+        }
+
+        void finish()
+        {
+            f.clear();
+            f.seekg(start + pos);
+        }
+    };
+
     /* --------------------------------------------------------------- */
     /* --------------------------- WRITING --------------------------- */
     /* --------------------------------------------------------------- */
 
-    inline void WriteItem(DataFile f, const InventoryItem& item)
+    /* What gets written: the live inventory, or a snapshot of it */
+    struct Contents
     {
-        auto& fout = *f;
-        write_bytes(fout, item.item_id);
+        const ItemPages& items;
+        uint32_t count;
+        uint64_t seq; // last journal transaction included
+        const MemberNames& member_names;
+        MemberSource* members; // where lists that were never decoded are copied from
+        const DueHeap& due;
+        const Inventory* indexes; // the live inventory, whose lookup structures are saved too
+    };
+
+    inline Contents ContentsOf(const Inventory& inv)
+    {
+        return {
+            inv.items, inv.count, inv.log.seq, inv.member_names.names, inv.member_source.get(), inv.due.heap, &inv,
+        };
+    }
 
-        /* Meta */
+    /* Snapshots carry no indexes; a file saved from one rebuilds them when loaded */
+    inline Contents ContentsOf(const Snapshot& snap)
+    {
+        return { snap.items, snap.count, snap.seq, snap.member_names, snap.member_source.get(), snap.due, nullptr };
+    }
+
+    /*
+     * Stored member lists, read straight from a MemberSource: the member count (4 bytes), then that many
+     * MemberSlots. `names` is the size of the directory the member ids refer to.
+     */
+    inline bool read_stored_count(MemberSource& src, uint64_t pos, uint32_t& count)
+    {
+        if (!MemberSources::Read(src, pos, &count, sizeof(count)))
+            return false;
+
+        count = Schema::little_endian(count);
+        return (uint64_t) count * sizeof(MemberSlot) <= src.size - pos - sizeof(count);
+    }
+
+    /* Decodes the list at pos into `list`, which must be empty. On failure it stays empty */
+    inline bool DecodeMembers(MemberSource& src, uint64_t pos, size_t names, MemberList& list)
+    {
+        uint32_t count;
+        if (!read_stored_count(src, pos, count))
+            return false;
+
+        MemberLists::Reserve(list, count);
+        if (!MemberSources::Read(src, pos + sizeof(count), list.data(), count * sizeof(MemberSlot)))
+            return false;
+
+        for (uint32_t i = 0; i < count; ++i)
         {
-            // 1. Name
-            write_bytes(fout, item.meta.name);
+            MemberRecord::ToHostOrder(list[i]);
 
-            // 2. Cat
-            write_bytes(fout, item.meta.cat);
+            if (list[i].member >= names)
+            {
+                MemberLists::Free(list);
+                return false;
+            }
         }
 
-        write_bytes(fout, item.item_count);
-        write_bytes(fout, item.assigned_count);
-        write_bytes(fout, item.active);
+        list.size = count;
+        return true;
+    }
+
+    /* Calls fn(member_id_t member, uint32_t units) for each member of the list at pos, without keeping it */
+    template<typename F>
+    bool ForEachStoredMember(MemberSource& src, uint64_t pos, size_t names, F fn)
+    {
+        MemberList list;
+        if (!DecodeMembers(src, pos, names, list))
+            return false;
+
+        for (uint32_t i = 0; i < list.size; ++i)
+            fn(list[i].member, list[i].units);
+
+        MemberLists::Free(list);
+        return true;
+    }
+
+    inline void WriteHeader(DataFile f, const Contents& c)
+    {
+        uint32_t version = VERSION_MARK | FORMAT_VERSION;
+        uint8_t id_bytes = sizeof(item_id_t);
+
+        write_bytes(*f, MAGIC_BYTES);
+        write_bytes(*f, version);
+        write_bytes(*f, id_bytes);
+        write_bytes(*f, c.count);
     }
 
-    inline void WriteSingleMember(fstream& fout, const Member* mem)
+    /* Long item strings in the order item records refer to them: name then category, item by item */
+    template<typename = void>
+    void WriteStringBlob(DataFile f, const Contents& c)
     {
-        write_bytes(fout, mem->name);
-        write_bytes(fout, mem->borrow_count);
+        uint64_t size = 0;
+        for (uint32_t i = 0; i < c.count; ++i)
+        {
+            auto& meta = c.items[i].meta;
+            size += meta.name.is_inline() ? 0 : meta.name.size() + 1;
+            size += meta.cat.is_inline() ? 0 : meta.cat.size() + 1;
+        }
+
+        write_bytes(*f, size);
+
+        for (uint32_t i = 0; i < c.count; ++i)
+        {
+            auto& meta = c.items[i].meta;
+
+            if (!meta.name.is_inline())
+                write_bytes(*f, meta.name.c_str(), meta.name.size() + 1);
+
+            if (!meta.cat.is_inline())
+                write_bytes(*f, meta.cat.c_str(), meta.cat.size() + 1);
+        }
     }
 
+    /* Item records, encoded into a buffer that is written out whenever it could not take another one */
+    template<typename = void>
+    void WriteItems(DataFile f, const Contents& c)
+    {
+        static constexpr size_t BUFFER = 64 << 10;
+        static_assert(ItemRecord::max_size <= BUFFER, "An item record must fit the write buffer");
+
+        std::vector<char> buf(BUFFER);
+        char* out = buf.data();
+        TextContext ctx;
+
+        for (uint32_t i = 0; i < c.count; ++i)
+        {
+            if (out + ItemRecord::max_size > buf.data() + BUFFER)
+            {
+                f->write(buf.data(), out - buf.data());
+                out = buf.data();
+            }
+
+            out = ItemRecord::Encode(c.items[i], out, ctx);
+        }
+
+        f->write(buf.data(), out - buf.data());
+    }
+
+    /* Copies a list that was never decoded as it is. Returns the bytes written */
+    inline uint64_t CopyStoredMembers(DataFile f, MemberSource& src, uint64_t pos, std::vector<char>& entry)
+    {
+        uint32_t count;
+
+        /* Unreadable: the item is saved without members rather than with a broken entry */
+        if (!read_stored_count(src, pos, count))
+            count = 0;
+
+        entry.resize(sizeof(count) + count * sizeof(MemberSlot));
+        if (!MemberSources::Read(src, pos, entry.data(), entry.size()))
+        {
+            count = 0;
+            entry.resize(sizeof(count));
+        }
+
+        auto stored = Schema::little_endian(count);
+        memcpy(entry.data(), &stored, sizeof(stored));
+        write_bytes(*f, entry.data(), entry.size());
+
+        return entry.size();
+    }
+
+    /* The count, then the slots in one write. Returns the bytes written */
     template<typename = void> /* Just to silence warning */
-    void WriteMembers(DataFile f, const InventoryItem& item)
+    uint64_t WriteMembers(DataFile f, const InventoryItem& item, MemberSource* src, std::vector<char>& scratch)
     {
-        auto count_pos = f->tellp();
+        auto stored = stored_members_of(item);
+        if (stored != MemberSources::NONE)
+            return CopyStoredMembers(f, *src, stored, scratch);
 
-        uint32_t count = 0;
-        write_bytes(*f, count);
+        auto& list = members_of(item);
+        write_bytes(*f, list.size);
 
-        auto mem = item.allocated_to;
-        while (mem != nullptr)
+        if (MemberRecord::raw)
         {
-            WriteSingleMember(*f, mem);
-            ++count;
-            mem = mem->next;
+            write_bytes(*f, list.data(), list.size);
         }
+        else
+        {
+            Schema::NoContext none;
+            char slot[MemberRecord::max_size];
 
-        auto next_write_spos = f->tellp();
+            for (uint32_t i = 0; i < list.size; ++i)
+                f->write(slot, MemberRecord::Encode(list[i], slot, none) - slot);
+        }
 
-        f->seekp(count_pos);
-        write_bytes(*f, count);
+        return sizeof(list.size) + list.size * sizeof(MemberSlot);
+    }
 
-        f->seekp(next_write_spos);
+    inline void WriteSectionHeader(DataFile f, SectionTag tag, uint64_t size)
+    {
+        write_bytes(*f, tag);
+        write_bytes(*f, size);
     }
 
+    /* An index section is built in memory first, so its checksum can go in front of it */
+    struct IndexPayload
+    {
+        std::vector<char> bytes;
+
+        template<typename T>
+        void put(T v)
+        {
+            auto at = bytes.size();
+            bytes.resize(at + sizeof(T));
+
+            char* out = &bytes[at];
+            Schema::put(out, v);
+        }
+
+        template<typename T>
+        void put(const T* x, size_t count)
+        {
+            auto at = bytes.size();
+            bytes.resize(at + sizeof(T) * count);
+            if (count == 0)
+                return;
+
+            char* out = &bytes[at];
+            if (Schema::HOST_LITTLE_ENDIAN || sizeof(T) == 1)
+            {
+                memcpy(out, x, sizeof(T) * count);
+                return;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+                Schema::put(out, x[i]);
+        }
+    };
+
+    inline void WriteIndexSection(DataFile f, SectionTag tag, const Contents& c, const IndexPayload& payload)
+    {
+        IndexStamp stamp;
+        stamp.count = c.count;
+        stamp.seq = c.seq;
+        stamp.checksum = Checksum(payload.bytes.data(), payload.bytes.size());
+
+        WriteSectionHeader(f, tag, INDEX_STAMP_BYTES + payload.bytes.size());
+        write_bytes(*f, stamp.version);
+        write_bytes(*f, stamp.count);
+        write_bytes(*f, stamp.seq);
+        write_bytes(*f, stamp.checksum);
+        write_bytes(*f, payload.bytes.data(), payload.bytes.size());
+    }
+
+    /* The live inventory's lookup structures, as they are in memory */
     template<typename = void>
-    void WriteToFile(DataFile f, const Inventory& inv)
+    void WriteIndexes(DataFile f, const Contents& c)
     {
-        f->clear();
-        f->seekp(0, ios::beg);
+        auto& inv = *c.indexes;
+        IndexPayload payload;
 
-        write_bytes(*f, MAGIC_BYTES);
-        write_bytes(*f, inv.count);
+        {
+            auto& ids = inv.ids;
+            uint32_t buckets = ids.keys.size();
+
+            payload.put((uint32_t) sizeof(item_id_t));
+            payload.put(buckets);
+            payload.put(ids.size);
+            payload.put(ids.max_key_slot);
+            payload.put(ids.keys.data(), buckets);
+            payload.put(ids.slots.data(), buckets);
+
+            WriteIndexSection(f, SectionTag::IdTable, c, payload);
+        }
+
+        /* Renumbered the way a rebuild would number them, by first item, with each category's items in slot
+         * order, so a load that takes the index lists categories and their items just as one that rebuilds */
+        payload.bytes.clear();
+        {
+            auto& cats = inv.categories;
+
+            std::vector<cat_id_t> renumbered(cats.entries.size(), CAT_NONE);
+            std::vector<cat_id_t> order;
+            for (uint32_t i = 0; i < c.count; ++i)
+            {
+                auto cat = Categories::CategoryOf(cats, i);
+                if (cat != CAT_NONE && renumbered[cat] == CAT_NONE)
+                {
+                    renumbered[cat] = order.size();
+                    order.push_back(cat);
+                }
+            }
+
+            payload.put((uint32_t) order.size());
+            for (auto cat : order)
+            {
+                auto& entry = cats.entries[cat];
+                payload.put((uint32_t) entry.name.size());
+                payload.put(entry.name.data(), entry.name.size());
+                payload.put(entry.item_count);
+                payload.put(entry.assigned_count);
+            }
+
+            std::vector<uint32_t> filled(order.size(), 0);
+            payload.bytes.reserve(payload.bytes.size() + (size_t) c.count * 8);
+            for (uint32_t i = 0; i < c.count; ++i)
+            {
+                auto cat = Categories::CategoryOf(cats, i);
+                if (cat == CAT_NONE)
+                {
+                    payload.put(CAT_NONE);
+                    payload.put((uint32_t) 0);
+                    continue;
+                }
+
+                payload.put(renumbered[cat]);
+                payload.put(filled[renumbered[cat]]++);
+            }
+
+            WriteIndexSection(f, SectionTag::Categories, c, payload);
+        }
+
+        /* Only if something needed it; items added since are merged into a copy */
+        if (inv.names.ready)
+        {
+            auto order = &inv.names;
+            NameIndex settled;
+            if (!inv.names.added.empty())
+            {
+                settled = inv.names;
+                NameIndexes::Settle(settled, ItemNameOf { &inv });
+                order = &settled;
+            }
+
+            payload.bytes.clear();
+            payload.put((uint32_t) order->sorted.size());
+            payload.put(order->sorted.data(), order->sorted.size());
+
+            WriteIndexSection(f, SectionTag::NameOrder, c, payload);
+        }
+
+        if (!inv.member_names.table.empty())
+        {
+            auto& table = inv.member_names.table;
+
+            payload.bytes.clear();
+            payload.put((uint32_t) table.size());
+            payload.put(table.data(), table.size());
+
+            WriteIndexSection(f, SectionTag::MemberTable, c, payload);
+        }
+
+        /* Only once something asked for it, and with every change folded in */
+        if (Digests::Settled(inv.digest))
+        {
+            payload.bytes.clear();
+            payload.put(inv.digest.sum);
+
+            WriteIndexSection(f, SectionTag::StateDigest, c, payload);
+        }
+    }
+
+    template<typename = void>
+    void WriteSections(DataFile f, const Contents& c)
+    {
+        write_bytes(*f, SECTIONS_MAGIC);
+
+        /* Reorder levels, one per item in file order */
+        {
+            WriteSectionHeader(f, SectionTag::ReorderLevels, (uint64_t) c.count * sizeof(item_count_t));
+            for (uint32_t i = 0; i < c.count; ++i)
+                write_bytes(*f, c.items[i].reorder_level);
+        }
+
+        WriteSectionHeader(f, SectionTag::JournalSeq, sizeof(c.seq));
+        write_bytes(*f, c.seq);
+
+        /* Member names, in id order */
+        {
+            auto& names = c.member_names;
+            uint32_t count = names.size();
+
+            uint64_t size = sizeof(count);
+            for (uint32_t i = 0; i < count; ++i)
+                size += sizeof(uint32_t) + names[i].size();
+
+            WriteSectionHeader(f, SectionTag::MemberNames, size);
+            write_bytes(*f, count);
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                uint32_t len = names[i].size();
+                write_bytes(*f, len);
+                write_bytes(*f, names[i].data(), len);
+            }
+        }
+
+        /* Due dates, after the names their member ids refer to */
+        if (!c.due.empty())
+        {
+            uint32_t count = c.due.size();
+            WriteSectionHeader(f, SectionTag::DueDates, sizeof(count) + (uint64_t) count * 16);
+            write_bytes(*f, count);
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                auto& e = c.due[i];
+                write_bytes(*f, e.slot);
+                write_bytes(*f, e.member);
+                write_bytes(*f, e.due);
+            }
+        }
+
+        /* Last, as the member table refers to the names */
+        if (c.indexes != nullptr)
+            WriteIndexes(f, c);
+
+        WriteSectionHeader(f, SectionTag::End, 0);
+    }
+
+    template<typename = void>
+    void WriteContents(DataFile f, const Contents& c)
+    {
+        WriteHeader(f, c);
+        WriteStringBlob(f, c);
+
+        WriteItems(f, c);
+
+        WriteSections(f, c);
+
+        /* Member block, then where each item's entry starts in it, then the block's size */
+        std::vector<uint64_t> starts(c.count, MemberSources::NONE);
+        std::vector<char> scratch;
+        uint64_t size = 0;
+
+        for (uint32_t i = 0; i < c.count; ++i)
+        {
+            auto& item = c.items[i];
+            if (members_of(item).empty() && stored_members_of(item) == MemberSources::NONE)
+                continue;
+
+            starts[i] = size;
+            size += WriteMembers(f, item, c.members, scratch);
+        }
+
+        write_bytes(*f, starts.data(), starts.size());
+        write_bytes(*f, size);
+    }
+
+    /*
+     * Writes the data file under a temporary name, syncs it and renames it over the old one. A crash can no
+     * longer leave a half-written data file behind, and the old file, which member lists not decoded yet
+     * are still read from, never changes. f is reopened on the new file.
+     */
+    template<typename = void>
+    bool WriteToFile(DataFile f, const Inventory& inv)
+    {
+        std::string temp = std::string(MAIN_FILE_NAME) + ".tmp";
+        {
+            fstream out(temp, ios::binary | ios::out | ios::trunc);
+            WriteContents(&out, ContentsOf(inv));
+
+            out.flush();
+            if (!out)
+            {
+                ::unlink(temp.c_str());
+                return false;
+            }
+        }
 
-        for (int i = 0; i < inv.count; ++i)
-            WriteItem(f, inv.items[i]);
+        int fd = ::open(temp.c_str(), O_RDONLY);
+        bool synced = fd >= 0 && ::fsync(fd) == 0;
+        if (fd >= 0)
+            ::close(fd);
 
-        for (int i = 0; i < inv.count; ++i)
-            WriteMembers(f, inv.items[i]);
+        if (!synced || ::rename(temp.c_str(), MAIN_FILE_NAME) != 0)
+        {
+            ::unlink(temp.c_str());
+            return false;
+        }
+
+        f->close();
+        f->open(MAIN_FILE_NAME, ios::binary | ios::in | ios::out);
+        return true;
+    }
+
+    /* Saves a snapshot as a regular data file. Only reads the snapshot, so it may run on any thread */
+    template<typename = void>
+    bool WriteSnapshot(const char* path, const Snapshot& snap)
+    {
+        fstream f(path, ios::binary | ios::out | ios::trunc);
+        if (!f)
+            return false;
 
-        std::flush(*f);
+        WriteContents(&f, ContentsOf(snap));
+
+        f.flush();
+        return !f.fail();
     }
 
     /* --------------------------------------------------------------- */
@@ -216,31 +902,144 @@ namespace Serialization
         return ValidateMagicBytes(*f);
     }
 
-    inline item_count_t ReadCount(DataFile f)
+    inline bool ReadHeader(DataFile f, FileHeader& header)
     {
-        item_count_t count;
-        if (read_bytes(*f, count))
-            return count;
+        uint32_t word;
+        if (!read_bytes(*f, word))
+            return false;
+
+        if ((word & VERSION_MARK) != VERSION_MARK)
+        {
+            header = FileHeader {};
+            header.count = word;
+            return true;
+        }
+
+        header.version = word & ~VERSION_MARK;
+        if (header.version > FORMAT_VERSION)
+            return false;
+
+        return read_bytes(*f, header.id_bytes) && read_bytes(*f, header.count);
+    }
+
+    /* Peeks at the header following the magic bytes. A file whose ids are wider than this build's item_id_t
+     * would not load, and must not be overwritten with an empty inventory either */
+    inline bool IsFileCompatible(DataFile f)
+    {
+        auto pos = f->tellg();
+
+        FileHeader header;
+        bool ok = ReadHeader(f, header) && header.id_bytes <= sizeof(item_id_t);
+
+        f->clear();
+        f->seekg(pos);
+
+        return ok;
+    }
+
+    /* Reads an id stored with `id_bytes` bytes. Fails if it doesn't fit this build's item_id_t */
+    inline bool read_id(fstream& fin, uint8_t id_bytes, item_id_t& id)
+    {
+        uint64_t value;
+
+        switch (id_bytes)
+        {
+            case 2:
+            {
+                uint16_t x;
+                if (!read_bytes(fin, x))
+                    return false;
+                value = x;
+                break;
+            }
+            case 4:
+            {
+                uint32_t x;
+                if (!read_bytes(fin, x))
+                    return false;
+                value = x;
+                break;
+            }
+            case 8:
+            {
+                if (!read_bytes(fin, value))
+                    return false;
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if (value > std::numeric_limits<item_id_t>::max())
+            return false;
+
+        id = value;
+        return true;
+    }
+
+    inline bool read_string(fstream& fin,
+                            const FileHeader& header,
+                            const StringBlob& blob,
+                            StringArena& arena,
+                            ArenaString& s)
+    {
+        if (header.version < 3)
+        {
+            static std::string legacy;
+            if (!read_bytes(fin, legacy) || legacy.size() > std::numeric_limits<uint32_t>::max())
+                return false;
+
+            s = Strings::Store(arena, legacy);
+            return true;
+        }
+
+        uint32_t len;
+        if (!read_bytes(fin, len))
+            return false;
+
+        if (len <= ArenaString::INLINE_CAPACITY)
+        {
+            char chars[ArenaString::INLINE_CAPACITY];
+            if (!read_bytes(fin, chars, len))
+                return false;
+
+            s = Strings::Load(arena, chars, len);
+            return true;
+        }
+
+        uint64_t offset;
+        if (!read_bytes(fin, offset))
+            return false;
 
-        return -1;
+        /* The string and its terminator must lie inside the blob */
+        if (offset >= blob.size || blob.size - offset <= len || blob.base[offset + len] != '\0')
+            return false;
+
+        s = Strings::Load(arena, blob.base + offset, len);
+        return true;
     }
 
+    /* Items of files before version 3, or with ids of another width; the rest go through ItemRecord */
     template<typename = void>
-    bool ReadItem(DataFile f, InventoryItem& item)
+    bool ReadItem(DataFile f,
+                  Inventory& inv,
+                  InventoryItem& item,
+                  const FileHeader& header,
+                  const StringBlob& blob)
     {
         int res = 1;
 
         auto& fin = *f;
 
-        res &= read_bytes(fin, item.item_id);
+        res &= read_id(fin, header.id_bytes, item.item_id);
 
         /* Meta */
         {
             // 1. Name
-            res &= read_bytes(fin, item.meta.name);
+            res &= read_string(fin, header, blob, inv.strings, item.meta.name);
 
             // 2. Cat
-            res &= read_bytes(fin, item.meta.cat);
+            res &= read_string(fin, header, blob, inv.strings, item.meta.cat);
         }
         res &= read_bytes(fin, item.item_count);
         res &= read_bytes(fin, item.assigned_count);
@@ -249,84 +1048,569 @@ namespace Serialization
         return res;
     }
 
-    inline bool ReadItem(DataFile f, InventoryItem& item, size_t index)
+    inline uint64_t BytesLeft(DataFile f)
     {
-        f->seekg(sizeof(MAGIC_BYTES) + sizeof(item_count_t), ios::beg);
-        f->seekg(sizeof(InventoryItem) * index, ios::cur);
-        return ReadItem(f, item);
+        auto pos = f->tellg();
+        f->seekg(0, ios::end);
+        auto end = f->tellg();
+        f->seekg(pos);
+
+        return end > pos ? (uint64_t) (end - pos) : 0;
     }
 
-    inline bool ReadSingleMember(DataFile f, Member* mem)
+    /* Members of a pre-version 5 file, each named in place. The names are interned as they are read */
+    inline bool read_legacy_members(DataFile f, Inventory& inv, MemberList& list)
     {
-        bool res = 1;
+        uint32_t count;
+        if (!read_bytes(*f, count))
+            return false;
+
+        static std::string name;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            int units;
+            if (!read_bytes(*f, name) || !read_bytes(*f, units))
+                return false;
 
-        res &= read_bytes(*f, mem->name);
-        res &= read_bytes(*f, mem->borrow_count);
+            auto member = MemberLists::Intern(inv.member_names, name.data(), name.size());
+            MemberLists::Append(list, member, units);
+        }
 
-        return res;
+        return true;
     }
 
+    /*
+     * Table at the end of a version 4+ file: where each item's entry starts in the member block, which
+     * begins at the current position. Leaves the stream at the start of the block
+     */
+    template<typename = void>
+    bool ReadMemberTable(DataFile f, uint32_t count, uint64_t& block, std::vector<uint64_t>& starts)
+    {
+        block = f->tellg();
+
+        uint64_t table = (uint64_t) count * sizeof(uint64_t);
+        uint64_t left = BytesLeft(f);
 
-    inline bool ReadMembers(DataFile f, InventoryItem& item)
+        if (left < table + sizeof(uint64_t))
+            return false;
+
+        uint64_t size;
+        f->seekg(block + left - sizeof(size));
+        if (!read_bytes(*f, size) || size != left - table - sizeof(size))
+            return false;
+
+        starts.resize(count);
+        f->seekg(block + size);
+        if (!read_bytes(*f, starts.data(), count))
+            return false;
+
+        for (auto start : starts)
+            if (start != MemberSources::NONE && start >= size)
+                return false;
+
+        f->seekg(block);
+        return true;
+    }
+
+    /* Opens the data file at path as the inventory's MemberSource if any list is still stored in it */
+    template<typename = void>
+    bool AttachMemberSource(Inventory& inv, const char* path)
     {
-        uint32_t count;
-        if (!read_bytes(*f, count))
+        bool stored = false;
+        for (uint32_t i = 0; i < inv.count && !stored; ++i)
+            stored = stored_members_of(inv.items[i]) != MemberSources::NONE;
+
+        if (!stored)
+            return true;
+
+        inv.member_source = MemberSources::Open(path);
+        if (inv.member_source == nullptr)
             return false;
 
-        Member* tail = nullptr;
-        Member* head = nullptr;
+#if APP_LAZY_MEMBERS == 0
+        auto names = inv.member_names.names.size();
+
+        for (uint32_t i = 0; i < inv.count; ++i)
+        {
+            auto& item = inventory_mutable(inv, i);
+            auto stored = stored_members_of(item);
+            if (stored == MemberSources::NONE)
+                continue;
+
+            if (!DecodeMembers(*inv.member_source, stored, names, members_mutable(item)))
+                return false;
+
+            set_stored_members(item, MemberSources::NONE);
+        }
+
+        inv.member_source.reset();
+#endif
+
+        return true;
+    }
+
+    /* An index section's payload in memory; every get fails once it runs out */
+    struct IndexReader
+    {
+        const char* p;
+        const char* end;
+
+        size_t left() const
+        {
+            return end - p;
+        }
 
-        for (int i = 0; i < count; ++i)
+        template<typename T>
+        bool get(T& v)
         {
-            Member* current = CreateMember("");
-            if (!ReadSingleMember(f, current))
+            if (left() < sizeof(T))
                 return false;
 
-            if (i == 0)
-                head = current;
+            v = Schema::get<T>(p);
+            p += sizeof(T);
+            return true;
+        }
+
+        template<typename T>
+        bool get(T* x, size_t count)
+        {
+            if (left() / sizeof(T) < count)
+                return false;
 
-            current->prev = tail;
-            current->next = nullptr;
+            if (count > 0)
+                memcpy(x, p, sizeof(T) * count);
+            p += sizeof(T) * count;
 
-            if (tail != nullptr)
-                tail->next = current;
+            if (!Schema::HOST_LITTLE_ENDIAN && sizeof(T) > 1)
+                for (size_t i = 0; i < count; ++i)
+                    x[i] = Schema::little_endian(x[i]);
 
-            tail = current;
+            return true;
         }
+    };
+
+    /* Whether the section was written for this very file, and arrived intact */
+    inline bool IndexMatches(const std::vector<char>& section, uint32_t count, uint64_t seq)
+    {
+        if (section.size() < INDEX_STAMP_BYTES)
+            return false;
 
-        item.allocated_to = head;
+        auto p = section.data();
+        auto version = Schema::get<uint32_t>(p);
+        auto stamped_count = Schema::get<uint32_t>(p + 4);
+        auto stamped_seq = Schema::get<uint64_t>(p + 8);
+        auto checksum = Schema::get<uint64_t>(p + 16);
 
+        return version == INDEX_VERSION && stamped_count == count && stamped_seq == seq
+               && checksum == Checksum(p + INDEX_STAMP_BYTES, section.size() - INDEX_STAMP_BYTES);
+    }
+
+    inline bool is_table_size(uint32_t buckets)
+    {
+        return buckets >= 64 && (buckets & (buckets - 1)) == 0;
+    }
+
+    template<typename = void>
+    bool ReadIdTable(IndexReader& in, Inventory& inv, uint32_t count)
+    {
+        uint32_t key_bytes, buckets;
+        IdHashIndex<item_id_t> ids;
+        if (!in.get(key_bytes) || !in.get(buckets) || !in.get(ids.size) || !in.get(ids.max_key_slot))
+            return false;
+
+        /* Keys of another width (a build with other APP_ITEM_ID_BITS) go in other buckets */
+        if (key_bytes != sizeof(item_id_t) || (buckets != 0 && !is_table_size(buckets)))
+            return false;
+
+        if ((uint64_t) ids.size * 2 > buckets || (ids.max_key_slot != IDINDEX_NONE && ids.max_key_slot >= count))
+            return false;
+
+        ids.keys.resize(buckets);
+        ids.slots.resize(buckets);
+        if (!in.get(ids.keys.data(), buckets) || !in.get(ids.slots.data(), buckets) || in.left() != 0)
+            return false;
+
+        uint32_t used = 0;
+        for (uint32_t b = 0; b < buckets; ++b)
+        {
+            if (ids.keys[b] == IdHashIndex<item_id_t>::EMPTY)
+                continue;
+
+            if (ids.slots[b] >= count)
+                return false;
+
+            ++used;
+        }
+
+        if (used != ids.size)
+            return false;
+
+        inv.ids = std::move(ids);
         return true;
     }
 
+    /* The category of each item comes with its position in the category, so the slot lists are put back
+     * exactly as they were */
     template<typename = void>
-    bool ReadFromFile(DataFile f, Inventory& inv)
+    bool ReadCategoryIndex(IndexReader& in, Inventory& inv, uint32_t count)
     {
-        auto count = ReadCount(f);
-        if (count == -1)
+        uint32_t cats;
+        if (!in.get(cats))
             return false;
 
-        if (count > 0)
+        CategoryIndex index;
+        std::string name;
+        for (uint32_t c = 0; c < cats; ++c)
         {
-            inventory_allocate_capacity(inv, pow(2, ceil(log2(count))));
+            uint32_t len;
+            if (!in.get(len) || len > in.left())
+                return false;
+
+            name.resize(len);
+            if (!in.get(&name[0], len) || Categories::Intern(index, name) != c)
+                return false;
 
-            static InventoryItem item;
-            for (int i = 0; i < count; ++i)
+            auto& entry = index.entries[c];
+            if (!in.get(entry.item_count) || !in.get(entry.assigned_count))
+                return false;
+        }
+
+        if (in.left() != (uint64_t) count * 8)
+            return false;
+
+        index.links.resize(count);
+        std::vector<uint32_t> sizes(cats, 0);
+        for (auto& link : index.links)
+        {
+            in.get(link.cat);
+            in.get(link.pos);
+
+            if (link.cat == CAT_NONE)
+                continue;
+
+            if (link.cat >= cats)
+                return false;
+
+            ++sizes[link.cat];
+        }
+
+        for (uint32_t c = 0; c < cats; ++c)
+            index.entries[c].slots.assign(sizes[c], IDINDEX_NONE);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto& link = index.links[i];
+            if (link.cat == CAT_NONE)
+                continue;
+
+            auto& slots = index.entries[link.cat].slots;
+            if (link.pos >= slots.size() || slots[link.pos] != IDINDEX_NONE)
+                return false;
+
+            slots[link.pos] = i;
+        }
+
+        inv.categories = std::move(index);
+        return true;
+    }
+
+    template<typename = void>
+    bool ReadNameOrder(IndexReader& in, Inventory& inv, uint32_t count)
+    {
+        uint32_t size;
+        if (!in.get(size) || size > count)
+            return false;
+
+        std::vector<uint32_t> sorted(size);
+        if (!in.get(sorted.data(), size) || in.left() != 0)
+            return false;
+
+        for (auto slot : sorted)
+            if (slot >= count)
+                return false;
+
+        NameIndexes::Adopt(inv.names, std::move(sorted));
+        return true;
+    }
+
+    /* Needs the names read first */
+    template<typename = void>
+    bool ReadMemberIndex(IndexReader& in, Inventory& inv)
+    {
+        auto names = inv.member_names.names.size();
+
+        uint32_t buckets;
+        if (!in.get(buckets) || !is_table_size(buckets) || (uint64_t) names * 2 > buckets)
+            return false;
+
+        std::vector<member_id_t> table(buckets);
+        if (!in.get(table.data(), buckets) || in.left() != 0)
+            return false;
+
+        size_t used = 0;
+        for (auto id : table)
+        {
+            if (id == MEMBER_NONE)
+                continue;
+
+            if (id >= names)
+                return false;
+
+            ++used;
+        }
+
+        if (used != names)
+            return false;
+
+        inv.member_names.table = std::move(table);
+        return true;
+    }
+
+    template<typename = void>
+    bool ReadSections(DataFile f, Inventory& inv, uint32_t count, uint32_t& loaded)
+    {
+        uint32_t magic;
+        if (!read_bytes(*f, magic) || magic != SECTIONS_MAGIC)
+        {
+            /* Pre-section file */
+            f->clear();
+            return true;
+        }
+
+        /* Names are hashed once all are in, unless their table comes with them */
+        bool index_names = false;
+        std::vector<char> section;
+
+        while (true)
+        {
+            SectionTag tag;
+            uint64_t size;
+            if (!read_bytes(*f, tag) || !read_bytes(*f, size))
+                return false;
+
+            switch (tag)
+            {
+                case SectionTag::End:
+                    /* Ids are positions: a repeated name would shift every later one */
+                    return !index_names || MemberLists::Index(inv.member_names);
+
+                case SectionTag::ReorderLevels:
+                {
+                    if (size != (uint64_t) count * sizeof(item_count_t))
+                        return false;
+
+                    for (uint32_t i = 0; i < count; ++i)
+                        if (!read_bytes(*f, inventory_mutable(inv, i).reorder_level))
+                            return false;
+
+                    break;
+                }
+
+                case SectionTag::JournalSeq:
+                {
+                    if (size != sizeof(inv.log.seq) || !read_bytes(*f, inv.log.seq))
+                        return false;
+
+                    break;
+                }
+
+                case SectionTag::MemberNames:
+                {
+                    uint32_t names;
+                    if (size < sizeof(names) || size > BytesLeft(f) || !read_bytes(*f, names))
+                        return false;
+
+                    auto& dir = inv.member_names;
+                    if (!dir.names.empty() || names > size / sizeof(uint32_t))
+                        return false;
+
+                    dir.names.reserve(names);
+                    for (uint32_t i = 0; i < names; ++i)
+                    {
+                        uint32_t len;
+                        if (!read_bytes(*f, len) || len > size)
+                            return false;
+
+                        auto& name = dir.names.emplace_back(len, '\0');
+                        if (!read_bytes(*f, &name[0], len))
+                            return false;
+                    }
+
+                    index_names = true;
+                    break;
+                }
+
+                case SectionTag::DueDates:
+                {
+                    uint32_t loans;
+                    if (!read_bytes(*f, loans) || size != sizeof(loans) + (uint64_t) loans * 16)
+                        return false;
+
+                    std::vector<DueEntry> entries(loans);
+                    for (auto& e : entries)
+                    {
+                        if (!read_bytes(*f, e.slot) || !read_bytes(*f, e.member) || !read_bytes(*f, e.due))
+                            return false;
+
+                        if (e.slot >= count || e.member >= inv.member_names.names.size() || e.due == 0)
+                            return false;
+                    }
+
+                    DueDates::Assign(inv.due, std::move(entries));
+
+                    /* Each loan at most once */
+                    if (inv.due.pos.size() != inv.due.heap.size())
+                        return false;
+
+                    break;
+                }
+
+                case SectionTag::IdTable:
+                case SectionTag::Categories:
+                case SectionTag::NameOrder:
+                case SectionTag::MemberTable:
+                case SectionTag::StateDigest:
+                {
+                    if (size > BytesLeft(f))
+                        return false;
+
+                    section.resize(size);
+                    if (!read_bytes(*f, section.data(), size))
+                        return false;
+
+                    /* Not for this file, or damaged: rebuilt instead */
+                    if (!IndexMatches(section, count, inv.log.seq))
+                        break;
+
+                    IndexReader in { section.data() + INDEX_STAMP_BYTES, section.data() + size };
+
+                    if (tag == SectionTag::IdTable && ReadIdTable(in, inv, count))
+                        loaded |= LOADED_IDS;
+                    else if (tag == SectionTag::Categories && ReadCategoryIndex(in, inv, count))
+                        loaded |= LOADED_CATEGORIES;
+                    else if (tag == SectionTag::NameOrder && ReadNameOrder(in, inv, count))
+                        loaded |= LOADED_NAMES;
+                    else if (tag == SectionTag::MemberTable && index_names && ReadMemberIndex(in, inv))
+                        index_names = false;
+                    else if (tag == SectionTag::StateDigest && in.left() == sizeof(uint64_t))
+                    {
+                        uint64_t sum;
+                        if (in.get(sum))
+                            Digests::Assign(inv.digest, sum);
+                    }
+
+                    break;
+                }
+
+                default:
+                    f->seekg(size, ios::cur);
+                    break;
+            }
+        }
+    }
+
+    /* `loaded` gets the LoadedIndex bits of the indexes the file carried. path names the file f has open,
+     * which member lists are read from later */
+    template<typename = void>
+    bool ReadFromFile(DataFile f, Inventory& inv, uint32_t& loaded, const char* path = MAIN_FILE_NAME)
+    {
+        loaded = 0;
+
+        FileHeader header;
+        if (!ReadHeader(f, header))
+            return false;
+
+        auto count = header.count;
+
+        /* One allocation and one read for every long string in the file. Compact builds copy the strings
+         * into their pool as items are read, so the blob is only needed until then */
+        StringBlob blob;
+        std::vector<char> blob_copy;
+        if (header.version >= 3)
+        {
+            if (!read_bytes(*f, blob.size) || blob.size > BytesLeft(f))
+                return false;
+
+            if (blob.size > 0)
             {
-                if (!ReadItem(f, item))
+#if APP_COMPACT_ITEMS
+                blob_copy.resize(blob.size);
+                char* base = blob_copy.data();
+#else
+                char* base = Strings::Adopt(inv.strings, blob.size);
+#endif
+                if (!read_bytes(*f, base, blob.size))
                     return false;
 
-                inv.items[i] = item;
+                blob.base = base;
+            }
+        }
+
+        if (count > 0)
+        {
+            /* A count the rest of the file cannot possibly hold means corruption, not a reason to reserve
+             * gigabytes up front */
+            size_t len_bytes = header.version < 3 ? sizeof(size_t) : sizeof(uint32_t);
+            size_t min_item_bytes = header.id_bytes + 2 * len_bytes + 2 * sizeof(item_count_t) + sizeof(bool);
+            if ((uint64_t) count * min_item_bytes > BytesLeft(f))
+                return false;
+
+            inventory_allocate_capacity(inv, count);
+
+            /* Items are constructed in place one by one, so inv.count always covers exactly what was read */
+            if (header.version >= 3 && header.id_bytes == sizeof(item_id_t))
+            {
+                ChunkReader in(*f);
+                TextContext ctx;
+                ctx.blob = blob;
+                ctx.arena = &inv.strings;
+
+                for (uint32_t i = 0; i < count; ++i)
+                    if (!ItemRecord::Decode(inventory_emplace(inv), in, ctx))
+                        return false;
+
+                in.finish();
+            }
+            else
+            {
+                for (uint32_t i = 0; i < count; ++i)
+                    if (!ReadItem(f, inv, inventory_emplace(inv), header, blob))
+                        return false;
             }
+        }
 
-            for (int i = 0; i < count; ++i)
-                if (!ReadMembers(f, inv.items[i]))
+        if (header.version < 4)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+                if (!read_legacy_members(f, inv, members_mutable(inventory_mutable(inv, i))))
                     return false;
+
+            return ReadSections(f, inv, count, loaded);
         }
 
-        inv.count = count;
+        uint64_t block;
+        std::vector<uint64_t> starts;
+        if (!ReadSections(f, inv, count, loaded) || !ReadMemberTable(f, count, block, starts))
+            return false;
 
-        return true;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (starts[i] == MemberSources::NONE)
+                continue;
+
+            /* Version 4 entries follow each other in item order */
+            if (header.version == 4)
+            {
+                if (!read_legacy_members(f, inv, members_mutable(inventory_mutable(inv, i))))
+                    return false;
+            }
+            else
+            {
+                set_stored_members(inventory_mutable(inv, i), block + starts[i]);
+            }
+        }
+
+        return AttachMemberSource(inv, path);
     }
 
 } // namespace Serialization
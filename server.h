@@ -0,0 +1,302 @@
+#pragma once
+
+#ifndef __APP_SERVER_H_
+#define __APP_SERVER_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "parse.h"
+
+/*
+ * Wire format of the server mode. Requests are single lines of tab-separated fields; every request gets
+ * exactly one response line starting with OK or ERR, in the order the requests were sent:
+ *
+ *   PING                                      OK
+ *   FIND      id                              OK    id  name  category  available  assigned  reorder
+ *   ADD       id  name  category  units  [reorder]
+ *                                             OK
+ *   ASSIGN    id  member  [units]             OK    available
+ *   RETRIEVE  id  member  [units]             OK    available
+ *   LIST                                      ITEM  id  name  category  available  assigned  reorder
+ *                                             ...   (one per item, before the final line)
+ *                                             OK    count
+ *   DELTA     baseline_file  delta_file       OK    changed_items  delta_bytes   (see delta.h)
+ *
+ *   Any failure:                              ERR   message
+ *
+ * Blank lines are ignored. Clients may pipeline: send any number of requests without waiting for the responses.
+ */
+namespace Protocol
+{
+    static constexpr const char* SOCKET_NAME = "inventory_data.rvms.sock";
+
+    static constexpr size_t MAX_LINE = 64 << 10;
+    static constexpr size_t MAX_FIELDS = 8;
+
+    struct Field
+    {
+        const char* ptr;
+        size_t len;
+    };
+
+    /* Splits [line, line + len) at tabs, NUL-terminating each field in place. Extra fields are dropped */
+    inline size_t Split(char* line, size_t len, Field* fields, size_t max_fields = MAX_FIELDS)
+    {
+        size_t n = 0;
+        char* end = line + len;
+
+        while (true)
+        {
+            auto tab = (char*) memchr(line, '\t', end - line);
+            char* stop = tab ? tab : end;
+
+            *stop = '\0';
+            if (n < max_fields)
+                fields[n++] = { line, (size_t) (stop - line) };
+
+            if (tab == nullptr)
+                return n;
+
+            line = tab + 1;
+        }
+    }
+
+    inline bool IsCommand(const Field& f, const char* name)
+    {
+        return f.len == strlen(name) && memcmp(f.ptr, name, f.len) == 0;
+    }
+
+    inline bool ToUint(const Field& f, uint64_t max, uint64_t& out)
+    {
+        auto res = Parse::Uint(f.ptr, f.ptr + f.len, max, out);
+        return res.ec == Parse::Error::None && res.ptr == f.ptr + f.len;
+    }
+
+    inline void Append(std::vector<char>& out, const char* p, size_t n)
+    {
+        out.insert(out.end(), p, p + n);
+    }
+
+    inline void Append(std::vector<char>& out, const char* s)
+    {
+        Append(out, s, strlen(s));
+    }
+
+    /* Tab, then the field. Tabs and newlines inside it would break the framing, so they become spaces */
+    inline void AppendField(std::vector<char>& out, const char* p, size_t n)
+    {
+        out.push_back('\t');
+
+        auto at = out.size();
+        Append(out, p, n);
+
+        for (auto i = at; i < out.size(); ++i)
+            if (out[i] == '\t' || out[i] == '\n')
+                out[i] = ' ';
+    }
+
+    inline void AppendField(std::vector<char>& out, uint64_t v)
+    {
+        char digits[20];
+        int n = 0;
+        do
+        {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v != 0);
+
+        out.push_back('\t');
+        for (int i = n - 1; i >= 0; --i)
+            out.push_back(digits[i]);
+    }
+
+    inline void Error(std::vector<char>& out, const char* message)
+    {
+        Append(out, "ERR");
+        AppendField(out, message, strlen(message));
+        out.push_back('\n');
+    }
+} // namespace Protocol
+
+/* Non-blocking Unix socket plumbing for the server's event loop */
+namespace Net
+{
+    /* Stop reading from a client that has this much unsent output, until it catches up */
+    static constexpr size_t MAX_PENDING_OUTPUT = 1 << 20;
+    static constexpr size_t READ_CHUNK = 64 << 10;
+
+    struct Connection
+    {
+        int fd = -1;
+
+        std::vector<char> in;
+        size_t in_begin = 0; // start of the first line not handled yet
+        size_t in_end = 0;
+
+        std::vector<char> out;
+        size_t out_sent = 0;
+
+        bool eof = false;    // the client will send nothing more
+        bool failed = false; // broken socket or protocol violation: close without further ado
+
+        uint32_t events = 0; // what the event loop currently waits for
+    };
+
+    inline bool fill_address(sockaddr_un& addr, const char* path)
+    {
+        if (strlen(path) >= sizeof(addr.sun_path))
+            return false;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        return true;
+    }
+
+    /* Binds a listening socket at path, replacing a stale socket file left by an earlier run */
+    inline int Listen(const char* path)
+    {
+        sockaddr_un addr;
+        if (!fill_address(addr, path))
+            return -1;
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+
+        ::unlink(path);
+
+        if (::bind(fd, (sockaddr*) &addr, sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    /* Blocking client connection */
+    inline int Connect(const char* path)
+    {
+        sockaddr_un addr;
+        if (!fill_address(addr, path))
+            return -1;
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+
+        if (::connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    inline size_t Pending(const Connection& c)
+    {
+        return c.out.size() - c.out_sent;
+    }
+
+    /* One read into the input buffer. Leftover partial lines are moved to the front first */
+    inline void Receive(Connection& c)
+    {
+        if (c.in_begin > 0)
+        {
+            memmove(c.in.data(), c.in.data() + c.in_begin, c.in_end - c.in_begin);
+            c.in_end -= c.in_begin;
+            c.in_begin = 0;
+        }
+
+        if (c.in.size() - c.in_end < READ_CHUNK)
+            c.in.resize(c.in_end + READ_CHUNK);
+
+        auto got = ::read(c.fd, c.in.data() + c.in_end, c.in.size() - c.in_end);
+
+        if (got > 0)
+        {
+            c.in_end += got;
+        }
+        else if (got == 0)
+        {
+            /* A last line without a newline still counts */
+            if (c.in_end > c.in_begin)
+                c.in[c.in_end++] = '\n';
+
+            c.eof = true;
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            c.failed = true;
+        }
+    }
+
+    /*
+     * Next complete line in the input buffer, without its newline (or CR LF), NUL-terminated in place.
+     * Returns false when only a partial line is left; a partial line longer than Protocol::MAX_LINE fails
+     * the connection.
+     */
+    inline bool NextLine(Connection& c, char*& line, size_t& len)
+    {
+        char* begin = c.in.data() + c.in_begin;
+        auto nl = (char*) memchr(begin, '\n', c.in_end - c.in_begin);
+
+        if (nl == nullptr)
+        {
+            if (c.in_end - c.in_begin > Protocol::MAX_LINE)
+                c.failed = true;
+
+            return false;
+        }
+
+        line = begin;
+        len = nl - begin;
+        c.in_begin += len + 1;
+
+        if (len > 0 && line[len - 1] == '\r')
+            --len;
+
+        line[len] = '\0';
+        return true;
+    }
+
+    /* Writes as much pending output as the socket takes */
+    inline void Flush(Connection& c)
+    {
+        while (Pending(c) > 0)
+        {
+            auto w = ::send(c.fd, c.out.data() + c.out_sent, Pending(c), MSG_NOSIGNAL);
+
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    c.failed = true;
+
+                break;
+            }
+
+            c.out_sent += w;
+        }
+
+        if (Pending(c) == 0)
+        {
+            c.out.clear();
+            c.out_sent = 0;
+        }
+    }
+} // namespace Net
+
+#endif
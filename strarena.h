@@ -0,0 +1,440 @@
+#pragma once
+
+#ifndef __APP_STRARENA_H_
+#define __APP_STRARENA_H_
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include <sys/mman.h>
+
+/*
+ * APP_COMPACT_ITEMS=1 trades some speed for memory on huge inventories: handles shrink to a 4-byte offset
+ * into one StringSpace, equal strings are stored once, and items lose their slot and member list fields
+ * (see repr.h). Data files are the same either way.
+ */
+#ifndef APP_COMPACT_ITEMS
+    #define APP_COMPACT_ITEMS 0
+#endif
+
+#if APP_COMPACT_ITEMS
+
+/*
+ * Range of address space reserved once for the whole process; every arena block is carved out of it, so a
+ * string anywhere in it is known by its 32-bit offset. Memory is only committed as blocks are written to
+ * and goes back to the system when a block is released. Released blocks of the usual size are reused;
+ * larger ones only give back their memory, not their addresses.
+ *
+ * Offset 0 holds the empty string.
+ */
+struct StringSpace
+{
+    static constexpr uint64_t SIZE = 1ull << 32;
+    static constexpr uint64_t PAGE = 4096;
+
+    char* base = nullptr;
+    uint64_t top = PAGE; // end of the addresses handed out so far
+    std::vector<uint64_t> free_blocks;
+    std::mutex lock;
+};
+
+namespace StringSpaces
+{
+    inline StringSpace* reserve()
+    {
+        auto space = new StringSpace;
+
+        void* base = ::mmap(nullptr, StringSpace::SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+            throw std::bad_alloc();
+
+        space->base = (char*) base;
+        return space;
+    }
+
+    inline StringSpace& Get()
+    {
+        static StringSpace* space = reserve();
+        return *space;
+    }
+
+    inline const char* Base()
+    {
+        static const char* base = Get().base;
+        return base;
+    }
+
+    /* n bytes at a page boundary; blocks of `reuse` bytes come from the released ones first */
+    inline char* Allocate(size_t n, size_t reuse)
+    {
+        auto& space = Get();
+        std::lock_guard<std::mutex> hold(space.lock);
+
+        if (n == reuse && !space.free_blocks.empty())
+        {
+            auto at = space.free_blocks.back();
+            space.free_blocks.pop_back();
+            return space.base + at;
+        }
+
+        n = (n + StringSpace::PAGE - 1) & ~(StringSpace::PAGE - 1);
+        if (StringSpace::SIZE - space.top < n)
+            throw std::bad_alloc();
+
+        auto at = space.top;
+        space.top += n;
+        return space.base + at;
+    }
+
+    inline void Release(char* p, size_t n, size_t reuse)
+    {
+        auto& space = Get();
+        n = (n + StringSpace::PAGE - 1) & ~(StringSpace::PAGE - 1);
+        ::madvise(p, n, MADV_DONTNEED);
+
+        std::lock_guard<std::mutex> hold(space.lock);
+        if (n == reuse)
+            space.free_blocks.push_back(p - space.base);
+    }
+
+    /* Deleter of arena blocks */
+    struct BlockRelease
+    {
+        size_t n;
+        size_t reuse;
+
+        void operator()(char* p) const { Release(p, n, reuse); }
+    };
+} // namespace StringSpaces
+
+/*
+ * 4-byte string handle: the offset of the string in the StringSpace, where it is stored as its length (4)
+ * and its characters, NUL-terminated. Like the 24-byte handle of the default build it never owns what it
+ * points to; the arena that stored the string must outlive it.
+ */
+struct ArenaString
+{
+    /* Strings up to this long are kept in the item records of data files, as in the default build */
+    static constexpr uint32_t INLINE_CAPACITY = 19;
+
+    uint32_t ref = 0;
+
+    uint32_t size() const
+    {
+        uint32_t len;
+        memcpy(&len, StringSpaces::Base() + ref, sizeof(len));
+        return len;
+    }
+
+    bool empty() const { return size() == 0; }
+    bool is_inline() const { return size() <= INLINE_CAPACITY; }
+    bool in_arena() const { return ref != 0; }
+
+    const char* data() const { return StringSpaces::Base() + ref + sizeof(uint32_t); }
+    const char* c_str() const { return data(); }
+};
+
+static_assert(sizeof(ArenaString) == 4, "ArenaString is meant to be an offset");
+
+#else
+
+/*
+ * 24-byte string handle. Strings of up to INLINE_CAPACITY characters are stored in the handle itself; longer
+ * ones point into a StringArena that outlives the handle. Both forms are NUL-terminated.
+ *
+ * Handles never own what they point to, so copying one is a plain 24-byte copy and a handle can be moved
+ * around with memcpy.
+ */
+struct ArenaString
+{
+    static constexpr uint32_t INLINE_CAPACITY = 19;
+
+    /* Both layouts begin with len, which is what tells them apart */
+    union
+    {
+        struct
+        {
+            uint32_t len;
+            char chars[INLINE_CAPACITY + 1];
+        } small;
+
+        struct
+        {
+            uint32_t len;
+            uint32_t reserved;
+            const char* ptr;
+        } large;
+    };
+
+    ArenaString()
+    {
+        small.len = 0;
+        small.chars[0] = '\0';
+    }
+
+    uint32_t size() const { return small.len; }
+    bool empty() const { return small.len == 0; }
+    bool is_inline() const { return small.len <= INLINE_CAPACITY; }
+
+    bool in_arena() const { return !is_inline(); }
+
+    const char* data() const { return is_inline() ? small.chars : large.ptr; }
+    const char* c_str() const { return data(); }
+};
+
+static_assert(sizeof(ArenaString) == 24, "ArenaString is meant to be three words");
+
+#endif
+
+static_assert(std::is_trivially_copyable<ArenaString>::value, "ArenaString must stay memcpy-able");
+
+/*
+ * Bump allocator for the strings that don't fit inline. Memory is handed out from large blocks and only
+ * released all at once, so pointers into it stay valid for the lifetime of the arena. Strings replaced by an
+ * edit are left behind until the arena is rebuilt (see Core::Compact) or the data file is reloaded.
+ *
+ * Blocks are reference counted so a snapshot can keep the strings it sees alive past a rebuild.
+ *
+ * In compact builds every string, short or long, goes into the arena, and `pool` finds a string already
+ * stored by its contents: open addressing with linear probing over the handles, 0 in empty buckets.
+ */
+struct StringArena
+{
+    std::vector<std::shared_ptr<char>> blocks;
+
+    char* cur = nullptr;
+    size_t left = 0;
+
+    uint64_t reserved = 0; // bytes held in blocks
+    uint64_t used = 0;     // bytes handed out, including strings no longer referenced
+
+#if APP_COMPACT_ITEMS
+    std::vector<uint32_t> pool;
+    uint32_t pooled = 0;
+#endif
+};
+
+namespace Strings
+{
+    static constexpr size_t BLOCK_SIZE = 64 << 10;
+
+    inline char* new_block(StringArena& arena, size_t n)
+    {
+#if APP_COMPACT_ITEMS
+        arena.blocks.emplace_back(StringSpaces::Allocate(n, BLOCK_SIZE), StringSpaces::BlockRelease { n, BLOCK_SIZE });
+#else
+        arena.blocks.emplace_back(new char[n], std::default_delete<char[]>());
+#endif
+        arena.reserved += n;
+        return arena.blocks.back().get();
+    }
+
+    /* Allocates one block of exactly `n` bytes, e.g. to load a whole string blob with a single read */
+    inline char* Adopt(StringArena& arena, size_t n)
+    {
+        arena.used += n;
+        return new_block(arena, n);
+    }
+
+    inline char* Allocate(StringArena& arena, size_t n)
+    {
+        /* Big strings get a block of their own instead of wasting the rest of the current one */
+        if (n > BLOCK_SIZE / 4)
+            return Adopt(arena, n);
+
+        if (n > arena.left)
+        {
+            arena.cur = new_block(arena, BLOCK_SIZE);
+            arena.left = BLOCK_SIZE;
+        }
+
+        char* p = arena.cur;
+        arena.cur += n;
+        arena.left -= n;
+        arena.used += n;
+
+        return p;
+    }
+
+    inline bool Equal(const ArenaString& s, const char* p, size_t len)
+    {
+        return s.size() == len && memcmp(s.data(), p, len) == 0;
+    }
+
+#if APP_COMPACT_ITEMS
+    /* 64-bit FNV-1a */
+    inline uint64_t hash(const char* p, size_t len)
+    {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < len; ++i)
+            h = (h ^ (unsigned char) p[i]) * 0x100000001b3ull;
+
+        return h;
+    }
+
+    /* The bucket of the pool that holds the string, or the empty one where it would go */
+    inline uint32_t& pool_bucket(StringArena& arena, const char* p, size_t len)
+    {
+        size_t mask = arena.pool.size() - 1;
+        for (size_t b = hash(p, len) & mask;; b = (b + 1) & mask)
+        {
+            ArenaString s;
+            s.ref = arena.pool[b];
+            if (s.ref == 0 || Equal(s, p, len))
+                return arena.pool[b];
+        }
+    }
+
+    inline void grow_pool(StringArena& arena)
+    {
+        std::vector<uint32_t> old(std::max<size_t>(64, arena.pool.size() * 2), 0);
+        std::swap(old, arena.pool);
+
+        for (auto ref : old)
+        {
+            ArenaString s;
+            s.ref = ref;
+            if (ref != 0)
+                pool_bucket(arena, s.data(), s.size()) = ref;
+        }
+    }
+
+    /* Handle for a copy of [p, p + len), shared with any equal string stored before */
+    inline ArenaString Store(StringArena& arena, const char* p, size_t len)
+    {
+        ArenaString s;
+        if (len == 0)
+            return s;
+
+        if ((arena.pooled + 1) * 2 > arena.pool.size())
+            grow_pool(arena);
+
+        auto& bucket = pool_bucket(arena, p, len);
+        if (bucket == 0)
+        {
+            uint32_t n = len;
+            char* copy = Allocate(arena, sizeof(n) + len + 1);
+            memcpy(copy, &n, sizeof(n));
+            memcpy(copy + sizeof(n), p, len);
+            copy[sizeof(n) + len] = '\0';
+
+            bucket = copy - StringSpaces::Base();
+            ++arena.pooled;
+        }
+
+        s.ref = bucket;
+        return s;
+    }
+
+    /* Handle for a string read from a data file. [p, p + len) is copied, so it can be scratch memory */
+    inline ArenaString Load(StringArena& arena, const char* p, uint32_t len)
+    {
+        return Store(arena, p, len);
+    }
+#else
+    /* Handle for len characters at p, which must already be NUL-terminated memory owned by the arena */
+    inline ArenaString Borrow(const char* p, uint32_t len)
+    {
+        ArenaString s;
+
+        if (len <= ArenaString::INLINE_CAPACITY)
+        {
+            memcpy(s.small.chars, p, len);
+            s.small.chars[len] = '\0';
+            s.small.len = len;
+        }
+        else
+        {
+            s.large.len = len;
+            s.large.reserved = 0;
+            s.large.ptr = p;
+        }
+
+        return s;
+    }
+
+    /* Copies [p, p + len) into a new handle, using the arena only when it doesn't fit inline */
+    inline ArenaString Store(StringArena& arena, const char* p, size_t len)
+    {
+        if (len <= ArenaString::INLINE_CAPACITY)
+            return Borrow(p, len);
+
+        char* copy = Allocate(arena, len + 1);
+        memcpy(copy, p, len);
+        copy[len] = '\0';
+
+        return Borrow(copy, len);
+    }
+
+    /* Handle for a string read from a data file. Long ones must lie in memory owned by the arena, such as
+     * a blob loaded with Adopt() */
+    inline ArenaString Load(StringArena&, const char* p, uint32_t len)
+    {
+        return Borrow(p, len);
+    }
+#endif
+
+    inline ArenaString Store(StringArena& arena, const std::string& s)
+    {
+        return Store(arena, s.data(), s.size());
+    }
+
+    inline void Clear(StringArena& arena)
+    {
+        arena.blocks.clear();
+        arena.cur = nullptr;
+        arena.left = 0;
+        arena.reserved = 0;
+        arena.used = 0;
+
+#if APP_COMPACT_ITEMS
+        arena.pool.clear();
+        arena.pooled = 0;
+#endif
+    }
+} // namespace Strings
+
+inline bool operator==(const ArenaString& a, const ArenaString& b)
+{
+    return Strings::Equal(a, b.data(), b.size());
+}
+
+inline bool operator!=(const ArenaString& a, const ArenaString& b)
+{
+    return !(a == b);
+}
+
+inline bool operator==(const ArenaString& a, const std::string& b)
+{
+    return Strings::Equal(a, b.data(), b.size());
+}
+
+/* Honours setw() and left/right like std::string does, so tables line up the same */
+inline std::ostream& operator<<(std::ostream& os, const ArenaString& s)
+{
+    auto width = os.width(0);
+    size_t pad = width > (std::streamsize) s.size() ? width - s.size() : 0;
+    bool left = (os.flags() & std::ios::adjustfield) == std::ios::left;
+
+    if (!left)
+        for (size_t i = 0; i < pad; ++i)
+            os.put(os.fill());
+
+    os.write(s.data(), s.size());
+
+    if (left)
+        for (size_t i = 0; i < pad; ++i)
+            os.put(os.fill());
+
+    return os;
+}
+
+#endif
@@ -0,0 +1,293 @@
+#pragma once
+
+#ifndef __APP_TRACE_H_
+#define __APP_TRACE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "oplog.h"
+
+/*
+ * Record of a session for replaying it later, e.g. to compare storage or index changes on a real operation
+ * mix. Frontend marks the start of each menu action; Core adds every change it makes, in the same encoding
+ * as the journal, along with the lookups, name searches and queries the actions run. Each record carries
+ * the microseconds since the one before it.
+ *
+ * Records are buffered and written out in blocks, so recording costs a copy per operation. The state the
+ * session started from is saved next to the trace (see Lifecycle::StartRecording).
+ */
+enum class TraceKind : uint8_t
+{
+    Action = 1, // a menu option was chosen
+    Change,     // an Op, as Core recorded it
+    Find,       // an item looked up by id
+    Search,     // items looked up by name
+    Query,      // the text of a query
+    Compact,    // deleted items purged
+};
+
+struct TraceLog
+{
+    std::ofstream out;
+    std::vector<char> buf;
+    std::chrono::steady_clock::time_point last;
+    uint64_t records = 0;
+};
+
+/* Decoded record. Strings point into the trace it was decoded from */
+template<typename IdT>
+struct TraceRecord
+{
+    TraceKind kind;
+    uint64_t gap_us = 0;
+
+    uint8_t action = 0;
+    Op<IdT> op {};
+    IdT id = 0;
+    const char* text = nullptr; // item name or query
+    uint32_t text_len = 0;
+};
+
+/* Latencies of one kind of record, in nanoseconds */
+struct LatencyStats
+{
+    std::vector<uint64_t> ns;
+    uint64_t total = 0;
+};
+
+namespace Traces
+{
+    /* File layout: MAGIC, VERSION (2), the byte width of item ids (1), then the records back to back */
+    static constexpr uint32_t MAGIC = 0x45435254; // "TRCE"
+    static constexpr uint16_t VERSION = 1;
+    static constexpr size_t HEADER_BYTES = 7;
+    static constexpr size_t FLUSH_BYTES = 64 << 10;
+
+    inline bool IsOpen(const TraceLog& log)
+    {
+        return log.out.is_open();
+    }
+
+    inline void put_varint(std::vector<char>& buf, uint64_t x)
+    {
+        while (x >= 0x80)
+        {
+            buf.push_back((char) (x | 0x80));
+            x >>= 7;
+        }
+        buf.push_back((char) x);
+    }
+
+    inline bool get_varint(const char*& p, const char* end, uint64_t& x)
+    {
+        x = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7)
+        {
+            uint8_t b = *p++;
+            x |= (uint64_t) (b & 0x7F) << shift;
+            if (b < 0x80)
+                return true;
+        }
+
+        return false;
+    }
+
+    inline void flush(TraceLog& log)
+    {
+        log.out.write(log.buf.data(), log.buf.size());
+        log.buf.clear();
+    }
+
+    /* Starts a record: its kind and the time since the last one */
+    inline void begin(TraceLog& log, TraceKind kind)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto gap = std::chrono::duration_cast<std::chrono::microseconds>(now - log.last).count();
+        log.last = now;
+
+        log.buf.push_back((char) kind);
+        put_varint(log.buf, gap > 0 ? gap : 0);
+        ++log.records;
+    }
+
+    inline void end(TraceLog& log)
+    {
+        if (log.buf.size() >= FLUSH_BYTES)
+            flush(log);
+    }
+
+    template<typename IdT>
+    inline bool Open(TraceLog& log, const char* path)
+    {
+        log.out.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!log.out)
+            return false;
+
+        OpLog::put(log.buf, MAGIC);
+        OpLog::put(log.buf, VERSION);
+        OpLog::put(log.buf, (uint8_t) sizeof(IdT));
+
+        log.last = std::chrono::steady_clock::now();
+        log.records = 0;
+        return true;
+    }
+
+    /* Writes out what is buffered; false if any of the trace could not be written */
+    inline bool Close(TraceLog& log)
+    {
+        if (!IsOpen(log))
+            return true;
+
+        flush(log);
+        log.out.close();
+        return !log.out.fail();
+    }
+
+    inline void Action(TraceLog& log, uint8_t option)
+    {
+        if (!IsOpen(log))
+            return;
+
+        begin(log, TraceKind::Action);
+        log.buf.push_back((char) option);
+        end(log);
+    }
+
+    template<typename IdT>
+    inline void Change(TraceLog& log, const Op<IdT>& op)
+    {
+        if (!IsOpen(log))
+            return;
+
+        begin(log, TraceKind::Change);
+        OpLog::Encode(log.buf, op);
+        end(log);
+    }
+
+    template<typename IdT>
+    inline void Find(TraceLog& log, IdT id)
+    {
+        if (!IsOpen(log))
+            return;
+
+        begin(log, TraceKind::Find);
+        OpLog::put(log.buf, id);
+        end(log);
+    }
+
+    /* Search or Query */
+    inline void Text(TraceLog& log, TraceKind kind, const char* text, size_t len)
+    {
+        if (!IsOpen(log))
+            return;
+
+        begin(log, kind);
+        OpLog::put_string(log.buf, text, (uint32_t) len);
+        end(log);
+    }
+
+    inline void Compact(TraceLog& log)
+    {
+        if (!IsOpen(log))
+            return;
+
+        begin(log, TraceKind::Compact);
+        end(log);
+    }
+
+    /* Reads a whole trace into bytes and decodes it into records that point into them */
+    template<typename IdT>
+    inline bool Read(const char* path, std::vector<char>& bytes, std::vector<TraceRecord<IdT>>& records)
+    {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        if (!f)
+            return false;
+
+        bytes.resize((size_t) f.tellg());
+        f.seekg(0);
+        if (!f.read(bytes.data(), bytes.size()) || bytes.size() < HEADER_BYTES)
+            return false;
+
+        const char* p = bytes.data();
+        const char* end = p + bytes.size();
+
+        uint32_t magic;
+        uint16_t version;
+        uint8_t id_bytes;
+        if (!OpLog::get(p, end, magic) || !OpLog::get(p, end, version) || !OpLog::get(p, end, id_bytes)
+            || magic != MAGIC || version != VERSION || id_bytes != sizeof(IdT))
+            return false;
+
+        records.clear();
+        while (p < end)
+        {
+            records.emplace_back();
+            auto& rec = records.back();
+
+            uint8_t kind = *p++;
+            if (!get_varint(p, end, rec.gap_us))
+                return false;
+
+            rec.kind = (TraceKind) kind;
+
+            bool ok;
+            switch (rec.kind)
+            {
+                case TraceKind::Action:  ok = OpLog::get(p, end, rec.action); break;
+                case TraceKind::Change:  ok = OpLog::Decode(p, end, rec.op); break;
+                case TraceKind::Find:    ok = OpLog::get(p, end, rec.id); break;
+                case TraceKind::Search:
+                case TraceKind::Query:   ok = OpLog::get_string(p, end, rec.text, rec.text_len); break;
+                case TraceKind::Compact: ok = true; break;
+                default:                 ok = false; break;
+            }
+
+            if (!ok)
+                return false;
+        }
+
+        return true;
+    }
+
+    inline void Add(LatencyStats& stats, uint64_t ns)
+    {
+        stats.ns.push_back(ns);
+        stats.total += ns;
+    }
+
+    /* The latency below which a fraction q of them fall. Sorts the samples */
+    inline uint64_t Percentile(LatencyStats& stats, double q)
+    {
+        if (stats.ns.empty())
+            return 0;
+
+        auto at = std::min(stats.ns.size() - 1, (size_t) (q * stats.ns.size()));
+        std::nth_element(stats.ns.begin(), stats.ns.begin() + at, stats.ns.end());
+        return stats.ns[at];
+    }
+
+    /* Counts per power-of-two bucket: bucket b holds latencies in [2^(b-1), 2^b) ns, bucket 0 those under 1 */
+    inline std::vector<uint64_t> Histogram(const LatencyStats& stats)
+    {
+        std::vector<uint64_t> buckets;
+        for (auto ns : stats.ns)
+        {
+            size_t b = 0;
+            while (b < 64 && (ns >> b) != 0)
+                ++b;
+
+            if (buckets.size() <= b)
+                buckets.resize(b + 1);
+            ++buckets[b];
+        }
+
+        return buckets;
+    }
+} // namespace Traces
+
+#endif